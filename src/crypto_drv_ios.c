@@ -19,12 +19,13 @@
 
 // The implementation of the Erlang crypto driver uses iOS/Mac OS APIs instead of OpenSSL.
 // It currently only implements the small number of functions needed by Couchbase Mobile:
-// DRV_MD5, DRV_RAND_BYTES, DRV_RAND_UNIFORM.
+// DRV_MD5, DRV_RAND_BYTES, DRV_RAND_UNIFORM, plus the non-standard DRV_RAND_UUIDS batch call.
 // The spec for the Erlang APIs is at http://www.erlang.org/doc/man/crypto.html
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include "erl_driver.h"
 
 #include <CommonCrypto/CommonDigest.h>
@@ -36,9 +37,16 @@
 #define get_int32(s) CFSwapInt32BigToHost(*(const int32_t*)(s))
 #define put_int32(s,i) {*(int32_t*)(s) = CFSwapInt32HostToBig((i));}
 
+typedef struct RandPool RandPool;
+
 static unsigned char* return_binary(char **rbuf, int rlen, int len);
 
-static int generateUniformRandom(int from_len, const void* from_ptr,
+static RandPool* randPoolNew(void);
+static void randPoolFree(RandPool* pool);
+static int randPoolBytes(RandPool* pool, void* dst, size_t len);
+
+static int generateUniformRandom(RandPool* pool,
+								 int from_len, const void* from_ptr,
 								 int to_len, const void* to_ptr,
 								 void* result_ptr);
 
@@ -156,6 +164,12 @@ ErlDrvEntry crypto_driver_entry = {
 #define DRV_BF_CFB64_ENCRYPT     59
 #define DRV_BF_CFB64_DECRYPT     60
 
+/* iOS-only extension: <<count:32/integer>> -> count * 16 random bytes, for UUID generation.
+ * Numbered outside the 8-bit range of the standard commands so that it can never collide with
+ * them, and not listed in kImplementedFuncs since crypto:info/0 maps those through ?FUNC_LIST. */
+#define DRV_RAND_UUIDS           0x1000
+#define RAND_UUID_SIZE           16
+
 /* #define DRV_CBC_IDEA_ENCRYPT    34 */
 /* #define DRV_CBC_IDEA_DECRYPT    35 */
 
@@ -190,12 +204,17 @@ void crypto_finish(void)
 
 ErlDrvData crypto_start(ErlDrvPort port, char *command)
 {
+	/* Each port gets its own random pool; calls on a port are serialized by the port lock. */
+	RandPool* pool = randPoolNew();
+	if (pool == NULL)
+		return ERL_DRV_ERROR_GENERAL;
     set_port_control_flags(port, PORT_CONTROL_FLAG_BINARY);
-    return 0; /* not used */
+    return (ErlDrvData) pool;
 }
 
 void crypto_stop(ErlDrvData drv_data)
 {
+	randPoolFree((RandPool*) drv_data);
 }
 
 /* Main entry point for crypto functions. Spec is at http://www.erlang.org/doc/man/crypto.html */
@@ -203,6 +222,7 @@ int crypto_control(ErlDrvData drv_data, unsigned int command,
 				   char *buf, int len,
 				   char **rbuf, int rlen)
 {
+	RandPool* pool = (RandPool*) drv_data;
 	unsigned char* bin;
     switch(command) {
 		case DRV_INFO: {
@@ -267,14 +287,18 @@ int crypto_control(ErlDrvData drv_data, unsigned int command,
 			if (len != 6)
 				return -1;
 			int dlen = get_int32(buf);
+			if (dlen < 0)
+				return -1;
 			bin = return_binary(rbuf,rlen,dlen);
 			if (bin==NULL) return -1;
-			if (SecRandomCopyBytes(NULL, dlen, bin) != 0)
+			if (!randPoolBytes(pool, bin, dlen))
 				return -1;
-			int or_mask = ((unsigned char*)buf)[4];
-			bin[dlen-1] |= or_mask; /* topmask */
-			or_mask = ((unsigned char*)buf)[5];
-			bin[0] |= or_mask; /* bottommask */
+			if (dlen > 0) {
+				int or_mask = ((unsigned char*)buf)[4];
+				bin[dlen-1] |= or_mask; /* topmask */
+				or_mask = ((unsigned char*)buf)[5];
+				bin[0] |= or_mask; /* bottommask */
+			}
 			return dlen;
 		}
 		case DRV_RAND_UNIFORM: {
@@ -291,7 +315,7 @@ int crypto_control(ErlDrvData drv_data, unsigned int command,
 
 			int result_len;
 			char result[8];
-			result_len = generateUniformRandom(from_len, buf + 4,
+			result_len = generateUniformRandom(pool, from_len, buf + 4,
 											   to_len, buf + 4 + from_len + 4,
 											   &result);
 			if (result_len < 0)
@@ -302,7 +326,21 @@ int crypto_control(ErlDrvData drv_data, unsigned int command,
 			memcpy(bin+4, result, result_len);
 			return 4+result_len;
 		}
-		// NOTE: If you implement more cases, you must add them to kImplementedFuncs[].
+		case DRV_RAND_UUIDS: {
+			/* buf = <<count:32/integer>>; returns count concatenated 16-byte random values */
+			if (len != 4)
+				return -1;
+			int count = get_int32(buf);
+			if (count < 0 || count > INT_MAX / RAND_UUID_SIZE)
+				return -1;
+			int dlen = count * RAND_UUID_SIZE;
+			bin = return_binary(rbuf,rlen,dlen);
+			if (bin==NULL) return -1;
+			if (!randPoolBytes(pool, bin, dlen))
+				return -1;
+			return dlen;
+		}
+		// NOTE: If you implement more standard cases, you must add them to kImplementedFuncs[].
 		default: {
             fprintf(stderr, "ERROR: crypto_drv_ios.c: unsupported crypto_control command %u\n",
                     command);
@@ -329,7 +367,7 @@ static unsigned char* return_binary(char **rbuf, int rlen, int len)
 
 
 /* Returns a random number n such that from <= n < to.  On failure returns 'to'. */
-static uint64_t randomNumberInRange(uint64_t from, uint64_t to) {
+static uint64_t randomNumberInRange(RandPool* pool, uint64_t from, uint64_t to) {
 	if (to <= from)
 		return to;
 	uint64_t range = to - from;
@@ -340,7 +378,7 @@ static uint64_t randomNumberInRange(uint64_t from, uint64_t to) {
 
 	uint64_t n;
 	do {
-		if (SecRandomCopyBytes(NULL, sizeof(n), (uint8_t*)&n) != 0)
+		if (!randPoolBytes(pool, &n, sizeof(n)))
 			return to; // error
 		n >>= shift;
 	} while (n >= range);
@@ -349,7 +387,8 @@ static uint64_t randomNumberInRange(uint64_t from, uint64_t to) {
 
 
 /* Fake implementation of bignum rand_uniform function. Only handles numbers up to 8 bytes long. */
-static int generateUniformRandom(int from_len, const void* from_ptr,
+static int generateUniformRandom(RandPool* pool,
+								 int from_len, const void* from_ptr,
 								 int to_len, const void* to_ptr,
 								 void* result_ptr)
 {
@@ -364,10 +403,145 @@ static int generateUniformRandom(int from_len, const void* from_ptr,
 	to = CFSwapInt64BigToHost(to);
 
 	// Generate the random number.
-	uint64_t result = randomNumberInRange(from, to);
+	uint64_t result = randomNumberInRange(pool, from, to);
 	if (result >= to)
 		return -1;
 
 	*(uint64_t*)result_ptr = CFSwapInt64HostToBig(result);
 	return sizeof(result);
 }
+
+
+#pragma mark - RANDOM POOL:
+
+
+// Random bytes are served from a buffered ChaCha20 keystream instead of calling
+// SecRandomCopyBytes for every request, which costs a trip into the kernel.
+// The key is seeded from SecRandomCopyBytes and reseeded every kRandReseedInterval bytes.
+// After every refill the first 32 bytes of fresh keystream replace the key ("fast key erasure"),
+// and bytes are wiped from the buffer as they are handed out, so a later compromise of the
+// pool state doesn't reveal earlier output.
+
+#define kRandPoolBlocks		16
+#define kRandReseedInterval	(1024*1024)
+#define kChaChaKeySize		32
+#define kChaChaBlockSize	64
+
+struct RandPool {
+	uint8_t key[kChaChaKeySize];
+	uint8_t nonce[8];
+	uint64_t counter;
+	size_t sinceReseed;
+	size_t pos;									// next unused byte in buf
+	int seeded;
+	uint8_t buf[kRandPoolBlocks * kChaChaBlockSize];
+};
+
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) \
+	a += b; d ^= a; d = ROTL32(d, 16); \
+	c += d; b ^= c; b = ROTL32(b, 12); \
+	a += b; d ^= a; d = ROTL32(d, 8);  \
+	c += d; b ^= c; b = ROTL32(b, 7);
+
+static uint32_t load32le(const uint8_t* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void store32le(uint8_t* p, uint32_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+/* Writes one 64-byte ChaCha20 block for the pool's current key, nonce and counter. */
+static void chachaBlock(const RandPool* pool, uint64_t counter, uint8_t* out) {
+	uint32_t in[16], x[16];
+	int i;
+	in[0] = 0x61707865;		/* "expand 32-byte k" */
+	in[1] = 0x3320646e;
+	in[2] = 0x79622d32;
+	in[3] = 0x6b206574;
+	for (i = 0; i < 8; i++)
+		in[4 + i] = load32le(pool->key + 4 * i);
+	in[12] = (uint32_t)counter;
+	in[13] = (uint32_t)(counter >> 32);
+	in[14] = load32le(pool->nonce);
+	in[15] = load32le(pool->nonce + 4);
+
+	memcpy(x, in, sizeof(x));
+	for (i = 0; i < 10; i++) {
+		QUARTERROUND(x[0], x[4], x[8],  x[12]);
+		QUARTERROUND(x[1], x[5], x[9],  x[13]);
+		QUARTERROUND(x[2], x[6], x[10], x[14]);
+		QUARTERROUND(x[3], x[7], x[11], x[15]);
+		QUARTERROUND(x[0], x[5], x[10], x[15]);
+		QUARTERROUND(x[1], x[6], x[11], x[12]);
+		QUARTERROUND(x[2], x[7], x[8],  x[13]);
+		QUARTERROUND(x[3], x[4], x[9],  x[14]);
+	}
+	for (i = 0; i < 16; i++)
+		store32le(out + 4 * i, x[i] + in[i]);
+}
+
+static int randPoolSeed(RandPool* pool) {
+	if (SecRandomCopyBytes(NULL, sizeof(pool->key), pool->key) != 0
+			|| SecRandomCopyBytes(NULL, sizeof(pool->nonce), pool->nonce) != 0)
+		return 0;
+	pool->counter = 0;
+	pool->sinceReseed = 0;
+	pool->seeded = 1;
+	return 1;
+}
+
+static int randPoolRefill(RandPool* pool) {
+	int i;
+	if (!pool->seeded || pool->sinceReseed >= kRandReseedInterval) {
+		if (!randPoolSeed(pool))
+			return 0;
+	}
+	for (i = 0; i < kRandPoolBlocks; i++)
+		chachaBlock(pool, pool->counter++, pool->buf + i * kChaChaBlockSize);
+	memcpy(pool->key, pool->buf, kChaChaKeySize);
+	memset(pool->buf, 0, kChaChaKeySize);
+	pool->pos = kChaChaKeySize;
+	return 1;
+}
+
+static RandPool* randPoolNew(void) {
+	RandPool* pool = (RandPool*) driver_alloc(sizeof(RandPool));
+	if (pool == NULL)
+		return NULL;
+	memset(pool, 0, sizeof(RandPool));
+	pool->pos = sizeof(pool->buf);				// empty; seeded on first use
+	return pool;
+}
+
+static void randPoolFree(RandPool* pool) {
+	if (pool == NULL)
+		return;
+	memset(pool, 0, sizeof(RandPool));
+	driver_free(pool);
+}
+
+/* Copies len random bytes into dst. Returns 0 if the system random source failed. */
+static int randPoolBytes(RandPool* pool, void* dst, size_t len) {
+	uint8_t* out = (uint8_t*) dst;
+	while (len > 0) {
+		if (pool->pos >= sizeof(pool->buf) && !randPoolRefill(pool))
+			return 0;
+		size_t n = sizeof(pool->buf) - pool->pos;
+		if (n > len)
+			n = len;
+		memcpy(out, pool->buf + pool->pos, n);
+		memset(pool->buf + pool->pos, 0, n);
+		pool->pos += n;
+		pool->sinceReseed += n;
+		out += n;
+		len -= n;
+	}
+	return 1;
+}
@@ -364,6 +364,7 @@ extern int count_instructions;
            SWAPOUT; \
            reg[0] = r(0); \
            PROCESS_MAIN_CHK_LOCKS(c_p); \
+           c_p->fcalls = FCALLS; \
            FCALLS -= erts_garbage_collect(c_p, needed + (HeapNeed), reg, (M)); \
            PROCESS_MAIN_CHK_LOCKS(c_p); \
            r(0) = reg[0]; \
@@ -417,6 +418,7 @@ extern int count_instructions;
        SWAPOUT;                                                 		\
        reg[0] = r(0);                                           		\
        PROCESS_MAIN_CHK_LOCKS(c_p);                             		\
+       c_p->fcalls = FCALLS;                                                    \
        FCALLS -= erts_garbage_collect(c_p, need, reg, (Live));  		\
        PROCESS_MAIN_CHK_LOCKS(c_p);                             		\
        r(0) = reg[0];                                           		\
@@ -439,6 +441,7 @@ extern int count_instructions;
        SWAPOUT;                                                 \
        reg[0] = r(0);                                           \
        PROCESS_MAIN_CHK_LOCKS(c_p);                             \
+       c_p->fcalls = FCALLS;                                    \
        FCALLS -= erts_garbage_collect(c_p, need, reg, (Live));  \
        PROCESS_MAIN_CHK_LOCKS(c_p);                             \
        r(0) = reg[0];                                           \
@@ -461,6 +464,7 @@ extern int count_instructions;
        reg[0] = r(0);							\
        reg[Live] = Extra;						\
        PROCESS_MAIN_CHK_LOCKS(c_p);					\
+       c_p->fcalls = FCALLS;                                            \
        FCALLS -= erts_garbage_collect(c_p, need, reg, (Live)+1);	\
        PROCESS_MAIN_CHK_LOCKS(c_p);					\
        if (Live > 0) {							\
@@ -1514,6 +1518,7 @@ void process_main(void)
 						 * created heap fragments */
 		 SWAPOUT;
 		 PROCESS_MAIN_CHK_LOCKS(c_p);
+		 c_p->fcalls = FCALLS;
 		 FCALLS -= erts_garbage_collect(c_p, 3, reg+2, 1);
 		 PROCESS_MAIN_CHK_LOCKS(c_p);
 		 SWAPIN;
@@ -1788,6 +1793,8 @@ void process_main(void)
 	     c_p->i = (BeamInstr *) Arg(0); /* L1 */
 	     SWAPOUT;
 	     c_p->arity = 0;
+	     /* Make sure senders will wake us up */
+	     ERTS_SMP_MSGQ_FETCH_LF_INQ(c_p);
 	     c_p->status = P_WAITING;
 	     erts_smp_proc_unlock(c_p, ERTS_PROC_LOCKS_MSG_RECEIVE);
 	     c_p->current = NULL;
@@ -3095,6 +3102,7 @@ void process_main(void)
 	   * I[0]: &&call_nif
 	   * I[1]: Function pointer to NIF function
 	   * I[2]: Pointer to erl_module_nif
+	   * I[3]: ErlNifFunc entry, if I[1] is the dirty NIF dispatcher
 	   */
      	 BifFunction vbf;
 
@@ -4363,6 +4371,7 @@ apply_bif_or_nif_epilogue:
 	     if (E - 3 < HTOP) {
 		 /* SWAPOUT, SWAPIN was done and r(0) was saved above */
 		 PROCESS_MAIN_CHK_LOCKS(c_p);
+		 c_p->fcalls = FCALLS;
 		 FCALLS -= erts_garbage_collect(c_p, 3, reg, ep->code[2]);
 		 PROCESS_MAIN_CHK_LOCKS(c_p);
 		 r(0) = reg[0];
@@ -4452,6 +4461,7 @@ apply_bif_or_nif_epilogue:
 	     if (E - 2 < HTOP) {
 		 reg[0] = r(0);
 		 PROCESS_MAIN_CHK_LOCKS(c_p);
+		 c_p->fcalls = FCALLS;
 		 FCALLS -= erts_garbage_collect(c_p, 2, reg, I[-1]);
 		 PROCESS_MAIN_CHK_LOCKS(c_p);
 		 r(0) = reg[0];
@@ -4555,6 +4565,7 @@ apply_bif_or_nif_epilogue:
 	 if (E - need < HTOP) {
 	     /* SWAPOUT was done and r(0) was saved above */
 	     PROCESS_MAIN_CHK_LOCKS(c_p);
+	     c_p->fcalls = FCALLS;
 	     FCALLS -= erts_garbage_collect(c_p, need, reg, I[-1]);
 	     PROCESS_MAIN_CHK_LOCKS(c_p);
 	     r(0) = reg[0];
@@ -1508,6 +1508,53 @@ BIF_RETTYPE process_flag_2(BIF_ALIST_2)
        else
 	   BIF_RET(old_value);
    }
+   else if (BIF_ARG_1 == am_scheduler_group) {
+       int yield;
+       erts_smp_proc_lock(BIF_P, ERTS_PROC_LOCK_STATUS);
+       old_value = erts_set_process_sched_group(BIF_P, BIF_ARG_2, &yield);
+       erts_smp_proc_unlock(BIF_P, ERTS_PROC_LOCK_STATUS);
+       if (old_value == THE_NON_VALUE)
+	   goto error;
+       if (yield)
+	   ERTS_BIF_YIELD_RETURN_X(BIF_P, old_value, am_scheduler_group);
+       else
+	   BIF_RET(old_value);
+   }
+   else if (BIF_ARG_1 == am_max_gc_pause) {
+       Sint i;
+       if (!is_small(BIF_ARG_2)) {
+	   goto error;
+       }
+       i = signed_val(BIF_ARG_2);
+       if (i < 0) {
+	   goto error;
+       }
+       old_value = make_small(BIF_P->max_gc_pause);
+       BIF_P->max_gc_pause = (Uint) i;
+       BIF_RET(old_value);
+   }
+   else if (BIF_ARG_1 == am_message_queue_data) {
+       old_value = (BIF_P->flags & F_OFF_HEAP_MSGQ) ? am_off_heap : am_on_heap;
+       if (BIF_ARG_2 == am_off_heap) {
+	   BIF_P->flags |= F_OFF_HEAP_MSGQ;
+       } else if (BIF_ARG_2 == am_on_heap) {
+	   BIF_P->flags &= ~F_OFF_HEAP_MSGQ;
+       } else {
+	   goto error;
+       }
+       BIF_RET(old_value);
+   }
+   else if (BIF_ARG_1 == am_preserve_sharing) {
+       old_value = (BIF_P->flags & F_COPY_SHARING) ? am_true : am_false;
+       if (BIF_ARG_2 == am_true) {
+	   BIF_P->flags |= F_COPY_SHARING;
+       } else if (BIF_ARG_2 == am_false) {
+	   BIF_P->flags &= ~F_COPY_SHARING;
+       } else {
+	   goto error;
+       }
+       BIF_RET(old_value);
+   }
    else if (BIF_ARG_1 == am_min_heap_size) {
        Sint i;
        if (!is_small(BIF_ARG_2)) {
@@ -1611,6 +1658,15 @@ BIF_RETTYPE process_flag_3(BIF_ALIST_3)
    return res;
 }
 
+/*
+ * Copy Term into an immutable, reference counted area outside of the
+ * heap (copy.c). Terms in the area are then sent by reference.
+ */
+BIF_RETTYPE share_term_1(BIF_ALIST_1)
+{
+    BIF_RET(erts_share_term(BIF_P, BIF_ARG_1));
+}
+
 /**********************************************************************/
 
 /* register(atom, Process|Port) registers a global process or port
@@ -1988,7 +2044,9 @@ do_send(Process *p, Eterm to, Eterm msg, int suspend) {
 	    res = 0;
 	else {
 #ifdef ERTS_SMP
-	    res = rp->msg_inq.len*4;
+	    /* Include messages enqueued lock free; see erts_queue_message() */
+	    res = (rp->msg_inq.len
+		   + erts_smp_atomic_read(&rp->msg_lf_inq_len))*4;
 	    if (ERTS_PROC_LOCK_MAIN & rp_locks)
 		res += rp->msg.len*4;
 #else
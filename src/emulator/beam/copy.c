@@ -462,6 +462,652 @@ copy_struct(Eterm obj, Uint sz, Eterm** hpp, ErlOffHeap* off_heap)
     return res;
 }
 
+/*
+ * Single pass copying.
+ *
+ * copy_struct() needs the size calculated by size_object() up front,
+ * so sending a message walks the term twice. The functions below copy
+ * depth first and allocate each object as it is reached, either from
+ * a bounded area (copy_struct_bounded()) or from a chain of heap
+ * fragments that is extended as needed (copy_struct_frags()).
+ *
+ * An object is never split between two areas, so every fragment in a
+ * chain can be parsed on its own by move_multi_frags(). A fragment
+ * only keeps the off-heap entries of objects allocated in it.
+ *
+ * With 'share' set, each subterm is copied once no matter how many
+ * times it is referred to within the term. Copied objects are then
+ * looked up by source address in a hash table, so the source term is
+ * never written to (it might be a literal).
+ *
+ * Subterms in the shared term areas listed in 'areas' are not copied.
+ * The areas referred to are marked (hit) so that the caller can add
+ * references to them for the receiver of the copy.
+ */
+
+#define ERTS_COPY_FRAG_MIN_SZ	32
+#define ERTS_COPY_FRAG_MAX_SZ	(8*1024)
+#define ERTS_COPY_SHARE_MIN_SZ	64
+
+typedef struct {
+    Eterm *src;
+    Eterm copy;
+} ErtsCopyShareEntry;
+
+typedef struct {
+    ErtsCopyShareEntry *tab;
+    Uint size;			/* Power of 2 */
+    Uint used;
+} ErtsCopyShare;
+
+typedef struct {
+    Eterm *hp;
+    Eterm *hend;
+    ErlOffHeap *off_heap;	/* Off-heap list of the area at hp */
+    ErlHeapFragment *bp;	/* Fragment at hp; NULL if bounded */
+    ErlHeapFragment *first;
+    ErlHeapFragment *last;
+    Uint frag_sz;		/* Size of next fragment */
+    int bounded;
+} ErtsCopyDest;
+
+#define ERTS_COPY_SHARE_IX(SP, PTR) \
+    ((((UWord) (PTR)) >> 3)*((UWord) 2654435761UL) & ((SP)->size - 1))
+
+static ERTS_INLINE ErtsCopyShareEntry *
+copy_share_lookup(ErtsCopyShare *sp, Eterm *src)
+{
+    Uint ix = ERTS_COPY_SHARE_IX(sp, src);
+    while (sp->tab[ix].src != NULL && sp->tab[ix].src != src)
+	ix = (ix + 1) & (sp->size - 1);
+    return &sp->tab[ix];
+}
+
+static void
+copy_share_insert(ErtsCopyShare *sp, Eterm *src, Eterm copy)
+{
+    ErtsCopyShareEntry *ep;
+
+    if (2*(sp->used + 1) > sp->size) {
+	ErtsCopyShareEntry *old_tab = sp->tab;
+	Uint old_size = sp->size;
+	Uint i;
+
+	sp->size = old_size ? 2*old_size : ERTS_COPY_SHARE_MIN_SZ;
+	sp->tab = erts_alloc(ERTS_ALC_T_TMP,
+			     sp->size*sizeof(ErtsCopyShareEntry));
+	sys_memzero((void *) sp->tab, sp->size*sizeof(ErtsCopyShareEntry));
+	for (i = 0; i < old_size; i++) {
+	    if (old_tab[i].src != NULL)
+		*copy_share_lookup(sp, old_tab[i].src) = old_tab[i];
+	}
+	if (old_tab)
+	    erts_free(ERTS_ALC_T_TMP, (void *) old_tab);
+    }
+    ep = copy_share_lookup(sp, src);
+    ASSERT(ep->src == NULL);
+    ep->src = src;
+    ep->copy = copy;
+    sp->used++;
+}
+
+static ERTS_INLINE void
+copy_dest_close_frag(ErtsCopyDest *dp)
+{
+    if (dp->bp)
+	dp->bp->used_size = dp->hp - dp->bp->mem;
+}
+
+static ErlHeapFragment *
+copy_dest_new_frag(ErtsCopyDest *dp, Uint size)
+{
+    ErlHeapFragment *bp = new_message_buffer(size);
+    if (dp->last)
+	dp->last->next = bp;
+    else
+	dp->first = bp;
+    dp->last = bp;
+    return bp;
+}
+
+/*
+ * Allocate 'need' words for one object. Returns NULL if a bounded area
+ * is exhausted. *ohpp is set to the off-heap list of the allocated area.
+ */
+static Eterm *
+copy_dest_alloc(ErtsCopyDest *dp, Uint need, ErlOffHeap **ohpp)
+{
+    Eterm *res;
+
+    if ((Uint) (dp->hend - dp->hp) < need) {
+	ErlHeapFragment *bp;
+
+	if (dp->bounded)
+	    return NULL;
+	if (need > dp->frag_sz) {
+	    /* Large object; give it a fragment of its own */
+	    bp = copy_dest_new_frag(dp, need);
+	    *ohpp = &bp->off_heap;
+	    return bp->mem;
+	}
+	copy_dest_close_frag(dp);
+	bp = copy_dest_new_frag(dp, dp->frag_sz);
+	dp->bp = bp;
+	dp->hp = bp->mem;
+	dp->hend = bp->mem + dp->frag_sz;
+	dp->off_heap = &bp->off_heap;
+	if (dp->frag_sz < ERTS_COPY_FRAG_MAX_SZ)
+	    dp->frag_sz *= 2;
+    }
+    res = dp->hp;
+    dp->hp += need;
+    *ohpp = dp->off_heap;
+    return res;
+}
+
+static Eterm
+copy_one_pass(Eterm obj, ErtsCopyDest *dp, int share,
+	      ErtsSharedAreaRef *areas)
+{
+    Eterm res;
+    Eterm* resp = &res;
+    Eterm* objp;
+    Eterm* hp;
+    Eterm hdr;
+    ErlOffHeap* ohp;
+    ErtsCopyShare shtab;
+    ErtsSharedAreaRef *ref;
+    Eterm *areas_lo = NULL;
+    Eterm *areas_hi = NULL;
+    Uint i;
+    DECLARE_ESTACK(s);
+
+    shtab.tab = NULL;
+    shtab.size = 0;
+    shtab.used = 0;
+
+    /* Bounds of all shared areas, so most pointers skip the list scan */
+    for (ref = areas; ref; ref = ref->next) {
+	Eterm *mem = ref->area->mem;
+	if (!areas_lo || mem < areas_lo)
+	    areas_lo = mem;
+	if (mem + ref->area->size > areas_hi)
+	    areas_hi = mem + ref->area->size;
+    }
+
+    for (;;) {
+	if (IS_CONST(obj)) {
+	    *resp = obj;
+	    goto pop_next;
+	}
+
+	objp = ptr_val(obj);
+	if (objp >= areas_lo && objp < areas_hi) {
+	    ref = erts_shared_area_ref(areas, objp);
+	    if (ref) {
+		/* Immutable and kept alive by references; don't copy */
+		ref->hit = 1;
+		*resp = obj;
+		goto pop_next;
+	    }
+	}
+	if (share && shtab.used) {
+	    ErtsCopyShareEntry *ep = copy_share_lookup(&shtab, objp);
+	    if (ep->src) {
+		*resp = ep->copy;
+		goto pop_next;
+	    }
+	}
+
+	switch (primary_tag(obj)) {
+	case TAG_PRIMARY_LIST:
+	    hp = copy_dest_alloc(dp, 2, &ohp);
+	    if (!hp)
+		goto overflow;
+	    hp[0] = objp[0];
+	    hp[1] = objp[1];
+	    *resp = make_list(hp);
+	    if (share)
+		copy_share_insert(&shtab, objp, *resp);
+	    if (!IS_CONST(hp[0]))
+		ESTACK_PUSH2(s, (Eterm) &hp[0], hp[0]);
+	    /* Continue with the tail without touching the stack */
+	    obj = hp[1];
+	    resp = &hp[1];
+	    continue;
+	case TAG_PRIMARY_BOXED:
+	    hdr = *objp;
+	    switch (hdr & _TAG_HEADER_MASK) {
+	    case ARITYVAL_SUBTAG:
+		i = arityval(hdr);
+		hp = copy_dest_alloc(dp, i + 1, &ohp);
+		if (!hp)
+		    goto overflow;
+		hp[0] = hdr;
+		*resp = make_tuple(hp);
+		if (share)
+		    copy_share_insert(&shtab, objp, *resp);
+		for (; i > 0; i--) {
+		    Eterm elem = objp[i];
+		    hp[i] = elem;
+		    if (!IS_CONST(elem))
+			ESTACK_PUSH2(s, (Eterm) &hp[i], elem);
+		}
+		goto pop_next;
+	    case REFC_BINARY_SUBTAG:
+		{
+		    ProcBin* pb = (ProcBin *) objp;
+
+		    if (pb->flags) {
+			erts_emasculate_writable_binary(pb);
+		    }
+		    i = thing_arityval(hdr) + 1;
+		    hp = copy_dest_alloc(dp, i, &ohp);
+		    if (!hp)
+			goto overflow;
+		    sys_memcpy((void *) hp, (void *) objp, i*sizeof(Eterm));
+		    pb = (ProcBin *) hp;
+		    erts_refc_inc(&pb->val->refc, 2);
+		    pb->next = ohp->mso;
+		    pb->flags = 0;
+		    ohp->mso = pb;
+		    ohp->overhead += pb->size / sizeof(Eterm);
+		    *resp = make_binary(hp);
+		}
+		break;
+	    case SUB_BINARY_SUBTAG:
+		{
+		    ErlSubBin* sb = (ErlSubBin *) objp;
+		    Uint bit_offset = sb->bitoffs;
+		    Uint bit_size = sb->bitsize;
+		    Uint offset = sb->offs;
+		    size_t size = sb->size;
+		    Uint extra_bytes;
+		    Uint real_size;
+		    Eterm* bin_hp;
+		    Eterm* real_binp;
+
+		    if ((bit_size + bit_offset) > 8) {
+			extra_bytes = 2;
+		    } else if ((bit_size + bit_offset) > 0) {
+			extra_bytes = 1;
+		    } else {
+			extra_bytes = 0;
+		    }
+		    real_size = size+extra_bytes;
+		    real_binp = binary_val(sb->orig);
+		    if (thing_subtag(*real_binp) == HEAP_BINARY_SUBTAG) {
+			ErlHeapBin* from = (ErlHeapBin *) real_binp;
+			ErlHeapBin* to;
+			bin_hp = copy_dest_alloc(dp, heap_bin_size(real_size),
+						 &ohp);
+			if (!bin_hp)
+			    goto overflow;
+			to = (ErlHeapBin *) bin_hp;
+			to->thing_word = header_heap_bin(real_size);
+			to->size = real_size;
+			sys_memcpy(to->data, ((byte *)from->data)+offset,
+				   real_size);
+		    } else {
+			ProcBin* from = (ProcBin *) real_binp;
+			ProcBin* to;
+
+			ASSERT(thing_subtag(*real_binp) == REFC_BINARY_SUBTAG);
+			if (from->flags) {
+			    erts_emasculate_writable_binary(from);
+			}
+			bin_hp = copy_dest_alloc(dp, PROC_BIN_SIZE, &ohp);
+			if (!bin_hp)
+			    goto overflow;
+			to = (ProcBin *) bin_hp;
+			to->thing_word = HEADER_PROC_BIN;
+			to->size = real_size;
+			to->val = from->val;
+			erts_refc_inc(&to->val->refc, 2);
+			to->bytes = from->bytes + offset;
+			to->next = ohp->mso;
+			to->flags = 0;
+			ohp->mso = to;
+			ohp->overhead += to->size / sizeof(Eterm);
+		    }
+		    *resp = make_binary(bin_hp);
+		    if (extra_bytes != 0) {
+			ErlSubBin* res_sb;
+			hp = copy_dest_alloc(dp, ERL_SUB_BIN_SIZE, &ohp);
+			if (!hp)
+			    goto overflow;
+			res_sb = (ErlSubBin *) hp;
+			res_sb->thing_word = HEADER_SUB_BIN;
+			res_sb->size = size;
+			res_sb->bitsize = bit_size;
+			res_sb->bitoffs = bit_offset;
+			res_sb->offs = 0;
+			res_sb->is_writable = 0;
+			res_sb->orig = *resp;
+			*resp = make_binary(hp);
+		    }
+		}
+		break;
+	    case FUN_SUBTAG:
+		{
+		    ErlFunThing* funp = (ErlFunThing *) objp;
+		    Uint sz = thing_arityval(hdr) + 1;
+		    Uint eterms = 1 /* creator */ + funp->num_free;
+
+		    hp = copy_dest_alloc(dp, sz + eterms, &ohp);
+		    if (!hp)
+			goto overflow;
+		    sys_memcpy((void *) hp, (void *) objp,
+			       (sz + eterms)*sizeof(Eterm));
+		    funp = (ErlFunThing *) hp;
+		    funp->next = ohp->funs;
+		    ohp->funs = funp;
+		    erts_refc_inc(&funp->fe->refc, 2);
+		    *resp = make_fun(hp);
+		    if (share)
+			copy_share_insert(&shtab, objp, *resp);
+		    for (i = sz; i < sz + eterms; i++) {
+			if (!IS_CONST(hp[i]))
+			    ESTACK_PUSH2(s, (Eterm) &hp[i], hp[i]);
+		    }
+		}
+		goto pop_next;
+	    case EXTERNAL_PID_SUBTAG:
+	    case EXTERNAL_PORT_SUBTAG:
+	    case EXTERNAL_REF_SUBTAG:
+		{
+		    ExternalThing *etp;
+
+		    i = thing_arityval(hdr) + 1;
+		    hp = copy_dest_alloc(dp, i, &ohp);
+		    if (!hp)
+			goto overflow;
+		    sys_memcpy((void *) hp, (void *) objp, i*sizeof(Eterm));
+		    etp = (ExternalThing *) hp;
+		    etp->next = ohp->externals;
+		    ohp->externals = etp;
+		    erts_refc_inc(&etp->node->refc, 2);
+		    *resp = make_external(hp);
+		}
+		break;
+	    case BIN_MATCHSTATE_SUBTAG:
+		erl_exit(ERTS_ABORT_EXIT,
+			 "copy_struct: matchstate term not allowed");
+	    default:
+		i = thing_arityval(hdr) + 1;
+		hp = copy_dest_alloc(dp, i, &ohp);
+		if (!hp)
+		    goto overflow;
+		sys_memcpy((void *) hp, (void *) objp, i*sizeof(Eterm));
+		*resp = make_boxed(hp);
+		break;
+	    }
+	    if (share)
+		copy_share_insert(&shtab, objp, *resp);
+	    break;
+	default:
+	    erl_exit(ERTS_ABORT_EXIT,
+		     "%s, line %d: Internal error in copy_struct: 0x%08x\n",
+		     __FILE__, __LINE__, obj);
+	}
+
+    pop_next:
+	if (ESTACK_ISEMPTY(s))
+	    break;
+	obj = ESTACK_POP(s);
+	resp = (Eterm *) ESTACK_POP(s);
+    }
+
+    DESTROY_ESTACK(s);
+    if (shtab.tab)
+	erts_free(ERTS_ALC_T_TMP, (void *) shtab.tab);
+    return res;
+
+ overflow:
+    DESTROY_ESTACK(s);
+    if (shtab.tab)
+	erts_free(ERTS_ALC_T_TMP, (void *) shtab.tab);
+    return THE_NON_VALUE;
+}
+
+/*
+ * Copy a structure into the area [*hpp, hend) in a single pass. If
+ * the copy doesn't fit, nothing is allocated from the area, off_heap
+ * is restored and THE_NON_VALUE is returned.
+ */
+Eterm
+copy_struct_bounded(Eterm obj, Eterm** hpp, Eterm* hend,
+		    ErlOffHeap* off_heap, int share, ErtsSharedAreaRef* areas)
+{
+    ErtsCopyDest dest;
+    ErlOffHeap orig;
+    Eterm res;
+
+    if (IS_CONST(obj))
+	return obj;
+
+    dest.hp = *hpp;
+    dest.hend = hend;
+    dest.off_heap = off_heap;
+    dest.bp = dest.first = dest.last = NULL;
+    dest.frag_sz = 0;
+    dest.bounded = 1;
+    orig = *off_heap;
+
+    res = copy_one_pass(obj, &dest, share, areas);
+    if (is_value(res)) {
+	*hpp = dest.hp;
+	return res;
+    }
+
+    /*
+     * Entries added during the copy are at the heads of the off-heap
+     * lists; move them to a list of their own and release them.
+     */
+    {
+	ErlOffHeap added;
+
+	added.mso = off_heap->mso != orig.mso ? off_heap->mso : NULL;
+	if (added.mso) {
+	    ProcBin *pb = added.mso;
+	    while (pb->next != orig.mso)
+		pb = pb->next;
+	    pb->next = NULL;
+	}
+	added.funs = off_heap->funs != orig.funs ? off_heap->funs : NULL;
+	if (added.funs) {
+	    ErlFunThing *funp = added.funs;
+	    while (funp->next != orig.funs)
+		funp = funp->next;
+	    funp->next = NULL;
+	}
+	added.externals = (off_heap->externals != orig.externals
+			   ? off_heap->externals
+			   : NULL);
+	if (added.externals) {
+	    ExternalThing *etp = added.externals;
+	    while (etp->next != orig.externals)
+		etp = etp->next;
+	    etp->next = NULL;
+	}
+	added.overhead = 0;
+	*off_heap = orig;
+	erts_cleanup_offheap(&added);
+    }
+    return THE_NON_VALUE;
+}
+
+/*
+ * Copy a structure into newly allocated heap fragments in a single
+ * pass. The fragments are chained through their next field and the
+ * first one is returned in *bpp (NULL if obj is immediate).
+ */
+Eterm
+copy_struct_frags(Eterm obj, ErlHeapFragment** bpp, int share,
+		  ErtsSharedAreaRef* areas)
+{
+    ErtsCopyDest dest;
+    Eterm res;
+
+    *bpp = NULL;
+    if (IS_CONST(obj))
+	return obj;
+
+    dest.hp = dest.hend = NULL;
+    dest.off_heap = NULL;
+    dest.bp = dest.first = dest.last = NULL;
+    dest.frag_sz = ERTS_COPY_FRAG_MIN_SZ;
+    dest.bounded = 0;
+
+    res = copy_one_pass(obj, &dest, share, areas);
+    ASSERT(is_value(res));
+    copy_dest_close_frag(&dest);
+    *bpp = dest.first;
+    return res;
+}
+
+/*
+ * Shared term areas.
+ *
+ * erlang:share_term/1 copies a term once into an area outside of all
+ * heaps. Like literals, terms in an area are never moved or written
+ * to; the garbage collector leaves pointers to them alone, and sends
+ * pass them by reference.
+ *
+ * An area is freed when no process refers to it. A process holding
+ * (or possibly holding) pointers into an area has a reference to it
+ * in its shared_areas list, which is only modified under its msgq
+ * lock. The creator and every receiver of a message referring to the
+ * area get a reference; the owner drops it when it exits, or when a
+ * fullsweep finds no more pointers into the area (erl_gc.c).
+ */
+
+ErtsSharedAreaRef *
+erts_shared_area_ref(ErtsSharedAreaRef *refs, Eterm *ptr)
+{
+    for (; refs; refs = refs->next) {
+	ErtsSharedArea *area = refs->area;
+	if (in_area(ptr, area->mem, area->size*sizeof(Eterm)))
+	    return refs;
+    }
+    return NULL;
+}
+
+static void
+release_shared_area(ErtsSharedArea *area)
+{
+    if (erts_refc_dectest(&area->refc, 0) == 0) {
+	erts_cleanup_offheap(&area->off_heap);
+	erts_free(ERTS_ALC_T_LL_TEMP_TERM, (void *) area);
+    }
+}
+
+void
+erts_release_shared_area_refs(ErtsSharedAreaRef *refs)
+{
+    while (refs) {
+	ErtsSharedAreaRef *next = refs->next;
+	release_shared_area(refs->area);
+	erts_free(ERTS_ALC_T_LL_TEMP_TERM, (void *) refs);
+	refs = next;
+    }
+}
+
+static void
+add_shared_area_ref(Process *p, ErtsSharedArea *area)
+{
+    ErtsSharedAreaRef *ref;
+
+    ERTS_SMP_LC_ASSERT(ERTS_PROC_LOCK_MSGQ & erts_proc_lc_my_proc_locks(p));
+    for (ref = p->shared_areas; ref; ref = ref->next) {
+	if (ref->area == area) {
+	    /* A fullsweep running in p may not see the message we
+	       queued; make it keep the reference */
+	    ref->hit = 1;
+	    return;
+	}
+    }
+    ref = erts_alloc(ERTS_ALC_T_LL_TEMP_TERM, sizeof(ErtsSharedAreaRef));
+    erts_refc_inc(&area->refc, 1);
+    ref->area = area;
+    ref->hit = 0;
+    ref->next = p->shared_areas;
+    /* The owner may be reading the list without the msgq lock */
+    ERTS_THR_MEMORY_BARRIER;
+    p->shared_areas = ref;
+}
+
+/*
+ * Give receiver references to the areas that were hit when copying
+ * a message to it, and clear the hits. Called after the message has
+ * been queued; the sender's own references keep the areas alive until
+ * then. May release the status lock on receiver.
+ */
+void
+erts_add_shared_area_refs(Process *receiver, ErtsProcLocks *receiver_locks,
+			  ErtsSharedAreaRef *hits)
+{
+    ErtsSharedAreaRef *ref;
+
+    for (ref = hits; ref && !ref->hit; ref = ref->next)
+	;
+    if (!ref)
+	return;
+
+#ifdef ERTS_SMP
+    if (!(*receiver_locks & ERTS_PROC_LOCK_MSGQ)) {
+	if (*receiver_locks & ERTS_PROC_LOCK_STATUS) {
+	    erts_smp_proc_unlock(receiver, ERTS_PROC_LOCK_STATUS);
+	    *receiver_locks &= ~ERTS_PROC_LOCK_STATUS;
+	}
+	erts_smp_proc_lock(receiver, ERTS_PROC_LOCK_MSGQ);
+	*receiver_locks |= ERTS_PROC_LOCK_MSGQ;
+    }
+#endif
+    for (; ref; ref = ref->next) {
+	if (ref->hit) {
+	    ref->hit = 0;
+	    add_shared_area_ref(receiver, ref->area);
+	}
+    }
+}
+
+/*
+ * Copy a term into a new shared area and return the copy. Terms
+ * already in an area of the process are returned as they are.
+ */
+Eterm
+erts_share_term(Process *p, Eterm obj)
+{
+    ErtsSharedArea *area;
+    Eterm *hp;
+    Eterm res;
+    Uint sz;
+
+    if (IS_CONST(obj))
+	return obj;
+    if (erts_shared_area_ref(p->shared_areas, ptr_val(obj))) {
+	return obj;
+    }
+
+    sz = size_object(obj);
+    area = erts_alloc(ERTS_ALC_T_LL_TEMP_TERM,
+		      sizeof(ErtsSharedArea) + (sz - 1)*sizeof(Eterm));
+    erts_refc_init(&area->refc, 0);
+    area->off_heap.mso = NULL;
+    area->off_heap.funs = NULL;
+    area->off_heap.externals = NULL;
+    area->off_heap.overhead = 0;
+    area->size = sz;
+    hp = area->mem;
+    res = copy_struct(obj, sz, &hp, &area->off_heap);
+
+    erts_smp_proc_lock(p, ERTS_PROC_LOCK_MSGQ);
+    add_shared_area_ref(p, area);
+    erts_smp_proc_unlock(p, ERTS_PROC_LOCK_MSGQ);
+    return res;
+}
+
 #ifdef HYBRID
 
 #ifdef BM_MESSAGE_SIZES
@@ -552,6 +552,7 @@ static Eterm pi_args[] = {
     am_suspending,
     am_min_heap_size,
     am_min_bin_vheap_size,
+    am_gc_stats,
 #ifdef HYBRID
     am_message_binary
 #endif
@@ -600,8 +601,9 @@ pi_arg2ix(Eterm arg)
     case am_suspending:				return 26;
     case am_min_heap_size:			return 27;
     case am_min_bin_vheap_size:			return 28;
+    case am_gc_stats:				return 29;
 #ifdef HYBRID
-    case am_message_binary:			return 29;
+    case am_message_binary:			return 30;
 #endif
     default:					return -1;
     }
@@ -1488,6 +1490,11 @@ process_info_aux(Process *BIF_P,
 	break;
     }
 
+    case am_gc_stats:
+	res = erts_gc_stats(BIF_P, rp);
+	hp = HAlloc(BIF_P, 3);
+	break;
+
     case am_group_leader: {
 	int sz = NC_HEAP_SIZE(rp->group_leader);
 	hp = HAlloc(BIF_P, 3 + sz);
@@ -3121,6 +3128,9 @@ BIF_RETTYPE statistics_1(BIF_ALIST_1)
 	    hpp = &hp;
 	}
     }
+    else if (ERTS_IS_ATOM_STR("scheduler_wakeup_latency", BIF_ARG_1)) {
+	BIF_RET(erts_sched_wakeup_latency_term(BIF_P));
+    }
     BIF_ERROR(BIF_P, BADARG);
 }
 
@@ -42,6 +42,9 @@
 #include "erl_db.h"
 #include "bif.h"
 #include "big.h"
+#include "external.h"
+#include "erl_driver.h"
+#include "erl_binary.h"
 
 
 erts_smp_atomic_t erts_ets_misc_mem_size;
@@ -200,6 +203,10 @@ static BIF_RETTYPE ets_select_delete_1(Process *p, Eterm a1);
 static BIF_RETTYPE ets_select_count_1(Process *p, Eterm a1);
 static BIF_RETTYPE ets_select_trap_1(Process *p, Eterm a1);
 static BIF_RETTYPE ets_delete_trap(Process *p, Eterm a1);
+static BIF_RETTYPE ets_lookup_many_trap(Process *p, Eterm a1, Eterm a2,
+					Eterm a3);
+static BIF_RETTYPE ets_snapshot_trap(Process *p, Eterm a1, Eterm a2, Eterm a3);
+static BIF_RETTYPE ets_restore_trap(Process *p, Eterm a1, Eterm a2);
 static Eterm table_info(Process* p, DbTable* tb, Eterm What);
 
 /* 
@@ -213,6 +220,9 @@ Export ets_select_continue_exp;
  * Static traps
  */
 static Export ets_delete_continue_exp;
+static Export ets_lookup_many_continue_exp;
+static Export ets_snapshot_continue_exp;
+static Export ets_restore_continue_exp;
 
 static ERTS_INLINE DbTable* db_ref(DbTable* tb)
 {
@@ -222,9 +232,12 @@ static ERTS_INLINE DbTable* db_ref(DbTable* tb)
     return tb;
 }
 
+static void stats_free(DbTable* tb);
+
 static ERTS_INLINE DbTable* db_unref(DbTable* tb)
 {
     if (!erts_refc_dectest(&tb->common.ref, 0)) {
+	stats_free(tb);
 #ifdef HARDDEBUG
 	if (erts_smp_atomic_read(&tb->common.memory_size) != sizeof(DbTable)) {
 	    erts_fprintf(stderr, "ets: db_unref memory remain=%ld fix=%x\n",
@@ -317,6 +330,13 @@ static ERTS_INLINE void db_unlock(DbTable* tb, db_lock_kind_t kind)
 	else {
 	    ASSERT(kind != LCK_WRITE);
 	    erts_smp_rwmtx_runlock(&tb->common.rwlock);
+	    /* Writes may have asked for the bases of a partitioned
+	       ordered_set to be split or joined, which needs the table
+	       write locked. We still hold our reference to it. */
+	    if (kind == LCK_WRITE_REC && IS_TREE_TABLE(tb->common.status)
+		&& erts_smp_atomic_read(&tb->tree.adapt)) {
+		db_adapt_tree(tb);
+	    }
 	}
     }
     else {
@@ -413,6 +433,396 @@ static ERTS_INLINE void free_slot(int slot)
     erts_smp_spin_unlock(&meta_main_tab_main_lock);
 }
 
+/*
+** Operation counters for ets:info(T,stats), one slot per scheduler so
+** that counting is a plain add to a line no other scheduler writes.
+*/
+#ifdef ERTS_SMP
+#  define DB_STATS_SLOTS (erts_no_schedulers + 1)
+#  define DB_STATS_SLOT(P) ((P)->scheduler_data ? (P)->scheduler_data->no : 0)
+#else
+#  define DB_STATS_SLOTS 1
+#  define DB_STATS_SLOT(P) 0
+#endif
+#define DB_STATS_SIZE (DB_STATS_SLOTS * sizeof(DbTableStats))
+
+#define DB_STATS_COUNT(TB,P,FIELD,N)					\
+do {									\
+    if ((TB)->common.stats != NULL) {					\
+	(TB)->common.stats->sched[DB_STATS_SLOT(P)].c.FIELD += (N);	\
+    }									\
+} while (0)
+
+static DbTableStats* stats_create(DbTable* tb)
+{
+    DbTableStats* st = (DbTableStats*) erts_db_alloc(ERTS_ALC_T_DB_TABLE,
+						     tb, DB_STATS_SIZE);
+    ERTS_ETS_MISC_MEM_ADD(DB_STATS_SIZE);
+    sys_memzero(st, DB_STATS_SIZE);
+    return st;
+}
+
+static void stats_free(DbTable* tb)
+{
+    if (tb->common.stats != NULL) {
+	erts_db_free(ERTS_ALC_T_DB_TABLE, tb, (void *) tb->common.stats,
+		     DB_STATS_SIZE);
+	ERTS_ETS_MISC_MEM_ADD(-DB_STATS_SIZE);
+	tb->common.stats = NULL;
+    }
+}
+
+/* A scan of select, select_count or select_delete that started at
+** 'start' is done. 'calls' is 0 when resuming a trapped scan.
+*/
+static ERTS_INLINE void stats_select(DbTable* tb, Process* p, Uint64 start,
+				     int calls)
+{
+    if (tb->common.stats != NULL) {
+	DbTableStats* st = tb->common.stats;
+	int ix = DB_STATS_SLOT(p);
+	st->sched[ix].c.selects += calls;
+	st->sched[ix].c.select_time += db_stats_time() - start;
+    }
+}
+
+/*
+** Secondary indexes, created with {index,Pos}. Each index is an internal
+** bag hash table with a {Value,Key} tuple for each distinct Value found
+** at position Pos among the objects with Key. Tables with indexes are
+** never fine locked, so the table lock taken by the BIFs covers the
+** indexes as well. Writes bound to a key unlink the entries of the key
+** before the write and link them again after it. delete_all_objects
+** clears the indexes. select_delete (and match_delete, which is a
+** select_delete) removes objects without looking at the indexes, so
+** index_sweep() removes their entries when it is done. Until then, that
+** is while it traps, index_lookup/3 ignores the stale entries and
+** index_prune() removes them.
+*/
+#define DB_MAX_INDEXES 4
+
+typedef struct db_table_index {
+    int n;
+    Uint pos[DB_MAX_INDEXES];
+    DbTable* tab[DB_MAX_INDEXES];
+} DbTableIndex;
+
+static DbTableIndex* index_create(DbTable* tb, Uint* pos, int n)
+{
+    DbTableIndex* ix = (DbTableIndex*) erts_db_alloc(ERTS_ALC_T_DB_TABLE,
+						     tb,
+						     sizeof(DbTableIndex));
+    int i;
+
+    ERTS_ETS_MISC_MEM_ADD(sizeof(DbTableIndex));
+    ix->n = n;
+    for (i = 0; i < n; i++) {
+	DbTable init_tb;
+	DbTable* itb;
+
+	erts_smp_atomic_init(&init_tb.common.memory_size, 0);
+	itb = (DbTable*) erts_db_alloc(ERTS_ALC_T_DB_TABLE,
+				       &init_tb,
+				       sizeof(DbTable));
+	ERTS_ETS_MISC_MEM_ADD(sizeof(DbTable));
+	erts_smp_atomic_init(&itb->common.memory_size,
+			     erts_smp_atomic_read(&init_tb.common.memory_size));
+
+	itb->common.id = NIL;
+	itb->common.the_name = am_true;
+	itb->common.status = (DB_NORMAL | DB_BAG | DB_PUBLIC);
+#ifdef ERTS_SMP
+	itb->common.type = itb->common.status & ERTS_ETS_TABLE_TYPES;
+	/* Protected by the lock of the indexed table */
+	itb->common.is_thread_safe = 1;
+#endif
+	itb->common.keypos = 1;
+	itb->common.size_hint = 0;
+	itb->common.index = NULL;
+	itb->common.stats = NULL;
+	itb->common.owner = NIL;
+	erts_smp_atomic_init(&itb->common.nitems, 0);
+	itb->common.slot = -1;
+	itb->common.meth = &db_hash;
+	itb->common.fixations = NULL;
+	erts_refc_init(&itb->common.ref, 1);
+	erts_refc_init(&itb->common.fixref, 0);
+	db_create_hash(NULL, itb);
+
+	ix->pos[i] = pos[i];
+	ix->tab[i] = itb;
+    }
+    return ix;
+}
+
+static void index_free(DbTable* tb)
+{
+    DbTableIndex* ix = tb->common.index;
+    int i;
+
+    if (ix == NULL) {
+	return;
+    }
+    for (i = 0; i < ix->n; i++) {
+	DbTable* itb = ix->tab[i];
+	itb->common.meth->db_free_table(itb);
+	erts_db_free(ERTS_ALC_T_DB_TABLE, itb, (void *) itb, sizeof(DbTable));
+	ERTS_ETS_MISC_MEM_ADD(-sizeof(DbTable));
+    }
+    erts_db_free(ERTS_ALC_T_DB_TABLE, tb, (void *) ix, sizeof(DbTableIndex));
+    ERTS_ETS_MISC_MEM_ADD(-sizeof(DbTableIndex));
+    tb->common.index = NULL;
+}
+
+/* Index table on position pos (a term), or NULL if there is none */
+static DbTable* index_table(DbTable* tb, Eterm pos)
+{
+    DbTableIndex* ix = tb->common.index;
+    int i;
+
+    if (ix != NULL && is_small(pos)) {
+	for (i = 0; i < ix->n; i++) {
+	    if (make_small(ix->pos[i]) == pos) {
+		return ix->tab[i];
+	    }
+	}
+    }
+    return NULL;
+}
+
+static void index_unlink_object(DbTable* tb, Eterm obj, void* arg)
+{
+    DbTableIndex* ix = tb->common.index;
+    Eterm* tpl = tuple_val(obj);
+    Eterm key = tpl[tb->common.keypos];
+    int i;
+
+    for (i = 0; i < ix->n; i++) {
+	if (ix->pos[i] <= arityval(tpl[0])) {
+	    db_erase_bag_exact2(ix->tab[i], tpl[ix->pos[i]], key);
+	}
+    }
+}
+
+static void index_link_object(DbTable* tb, Eterm obj, void* arg)
+{
+    DbTableIndex* ix = tb->common.index;
+    Eterm* tpl = tuple_val(obj);
+    Eterm key = tpl[tb->common.keypos];
+    DeclareTmpHeapNoproc(entry,3);
+    int i;
+
+    UseTmpHeapNoproc(3);
+    for (i = 0; i < ix->n; i++) {
+	if (ix->pos[i] <= arityval(tpl[0])) {
+	    db_put_hash(ix->tab[i], TUPLE2(entry, tpl[ix->pos[i]], key), 0);
+	}
+    }
+    UnUseTmpHeapNoproc(3);
+}
+
+/* Called with the table write locked, before a write to key */
+static ERTS_INLINE void index_unlink_key(DbTable* tb, Eterm key)
+{
+    if (tb->common.index != NULL) {
+	tb->common.meth->db_foreach_key(tb, key, index_unlink_object, NULL);
+    }
+}
+
+/* Called with the table write locked, after a write to key */
+static ERTS_INLINE void index_link_key(DbTable* tb, Eterm key)
+{
+    if (tb->common.index != NULL) {
+	tb->common.meth->db_foreach_key(tb, key, index_link_object, NULL);
+    }
+}
+
+static void index_clear(Process* p, DbTable* tb)
+{
+    DbTableIndex* ix = tb->common.index;
+    int i;
+
+    if (ix != NULL) {
+	for (i = 0; i < ix->n; i++) {
+	    ix->tab[i]->common.meth->db_delete_all_objects(p, ix->tab[i]);
+	}
+    }
+}
+
+static Uint index_memory(DbTable* tb)
+{
+    DbTableIndex* ix = tb->common.index;
+    Uint sz = 0;
+    int i;
+
+    if (ix != NULL) {
+	for (i = 0; i < ix->n; i++) {
+	    sz += erts_smp_atomic_read(&ix->tab[i]->common.memory_size);
+	}
+    }
+    return sz;
+}
+
+static int put_object(DbTable* tb, Eterm obj, int key_clash_fail)
+{
+    Eterm key;
+    int cret;
+
+    if (tb->common.index == NULL) {
+	return tb->common.meth->db_put(tb, obj, key_clash_fail);
+    }
+    key = TERM_GETKEY(tb, obj);
+    index_unlink_key(tb, key);
+    cret = tb->common.meth->db_put(tb, obj, key_clash_fail);
+    index_link_key(tb, key);
+    return cret;
+}
+
+/*
+** Collecting the result of index_lookup/3
+*/
+typedef struct {
+    Eterm* v;
+    Uint n;
+    Uint cap;
+} DbIndexVec;
+
+typedef struct {
+    Uint pos;
+    Eterm value;
+    int collect;          /* collect the objects or just note one is found */
+    int found;
+    DbIndexVec objs;
+    Uint sz;
+} DbIndexLookup;
+
+static void index_vec_push(DbIndexVec* vec, Eterm term)
+{
+    if (vec->n == vec->cap) {
+	vec->cap = vec->cap ? 2*vec->cap : 16;
+	vec->v = (vec->v == NULL)
+	    ? erts_alloc(ERTS_ALC_T_DB_TMP, vec->cap * sizeof(Eterm))
+	    : erts_realloc(ERTS_ALC_T_DB_TMP, vec->v, vec->cap * sizeof(Eterm));
+    }
+    vec->v[vec->n++] = term;
+}
+
+static void index_collect_key(DbTable* itb, Eterm entry, void* arg)
+{
+    index_vec_push((DbIndexVec*) arg, tuple_val(entry)[2]);
+}
+
+static void index_collect_match(DbTable* tb, Eterm obj, void* arg)
+{
+    DbIndexLookup* il = (DbIndexLookup*) arg;
+    Eterm* tpl = tuple_val(obj);
+
+    if (il->pos <= arityval(tpl[0]) && EQ(tpl[il->pos], il->value)) {
+	il->found = 1;
+	if (il->collect) {
+	    index_vec_push(&il->objs, obj);
+	    il->sz += size_object(obj) + 2;
+	}
+    }
+}
+
+/*
+** Remove the entries for value that index_lookup found no object for.
+** Takes the table lock again, now for writing.
+*/
+static void index_prune(Process* p, Eterm tid, Eterm pos, Eterm value)
+{
+    DbTable* tb;
+    DbTable* itb;
+    DbIndexVec keys = {NULL, 0, 0};
+    DbIndexLookup il;
+    Uint i;
+
+    if ((tb = db_get_table(p, tid, DB_READ, LCK_WRITE)) == NULL) {
+	return;
+    }
+    if ((itb = index_table(tb, pos)) != NULL) {
+	itb->common.meth->db_foreach_key(itb, value, index_collect_key, &keys);
+	il.pos = unsigned_val(pos);
+	il.value = value;
+	il.collect = 0;
+	for (i = 0; i < keys.n; i++) {
+	    il.found = 0;
+	    tb->common.meth->db_foreach_key(tb, keys.v[i],
+					    index_collect_match, &il);
+	    if (!il.found) {
+		db_erase_bag_exact2(itb, value, keys.v[i]);
+	    }
+	}
+    }
+    db_unlock(tb, LCK_WRITE);
+    if (keys.v != NULL) {
+	erts_free(ERTS_ALC_T_DB_TMP, keys.v);
+    }
+}
+typedef struct {
+    DbTable* tb;
+    Uint pos;
+    DbIndexVec dead;
+} DbIndexSweep;
+
+static void index_sweep_entry(DbTable* itb, DbTerm* entry, void* arg)
+{
+    DbIndexSweep* sw = (DbIndexSweep*) arg;
+    DbIndexLookup il;
+
+    il.pos = sw->pos;
+    il.value = entry->tpl[1];
+    il.collect = 0;
+    il.found = 0;
+    sw->tb->common.meth->db_foreach_key(sw->tb, entry->tpl[2],
+					index_collect_match, &il);
+    if (!il.found) {
+	index_vec_push(&sw->dead, make_tuple(entry->tpl));
+    }
+}
+
+/*
+** Remove the entries whose object is gone, once select_delete is done.
+** Called with the table write locked. Returns the number of entries
+** looked at.
+*/
+static Uint index_sweep(Process* p, DbTable* tb)
+{
+    DbTableIndex* ix = tb->common.index;
+    DbIndexSweep sw;
+    Uint walked = 0;
+    Uint i;
+    int j;
+
+    if (ix == NULL) {
+	return 0;
+    }
+    sw.tb = tb;
+    sw.dead.v = NULL;
+    sw.dead.cap = 0;
+    for (j = 0; j < ix->n; j++) {
+	DbTable* itb = ix->tab[j];
+	Eterm cursor = NIL;
+
+	walked += erts_smp_atomic_read(&itb->common.nitems);
+	sw.pos = ix->pos[j];
+	sw.dead.n = 0;
+	while (cursor != am_EOT) {
+	    itb->common.meth->db_foreach_dbterm(p, itb, &cursor, MAX_SMALL,
+						index_sweep_entry, &sw);
+	}
+	for (i = 0; i < sw.dead.n; i++) {
+	    Eterm* tpl = tuple_val(sw.dead.v[i]);
+	    db_erase_bag_exact2(itb, tpl[1], tpl[2]);
+	}
+    }
+    if (sw.dead.v != NULL) {
+	erts_free(ERTS_ALC_T_DB_TMP, sw.dead.v);
+    }
+    return walked;
+}
+
 static int insert_named_tab(Eterm name_atom, DbTable* tb)
 {
     int ret = 0;
@@ -721,6 +1131,7 @@ BIF_RETTYPE ets_update_element_3(BIF_ALIST_3)
 	list = BIF_ARG_3;
     }
 
+    index_unlink_key(tb, BIF_ARG_2);
     if (!tb->common.meth->db_lookup_dbterm(tb, BIF_ARG_2, &handle)) {
 	cret = DB_ERROR_BADKEY;
 	goto bail_out;
@@ -756,11 +1167,13 @@ BIF_RETTYPE ets_update_element_3(BIF_ALIST_3)
 
     for (iter=list ; is_not_nil(iter); iter = CDR(list_val(iter))) {
 	Eterm* pvp = tuple_val(CAR(list_val(iter)));    /* {Pos,Value} */
-	db_do_update_element(&handle, signed_val(pvp[1]), pvp[2]);
+	db_do_update_element(&handle, signed_val(pvp[1]),
+			     db_encode_element(&tb->common, BIF_P, pvp[2]));
     }
 
 finalize:
     tb->common.meth->db_finalize_dbterm(&handle);
+    index_link_key(tb, BIF_ARG_2);
 
 bail_out:
     UnUseTmpHeap(2,BIF_P);
@@ -825,6 +1238,7 @@ BIF_RETTYPE ets_update_counter_3(BIF_ALIST_3)
 	ret_list_prevp = &ret;
     }
 
+    index_unlink_key(tb, BIF_ARG_2);
     if (!tb->common.meth->db_lookup_dbterm(tb, BIF_ARG_2, &handle)) {
 	goto bail_out; /* key not found */
     }
@@ -954,6 +1368,7 @@ BIF_RETTYPE ets_update_counter_3(BIF_ALIST_3)
 
 finalize:
     tb->common.meth->db_finalize_dbterm(&handle);
+    index_link_key(tb, BIF_ARG_2);
 
 bail_out:
     UnUseTmpHeap(5,BIF_P);
@@ -978,14 +1393,19 @@ BIF_RETTYPE ets_insert_2(BIF_ALIST_2)
     DbTable* tb;
     int cret = DB_ERROR_NONE;
     Eterm lst;
-    DbTableMethod* meth;
     db_lock_kind_t kind;
+    int many;
+    Uint n;
 
     CHECK_TABLES();
 
-    /* Write lock table if more than one object to keep atomicy */
-    kind = ((is_list(BIF_ARG_2) && CDR(list_val(BIF_ARG_2)) != NIL)
-	    ? LCK_WRITE : LCK_WRITE_REC);
+    /* Write lock table if more than one object to keep atomicy,
+    ** except for fine locked tables that lock the stripes or bases
+    ** the objects go to instead, see db_put_many_hash() and
+    ** db_put_many_tree().
+    */
+    many = (is_list(BIF_ARG_2) && CDR(list_val(BIF_ARG_2)) != NIL);
+    kind = LCK_WRITE_REC;
 
     if ((tb = db_get_table(BIF_P, BIF_ARG_1, DB_WRITE, kind)) == NULL) {
 	BIF_ERROR(BIF_P, BADARG);
@@ -994,29 +1414,45 @@ BIF_RETTYPE ets_insert_2(BIF_ALIST_2)
 	db_unlock(tb, kind);
 	BIF_RET(am_true);
     }
-    meth = tb->common.meth;
     if (is_list(BIF_ARG_2)) {
+	n = 0;
 	for (lst = BIF_ARG_2; is_list(lst); lst = CDR(list_val(lst))) {
 	    if (is_not_tuple(CAR(list_val(lst))) || 
 		(arityval(*tuple_val(CAR(list_val(lst)))) < tb->common.keypos)) {
 		goto badarg;
 	    }
+	    ++n;
 	}
 	if (lst != NIL) {
 	    goto badarg;
 	}
-	for (lst = BIF_ARG_2; is_list(lst); lst = CDR(list_val(lst))) {
-	    cret = meth->db_put(tb, CAR(list_val(lst)), 0);
-	    if (cret != DB_ERROR_NONE)
-		break;
+	if (many && (tb->common.status & DB_FINE_LOCKED)) {
+	    Eterm* objs = erts_alloc(ERTS_ALC_T_DB_TMP, n * sizeof(Eterm));
+	    n = 0;
+	    for (lst = BIF_ARG_2; is_list(lst); lst = CDR(list_val(lst))) {
+		objs[n++] = CAR(list_val(lst));
+	    }
+	    cret = (IS_HASH_TABLE(tb->common.status)
+		    ? db_put_many_hash(tb, objs, n)
+		    : db_put_many_tree(tb, objs, n));
+	    erts_free(ERTS_ALC_T_DB_TMP, objs);
+	}
+	else {
+	    for (lst = BIF_ARG_2; is_list(lst); lst = CDR(list_val(lst))) {
+		cret = put_object(tb, CAR(list_val(lst)), 0);
+		if (cret != DB_ERROR_NONE)
+		    break;
+	    }
 	}
     } else {
 	if (is_not_tuple(BIF_ARG_2) || 
 	    (arityval(*tuple_val(BIF_ARG_2)) < tb->common.keypos)) {
 	    goto badarg;
 	}
-	cret = meth->db_put(tb, BIF_ARG_2, 0);
+	cret = put_object(tb, BIF_ARG_2, 0);
+	n = 1;
     }
+    DB_STATS_COUNT(tb, BIF_P, inserts, n);
 
     db_unlock(tb, kind);
     
@@ -1080,9 +1516,10 @@ BIF_RETTYPE ets_insert_new_2(BIF_ALIST_2)
 	    }
     
 	    for (lst = BIF_ARG_2; is_list(lst); lst = CDR(list_val(lst))) {
-		cret = meth->db_put(tb,CAR(list_val(lst)), 0);
+		cret = put_object(tb, CAR(list_val(lst)), 0);
 		if (cret != DB_ERROR_NONE)
 		    break;
+		DB_STATS_COUNT(tb, BIF_P, inserts, 1);
 	    }
 	    goto done;
 	}
@@ -1105,8 +1542,8 @@ BIF_RETTYPE ets_insert_new_2(BIF_ALIST_2)
 	|| (arityval(*tuple_val(obj)) < tb->common.keypos)) {
 	goto badarg;
     }
-    cret = tb->common.meth->db_put(tb, obj,
-				   1); /* key_clash_fail */
+    cret = put_object(tb, obj, 1); /* key_clash_fail */
+    DB_STATS_COUNT(tb, BIF_P, inserts, 1);
 
 done:
     db_unlock(tb, kind);
@@ -1189,7 +1626,16 @@ BIF_RETTYPE ets_new_2(BIF_ALIST_2)
     UWord heir_data;
     Uint32 status;
     Sint keypos;
+    Uint size_hint;
     int is_named, is_fine_locked;
+#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+    int is_lockfree_read;
+#endif
+#ifdef ERTS_SMP
+    int is_parallel_scan;
+#endif
+    Uint index_pos[DB_MAX_INDEXES];
+    int nindex, i;
     int cret;
     DeclareTmpHeap(meta_tuple,3,BIF_P);
     DbTableMethod* meth;
@@ -1203,8 +1649,16 @@ BIF_RETTYPE ets_new_2(BIF_ALIST_2)
 
     status = DB_NORMAL | DB_SET | DB_PROTECTED;
     keypos = 1;
+    size_hint = 0;
     is_named = 0;
     is_fine_locked = 0;
+#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+    is_lockfree_read = 0;
+#endif
+#ifdef ERTS_SMP
+    is_parallel_scan = 0;
+#endif
+    nindex = 0;
     heir = am_none;
     heir_data = (UWord) am_undefined;
 
@@ -1231,6 +1685,10 @@ BIF_RETTYPE ets_new_2(BIF_ALIST_2)
 		    && is_small(tp[2]) && (signed_val(tp[2]) > 0)) {
 		    keypos = signed_val(tp[2]);
 		}		
+		else if (tp[1] == am_size_hint
+			 && is_small(tp[2]) && (signed_val(tp[2]) >= 0)) {
+		    size_hint = signed_val(tp[2]);
+		}
 		else if (tp[1] == am_write_concurrency) {
 		    if (tp[2] == am_true) {
 			is_fine_locked = 1;
@@ -1238,6 +1696,48 @@ BIF_RETTYPE ets_new_2(BIF_ALIST_2)
 			is_fine_locked = 0;
 		    } else break;
 		}
+		else if (tp[1] == am_read_concurrency) {
+		    /*
+		     * {read_concurrency, lockfree} is accepted but silently
+		     * ignored where lock free reads are not supported, i.e.
+		     * without SMP or with emulated atomics.
+		     */
+		    if (tp[2] == am_lockfree) {
+#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+			is_lockfree_read = 1;
+#endif
+		    } else if (tp[2] == am_true || tp[2] == am_false) {
+#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+			is_lockfree_read = 0;
+#endif
+		    } else break;
+		}
+		else if (tp[1] == am_index
+			 && is_small(tp[2]) && (signed_val(tp[2]) > 0)) {
+		    for (i = 0; i < nindex; i++) {
+			if (index_pos[i] == signed_val(tp[2]))
+			    break;
+		    }
+		    if (i == nindex) {
+			if (nindex == DB_MAX_INDEXES)
+			    break;
+			index_pos[nindex++] = signed_val(tp[2]);
+		    }
+		}
+		else if (tp[1] == am_parallel_scan) {
+		    if (tp[2] == am_true) {
+#ifdef ERTS_SMP
+			is_parallel_scan = 1;
+#endif
+		    } else if (tp[2] == am_false) {
+#ifdef ERTS_SMP
+			is_parallel_scan = 0;
+#endif
+		    } else break;
+		}
+		else if (tp[1] == am_compressed && tp[2] == am_zlib) {
+		    status |= DB_COMPRESSED | DB_COMPRESSED_ZLIB;
+		}
 		else if (tp[1] == am_heir && tp[2] == am_none) {
 		    heir = am_none;
 		    heir_data = am_undefined;
@@ -1262,168 +1762,1056 @@ BIF_RETTYPE ets_new_2(BIF_ALIST_2)
 	else if (val == am_named_table) {
 	    is_named = 1;
 	}
-	else if (val == am_set || val == am_protected)
-	    ;
-	else break;
+	else if (val == am_compressed) {
+	    status |= DB_COMPRESSED;
+	}
+	else if (val == am_set || val == am_protected)
+	    ;
+	else break;
+
+	list = CDR(list_val(list));
+    }
+    if (is_not_nil(list)) { /* bad opt or not a well formed list */
+	BIF_ERROR(BIF_P, BADARG);
+    }
+    for (i = 0; i < nindex; i++) {
+	if (index_pos[i] == keypos) { /* the key needs no index */
+	    BIF_ERROR(BIF_P, BADARG);
+	}
+    }
+    if (nindex > 0 && (status & DB_COMPRESSED)) {
+	/* The indexes hold the values as stored */
+	BIF_ERROR(BIF_P, BADARG);
+    }
+    if (IS_HASH_TABLE(status)) {
+	meth = &db_hash;
+	#ifdef ERTS_SMP
+	if (is_fine_locked && !(status & DB_PRIVATE)) {
+	    status |= DB_FINE_LOCKED;
+	}
+	#endif
+	#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+	/* Lock free reads need the bucket locks for the writers */
+	if (is_lockfree_read && (status & DB_SET) && !(status & DB_PRIVATE)) {
+	    status |= DB_FINE_LOCKED | DB_LOCKFREE_READ;
+	}
+	#endif
+	#ifdef ERTS_SMP
+	/* The scan helpers match on the objects as stored */
+	if (is_parallel_scan && !(status & DB_COMPRESSED)) {
+	    status |= DB_PARALLEL_SCAN;
+	}
+	#endif
+    }
+    else if (IS_TREE_TABLE(status)) {
+	meth = &db_tree;
+	#ifdef ERTS_SMP
+	/* Partitioned into separately locked subtrees, see erl_db_tree.h */
+	if (is_fine_locked && !(status & DB_PRIVATE)) {
+	    status |= DB_FINE_LOCKED;
+	}
+	#endif
+    }
+    else {
+	BIF_ERROR(BIF_P, BADARG);
+    }
+    if (nindex > 0) {
+	/* The indexes are protected by the table lock */
+	status &= ~(DB_FINE_LOCKED | DB_LOCKFREE_READ);
+    }
+
+    /* we create table outside any table lock
+     * and take the unusal cost of destroy table if it
+     * fails to find a slot 
+     */
+    {
+        DbTable init_tb;
+
+	erts_smp_atomic_init(&init_tb.common.memory_size, 0);
+	tb = (DbTable*) erts_db_alloc(ERTS_ALC_T_DB_TABLE,
+				      &init_tb, sizeof(DbTable));
+	ERTS_ETS_MISC_MEM_ADD(sizeof(DbTable));
+	erts_smp_atomic_init(&tb->common.memory_size,
+			     erts_smp_atomic_read(&init_tb.common.memory_size));
+    }
+
+    tb->common.meth = meth;
+    tb->common.the_name = BIF_ARG_1;
+    tb->common.status = status;    
+#ifdef ERTS_SMP
+    tb->common.type = status & ERTS_ETS_TABLE_TYPES;
+    /* Note, 'type' is *read only* from now on... */
+#endif
+    db_init_lock(tb, "db_tab", "db_tab_fix");
+    tb->common.keypos = keypos;
+    tb->common.size_hint = size_hint;
+    tb->common.owner = BIF_P->id;
+    set_heir(BIF_P, tb, heir, heir_data);
+
+    erts_smp_atomic_init(&tb->common.nitems, 0);
+
+    tb->common.fixations = NULL;
+
+    cret = meth->db_create(BIF_P, tb);
+    ASSERT(cret == DB_ERROR_NONE);
+    tb->common.index = (nindex > 0) ? index_create(tb, index_pos, nindex) : NULL;
+    tb->common.stats = stats_create(tb);
+
+    erts_smp_spin_lock(&meta_main_tab_main_lock);
+
+    if (meta_main_tab_cnt >= db_max_tabs) {
+	erts_smp_spin_unlock(&meta_main_tab_main_lock);
+	erts_send_error_to_logger_str(BIF_P->group_leader,
+				      "** Too many db tables **\n");
+	free_heir_data(tb);
+	index_free(tb);
+	stats_free(tb);
+	tb->common.meth->db_free_table(tb);
+	erts_db_free(ERTS_ALC_T_DB_TABLE, tb, (void *) tb, sizeof(DbTable));
+	ERTS_ETS_MISC_MEM_ADD(-sizeof(DbTable));
+	BIF_ERROR(BIF_P, SYSTEM_LIMIT);
+    }
+
+    slot = meta_main_tab_first_free;
+    ASSERT(slot>=0 && slot<db_max_tabs);
+    meta_main_tab_first_free = GET_NEXT_FREE_SLOT(slot);
+    meta_main_tab_cnt++;
+
+    if (is_named) {
+	ret = BIF_ARG_1;
+    }
+    else {
+	ret = make_small(slot | meta_main_tab_seq_cnt);
+	meta_main_tab_seq_cnt += meta_main_tab_seq_incr;
+	ASSERT((unsigned_val(ret) & meta_main_tab_slot_mask) == slot);
+    }
+    erts_smp_spin_unlock(&meta_main_tab_main_lock);
+
+    tb->common.id = ret;
+    tb->common.slot = slot;           /* store slot for erase */
+
+    meta_main_tab_lock(slot);
+    meta_main_tab[slot].u.tb = tb;
+    ASSERT(IS_SLOT_ALIVE(slot));
+    meta_main_tab_unlock(slot);
+
+    if (is_named && !insert_named_tab(BIF_ARG_1, tb)) {
+	meta_main_tab_lock(slot);
+	free_slot(slot);
+	meta_main_tab_unlock(slot);
+
+	db_lock_take_over_ref(tb,LCK_WRITE);
+	free_heir_data(tb);
+	index_free(tb);
+	tb->common.meth->db_free_table(tb);
+	db_unlock(tb,LCK_WRITE);
+	BIF_ERROR(BIF_P, BADARG);
+    }
+    
+    BIF_P->flags |= F_USING_DB; /* So we can remove tb if p dies */
+
+#ifdef HARDDEBUG
+    erts_fprintf(stderr,
+		"ets:new(%T,%T)=%T; Process: %T, initial: %T:%T/%bpu\n",
+		 BIF_ARG_1, BIF_ARG_2, ret, BIF_P->id,
+		 BIF_P->initial[0], BIF_P->initial[1], BIF_P->initial[2]);
+	erts_fprintf(stderr, "ets: new: meta_pid_to_tab common.memory_size = %ld\n",
+		     erts_smp_atomic_read(&meta_pid_to_tab->common.memory_size));
+	erts_fprintf(stderr, "ets: new: meta_pid_to_fixed_tab common.memory_size = %ld\n",
+		     erts_smp_atomic_read(&meta_pid_to_fixed_tab->common.memory_size));
+#endif
+
+    UseTmpHeap(3,BIF_P);
+
+    db_meta_lock(meta_pid_to_tab, LCK_WRITE_REC);
+    if (db_put_hash(meta_pid_to_tab,
+		    TUPLE2(meta_tuple, BIF_P->id, make_small(slot)),
+		    0) != DB_ERROR_NONE) {
+	erl_exit(1,"Could not update ets metadata.");
+    }
+    db_meta_unlock(meta_pid_to_tab, LCK_WRITE_REC);
+
+    UnUseTmpHeap(3,BIF_P);
+
+    BIF_RET(ret);
+}
+
+/* 
+** The lookup BIF 
+*/
+BIF_RETTYPE ets_lookup_2(BIF_ALIST_2)
+{
+    DbTable* tb;
+    int cret;
+    Eterm ret;
+
+    CHECK_TABLES();
+
+    if ((tb = db_get_table(BIF_P, BIF_ARG_1, DB_READ, LCK_READ)) == NULL) {
+	BIF_ERROR(BIF_P, BADARG);
+    }
+
+    cret = tb->common.meth->db_get(BIF_P, tb, BIF_ARG_2, &ret);
+    DB_STATS_COUNT(tb, BIF_P, lookups, 1);
+
+    db_unlock(tb, LCK_READ);
+
+    switch (cret) {
+    case DB_ERROR_NONE:
+	BIF_RET(ret);
+    case DB_ERROR_SYSRES:
+	BIF_ERROR(BIF_P, SYSTEM_LIMIT);
+    default:
+	BIF_ERROR(BIF_P, BADARG);
+    }
+
+}
+
+/*
+** Look up a list of keys, the result is all objects found for them
+*/
+
+/* Keys looked up per call before trapping */
+#define DB_LOOKUP_MANY_CHUNK 256
+
+/*
+** Look up the next chunk of keys. The results of the chunks done so
+** far are kept in acc, the latest first, and are concatenated in key
+** order after the last chunk.
+*/
+static BIF_RETTYPE lookup_many(Process *p, Eterm tab, Eterm keys, Eterm acc)
+{
+    DbTable* tb;
+    int cret;
+    Eterm ret;
+    Eterm res;
+    Eterm lst;
+    Eterm* hp;
+    Eterm keyv[DB_LOOKUP_MANY_CHUNK];
+    Uint n;
+
+    CHECK_TABLES();
+
+    if ((tb = db_get_table(p, tab, DB_READ, LCK_READ)) == NULL) {
+	BIF_ERROR(p, BADARG);
+    }
+    n = 0;
+    for (lst = keys; is_list(lst) && n < DB_LOOKUP_MANY_CHUNK;
+	 lst = CDR(list_val(lst))) {
+	keyv[n++] = CAR(list_val(lst));
+    }
+    cret = tb->common.meth->db_get_many(p, tb, keyv, n, &ret);
+    DB_STATS_COUNT(tb, p, lookups, n);
+
+    db_unlock(tb, LCK_READ);
+    BUMP_REDS(p, n / 4);
+
+    switch (cret) {
+    case DB_ERROR_NONE:
+	break;
+    case DB_ERROR_SYSRES:
+	BIF_ERROR(p, SYSTEM_LIMIT);
+    default:
+	BIF_ERROR(p, BADARG);
+    }
+
+    if (is_list(lst)) {
+	hp = HAlloc(p, 2);
+	acc = CONS(hp, ret, acc);
+	BIF_TRAP3(&ets_lookup_many_continue_exp, p, tab, lst, acc);
+    }
+
+    n = 0;
+    for (lst = acc; is_list(lst); lst = CDR(list_val(lst))) {
+	Eterm c;
+	for (c = CAR(list_val(lst)); is_list(c); c = CDR(list_val(c))) {
+	    n += 2;
+	}
+    }
+    if (n == 0) {
+	BIF_RET(ret);
+    }
+    hp = HAlloc(p, n);
+    res = ret;
+    for (lst = acc; is_list(lst); lst = CDR(list_val(lst))) {
+	Eterm first = NIL;
+	Eterm* tailp = &first;
+	Eterm c;
+	for (c = CAR(list_val(lst)); is_list(c); c = CDR(list_val(c))) {
+	    *tailp = make_list(hp);
+	    hp[0] = CAR(list_val(c));
+	    tailp = &hp[1];
+	    hp += 2;
+	}
+	*tailp = res;
+	res = first;
+    }
+    BUMP_REDS(p, n / 16);
+    BIF_RET(res);
+}
+
+static BIF_RETTYPE ets_lookup_many_trap(Process *p, Eterm tab, Eterm keys,
+					Eterm acc)
+{
+    return lookup_many(p, tab, keys, acc);
+}
+
+BIF_RETTYPE ets_lookup_many_2(BIF_ALIST_2)
+{
+    Eterm lst;
+
+    for (lst = BIF_ARG_2; is_list(lst); lst = CDR(list_val(lst))) {
+	;
+    }
+    if (lst != NIL) {
+	BIF_ERROR(BIF_P, BADARG);
+    }
+    if (BIF_ARG_2 == NIL) {
+	DbTable* tb;
+	if ((tb = db_get_table(BIF_P, BIF_ARG_1, DB_READ, LCK_READ)) == NULL) {
+	    BIF_ERROR(BIF_P, BADARG);
+	}
+	db_unlock(tb, LCK_READ);
+	BIF_RET(NIL);
+    }
+    return lookup_many(BIF_P, BIF_ARG_1, BIF_ARG_2, NIL);
+}
+
+/*
+** Look up the objects that have a value at an indexed position
+*/
+BIF_RETTYPE ets_index_lookup_3(BIF_ALIST_3)
+{
+    DbTable* tb;
+    DbTable* itb;
+    DbIndexVec keys = {NULL, 0, 0};
+    DbIndexLookup il;
+    Eterm ret = NIL;
+    Eterm* hp;
+    int stale = 0;
+    Uint i;
+
+    CHECK_TABLES();
+
+    if ((tb = db_get_table(BIF_P, BIF_ARG_1, DB_READ, LCK_READ)) == NULL) {
+	BIF_ERROR(BIF_P, BADARG);
+    }
+    if ((itb = index_table(tb, BIF_ARG_2)) == NULL) {
+	db_unlock(tb, LCK_READ);
+	BIF_ERROR(BIF_P, BADARG);
+    }
+
+    itb->common.meth->db_foreach_key(itb, BIF_ARG_3, index_collect_key, &keys);
+    il.pos = unsigned_val(BIF_ARG_2);
+    il.value = BIF_ARG_3;
+    il.collect = 1;
+    il.objs.v = NULL;
+    il.objs.n = 0;
+    il.objs.cap = 0;
+    il.sz = 0;
+    for (i = 0; i < keys.n; i++) {
+	il.found = 0;
+	tb->common.meth->db_foreach_key(tb, keys.v[i],
+					index_collect_match, &il);
+	if (!il.found) {
+	    stale = 1; /* select_delete is not done yet */
+	}
+    }
+
+    hp = HAlloc(BIF_P, il.sz);
+    for (i = il.objs.n; i-- > 0; ) {
+	Eterm obj = il.objs.v[i];
+	Uint sz = size_object(obj);
+	Eterm copy = copy_struct(obj, sz, &hp, &MSO(BIF_P));
+	ret = CONS(hp, copy, ret);
+	hp += 2;
+    }
+    db_unlock(tb, LCK_READ);
+
+    if (keys.v != NULL) {
+	erts_free(ERTS_ALC_T_DB_TMP, keys.v);
+    }
+    if (il.objs.v != NULL) {
+	erts_free(ERTS_ALC_T_DB_TMP, il.objs.v);
+    }
+    if (stale) {
+	index_prune(BIF_P, BIF_ARG_1, BIF_ARG_2, BIF_ARG_3);
+    }
+    BUMP_REDS(BIF_P, keys.n / 4);
+    BIF_RET(ret);
+}
+
+/*
+** Snapshots of a table, written by ets:snapshot/2 and read back by
+** ets:restore/2. A snapshot file is
+**
+**    bytes 0-3:    DB_SNAPSHOT_MAGIC
+**    bytes 4-7:    DB_SNAPSHOT_VERSION
+**    bytes 8-15:   number of objects N
+**    bytes 16-23:  offset of the index
+**    bytes 24-:    the objects, each in the external term format
+**    index:        N+1 offsets, object i is from offset i to offset i+1
+**
+** with all integers big endian.
+*/
+#define DB_SNAPSHOT_MAGIC   "ETSS"
+#define DB_SNAPSHOT_VERSION 1
+#define DB_SNAPSHOT_HDR     24
+#define DB_SNAPSHOT_BUF     (64*1024)
+#define DB_SNAPSHOT_OBJS    1000   /* objects encoded between traps */
+#define DB_SNAPSHOT_SLICE   4      /* buffers written between traps */
+#define DB_RESTORE_CHUNK    256    /* objects claimed at a time */
+#define DB_RESTORE_SLICE    16     /* chunks inserted between traps */
+
+typedef struct DbSnapshotBuf_ {
+    struct DbSnapshotBuf_* next;
+    Uint size;
+    Uint used;
+    byte data[1];
+} DbSnapshotBuf;
+
+/*
+** The state of a snapshot in progress, kept in a magic binary between
+** traps. It is freed by another scheduler than the one it was allocated
+** on if the process migrates, so nothing in it is ERTS_ALC_T_TMP.
+*/
+typedef struct {
+    int fd;
+    int error;            /* errno of the first failed write */
+    Uint64 pos;           /* file offset of last->data[0] */
+    DbSnapshotBuf* first; /* buffers not yet written */
+    DbSnapshotBuf* last;
+    Uint64* offs;         /* NULL once the index is added */
+    Uint noffs;
+    Uint offs_cap;
+    Eterm* heap;          /* objects of compressed tables are decoded here */
+    Uint heap_sz;
+} DbSnapshot;
+
+static char* snapshot_file_name(Eterm name)
+{
+    Sint len = list_length(name);
+    char* buf;
+
+    if (len <= 0) {
+	return NULL;
+    }
+    buf = erts_alloc(ERTS_ALC_T_TMP, len + 1);
+    if (intlist_to_buf(name, buf, len) != len) {
+	erts_free(ERTS_ALC_T_TMP, buf);
+	return NULL;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+static Eterm snapshot_error(Process* p, Eterm reason)
+{
+    Eterm* hp = HAlloc(p, 3);
+    return TUPLE2(hp, am_error, reason);
+}
+
+static Eterm snapshot_posix_error(Process* p, int error)
+{
+    char* id = erl_errno_id(error);
+    return snapshot_error(p, am_atom_put(id, sys_strlen(id)));
+}
+
+static void snapshot_write(DbSnapshot* sn, byte* data, Uint len)
+{
+    while (len > 0 && !sn->error) {
+	ssize_t n = write(sn->fd, data, len);
+	if (n < 0) {
+	    if (errno != EINTR) {
+		sn->error = errno;
+	    }
+	    continue;
+	}
+	data += n;
+	len -= n;
+    }
+}
+
+/* Make room for sz more bytes in the last buffer */
+static void snapshot_reserve(DbSnapshot* sn, Uint sz)
+{
+    DbSnapshotBuf* b = sn->last;
+
+    if (b == NULL || b->used + sz > b->size) {
+	Uint size = (sz > DB_SNAPSHOT_BUF) ? sz : DB_SNAPSHOT_BUF;
+	DbSnapshotBuf* nb = erts_alloc(ERTS_ALC_T_DB_SEL_LIST,
+				       sizeof(DbSnapshotBuf) - 1 + size);
+	nb->next = NULL;
+	nb->size = size;
+	nb->used = 0;
+	if (b == NULL) {
+	    sn->first = nb;
+	} else {
+	    b->next = nb;
+	    sn->pos += b->used;
+	}
+	sn->last = nb;
+    }
+}
+
+static void snapshot_put_int64(DbSnapshot* sn, Uint64 i)
+{
+    snapshot_reserve(sn, 8);
+    put_int64(i, sn->last->data + sn->last->used);
+    sn->last->used += 8;
+}
+
+/* Write at most max of the buffers before the last one, or all of
+   them if all is set. Returns true if there are none left to write. */
+static int snapshot_flush(DbSnapshot* sn, int max, int all)
+{
+    while (sn->first != NULL && (all || sn->first != sn->last)) {
+	DbSnapshotBuf* b = sn->first;
+	if (max-- == 0) {
+	    return 0;
+	}
+	snapshot_write(sn, b->data, b->used);
+	sn->first = b->next;
+	if (b == sn->last) {
+	    sn->last = NULL;
+	    sn->pos += b->used;
+	}
+	erts_free(ERTS_ALC_T_DB_SEL_LIST, b);
+    }
+    return 1;
+}
+
+static void snapshot_object(DbTable* tb, DbTerm* obj, void* arg)
+{
+    DbSnapshot* sn = (DbSnapshot *) arg;
+    DbSnapshotBuf* b;
+    ErlOffHeap off_heap;
+    Eterm term;
+    byte* ep;
+
+    if (IS_COMPRESSED(tb)) {
+	Uint sz = db_size_dbterm(&tb->common, obj);
+	Eterm* hp;
+
+	if (sz > sn->heap_sz) {
+	    if (sn->heap != NULL) {
+		erts_free(ERTS_ALC_T_DB_SEL_LIST, sn->heap);
+	    }
+	    sn->heap = erts_alloc(ERTS_ALC_T_DB_SEL_LIST, sz*sizeof(Eterm));
+	    sn->heap_sz = sz;
+	}
+	off_heap.mso = NULL;
+	off_heap.externals = NULL;
+#ifndef HYBRID /* FIND ME! */
+	off_heap.funs = NULL;
+#endif
+	off_heap.overhead = 0;
+	hp = sn->heap;
+	term = db_copy_dbterm(&tb->common, obj, &hp, &off_heap);
+    }
+    else {
+	term = make_tuple(obj->tpl);
+    }
+
+    snapshot_reserve(sn, erts_encode_ext_size(term));
+    b = sn->last;
+    ep = b->data + b->used;
+    erts_encode_ext(term, &ep);
+    if (sn->noffs == sn->offs_cap) {
+	sn->offs_cap *= 2;
+	sn->offs = erts_realloc(ERTS_ALC_T_DB_SEL_LIST, sn->offs,
+				sn->offs_cap * sizeof(Uint64));
+    }
+    sn->offs[sn->noffs++] = sn->pos + b->used;
+    b->used = ep - b->data;
+
+    if (IS_COMPRESSED(tb)) {
+	erts_cleanup_offheap(&off_heap);
+    }
+}
+
+static void snapshot_state_destructor(Binary* mb)
+{
+    DbSnapshot* sn = (DbSnapshot *) ERTS_MAGIC_BIN_DATA(mb);
+
+    while (sn->first != NULL) {
+	DbSnapshotBuf* b = sn->first;
+	sn->first = b->next;
+	erts_free(ERTS_ALC_T_DB_SEL_LIST, b);
+    }
+    if (sn->offs != NULL) {
+	erts_free(ERTS_ALC_T_DB_SEL_LIST, sn->offs);
+    }
+    if (sn->heap != NULL) {
+	erts_free(ERTS_ALC_T_DB_SEL_LIST, sn->heap);
+    }
+    if (sn->fd >= 0) {
+	close(sn->fd);
+    }
+}
+
+/*
+** Write what the objects encoded so far have filled and trap to encode
+** more, until the cursor is at the end. Then add the index and write
+** the rest, DB_SNAPSHOT_SLICE buffers between traps, and at last the
+** header.
+*/
+static BIF_RETTYPE snapshot_write_out(Process* p, Eterm tab, Eterm state,
+				      Eterm cursor)
+{
+    Binary* mb = ((ProcBin *) binary_val(state))->val;
+    DbSnapshot* sn = (DbSnapshot *) ERTS_MAGIC_BIN_DATA(mb);
+    byte hdr[DB_SNAPSHOT_HDR];
+    Uint64 index;
+    Uint i;
+
+    ASSERT(ERTS_MAGIC_BIN_DESTRUCTOR(mb) == snapshot_state_destructor);
+
+    BUMP_ALL_REDS(p);
+    if (cursor != am_EOT) {
+	snapshot_flush(sn, -1, 0);
+	BIF_TRAP3(&ets_snapshot_continue_exp, p, tab, state, cursor);
+    }
+    if (sn->offs != NULL) {
+	index = sn->pos + sn->last->used;
+	for (i = 0; i < sn->noffs; i++) {
+	    snapshot_put_int64(sn, sn->offs[i]);
+	}
+	snapshot_put_int64(sn, index);
+	erts_free(ERTS_ALC_T_DB_SEL_LIST, sn->offs);
+	sn->offs = NULL;
+    }
+    if (!snapshot_flush(sn, DB_SNAPSHOT_SLICE, 1)) {
+	BIF_TRAP3(&ets_snapshot_continue_exp, p, tab, state, am_EOT);
+    }
 
-	list = CDR(list_val(list));
+    /* The index is last in the file */
+    index = sn->pos - 8*((Uint64) sn->noffs + 1);
+    sys_memcpy(hdr, DB_SNAPSHOT_MAGIC, 4);
+    put_int32(DB_SNAPSHOT_VERSION, hdr + 4);
+    put_int64((Uint64) sn->noffs, hdr + 8);
+    put_int64(index, hdr + 16);
+    if (!sn->error && lseek(sn->fd, 0, SEEK_SET) < 0) {
+	sn->error = errno;
     }
-    if (is_not_nil(list)) { /* bad opt or not a well formed list */
-	BIF_ERROR(BIF_P, BADARG);
+    snapshot_write(sn, hdr, DB_SNAPSHOT_HDR);
+    if (close(sn->fd) < 0 && !sn->error) {
+	sn->error = errno;
     }
-    if (IS_HASH_TABLE(status)) {
-	meth = &db_hash;
-	#ifdef ERTS_SMP
-	if (is_fine_locked && !(status & DB_PRIVATE)) {
-	    status |= DB_FINE_LOCKED;
+    sn->fd = -1;
+
+    if (sn->error) {
+	BIF_RET(snapshot_posix_error(p, sn->error));
+    }
+    BIF_RET(am_ok);
+}
+
+static BIF_RETTYPE ets_snapshot_trap(Process* p, Eterm tab, Eterm state,
+				     Eterm cursor)
+{
+    if (cursor != am_EOT) {
+	Binary* mb = ((ProcBin *) binary_val(state))->val;
+	db_lock_kind_t kind = LCK_READ;
+	DbTable* tb;
+
+	/* The table may have gone away while we trapped */
+	if ((tb = db_get_table(p, tab, DB_READ, kind)) == NULL) {
+	    BIF_ERROR(p, BADARG);
 	}
-	#endif
+	tb->common.meth->db_foreach_dbterm(p, tb, &cursor, DB_SNAPSHOT_OBJS,
+					   snapshot_object,
+					   ERTS_MAGIC_BIN_DATA(mb));
+	if (cursor == am_EOT && ITERATION_SAFETY(p,tb) != ITER_SAFE) {
+	    unfix_table_locked(p, tb, &kind);
+	}
+	db_unlock(tb, kind);
     }
-    else if (IS_TREE_TABLE(status)) {
-	meth = &db_tree;
+    return snapshot_write_out(p, tab, state, cursor);
+}
+
+/*
+** Write all objects of a table to a file. The objects are encoded
+** DB_SNAPSHOT_OBJS at a time with the table read locked, trapping in
+** between, and the table is fixed meanwhile if it needs to be. As with
+** ets:select/2, each object that is in the table throughout is written
+** exactly once, while objects inserted, deleted or updated during the
+** snapshot may or may not be in it. The file is written between the
+** slices, with the table unlocked. Returns ok or {error, Posix}.
+*/
+BIF_RETTYPE ets_snapshot_2(BIF_ALIST_2)
+{
+    DbTable* tb;
+    DbSnapshot* sn;
+    Binary* mb;
+    Eterm* hp;
+    Eterm state;
+    Eterm cursor;
+    enum DbIterSafety safety;
+    char* name;
+    int fd;
+
+    CHECK_TABLES();
+
+    if ((name = snapshot_file_name(BIF_ARG_2)) == NULL) {
+	BIF_ERROR(BIF_P, BADARG);
     }
-    else {
+    if ((tb = db_get_table(BIF_P, BIF_ARG_1, DB_READ, LCK_READ)) == NULL) {
+	erts_free(ERTS_ALC_T_TMP, name);
 	BIF_ERROR(BIF_P, BADARG);
     }
+    fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    erts_free(ERTS_ALC_T_TMP, name);
+    if (fd < 0) {
+	int error = errno;
+	db_unlock(tb, LCK_READ);
+	BIF_RET(snapshot_posix_error(BIF_P, error));
+    }
+
+    mb = erts_create_magic_binary(sizeof(DbSnapshot),
+				  snapshot_state_destructor);
+    sn = (DbSnapshot *) ERTS_MAGIC_BIN_DATA(mb);
+    sn->fd = fd;
+    sn->error = 0;
+    sn->pos = 0;
+    sn->first = NULL;
+    sn->last = NULL;
+    sn->offs_cap = 1024;
+    sn->offs = erts_alloc(ERTS_ALC_T_DB_SEL_LIST,
+			  sn->offs_cap * sizeof(Uint64));
+    sn->noffs = 0;
+    sn->heap = NULL;
+    sn->heap_sz = 0;
+    hp = HAlloc(BIF_P, PROC_BIN_SIZE);
+    state = erts_mk_magic_binary_term(&hp, &MSO(BIF_P), mb);
 
-    /* we create table outside any table lock
-     * and take the unusal cost of destroy table if it
-     * fails to find a slot 
-     */
-    {
-        DbTable init_tb;
+    /* Room for the header, it is written last */
+    snapshot_reserve(sn, DB_SNAPSHOT_HDR);
+    sys_memzero(sn->first->data, DB_SNAPSHOT_HDR);
+    sn->first->used = DB_SNAPSHOT_HDR;
 
-	erts_smp_atomic_init(&init_tb.common.memory_size, 0);
-	tb = (DbTable*) erts_db_alloc(ERTS_ALC_T_DB_TABLE,
-				      &init_tb, sizeof(DbTable));
-	ERTS_ETS_MISC_MEM_ADD(sizeof(DbTable));
-	erts_smp_atomic_init(&tb->common.memory_size,
-			     erts_smp_atomic_read(&init_tb.common.memory_size));
+    safety = ITERATION_SAFETY(BIF_P,tb);
+    if (safety == ITER_UNSAFE) {
+	local_fix_table(tb);
+    }
+    cursor = NIL;
+    tb->common.meth->db_foreach_dbterm(BIF_P, tb, &cursor, DB_SNAPSHOT_OBJS,
+				       snapshot_object, (void *) sn);
+    if (cursor != am_EOT && safety != ITER_SAFE) {
+	fix_table_locked(BIF_P, tb);
+    }
+    if (safety == ITER_UNSAFE) {
+	local_unfix_table(tb);
     }
+    db_unlock(tb, LCK_READ);
 
-    tb->common.meth = meth;
-    tb->common.the_name = BIF_ARG_1;
-    tb->common.status = status;    
-#ifdef ERTS_SMP
-    tb->common.type = status & ERTS_ETS_TABLE_TYPES;
-    /* Note, 'type' is *read only* from now on... */
-#endif
-    db_init_lock(tb, "db_tab", "db_tab_fix");
-    tb->common.keypos = keypos;
-    tb->common.owner = BIF_P->id;
-    set_heir(BIF_P, tb, heir, heir_data);
+    return snapshot_write_out(BIF_P, BIF_ARG_1, state, cursor);
+}
 
-    erts_smp_atomic_init(&tb->common.nitems, 0);
+/*
+** Restoring, the mapped file is split into chunks of DB_RESTORE_CHUNK
+** objects that are decoded and inserted both by the calling process
+** and, for tables with fine grained locking, by idle schedulers that
+** got restore_helper() as a misc op, as the parallel scans in
+** erl_db_hash.c. The process inserts DB_RESTORE_SLICE chunks at a time
+** with the table locked, only chunks below the limit of the slice can
+** be claimed, and traps between the slices. The job is freed, and the
+** file unmapped, by whichever thread is done with it last, so it is not
+** allocated as ERTS_ALC_T_DB_TMP.
+*/
+typedef struct {
+    DbTable* tb;          /* set by the process before each slice */
+    byte* base;           /* the mapped file */
+    size_t size;
+    byte* index;
+    Uint64 index_off;
+    Uint nobjs;
+    long nchunks;
+    erts_smp_atomic_t next;   /* next chunk to claim */
+    erts_smp_atomic_t limit;  /* end of the current slice */
+    erts_smp_atomic_t refc;
+    erts_smp_atomic_t bad;    /* objects that could not be inserted */
+    DbWorkers workers;
+} DbRestore;
 
-    tb->common.fixations = NULL;
+/*
+** Check the header of a mapped snapshot, returns the number of objects
+** or -1 if it is not a valid snapshot. The offsets in the index are
+** checked as the objects are inserted.
+*/
+static Sint restore_check(byte* base, Uint64 size, Uint64* indexp)
+{
+    Uint64 nobjs, index;
+
+    if (size < DB_SNAPSHOT_HDR
+	|| sys_memcmp(base, DB_SNAPSHOT_MAGIC, 4) != 0
+	|| get_int32(base + 4) != DB_SNAPSHOT_VERSION) {
+	return -1;
+    }
+    nobjs = get_int64(base + 8);
+    index = get_int64(base + 16);
+    if (index < DB_SNAPSHOT_HDR || index > size
+	|| nobjs >= (size - index) / 8
+	|| nobjs > (Uint64) MAX_SMALL) {
+	return -1;
+    }
+    *indexp = index;
+    return (Sint) nobjs;
+}
 
-    cret = meth->db_create(BIF_P, tb);
-    ASSERT(cret == DB_ERROR_NONE);
+/* Decode and insert objects i0 up to i1 */
+static void restore_objects(DbRestore* rs, Uint i0, Uint i1,
+			    Eterm** heapp, Uint* heap_szp)
+{
+    DbTable* tb = rs->tb;
+    long bad = 0;
+    Uint i;
+
+    for (i = i0; i < i1; i++) {
+	Uint64 off = get_int64(rs->index + 8*i);
+	Uint64 end = get_int64(rs->index + 8*(i+1));
+	byte* ext = rs->base + off;
+	ErlOffHeap off_heap;
+	Sint sz;
+	Eterm obj;
+	Eterm* hp;
+
+	if (off < DB_SNAPSHOT_HDR || end < off || end > rs->index_off) {
+	    ++bad;
+	    continue;
+	}
+	/* Decoded straight from the mapping, binaries that end up off
+	   heap are shared with the table rather than copied again */
+	sz = erts_decode_ext_size(ext, (Uint) (end - off), 0);
+	if (sz < 0) {
+	    ++bad;
+	    continue;
+	}
+	if ((Uint) sz > *heap_szp) {
+	    if (*heapp != NULL) {
+		erts_free(ERTS_ALC_T_TMP, *heapp);
+	    }
+	    *heap_szp = (Uint) sz;
+	    *heapp = erts_alloc(ERTS_ALC_T_TMP, sz*sizeof(Eterm));
+	}
+	off_heap.mso = NULL;
+	off_heap.externals = NULL;
+#ifndef HYBRID /* FIND ME! */
+	off_heap.funs = NULL;
+#endif
+	off_heap.overhead = 0;
+	hp = *heapp;
+	obj = erts_decode_ext(&hp, &off_heap, &ext);
+	if (is_non_value(obj)
+	    || ext != rs->base + end
+	    || is_not_tuple(obj)
+	    || arityval(*tuple_val(obj)) < tb->common.keypos
+	    || put_object(tb, obj, 0) != DB_ERROR_NONE) {
+	    ++bad;
+	}
+	erts_cleanup_offheap(&off_heap);
+    }
+    if (bad) {
+	erts_smp_atomic_add(&rs->bad, bad);
+    }
+}
 
-    erts_smp_spin_lock(&meta_main_tab_main_lock);
+/* Claim and insert chunks until the limit of the current slice */
+static void restore_work(DbRestore* rs)
+{
+    Eterm* heap = NULL;
+    Uint heap_sz = 0;
+
+    db_workers_enter(&rs->workers);
+    for (;;) {
+	long c = erts_smp_atomic_read(&rs->next);
+	Uint i0, i1;
+	if (c >= erts_smp_atomic_read(&rs->limit)) {
+	    break;
+	}
+	if (erts_smp_atomic_cmpxchg(&rs->next, c + 1, c) != c) {
+	    continue;
+	}
+	i0 = (Uint) c * DB_RESTORE_CHUNK;
+	i1 = i0 + DB_RESTORE_CHUNK;
+	if (i1 > rs->nobjs) {
+	    i1 = rs->nobjs;
+	}
+	restore_objects(rs, i0, i1, &heap, &heap_sz);
+    }
+    db_workers_leave(&rs->workers);
+    if (heap != NULL) {
+	erts_free(ERTS_ALC_T_TMP, heap);
+    }
+}
 
-    if (meta_main_tab_cnt >= db_max_tabs) {
-	erts_smp_spin_unlock(&meta_main_tab_main_lock);
-	erts_send_error_to_logger_str(BIF_P->group_leader,
-				      "** Too many db tables **\n");
-	free_heir_data(tb);
-	tb->common.meth->db_free_table(tb);
-	erts_db_free(ERTS_ALC_T_DB_TABLE, tb, (void *) tb, sizeof(DbTable));
-	ERTS_ETS_MISC_MEM_ADD(-sizeof(DbTable));
-	BIF_ERROR(BIF_P, SYSTEM_LIMIT);
+static void restore_deref(DbRestore* rs)
+{
+    if (erts_smp_atomic_dectest(&rs->refc) == 0) {
+	munmap((void *) rs->base, rs->size);
+	db_workers_destroy(&rs->workers);
+	erts_free(ERTS_ALC_T_DB_SEL_LIST, rs);
     }
+}
 
-    slot = meta_main_tab_first_free;
-    ASSERT(slot>=0 && slot<db_max_tabs);
-    meta_main_tab_first_free = GET_NEXT_FREE_SLOT(slot);
-    meta_main_tab_cnt++;
+#ifdef ERTS_SMP
+/* Misc op run by an idle scheduler */
+static void restore_helper(void* arg)
+{
+    DbRestore* rs = (DbRestore *) arg;
 
-    if (is_named) {
-	ret = BIF_ARG_1;
-    }
-    else {
-	ret = make_small(slot | meta_main_tab_seq_cnt);
-	meta_main_tab_seq_cnt += meta_main_tab_seq_incr;
-	ASSERT((unsigned_val(ret) & meta_main_tab_slot_mask) == slot);
-    }
-    erts_smp_spin_unlock(&meta_main_tab_main_lock);
+    restore_work(rs);
+    restore_deref(rs);
+}
+#endif
 
-    tb->common.id = ret;
-    tb->common.slot = slot;           /* store slot for erase */
+static void restore_state_destructor(Binary* mb)
+{
+    restore_deref(*(DbRestore **) ERTS_MAGIC_BIN_DATA(mb));
+}
 
-    meta_main_tab_lock(slot);
-    meta_main_tab[slot].u.tb = tb;
-    ASSERT(IS_SLOT_ALIVE(slot));
-    meta_main_tab_unlock(slot);
+/* Insert the next DB_RESTORE_SLICE chunks, trap if there are more */
+static BIF_RETTYPE restore_continue(Process* p, Eterm tab, Eterm state)
+{
+    Binary* mb = ((ProcBin *) binary_val(state))->val;
+    DbRestore* rs = *(DbRestore **) ERTS_MAGIC_BIN_DATA(mb);
+    DbTable* tb;
+    long limit;
+    long bad;
 
-    if (is_named && !insert_named_tab(BIF_ARG_1, tb)) {
-	meta_main_tab_lock(slot);
-	free_slot(slot);
-	meta_main_tab_unlock(slot);
+    ASSERT(ERTS_MAGIC_BIN_DESTRUCTOR(mb) == restore_state_destructor);
 
-	db_lock_take_over_ref(tb,LCK_WRITE);
-	free_heir_data(tb);
-	tb->common.meth->db_free_table(tb);
-	db_unlock(tb,LCK_WRITE);
-	BIF_ERROR(BIF_P, BADARG);
+    /* The table may have gone away while we trapped */
+    if ((tb = db_get_table(p, tab, DB_WRITE, LCK_WRITE_REC)) == NULL) {
+	BIF_ERROR(p, BADARG);
     }
-    
-    BIF_P->flags |= F_USING_DB; /* So we can remove tb if p dies */
+    limit = erts_smp_atomic_read(&rs->limit) + DB_RESTORE_SLICE;
+    if (limit > rs->nchunks) {
+	limit = rs->nchunks;
+    }
+    rs->tb = tb;
+    erts_smp_atomic_xchg(&rs->limit, limit);
 
-#ifdef HARDDEBUG
-    erts_fprintf(stderr,
-		"ets:new(%T,%T)=%T; Process: %T, initial: %T:%T/%bpu\n",
-		 BIF_ARG_1, BIF_ARG_2, ret, BIF_P->id,
-		 BIF_P->initial[0], BIF_P->initial[1], BIF_P->initial[2]);
-	erts_fprintf(stderr, "ets: new: meta_pid_to_tab common.memory_size = %ld\n",
-		     erts_smp_atomic_read(&meta_pid_to_tab->common.memory_size));
-	erts_fprintf(stderr, "ets: new: meta_pid_to_fixed_tab common.memory_size = %ld\n",
-		     erts_smp_atomic_read(&meta_pid_to_fixed_tab->common.memory_size));
+#ifdef ERTS_SMP
+    /* Without fine grained locking, only the table lock we hold keeps
+       concurrent inserts apart */
+    if (tb->common.status & DB_FINE_LOCKED) {
+	int helpers = (int) (limit - erts_smp_atomic_read(&rs->next)) - 1;
+	if (helpers > (int) erts_no_schedulers - 1) {
+	    helpers = (int) erts_no_schedulers - 1;
+	}
+	if (helpers > 0) {
+	    int posted;
+	    erts_smp_atomic_add(&rs->refc, helpers);
+	    posted = erts_schedule_misc_op_idle(helpers, restore_helper,
+						(void *) rs);
+	    if (posted < helpers) {
+		erts_smp_atomic_add(&rs->refc, posted - helpers);
+	    }
+	}
+    }
 #endif
 
-    UseTmpHeap(3,BIF_P);
+    restore_work(rs);
+    /* All chunks of the slice are claimed, wait for the helpers still
+       inserting one, they rely on the table lock we hold */
+    db_workers_wait(&rs->workers);
+    db_unlock(tb, LCK_WRITE_REC);
 
-    db_meta_lock(meta_pid_to_tab, LCK_WRITE_REC);
-    if (db_put_hash(meta_pid_to_tab,
-		    TUPLE2(meta_tuple, BIF_P->id, make_small(slot)),
-		    0) != DB_ERROR_NONE) {
-	erl_exit(1,"Could not update ets metadata.");
+    BUMP_ALL_REDS(p);
+    if (limit < rs->nchunks) {
+	BIF_TRAP2(&ets_restore_continue_exp, p, tab, state);
     }
-    db_meta_unlock(meta_pid_to_tab, LCK_WRITE_REC);
-
-    UnUseTmpHeap(3,BIF_P);
+    bad = erts_smp_atomic_read(&rs->bad);
+    if (bad) {
+	BIF_RET(snapshot_error(p, am_badfile));
+    }
+    BIF_RET(erts_make_integer(rs->nobjs, p));
+}
 
-    BIF_RET(ret);
+static BIF_RETTYPE ets_restore_trap(Process* p, Eterm tab, Eterm state)
+{
+    return restore_continue(p, tab, state);
 }
 
-/* 
-** The lookup BIF 
+/*
+** Insert the objects of a snapshot written by snapshot/2 into a table.
+** The file is mapped and the objects are decoded from it in place.
+** The table is only locked while a slice is inserted, so the restore
+** is not atomic, other processes can see and update the table between
+** slices. Returns the number of objects inserted, {error, badfile} if
+** the file is not a snapshot or some objects did not fit the table (the
+** others are still inserted), or {error, Posix}.
 */
-BIF_RETTYPE ets_lookup_2(BIF_ALIST_2)
+BIF_RETTYPE ets_restore_2(BIF_ALIST_2)
 {
     DbTable* tb;
-    int cret;
-    Eterm ret;
+    DbRestore* rs;
+    Binary* mb;
+    Eterm* hp;
+    char* name;
+    int fd;
+    struct stat st;
+    byte* base;
+    Uint64 index;
+    Sint nobjs;
 
     CHECK_TABLES();
 
-    if ((tb = db_get_table(BIF_P, BIF_ARG_1, DB_READ, LCK_READ)) == NULL) {
+    if ((name = snapshot_file_name(BIF_ARG_2)) == NULL) {
 	BIF_ERROR(BIF_P, BADARG);
     }
-
-    cret = tb->common.meth->db_get(BIF_P, tb, BIF_ARG_2, &ret);
-
-    db_unlock(tb, LCK_READ);
-
-    switch (cret) {
-    case DB_ERROR_NONE:
-	BIF_RET(ret);
-    case DB_ERROR_SYSRES:
-	BIF_ERROR(BIF_P, SYSTEM_LIMIT);
-    default:
+    /* Only check the access here, the file is opened unlocked */
+    if ((tb = db_get_table(BIF_P, BIF_ARG_1, DB_WRITE, LCK_WRITE_REC)) == NULL) {
+	erts_free(ERTS_ALC_T_TMP, name);
 	BIF_ERROR(BIF_P, BADARG);
     }
+    db_unlock(tb, LCK_WRITE_REC);
 
+    fd = open(name, O_RDONLY);
+    erts_free(ERTS_ALC_T_TMP, name);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+	int error = errno;
+	if (fd >= 0) {
+	    close(fd);
+	}
+	BIF_RET(snapshot_posix_error(BIF_P, error));
+    }
+    if (st.st_size < DB_SNAPSHOT_HDR) {
+	close(fd);
+	BIF_RET(snapshot_error(BIF_P, am_badfile));
+    }
+    base = (byte *) mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE,
+			 fd, 0);
+    close(fd);
+    if (base == (byte *) MAP_FAILED) {
+	BIF_RET(snapshot_posix_error(BIF_P, errno));
+    }
+    if ((nobjs = restore_check(base, (Uint64) st.st_size, &index)) < 0) {
+	munmap((void *) base, (size_t) st.st_size);
+	BIF_RET(snapshot_error(BIF_P, am_badfile));
+    }
+
+    rs = erts_alloc(ERTS_ALC_T_DB_SEL_LIST, sizeof(DbRestore));
+    rs->tb = NULL;
+    rs->base = base;
+    rs->size = (size_t) st.st_size;
+    rs->index = base + index;
+    rs->index_off = index;
+    rs->nobjs = (Uint) nobjs;
+    rs->nchunks = (long) ((nobjs + DB_RESTORE_CHUNK - 1) / DB_RESTORE_CHUNK);
+    erts_smp_atomic_init(&rs->next, 0);
+    erts_smp_atomic_init(&rs->limit, 0);
+    erts_smp_atomic_init(&rs->refc, 1);
+    erts_smp_atomic_init(&rs->bad, 0);
+    db_workers_init(&rs->workers);
+
+    /* The reference of the process goes with the magic binary */
+    mb = erts_create_magic_binary(sizeof(DbRestore *),
+				  restore_state_destructor);
+    *(DbRestore **) ERTS_MAGIC_BIN_DATA(mb) = rs;
+    hp = HAlloc(BIF_P, PROC_BIN_SIZE);
+    return restore_continue(BIF_P, BIF_ARG_1,
+			    erts_mk_magic_binary_term(&hp, &MSO(BIF_P), mb));
 }
 
 /* 
@@ -1442,6 +2830,7 @@ BIF_RETTYPE ets_member_2(BIF_ALIST_2)
     }
 
     cret = tb->common.meth->db_member(tb, BIF_ARG_2, &ret);
+    DB_STATS_COUNT(tb, BIF_P, lookups, 1);
 
     db_unlock(tb, LCK_READ);
 
@@ -1481,6 +2870,7 @@ BIF_RETTYPE ets_lookup_element_3(BIF_ALIST_3)
 
     cret = tb->common.meth->db_get_element(BIF_P, tb, 
 					   BIF_ARG_2, index, &ret);
+    DB_STATS_COUNT(tb, BIF_P, lookups, 1);
     db_unlock(tb, LCK_READ);
     switch (cret) {
     case DB_ERROR_NONE:
@@ -1727,6 +3117,7 @@ BIF_RETTYPE ets_delete_all_objects_1(BIF_ALIST_1)
     }
 
     tb->common.meth->db_delete_all_objects(BIF_P, tb);
+    index_clear(BIF_P, tb);
 
     db_unlock(tb, LCK_WRITE);
 
@@ -1750,7 +3141,9 @@ BIF_RETTYPE ets_delete_2(BIF_ALIST_2)
 	BIF_ERROR(BIF_P, BADARG);
     }
 
+    index_unlink_key(tb, BIF_ARG_2);
     cret = tb->common.meth->db_erase(tb,BIF_ARG_2,&ret);
+    DB_STATS_COUNT(tb, BIF_P, deletes, 1);
 
     db_unlock(tb, LCK_WRITE_REC);
 
@@ -1784,7 +3177,10 @@ BIF_RETTYPE ets_delete_object_2(BIF_ALIST_2)
 	BIF_ERROR(BIF_P, BADARG);
     }
 
+    index_unlink_key(tb, TERM_GETKEY(tb, BIF_ARG_2));
     cret = tb->common.meth->db_erase_object(tb, BIF_ARG_2, &ret);
+    index_link_key(tb, TERM_GETKEY(tb, BIF_ARG_2));
+    DB_STATS_COUNT(tb, BIF_P, deletes, 1);
     db_unlock(tb, LCK_WRITE_REC);
 
     switch (cret) {
@@ -1805,6 +3201,7 @@ static BIF_RETTYPE ets_select_delete_1(Process *p, Eterm a1)
     BIF_RETTYPE result;
     DbTable* tb;
     int cret;
+    Uint64 start;
     Eterm ret;
     Eterm *tptr;
     db_lock_kind_t kind = LCK_WRITE_REC;
@@ -1818,11 +3215,16 @@ static BIF_RETTYPE ets_select_delete_1(Process *p, Eterm a1)
 	BIF_ERROR(p,BADARG);
     }
 
+    start = db_stats_time();
     cret = tb->common.meth->db_select_delete_continue(p,tb,a1,&ret);
+    stats_select(tb, p, start, 0);
 
     if(!DID_TRAP(p,ret) && ITERATION_SAFETY(p,tb) != ITER_SAFE) {  
 	unfix_table_locked(p, tb, &kind);
     }
+    if (!DID_TRAP(p,ret) && cret == DB_ERROR_NONE && ret != make_small(0)) {
+	BUMP_REDS(p, index_sweep(p, tb) / 4);
+    }
 
     db_unlock(tb, kind);
 
@@ -1845,6 +3247,7 @@ BIF_RETTYPE ets_select_delete_2(BIF_ALIST_2)
     BIF_RETTYPE result;
     DbTable* tb;
     int cret;
+    Uint64 start;
     Eterm ret;
     enum DbIterSafety safety;
 
@@ -1857,6 +3260,7 @@ BIF_RETTYPE ets_select_delete_2(BIF_ALIST_2)
 	}
 	nitems = erts_smp_atomic_read(&tb->common.nitems);
 	tb->common.meth->db_delete_all_objects(BIF_P, tb);
+	index_clear(BIF_P, tb);
 	db_unlock(tb, LCK_WRITE);
 	BIF_RET(erts_make_integer(nitems,BIF_P));
     }
@@ -1868,7 +3272,9 @@ BIF_RETTYPE ets_select_delete_2(BIF_ALIST_2)
     if (safety == ITER_UNSAFE) {
 	local_fix_table(tb);
     }
+    start = db_stats_time();
     cret = tb->common.meth->db_select_delete(BIF_P, tb, BIF_ARG_2, &ret);
+    stats_select(tb, BIF_P, start, 1);
 
     if (DID_TRAP(BIF_P,ret) && safety != ITER_SAFE) {
 	fix_table_locked(BIF_P,tb);
@@ -1876,6 +3282,10 @@ BIF_RETTYPE ets_select_delete_2(BIF_ALIST_2)
     if (safety == ITER_UNSAFE) {
 	local_unfix_table(tb);
     }
+    if (!DID_TRAP(BIF_P,ret) && cret == DB_ERROR_NONE
+	&& ret != make_small(0)) {
+	BUMP_REDS(BIF_P, index_sweep(BIF_P, tb) / 4);
+    }
     db_unlock(tb, LCK_WRITE_REC);
 
     switch (cret) {
@@ -2011,6 +3421,7 @@ BIF_RETTYPE ets_select_3(BIF_ALIST_3)
     BIF_RETTYPE result;
     DbTable* tb;
     int cret;
+    Uint64 start;
     Eterm ret;
     Sint chunk_size;
     enum DbIterSafety safety;
@@ -2028,10 +3439,12 @@ BIF_RETTYPE ets_select_3(BIF_ALIST_3)
     if (safety == ITER_UNSAFE) {
 	local_fix_table(tb);
     }
+    start = db_stats_time();
     cret = tb->common.meth->db_select_chunk(BIF_P, tb,
 					    BIF_ARG_2, chunk_size, 
 					    0 /* not reversed */,
 					    &ret);
+    stats_select(tb, BIF_P, start, 1);
     if (DID_TRAP(BIF_P,ret) && safety != ITER_SAFE) {
 	fix_table_locked(BIF_P, tb);
     }
@@ -2064,6 +3477,7 @@ static BIF_RETTYPE ets_select_trap_1(Process *p, Eterm a1)
     BIF_RETTYPE result;
     DbTable* tb;
     int cret;
+    Uint64 start;
     Eterm ret;
     Eterm *tptr;
     db_lock_kind_t kind = LCK_READ;
@@ -2077,8 +3491,10 @@ static BIF_RETTYPE ets_select_trap_1(Process *p, Eterm a1)
 	BIF_ERROR(p, BADARG);
     }
 
+    start = db_stats_time();
     cret = tb->common.meth->db_select_continue(p, tb, a1,
 					       &ret);
+    stats_select(tb, p, start, 0);
 
     if (!DID_TRAP(p,ret) && ITERATION_SAFETY(p,tb) != ITER_SAFE) {
 	unfix_table_locked(p, tb, &kind);
@@ -2108,6 +3524,7 @@ BIF_RETTYPE ets_select_1(BIF_ALIST_1)
     BIF_RETTYPE result;
     DbTable* tb;
     int cret;
+    Uint64 start;
     Eterm ret;
     Eterm *tptr;
     enum DbIterSafety safety;
@@ -2135,8 +3552,10 @@ BIF_RETTYPE ets_select_1(BIF_ALIST_1)
 	local_fix_table(tb);
     }
 
+    start = db_stats_time();
     cret = tb->common.meth->db_select_continue(BIF_P,tb,
 					       BIF_ARG_1, &ret);
+    stats_select(tb, BIF_P, start, 1);
 
     if (DID_TRAP(BIF_P,ret) && safety != ITER_SAFE) {
 	fix_table_locked(BIF_P, tb);
@@ -2168,6 +3587,7 @@ BIF_RETTYPE ets_select_2(BIF_ALIST_2)
     BIF_RETTYPE result;
     DbTable* tb;
     int cret;
+    Uint64 start;
     enum DbIterSafety safety;
     Eterm ret;
 
@@ -2185,8 +3605,10 @@ BIF_RETTYPE ets_select_2(BIF_ALIST_2)
 	local_fix_table(tb);
     }
 
+    start = db_stats_time();
     cret = tb->common.meth->db_select(BIF_P, tb, BIF_ARG_2,
 				      0, &ret);
+    stats_select(tb, BIF_P, start, 1);
 
     if (DID_TRAP(BIF_P,ret) && safety != ITER_SAFE) {
 	fix_table_locked(BIF_P, tb);
@@ -2219,6 +3641,7 @@ static BIF_RETTYPE ets_select_count_1(Process *p, Eterm a1)
     BIF_RETTYPE result;
     DbTable* tb;
     int cret;
+    Uint64 start;
     Eterm ret;
     Eterm *tptr;
     db_lock_kind_t kind = LCK_READ;
@@ -2231,7 +3654,9 @@ static BIF_RETTYPE ets_select_count_1(Process *p, Eterm a1)
 	BIF_ERROR(p, BADARG);
     }
 
+    start = db_stats_time();
     cret = tb->common.meth->db_select_count_continue(p, tb, a1, &ret);
+    stats_select(tb, p, start, 0);
 
     if (!DID_TRAP(p,ret) && ITERATION_SAFETY(p,tb) != ITER_SAFE) {
 	unfix_table_locked(p, tb, &kind);
@@ -2260,6 +3685,7 @@ BIF_RETTYPE ets_select_count_2(BIF_ALIST_2)
     BIF_RETTYPE result;
     DbTable* tb;
     int cret;
+    Uint64 start;
     enum DbIterSafety safety;
     Eterm ret;
 
@@ -2275,7 +3701,9 @@ BIF_RETTYPE ets_select_count_2(BIF_ALIST_2)
     if (safety == ITER_UNSAFE) {
 	local_fix_table(tb);
     }
+    start = db_stats_time();
     cret = tb->common.meth->db_select_count(BIF_P,tb,BIF_ARG_2, &ret);
+    stats_select(tb, BIF_P, start, 1);
 
     if (DID_TRAP(BIF_P,ret) && safety != ITER_SAFE) {
 	fix_table_locked(BIF_P, tb);
@@ -2307,6 +3735,7 @@ BIF_RETTYPE ets_select_reverse_3(BIF_ALIST_3)
     BIF_RETTYPE result;
     DbTable* tb;
     int cret;
+    Uint64 start;
     enum DbIterSafety safety;
     Eterm ret;
     Sint chunk_size;
@@ -2329,9 +3758,11 @@ BIF_RETTYPE ets_select_reverse_3(BIF_ALIST_3)
     if (safety == ITER_UNSAFE) {
 	local_fix_table(tb);
     }
+    start = db_stats_time();
     cret = tb->common.meth->db_select_chunk(BIF_P,tb,
 					    BIF_ARG_2, chunk_size, 
 					    1 /* reversed */, &ret);
+    stats_select(tb, BIF_P, start, 1);
     if (DID_TRAP(BIF_P,ret) && safety != ITER_SAFE) {
 	fix_table_locked(BIF_P, tb);
     }
@@ -2364,6 +3795,7 @@ BIF_RETTYPE ets_select_reverse_2(BIF_ALIST_2)
     BIF_RETTYPE result;
     DbTable* tb;
     int cret;
+    Uint64 start;
     enum DbIterSafety safety;
     Eterm ret;
 
@@ -2379,8 +3811,10 @@ BIF_RETTYPE ets_select_reverse_2(BIF_ALIST_2)
     if (safety == ITER_UNSAFE) {
 	local_fix_table(tb);
     }
+    start = db_stats_time();
     cret = tb->common.meth->db_select(BIF_P,tb,BIF_ARG_2,
 				      1 /*reversed*/, &ret);
+    stats_select(tb, BIF_P, start, 1);
 
     if (DID_TRAP(BIF_P,ret) && safety != ITER_SAFE) {
 	fix_table_locked(BIF_P, tb);
@@ -2699,6 +4133,9 @@ void init_db(void)
     meta_pid_to_tab->common.is_thread_safe = 0;
 #endif
     meta_pid_to_tab->common.keypos = 1;
+    meta_pid_to_tab->common.size_hint = 0;
+    meta_pid_to_tab->common.index = NULL;
+    meta_pid_to_tab->common.stats = NULL;
     meta_pid_to_tab->common.owner  = NIL;
     erts_smp_atomic_init(&meta_pid_to_tab->common.nitems, 0);
     meta_pid_to_tab->common.slot   = -1;
@@ -2731,6 +4168,9 @@ void init_db(void)
     meta_pid_to_fixed_tab->common.is_thread_safe = 0;
 #endif
     meta_pid_to_fixed_tab->common.keypos = 1;
+    meta_pid_to_fixed_tab->common.size_hint = 0;
+    meta_pid_to_fixed_tab->common.index = NULL;
+    meta_pid_to_fixed_tab->common.stats = NULL;
     meta_pid_to_fixed_tab->common.owner  = NIL;
     erts_smp_atomic_init(&meta_pid_to_fixed_tab->common.nitems, 0);
     meta_pid_to_fixed_tab->common.slot   = -1;
@@ -2790,6 +4230,34 @@ void init_db(void)
     ets_delete_continue_exp.code[3] = (BeamInstr) em_apply_bif;
     ets_delete_continue_exp.code[4] = (BeamInstr) &ets_delete_trap;
 
+    /* Non visual BIF to trap to. */
+    memset(&ets_lookup_many_continue_exp, 0, sizeof(Export));
+    ets_lookup_many_continue_exp.address =
+	&ets_lookup_many_continue_exp.code[3];
+    ets_lookup_many_continue_exp.code[0] = am_ets;
+    ets_lookup_many_continue_exp.code[1] =
+	am_atom_put("lookup_many_trap",16);
+    ets_lookup_many_continue_exp.code[2] = 3;
+    ets_lookup_many_continue_exp.code[3] = (BeamInstr) em_apply_bif;
+    ets_lookup_many_continue_exp.code[4] =
+	(BeamInstr) &ets_lookup_many_trap;
+
+    memset(&ets_snapshot_continue_exp, 0, sizeof(Export));
+    ets_snapshot_continue_exp.address = &ets_snapshot_continue_exp.code[3];
+    ets_snapshot_continue_exp.code[0] = am_ets;
+    ets_snapshot_continue_exp.code[1] = am_atom_put("snapshot_trap",13);
+    ets_snapshot_continue_exp.code[2] = 3;
+    ets_snapshot_continue_exp.code[3] = (BeamInstr) em_apply_bif;
+    ets_snapshot_continue_exp.code[4] = (BeamInstr) &ets_snapshot_trap;
+
+    memset(&ets_restore_continue_exp, 0, sizeof(Export));
+    ets_restore_continue_exp.address = &ets_restore_continue_exp.code[3];
+    ets_restore_continue_exp.code[0] = am_ets;
+    ets_restore_continue_exp.code[1] = am_atom_put("restore_trap",12);
+    ets_restore_continue_exp.code[2] = 2;
+    ets_restore_continue_exp.code[3] = (BeamInstr) em_apply_bif;
+    ets_restore_continue_exp.code[4] = (BeamInstr) &ets_restore_trap;
+
     hp = ms_delete_all_buff;
     ms_delete_all = CONS(hp, am_true, NIL);
     hp += 2;
@@ -3411,6 +4879,7 @@ static int free_table_cont(Process *p,
 		     tb->common.id);
 #endif
 	/* Completely done - we will not get called again. */
+	index_free(tb);
 	meta_main_tab_lock(tb->common.slot);
 	free_slot(tb->common.slot);
 	meta_main_tab_unlock(tb->common.slot);
@@ -3427,6 +4896,125 @@ static int free_table_cont(Process *p,
     }
 }
 
+/*
+** ets:info(T,stats), a property list with the operation counters summed
+** over all schedulers and, for hash tables, the wait count and time of
+** each stripe lock, a histogram of bucket chain lengths keyed on the
+** shortest length of each bucket, and the chain statistics tuple.
+*/
+static Eterm stats_info(Process* p, DbTable* tb)
+{
+    static char* names[] = {"lookups", "inserts", "deletes",
+			    "selects", "select_time"};
+    Uint64 vals[sizeof(names)/sizeof(names[0])];
+    DbHashStats stats;
+    Eterm chains = NIL;
+    Eterm res;
+    Eterm lst;
+    Uint sz;
+    Uint *hp;
+    Uint **hpp;
+    Uint *szp;
+    int i;
+
+    for (i = 0; i < sizeof(names)/sizeof(names[0]); i++) {
+	vals[i] = 0;
+    }
+    if (tb->common.stats != NULL) {
+	for (i = 0; i < DB_STATS_SLOTS; i++) {
+	    vals[0] += tb->common.stats->sched[i].c.lookups;
+	    vals[1] += tb->common.stats->sched[i].c.inserts;
+	    vals[2] += tb->common.stats->sched[i].c.deletes;
+	    vals[3] += tb->common.stats->sched[i].c.selects;
+	    vals[4] += tb->common.stats->sched[i].c.select_time;
+	}
+    }
+
+    if (IS_HASH_TABLE(tb->common.status)) {
+	FloatDef f;
+	Eterm avg, std_dev_real, std_dev_exp;
+
+	db_calc_stats_hash(&tb->hash, &stats);
+	hp = HAlloc(p, 1 + 6 + FLOAT_SIZE_OBJECT*3);
+	f.fd = stats.avg_chain_len;
+	avg = make_float(hp);
+	PUT_DOUBLE(f, hp);
+	hp += FLOAT_SIZE_OBJECT;
+
+	f.fd = stats.std_dev_chain_len;
+	std_dev_real = make_float(hp);
+	PUT_DOUBLE(f, hp);
+	hp += FLOAT_SIZE_OBJECT;
+	    
+	f.fd = stats.std_dev_expected;
+	std_dev_exp = make_float(hp);
+	PUT_DOUBLE(f, hp);
+	hp += FLOAT_SIZE_OBJECT;
+	chains = TUPLE6(hp, make_small(erts_smp_atomic_read(&tb->hash.nactive)),
+			avg, std_dev_real, std_dev_exp,
+			make_small(stats.min_chain_len),
+			make_small(stats.max_chain_len));
+    }
+
+    sz = 0;
+    hpp = NULL;
+    szp = &sz;
+    while (1) {
+	res = NIL;
+	if (IS_HASH_TABLE(tb->common.status)) {
+	    res = erts_bld_cons(hpp, szp,
+				erts_bld_tuple(hpp, szp, 2,
+					       am_atom_put("chains",6),
+					       chains),
+				res);
+	    lst = NIL;
+	    for (i = DB_HASH_CHAIN_HIST-1; i >= 0; i--) {
+		lst = erts_bld_cons(hpp, szp,
+				    erts_bld_tuple(hpp, szp, 2,
+						   make_small(i ? 1 << (i-1) : 0),
+						   erts_bld_uint(hpp, szp,
+								 stats.chain_hist[i])),
+				    lst);
+	    }
+	    res = erts_bld_cons(hpp, szp,
+				erts_bld_tuple(hpp, szp, 2,
+					       am_atom_put("chain_lengths",13),
+					       lst),
+				res);
+	    lst = NIL;
+	    for (i = DB_HASH_LOCK_CNT-1; i >= 0; i--) {
+		lst = erts_bld_cons(hpp, szp,
+				    erts_bld_tuple(hpp, szp, 2,
+						   erts_bld_uint(hpp, szp,
+								 stats.lock_wait_count[i]),
+						   erts_bld_uint64(hpp, szp,
+								   stats.lock_wait_time[i])),
+				    lst);
+	    }
+	    res = erts_bld_cons(hpp, szp,
+				erts_bld_tuple(hpp, szp, 2,
+					       am_atom_put("lock_waits",10),
+					       lst),
+				res);
+	}
+	for (i = sizeof(names)/sizeof(names[0]) - 1; i >= 0; i--) {
+	    res = erts_bld_cons(hpp, szp,
+				erts_bld_tuple(hpp, szp, 2,
+					       am_atom_put(names[i],
+							   sys_strlen(names[i])),
+					       erts_bld_uint64(hpp, szp, vals[i])),
+				res);
+	}
+	if (hpp) {
+	    break;
+	}
+	hp = HAlloc(p, sz);
+	hpp = &hp;
+	szp = NULL;
+    }
+    return res;
+}
+
 static Eterm table_info(Process* p, DbTable* tb, Eterm What)
 {
     Eterm ret = THE_NON_VALUE;
@@ -3446,6 +5034,7 @@ static Eterm table_info(Process* p, DbTable* tb, Eterm What)
 	}
     } else if (What == am_memory) {
 	Uint words = (Uint) ((erts_smp_atomic_read(&tb->common.memory_size)
+			      + index_memory(tb)
 			      + sizeof(Uint)
 			      - 1)
 			     / sizeof(Uint));
@@ -3469,6 +5058,28 @@ static Eterm table_info(Process* p, DbTable* tb, Eterm What)
 	ret = erts_this_dist_entry->sysname;
     } else if (What == am_named_table) {
 	ret = is_atom(tb->common.id) ? am_true : am_false;
+    } else if (What == am_read_concurrency) {
+	ret = (tb->common.status & DB_LOCKFREE_READ) ? am_lockfree : am_false;
+    } else if (What == am_index) {
+	DbTableIndex* ix = tb->common.index;
+	ret = NIL;
+	if (ix != NULL) {
+	    int i;
+	    Eterm* hp = HAlloc(p, 2*ix->n);
+	    for (i = ix->n; i-- > 0; ) {
+		ret = CONS(hp, make_small(ix->pos[i]), ret);
+		hp += 2;
+	    }
+	}
+    } else if (What == am_parallel_scan) {
+	ret = (tb->common.status & DB_PARALLEL_SCAN) ? am_true : am_false;
+    } else if (What == am_compressed) {
+	if (tb->common.status & DB_COMPRESSED_ZLIB)
+	    ret = am_zlib;
+	else if (tb->common.status & DB_COMPRESSED)
+	    ret = am_true;
+	else
+	    ret = am_false;
     /*
      * For debugging purposes
      */
@@ -3517,36 +5128,7 @@ static Eterm table_info(Process* p, DbTable* tb, Eterm What)
 	erts_smp_mtx_unlock(&tb->common.fixlock);
 #endif
     } else if (What == am_atom_put("stats",5)) {
-	if (IS_HASH_TABLE(tb->common.status)) {
-	    FloatDef f;
-	    DbHashStats stats;
-	    Eterm avg, std_dev_real, std_dev_exp;
-	    Eterm* hp;
-
-	    db_calc_stats_hash(&tb->hash, &stats);
-	    hp = HAlloc(p, 1 + 6 + FLOAT_SIZE_OBJECT*3);
-	    f.fd = stats.avg_chain_len;
-	    avg = make_float(hp);
-	    PUT_DOUBLE(f, hp);
-	    hp += FLOAT_SIZE_OBJECT;
-
-	    f.fd = stats.std_dev_chain_len;
-	    std_dev_real = make_float(hp);
-	    PUT_DOUBLE(f, hp);
-	    hp += FLOAT_SIZE_OBJECT;
-	    
-	    f.fd = stats.std_dev_expected;
-	    std_dev_exp = make_float(hp);
-	    PUT_DOUBLE(f, hp);
-	    hp += FLOAT_SIZE_OBJECT;
-	    ret = TUPLE6(hp, make_small(erts_smp_atomic_read(&tb->hash.nactive)),
-			 avg, std_dev_real, std_dev_exp,
-			 make_small(stats.min_chain_len),
-			 make_small(stats.max_chain_len));
-	}
-	else {
-	    ret = am_false;
-	}
+	ret = stats_info(p, tb);
     }
     return ret;
 }
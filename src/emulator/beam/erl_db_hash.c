@@ -96,6 +96,18 @@
  */
 #define CHAIN_LEN 6                 /* Medium bucket chain len      */
 
+/* Grow when the average chain is longer than GROW_LIMIT and shrink when it
+** is shorter than SHRINK_LIMIT. The gap avoids grow/shrink ping-pong.
+** At most RESIZE_STEPS buckets are split or joined per operation, which
+** lets a table that was fixed catch up in bounded steps.
+*/
+#define GROW_LIMIT(NACTIVE) ((NACTIVE)*(CHAIN_LEN+1))
+#define SHRINK_LIMIT(NACTIVE) ((NACTIVE)*(CHAIN_LEN-2))
+#define RESIZE_STEPS 4
+
+/* Largest number of slots to create up front for a size_hint */
+#define MAX_HINT_SLOTS (1 << 24)
+
 /* Number of slots per segment */
 #define SEGSZ_EXP  8
 #define SEGSZ   (1 << SEGSZ_EXP)
@@ -161,7 +173,45 @@ static ERTS_INLINE void add_fixed_deletion(DbTableHash* tb, int ix)
 
 #ifdef ERTS_SMP
 #  define DB_HASH_LOCK_MASK (DB_HASH_LOCK_CNT-1)
-#  define GET_LOCK(tb,hval) (&(tb)->locks->lck_vec[(hval) & DB_HASH_LOCK_MASK].lck)
+#  define GET_LOCK(tb,hval) (&(tb)->locks->lck_vec[(hval) & DB_HASH_LOCK_MASK].s.lck)
+
+/* The stripe lock was busy, wait for it and account the wait for
+** ets:info(T,stats). Kept out of line, the uncontended path is a trylock.
+*/
+#define DB_HASH_USEC_PER_SEC 1000000
+
+static void wait_lock_hash(DbTableHash* tb, HashValue hval, int exclusive)
+{
+    erts_smp_rwmtx_t* lck = GET_LOCK(tb,hval);
+    erts_smp_atomic_t* wait_sec = &tb->locks->lck_vec[hval & DB_HASH_LOCK_MASK].s.wait_sec;
+    erts_smp_atomic_t* wait_usec = &tb->locks->lck_vec[hval & DB_HASH_LOCK_MASK].s.wait_usec;
+    Uint64 start = db_stats_time();
+    Uint64 usec;
+    long val, was;
+
+    if (exclusive) {
+	erts_smp_rwmtx_rwlock(lck);
+    }
+    else {
+	erts_smp_rwmtx_rlock(lck);
+    }
+    usec = db_stats_time() - start;
+    erts_smp_atomic_inc(&tb->locks->lck_vec[hval & DB_HASH_LOCK_MASK].s.wait_count);
+    if (usec >= DB_HASH_USEC_PER_SEC) {
+	erts_smp_atomic_add(wait_sec, (long) (usec / DB_HASH_USEC_PER_SEC));
+	usec %= DB_HASH_USEC_PER_SEC;
+    }
+    /* Carry whole seconds over, done by whoever sees the overflow */
+    val = erts_smp_atomic_addtest(wait_usec, (long) usec);
+    while (val >= DB_HASH_USEC_PER_SEC) {
+	was = erts_smp_atomic_cmpxchg(wait_usec, val - DB_HASH_USEC_PER_SEC, val);
+	if (was == val) {
+	    erts_smp_atomic_inc(wait_sec);
+	    break;
+	}
+	val = was;
+    }
+}
 
 /* Fine grained read lock */
 static ERTS_INLINE erts_smp_rwmtx_t* RLOCK_HASH(DbTableHash* tb, HashValue hval)
@@ -171,7 +221,9 @@ static ERTS_INLINE erts_smp_rwmtx_t* RLOCK_HASH(DbTableHash* tb, HashValue hval)
     } else {
 	erts_smp_rwmtx_t* lck = GET_LOCK(tb,hval);
 	ASSERT(tb->common.type & DB_FINE_LOCKED);
-	erts_smp_rwmtx_rlock(lck);
+	if (erts_smp_rwmtx_tryrlock(lck) != 0) {
+	    wait_lock_hash(tb, hval, 0);
+	}
 	return lck;
     }
 }
@@ -183,7 +235,9 @@ static ERTS_INLINE erts_smp_rwmtx_t* WLOCK_HASH(DbTableHash* tb, HashValue hval)
     } else {
 	erts_smp_rwmtx_t* lck = GET_LOCK(tb,hval);
 	ASSERT(tb->common.type & DB_FINE_LOCKED);
-	erts_smp_rwmtx_rwlock(lck);
+	if (erts_smp_rwmtx_tryrwlock(lck) != 0) {
+	    wait_lock_hash(tb, hval, 1);
+	}
 	return lck;
     }
 }
@@ -352,14 +406,23 @@ static struct ext_segment* alloc_ext_seg(DbTableHash* tb, unsigned seg_ix,
 					 struct segment** old_segtab);
 static int alloc_seg(DbTableHash *tb);
 static int free_seg(DbTableHash *tb, int free_records);
+static void presize(DbTableHash* tb, Uint size_hint);
 static HashDbTerm* next(DbTableHash *tb, Uint *iptr, erts_smp_rwmtx_t** lck_ptr,
 			HashDbTerm *list);
 static HashDbTerm* search_list(DbTableHash* tb, Eterm key, 
 			       HashValue hval, HashDbTerm *list);
-static void shrink(DbTableHash* tb, int nactive);
-static void grow(DbTableHash* tb, int nactive);
+static int shrink(DbTableHash* tb, int nactive);
+static int grow(DbTableHash* tb, int nactive);
 static void free_term(DbTableHash *tb, HashDbTerm* p);
-static Eterm put_term_list(Process* p, HashDbTerm* ptr1, HashDbTerm* ptr2);
+static void do_free_term(DbTableHash *tb, HashDbTerm* p);
+static Eterm put_term_list(Process* p, DbTableHash* tb,
+			   HashDbTerm* ptr1, HashDbTerm* ptr2);
+static int put_locked(DbTableHash *tb, Eterm obj, HashValue hval,
+		      int key_clash_fail, HashDbTerm** retiredp, long* nitemsp);
+static void sort_by_stripe(HashValue* hvals, Uint n, Uint* order);
+static void lock_stripes(DbTableHash* tb, HashValue* hvals, Uint* order,
+			 Uint n, int write, int* locked);
+static void unlock_stripes(DbTableHash* tb, int write, int* locked);
 static HashDbTerm* get_term(DbTableHash* tb, HashDbTerm* old, 
 			    Eterm obj, HashValue hval);
 static int analyze_pattern(DbTableHash *tb, Eterm pattern, 
@@ -377,6 +440,9 @@ static int db_next_hash(Process *p,
 			Eterm key,
 			Eterm *ret);
 
+static int db_get_many_hash(Process *p, DbTable *tbl,
+			    Eterm *keys, Uint nkeys, Eterm *ret);
+
 static int db_member_hash(DbTable *tbl, Eterm key, Eterm *ret);
 
 static int db_get_element_hash(Process *p, DbTable *tbl, 
@@ -418,6 +484,16 @@ static void db_foreach_offheap_hash(DbTable *,
 				    void (*)(ErlOffHeap *, void *),
 				    void *);
 
+static void db_foreach_key_hash(DbTable *tbl,
+				Eterm key,
+				void (*func)(DbTable *, Eterm, void *),
+				void *arg);
+
+static void db_foreach_dbterm_hash(Process *p, DbTable *tbl,
+				   Eterm *cursor, Sint max,
+				   void (*func)(DbTable *, DbTerm *, void *),
+				   void *arg);
+
 static int db_delete_all_objects_hash(Process* p, DbTable* tbl);
 #ifdef HARDDEBUG
 static void db_check_table_hash(DbTableHash *tb);
@@ -427,13 +503,28 @@ static void db_finalize_dbterm_hash(DbUpdateHandle* handle);
 
 static ERTS_INLINE void try_shrink(DbTableHash* tb)
 {
-    int nactive = NACTIVE(tb);
-    if (nactive > SEGSZ && NITEMS(tb) < (nactive * CHAIN_LEN)
-	&& !IS_FIXED(tb)) {
-	shrink(tb, nactive);
+    int steps;
+    for (steps = 0; steps < RESIZE_STEPS; ++steps) {
+	int nactive = NACTIVE(tb);
+	if (nactive <= tb->min_nactive || NITEMS(tb) >= SHRINK_LIMIT(nactive)
+	    || IS_FIXED(tb) || !shrink(tb, nactive)) {
+	    break;
+	}
     }
 }	
 
+static ERTS_INLINE void try_grow(DbTableHash* tb, long nitems)
+{
+    int steps;
+    for (steps = 0; steps < RESIZE_STEPS; ++steps) {
+	int nactive = NACTIVE(tb);
+	if (nitems <= GROW_LIMIT(nactive) || IS_FIXED(tb)
+	    || !grow(tb, nactive)) {
+	    break;
+	}
+    }
+}
+
 /* Is this a live object (not pseodo-deleted) with the specified key? 
 */
 static ERTS_INLINE int has_live_key(DbTableHash* tb, HashDbTerm* b,
@@ -458,6 +549,229 @@ static ERTS_INLINE int has_key(DbTableHash* tb, HashDbTerm* b,
     }
 }
 
+#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+/*
+** Lock free reading (DB_LOCKFREE_READ, only for DB_SET)
+**
+** Lookups walk the bucket without taking the bucket lock. Writers still
+** serialize on the bucket locks but never modify a linked object in place,
+** they link in a complete new copy and "retire" the old one. Unlinked
+** objects (and segments released by shrink) are freed by epoch based
+** reclamation: each scheduler announces the global epoch while reading,
+** and a retired item is freed when the global epoch has advanced twice
+** since it was unlinked, which cannot happen while any reader that could
+** have seen it is still inside its read section.
+**
+** A split or join of a bucket may make a reader miss an existing key.
+** Grow/shrink therefore bump the resize_seq of the bucket lock to odd
+** while relinking, and a "not found" is only trusted if resize_seq was
+** even and unchanged during the walk.
+*/
+#  define IS_LOCKFREE(tb) ((tb)->common.type & DB_LOCKFREE_READ)
+/* Make a new object visible to readers before linking it */
+#  define LOCKFREE_WRITE_BARRIER(tb) \
+    do { if (IS_LOCKFREE(tb)) ERTS_THR_MEMORY_BARRIER; } while(0)
+#  define RESIZE_SEQ(tb,hval) \
+    (&(tb)->locks->lck_vec[(hval) & DB_HASH_LOCK_MASK].s.resize_seq)
+
+#  define LOCKFREE_RETIRE_LIMIT 64  /* try reclaim when this many retired */
+#  define LOCKFREE_READ_RETRIES 3   /* racing resizes before taking lock */
+
+typedef union {
+    erts_smp_atomic_t epoch;   /* (epoch << 1) | 1 while reading, else 0 */
+    byte _cache_line_alignment[64];
+} DbHashReaderEpoch;
+
+static erts_smp_atomic_t lockfree_epoch;
+static DbHashReaderEpoch* reader_epochs;  /* one per scheduler */
+static int no_reader_epochs;
+
+/* Enter read section. NULL if not a scheduler thread (use locks instead).
+*/
+static ERTS_INLINE DbHashReaderEpoch* lockfree_read_begin(void)
+{
+    ErtsSchedulerData *esdp = erts_get_scheduler_data();
+    DbHashReaderEpoch* rep;
+
+    if (esdp == NULL || esdp->no == 0 || esdp->no > no_reader_epochs) {
+	return NULL;
+    }
+    rep = &reader_epochs[esdp->no - 1];
+    ASSERT(erts_smp_atomic_read(&rep->epoch) == 0);
+    /* xchg for the full barrier before we start reading the table */
+    erts_smp_atomic_xchg(&rep->epoch,
+			 (erts_smp_atomic_read(&lockfree_epoch) << 1) | 1);
+    return rep;
+}
+
+static ERTS_INLINE void lockfree_read_end(DbHashReaderEpoch* rep)
+{
+    ERTS_THR_MEMORY_BARRIER;
+    erts_smp_atomic_set(&rep->epoch, 0);
+}
+
+/* Search bucket for a live object with key, without bucket lock.
+** Returns 0 if raced by grow/shrink too many times, caller must then
+** do a locked lookup. Otherwise 1 with object (or NULL) in *bp.
+*/
+static ERTS_INLINE int lockfree_search(DbTableHash* tb, Eterm key,
+				       HashValue hval, HashDbTerm** bp)
+{
+    erts_smp_atomic_t* seqp = RESIZE_SEQ(tb,hval);
+    int tries;
+
+    for (tries = 0; tries < LOCKFREE_READ_RETRIES; ++tries) {
+	long seq = erts_smp_atomic_read(seqp);
+	HashDbTerm* b;
+
+	if (seq & 1) {
+	    continue; /* bucket split or join in progress */
+	}
+	ERTS_THR_MEMORY_BARRIER;
+	b = BUCKET(tb, hash_to_ix(tb, hval));
+	while (b != NULL && !has_live_key(tb,b,key,hval)) {
+	    b = b->next;
+	}
+	if (b != NULL) {
+	    *bp = b;
+	    return 1;
+	}
+	ERTS_THR_MEMORY_BARRIER;
+	if (erts_smp_atomic_read(seqp) == seq) {
+	    *bp = NULL;
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+static ERTS_INLINE void begin_resize_seq(DbTableHash* tb, int ix)
+{
+    if (IS_LOCKFREE(tb)) {
+	erts_smp_atomic_inc(RESIZE_SEQ(tb,ix));
+	ERTS_THR_MEMORY_BARRIER;
+    }
+}
+
+static ERTS_INLINE void end_resize_seq(DbTableHash* tb, int ix)
+{
+    if (IS_LOCKFREE(tb)) {
+	ERTS_THR_MEMORY_BARRIER;
+	erts_smp_atomic_inc(RESIZE_SEQ(tb,ix));
+	ASSERT((erts_smp_atomic_read(RESIZE_SEQ(tb,ix)) & 1) == 0);
+    }
+}
+
+static void free_retired(DbTableHash* tb, DbHashRetired* r)
+{
+    if (r->seg_bytes == 0) {
+	do_free_term(tb, (HashDbTerm*) r->ptr);
+    }
+    else {
+	erts_db_free(ERTS_ALC_T_DB_SEG, (DbTable *)tb, r->ptr, r->seg_bytes);
+    }
+    erts_db_free(ERTS_ALC_T_DB_FIX_DEL, (DbTable *) tb,
+		 (void *) r, sizeof(DbHashRetired));
+    ERTS_ETS_MISC_MEM_ADD(-sizeof(DbHashRetired));
+}
+
+/* Lockless atomic insertion of list first..last into retired list */
+static void push_retired(DbTableHash* tb, DbHashRetired* first,
+			 DbHashRetired* last)
+{
+    long was_next = erts_smp_atomic_read(&tb->retired);
+    long exp_next;
+    do {
+	exp_next = was_next;
+	last->next = (DbHashRetired*) exp_next;
+	was_next = erts_smp_atomic_cmpxchg(&tb->retired, (long)first, exp_next);
+    }while (was_next != exp_next);
+}
+
+/* Advance global epoch if no reader is left in an older one */
+static void try_advance_epoch(void)
+{
+    long epoch = erts_smp_atomic_read(&lockfree_epoch);
+    int i;
+
+    ERTS_THR_MEMORY_BARRIER;
+    for (i = 0; i < no_reader_epochs; ++i) {
+	long e = erts_smp_atomic_read(&reader_epochs[i].epoch);
+	if (e != 0 && (e >> 1) != epoch) {
+	    return;
+	}
+    }
+    erts_smp_atomic_cmpxchg(&lockfree_epoch, epoch+1, epoch);
+}
+
+/* Free retired items that no reader can see anymore */
+static void reclaim_retired(DbTableHash* tb)
+{
+    DbHashRetired* r;
+    DbHashRetired* keep = NULL;
+    DbHashRetired* keep_last = NULL;
+    long epoch;
+    long freed = 0;
+
+    try_advance_epoch();
+    epoch = erts_smp_atomic_read(&lockfree_epoch);
+    r = (DbHashRetired*) erts_smp_atomic_xchg(&tb->retired, (long)NULL);
+    while (r != NULL) {
+	DbHashRetired* nxt = r->next;
+	if (epoch - r->epoch >= 2) {
+	    free_retired(tb, r);
+	    ++freed;
+	}
+	else {
+	    r->next = keep;
+	    keep = r;
+	    if (keep_last == NULL) keep_last = r;
+	}
+	r = nxt;
+    }
+    if (keep != NULL) {
+	push_retired(tb, keep, keep_last);
+    }
+    erts_smp_atomic_add(&tb->nretired, -freed);
+}
+
+/* Unlinked object or segment is freed when no reader can see it */
+static void retire(DbTableHash* tb, void* ptr, Uint seg_bytes)
+{
+    DbHashRetired* r = (DbHashRetired*) erts_db_alloc(ERTS_ALC_T_DB_FIX_DEL,
+						      (DbTable *) tb,
+						      sizeof(DbHashRetired));
+    ERTS_ETS_MISC_MEM_ADD(sizeof(DbHashRetired));
+    r->ptr = ptr;
+    r->seg_bytes = seg_bytes;
+    ERTS_THR_MEMORY_BARRIER; /* read epoch after the unlink */
+    r->epoch = erts_smp_atomic_read(&lockfree_epoch);
+    push_retired(tb, r, r);
+    if (erts_smp_atomic_inctest(&tb->nretired) > LOCKFREE_RETIRE_LIMIT) {
+	reclaim_retired(tb);
+    }
+}
+
+/* Free all retired items. Table must be exclusively locked. */
+static void free_all_retired(DbTableHash* tb)
+{
+    DbHashRetired* r;
+    r = (DbHashRetired*) erts_smp_atomic_xchg(&tb->retired, (long)NULL);
+    while (r != NULL) {
+	DbHashRetired* nxt = r->next;
+	free_retired(tb, r);
+	r = nxt;
+    }
+    erts_smp_atomic_set(&tb->nretired, 0);
+}
+
+#else /* !DB_HASH_LOCKFREE_READ_SUPPORT */
+#  define IS_LOCKFREE(tb) 0
+#  define LOCKFREE_WRITE_BARRIER(tb)
+#  define begin_resize_seq(tb,ix)
+#  define end_resize_seq(tb,ix)
+#endif /* DB_HASH_LOCKFREE_READ_SUPPORT */
+
 
 /*
 ** External interface 
@@ -471,6 +785,7 @@ DbTableMethod db_hash =
     db_next_hash,    /* prev == next   */
     db_put_hash,
     db_get_hash,
+    db_get_many_hash,
     db_get_element_hash,
     db_member_hash,
     db_erase_hash,
@@ -488,6 +803,8 @@ DbTableMethod db_hash =
     db_free_table_continue_hash,
     db_print_hash,
     db_foreach_offheap_hash,
+    db_foreach_key_hash,
+    db_foreach_dbterm_hash,
 #ifdef HARDDEBUG
     db_check_table_hash,
 #else
@@ -616,11 +933,19 @@ int db_create_hash(Process *p, DbTable *tbl)
     erts_smp_atomic_init(&tb->szm, SEGSZ_MASK);
     erts_smp_atomic_init(&tb->nactive, SEGSZ);
     erts_smp_atomic_init(&tb->fixdel, (long)NULL);
+#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+    erts_smp_atomic_init(&tb->retired, (long)NULL);
+    erts_smp_atomic_init(&tb->nretired, 0);
+#endif
     erts_smp_atomic_init(&tb->segtab, (long) alloc_ext_seg(tb,0,NULL)->segtab);
     tb->nsegs = NSEG_1;
     tb->nslots = SEGSZ;
 
     erts_smp_atomic_init(&tb->is_resizing, 0);
+    tb->min_nactive = SEGSZ;
+    if (tb->common.size_hint > GROW_LIMIT(SEGSZ)) {
+	presize(tb, tb->common.size_hint);
+    }
 #ifdef ERTS_SMP
     if (tb->common.type & DB_FINE_LOCKED) {
 	int i;
@@ -628,7 +953,11 @@ int db_create_hash(Process *p, DbTable *tbl)
 							      (DbTable *) tb,
 							      sizeof(DbTableHashFineLocks));	    	    
 	for (i=0; i<DB_HASH_LOCK_CNT; ++i) {
-	    erts_rwmtx_init_x(&tb->locks->lck_vec[i].lck, "db_hash_slot", make_small(i));
+	    erts_rwmtx_init_x(&tb->locks->lck_vec[i].s.lck, "db_hash_slot", make_small(i));
+	    erts_smp_atomic_init(&tb->locks->lck_vec[i].s.resize_seq, 0);
+	    erts_smp_atomic_init(&tb->locks->lck_vec[i].s.wait_count, 0);
+	    erts_smp_atomic_init(&tb->locks->lck_vec[i].s.wait_sec, 0);
+	    erts_smp_atomic_init(&tb->locks->lck_vec[i].s.wait_usec, 0);
 	}
 	/* This important property is needed to guarantee that the buckets
     	 * involved in a grow/shrink operation it protected by the same lock:
@@ -723,18 +1052,95 @@ int db_put_hash(DbTable *tbl, Eterm obj, int key_clash_fail)
 {
     DbTableHash *tb = &tbl->hash;
     HashValue hval;
+    HashDbTerm* retired;
+    erts_smp_rwmtx_t* lck;
+    long nitems;
+    int ret;
+
+    hval = MAKE_HASH(GETKEY(tb, tuple_val(obj)));
+    lck = WLOCK_HASH(tb, hval);
+    ret = put_locked(tb, obj, hval, key_clash_fail, &retired, &nitems);
+    WUNLOCK_HASH(lck);
+    if (retired != NULL) {
+	free_term(tb, retired);
+    }
+    if (nitems != 0) {
+	try_grow(tb, nitems);
+	CHECK_TABLES();
+    }
+    return ret;
+}
+
+/* Insert a list of objects into a table that is not exclusively locked.
+** The objects are grouped by lock stripe and all stripes needed are
+** write locked, in ascending order, before anything is inserted. Other
+** writers and readers that take the stripe locks thereby see either
+** none or all of the objects. Lock free readers (DB_LOCKFREE_READ) take
+** no stripe lock and may see the insert half done, though each object
+** on its own is still replaced atomically. Objects with the same key
+** keep their relative order, the last one wins in a set.
+*/
+int db_put_many_hash(DbTable *tbl, Eterm *objs, Uint nobjs)
+{
+    DbTableHash *tb = &tbl->hash;
+    HashValue* hvals;
+    Uint* order;
+    Uint i;
+    long nitems;
+    Uint added = 0;
+    int locked[DB_HASH_LOCK_CNT];
+
+    order = erts_alloc(ERTS_ALC_T_DB_TMP,
+		       nobjs * (sizeof(Uint) + sizeof(HashValue)));
+    hvals = (HashValue*) (order + nobjs);
+    for (i = 0; i < nobjs; ++i) {
+	hvals[i] = MAKE_HASH(GETKEY(tb, tuple_val(objs[i])));
+    }
+    sort_by_stripe(hvals, nobjs, order);
+
+    lock_stripes(tb, hvals, order, nobjs, 1, locked);
+    for (i = 0; i < nobjs; ++i) {
+	HashDbTerm* retired;
+	Uint j = order[i];
+
+	put_locked(tb, objs[j], hvals[j], 0, &retired, &nitems);
+	if (retired != NULL) {
+	    free_term(tb, retired);
+	}
+	if (nitems != 0) {
+	    ++added;
+	}
+    }
+    unlock_stripes(tb, 1, locked);
+    erts_free(ERTS_ALC_T_DB_TMP, order);
+    if (added != 0) {
+	/* Allow as many grow steps as inserting the objects one by one
+	   would have, the table cannot grow while we hold the stripes */
+	for (i = 0; i < added; ++i) {
+	    try_grow(tb, NITEMS(tb));
+	}
+	CHECK_TABLES();
+    }
+    return DB_ERROR_NONE;
+}
+
+/* Insert obj into its bucket with the lock stripe of hval write locked.
+** An object replaced in a lock free table is handed back in *retiredp,
+** to be freed by the caller, and *nitemsp is set to the new number of
+** items if the table grew, otherwise to zero.
+*/
+static int put_locked(DbTableHash *tb, Eterm obj, HashValue hval,
+		      int key_clash_fail, HashDbTerm** retiredp, long* nitemsp)
+{
     int ix;
     Eterm key;
     HashDbTerm** bp;
     HashDbTerm* b;
     HashDbTerm* q;
-    erts_smp_rwmtx_t* lck;
-    int nitems;
-    int ret = DB_ERROR_NONE;
 
+    *retiredp = NULL;
+    *nitemsp = 0;
     key = GETKEY(tb, tuple_val(obj));
-    hval = MAKE_HASH(key);
-    lck = WLOCK_HASH(tb, hval);
     ix = hash_to_ix(tb, hval);
     bp = &BUCKET(tb, ix);
     b = *bp;
@@ -757,21 +1163,28 @@ int db_put_hash(DbTable *tbl, Eterm obj, int key_clash_fail)
 	    erts_smp_atomic_inc(&tb->common.nitems);
 	}
 	else if (key_clash_fail) {
-	    ret = DB_ERROR_BADKEY;
-	    goto Ldone;
+	    return DB_ERROR_BADKEY;
+	}
+	if (IS_LOCKFREE(tb)) {
+	    /* Readers may be looking at b, replace it with a new object */
+	    q = get_term(tb, NULL, obj, hval);
+	    q->next = bnext;
+	    LOCKFREE_WRITE_BARRIER(tb);
+	    *bp = q;
+	    *retiredp = b;
+	    return DB_ERROR_NONE;
 	}
 	q = get_term(tb, b, obj, hval);
 	q->next = bnext;
 	q->hvalue = hval; /* In case of INVALID_HASH */
 	*bp = q;
-	goto Ldone;
+	return DB_ERROR_NONE;
     }
     else if (key_clash_fail) { /* && (DB_BAG || DB_DUPLICATE_BAG) */
 	q = b;
 	do {
 	    if (q->hvalue != INVALID_HASH) {
-		ret = DB_ERROR_BADKEY;
-		goto Ldone;
+		return DB_ERROR_BADKEY;
 	    }
 	    q = q->next;
 	}while (q != NULL && has_key(tb,q,key,hval)); 	
@@ -780,7 +1193,7 @@ int db_put_hash(DbTable *tbl, Eterm obj, int key_clash_fail)
 	HashDbTerm** qp = bp;
 	q = b;
 	do {
-	    if (eq(make_tuple(q->dbterm.tpl), obj)) {
+	    if (db_eq_dbterm(&tb->common, obj, &q->dbterm)) {
 		if (q->hvalue == INVALID_HASH) {
 		    erts_smp_atomic_inc(&tb->common.nitems);
 		    q->hvalue = hval;
@@ -790,7 +1203,7 @@ int db_put_hash(DbTable *tbl, Eterm obj, int key_clash_fail)
 			*bp = q;
 		    }
 		}
-		goto Ldone;
+		return DB_ERROR_NONE;
 	    }
 	    qp = &q->next;
 	    q = *qp;
@@ -801,21 +1214,81 @@ int db_put_hash(DbTable *tbl, Eterm obj, int key_clash_fail)
 Lnew:
     q = get_term(tb, NULL, obj, hval);
     q->next = b;
+    LOCKFREE_WRITE_BARRIER(tb);
     *bp = q;
-    nitems = erts_smp_atomic_inctest(&tb->common.nitems);
-    WUNLOCK_HASH(lck);
-    {
-	int nactive = NACTIVE(tb);       
-	if (nitems > nactive * (CHAIN_LEN+1) && !IS_FIXED(tb)) {
-	    grow(tb, nactive);
+    *nitemsp = erts_smp_atomic_inctest(&tb->common.nitems);
+    return DB_ERROR_NONE;
+}
+
+/* Stable counting sort of n hash values by lock stripe, the resulting
+** permutation is written to order. Without SMP there are no stripes to
+** take and the original order is kept.
+*/
+static void sort_by_stripe(HashValue* hvals, Uint n, Uint* order)
+{
+    Uint i;
+#ifdef ERTS_SMP
+    Uint start[DB_HASH_LOCK_CNT + 1];
+
+    sys_memzero(start, sizeof(start));
+    for (i = 0; i < n; ++i) {
+	++start[(hvals[i] & DB_HASH_LOCK_MASK) + 1];
+    }
+    for (i = 1; i <= DB_HASH_LOCK_CNT; ++i) {
+	start[i] += start[i-1];
+    }
+    for (i = 0; i < n; ++i) {
+	order[start[hvals[i] & DB_HASH_LOCK_MASK]++] = i;
+    }
+#else
+    for (i = 0; i < n; ++i) {
+	order[i] = i;
+    }
+#endif
+}
+
+/* Lock each stripe used by the hash values sorted by sort_by_stripe(),
+** which is in ascending order. locked[] records what to unlock.
+*/
+static void lock_stripes(DbTableHash* tb, HashValue* hvals, Uint* order,
+			 Uint n, int write, int* locked)
+{
+#ifdef ERTS_SMP
+    Uint i;
+
+    sys_memzero(locked, DB_HASH_LOCK_CNT * sizeof(int));
+    if (tb->common.is_thread_safe) {
+	return;
+    }
+    for (i = 0; i < n; ++i) {
+	HashValue hval = hvals[order[i]];
+	if (!locked[hval & DB_HASH_LOCK_MASK]) {
+	    if (write) {
+		WLOCK_HASH(tb, hval);
+	    } else {
+		RLOCK_HASH(tb, hval);
+	    }
+	    locked[hval & DB_HASH_LOCK_MASK] = 1;
 	}
     }
-    CHECK_TABLES();
-    return DB_ERROR_NONE;
+#endif
+}
 
-Ldone:
-    WUNLOCK_HASH(lck);	
-    return ret;
+static void unlock_stripes(DbTableHash* tb, int write, int* locked)
+{
+#ifdef ERTS_SMP
+    int i;
+
+    for (i = DB_HASH_LOCK_CNT - 1; i >= 0; --i) {
+	if (locked[i]) {
+	    if (write) {
+		WUNLOCK_HASH(GET_LOCK(tb,i));
+	    } else {
+		RUNLOCK_HASH(GET_LOCK(tb,i));
+	    }
+	}
+    }
+#endif
 }
 
 int db_get_hash(Process *p, DbTable *tbl, Eterm key, Eterm *ret)
@@ -827,6 +1300,30 @@ int db_get_hash(Process *p, DbTable *tbl, Eterm key, Eterm *ret)
     erts_smp_rwmtx_t* lck;
 
     hval = MAKE_HASH(key);
+#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+    if (IS_LOCKFREE(tb)) {
+	DbHashReaderEpoch* rep = lockfree_read_begin();
+	if (rep != NULL) {
+	    if (lockfree_search(tb, key, hval, &b1)) {
+		if (b1 != NULL) {
+		    /* Not put_term_list(), b1->next may change under us */
+		    Eterm copy;
+		    Eterm* hp = HAlloc(p, db_size_dbterm(&tb->common,
+							 &b1->dbterm) + 2);
+		    copy = db_copy_dbterm(&tb->common, &b1->dbterm,
+					  &hp, &MSO(p));
+		    *ret = CONS(hp, copy, NIL);
+		}
+		else {
+		    *ret = NIL;
+		}
+		lockfree_read_end(rep);
+		return DB_ERROR_NONE;
+	    }
+	    lockfree_read_end(rep);
+	}
+    }
+#endif
     lck = RLOCK_HASH(tb,hval);
     ix = hash_to_ix(tb, hval);
     b1 = BUCKET(tb, ix);
@@ -840,7 +1337,7 @@ int db_get_hash(Process *p, DbTable *tbl, Eterm key, Eterm *ret)
 		while(b2 != NULL && has_key(tb,b2,key,hval))
 		    b2 = b2->next;
 	    }
-	    copy = put_term_list(p, b1, b2);
+	    copy = put_term_list(p, tb, b1, b2);
 	    CHECK_TABLES();
 	    *ret = copy;
 	    goto done;
@@ -853,6 +1350,80 @@ done:
     return DB_ERROR_NONE;
 }
 
+/* Look up a number of keys at once. The keys are grouped by lock stripe
+** so that each stripe is read locked only once, and everything found is
+** copied into one heap block. The result is the concatenation of what
+** db_get_hash() returns for each key, in key order.
+*/
+static int db_get_many_hash(Process *p, DbTable *tbl,
+			    Eterm *keys, Uint nkeys, Eterm *ret)
+{
+    DbTableHash *tb = &tbl->hash;
+    HashDbTerm** found;
+    HashValue* hvals;
+    Uint* order;
+    Uint i;
+    Uint sz = 0;
+    int locked[DB_HASH_LOCK_CNT];
+    Eterm list = NIL;
+    Eterm* hp;
+
+    order = erts_alloc(ERTS_ALC_T_DB_TMP,
+		       nkeys * (sizeof(Uint) + 2*sizeof(HashDbTerm*)
+				+ sizeof(HashValue)));
+    found = (HashDbTerm**) (order + nkeys);
+    hvals = (HashValue*) (found + 2*nkeys);
+    for (i = 0; i < nkeys; ++i) {
+	hvals[i] = MAKE_HASH(keys[i]);
+    }
+    sort_by_stripe(hvals, nkeys, order);
+    lock_stripes(tb, hvals, order, nkeys, 0, locked);
+
+    /* Find the object range of each key and the heap size needed */
+    for (i = 0; i < nkeys; ++i) {
+	Uint j = order[i];
+	HashDbTerm* b1 = BUCKET(tb, hash_to_ix(tb, hvals[j]));
+	HashDbTerm* b2 = NULL;
+
+	while (b1 != NULL && !has_live_key(tb,b1,keys[j],hvals[j])) {
+	    b1 = b1->next;
+	}
+	if (b1 != NULL) {
+	    HashDbTerm* b;
+	    b2 = b1->next;
+	    if (tb->common.status & (DB_BAG | DB_DUPLICATE_BAG)) {
+		while(b2 != NULL && has_key(tb,b2,keys[j],hvals[j]))
+		    b2 = b2->next;
+	    }
+	    for (b = b1; b != b2; b = b->next) {
+		if (b->hvalue != INVALID_HASH)
+		    sz += db_size_dbterm(&tb->common, &b->dbterm) + 2;
+	    }
+	}
+	found[2*j] = b1;
+	found[2*j+1] = b2;
+    }
+
+    /* Build the list backwards, each key as put_term_list() would */
+    hp = HAlloc(p, sz);
+    for (i = nkeys; i-- > 0; ) {
+	HashDbTerm* b;
+	for (b = found[2*i]; b != found[2*i+1]; b = b->next) {
+	    if (b->hvalue != INVALID_HASH) {
+		Eterm copy = db_copy_dbterm(&tb->common, &b->dbterm,
+					    &hp, &MSO(p));
+		list = CONS(hp, copy, list);
+		hp += 2;
+	    }
+	}
+    }
+    CHECK_TABLES();
+    unlock_stripes(tb, 0, locked);
+    erts_free(ERTS_ALC_T_DB_TMP, order);
+    *ret = list;
+    return DB_ERROR_NONE;
+}
+
 int db_get_element_array(DbTable *tbl, 
 			 Eterm key,
 			 int ndex, 
@@ -926,6 +1497,19 @@ static int db_member_hash(DbTable *tbl, Eterm key, Eterm *ret)
     erts_smp_rwmtx_t* lck;
 
     hval = MAKE_HASH(key);
+#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+    if (IS_LOCKFREE(tb)) {
+	DbHashReaderEpoch* rep = lockfree_read_begin();
+	if (rep != NULL) {
+	    if (lockfree_search(tb, key, hval, &b1)) {
+		*ret = (b1 != NULL) ? am_true : am_false;
+		lockfree_read_end(rep);
+		return DB_ERROR_NONE;
+	    }
+	    lockfree_read_end(rep);
+	}
+    }
+#endif
     ix = hash_to_ix(tb, hval);
     lck = RLOCK_HASH(tb, hval);
     b1 = BUCKET(tb, ix);
@@ -956,6 +1540,29 @@ static int db_get_element_hash(Process *p, DbTable *tbl,
     int retval;
     
     hval = MAKE_HASH(key);
+#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+    if (IS_LOCKFREE(tb)) {
+	DbHashReaderEpoch* rep = lockfree_read_begin();
+	if (rep != NULL) {
+	    if (lockfree_search(tb, key, hval, &b1)) {
+		if (b1 == NULL) {
+		    retval = DB_ERROR_BADKEY;
+		}
+		else if (ndex > arityval(b1->dbterm.tpl[0])) {
+		    retval = DB_ERROR_BADITEM;
+		}
+		else {
+		    *ret = db_copy_element_proc(&tb->common, p,
+						&b1->dbterm, ndex);
+		    retval = DB_ERROR_NONE;
+		}
+		lockfree_read_end(rep);
+		return retval;
+	    }
+	    lockfree_read_end(rep);
+	}
+    }
+#endif
     lck = RLOCK_HASH(tb, hval);
     ix = hash_to_ix(tb, hval);
     b1 = BUCKET(tb, ix);
@@ -988,10 +1595,12 @@ static int db_get_element_hash(Process *p, DbTable *tbl,
 		while(b != b2) {
 		    if (b->hvalue != INVALID_HASH) {
 			Eterm *hp;
-			Uint sz = size_object(b->dbterm.tpl[ndex])+2;
+			Uint sz = db_size_element(&tb->common, &b->dbterm,
+						  ndex) + 2;
 			
 			hp = HAlloc(p, sz);
-			copy = copy_struct(b->dbterm.tpl[ndex], sz-2, &hp, &MSO(p));
+			copy = db_copy_element(&tb->common, &b->dbterm, ndex,
+					       &hp, &MSO(p));
 			elem_list = CONS(hp, copy, elem_list);
 			hp += 2;
 		    }
@@ -1000,8 +1609,7 @@ static int db_get_element_hash(Process *p, DbTable *tbl,
 		*ret = elem_list;
 	    }
 	    else {
-		COPY_OBJECT(b1->dbterm.tpl[ndex], p, &copy);
-		*ret = copy;
+		*ret = db_copy_element_proc(&tb->common, p, &b1->dbterm, ndex);
 	    }
 	    retval = DB_ERROR_NONE;
 	    goto done;
@@ -1135,7 +1743,7 @@ static int db_erase_object_hash(DbTable *tbl, Eterm object, Eterm *ret)
     while(b != 0) {
 	if (has_live_key(tb,b,key,hval)) {
 	    ++nkeys;
-	    if (eq(object, make_tuple(b->dbterm.tpl))) {
+	    if (db_eq_dbterm(&tb->common, object, &b->dbterm)) {
 		--nitems_diff;
 		if (nkeys==1 && IS_FIXED(tb)) { /* Pseudo remove */
 		    add_fixed_deletion(tb,ix);
@@ -1184,7 +1792,7 @@ static int db_slot_hash(Process *p, DbTable *tbl, Eterm slot_term, Eterm *ret)
     lck = RLOCK_HASH(tb, slot);
     nactive = NACTIVE(tb);
     if (slot < nactive) {
-	*ret = put_term_list(p, BUCKET(tb, slot), 0);
+	*ret = put_term_list(p, tb, BUCKET(tb, slot), 0);
 	retval = DB_ERROR_NONE;
     }
     else if (slot == nactive) {
@@ -1210,6 +1818,316 @@ static BIF_RETTYPE bif_trap1(Export *bif,
     BIF_TRAP1(bif, p, p1);
 }
     
+typedef enum { PSCAN_SELECT, PSCAN_COUNT, PSCAN_DELETE } DbHashScanOp;
+
+#ifdef ERTS_SMP
+/*
+** Parallel full table scans, for tables created with {parallel_scan,true}.
+** Each round of PSCAN_ROUND_SLOTS slots is split into chunks within one
+** lock stripe. The chunks are claimed both by the calling process and by
+** idle schedulers that got pscan_helper() as a misc op.
+**
+** All parties hold the table read locked while they claim and scan
+** chunks. A helper only takes the lock (and thereby touches the table at
+** all) while the caller is still claiming, which keeps the table alive
+** for it, and simply stays out if the lock is not free right away. When
+** the caller has run out of chunks it lets go of its table lock while it
+** waits for the helpers still scanning one. The table is then read
+** locked by them, not by a sleeping caller. Select deletes therefore only
+** run in parallel on tables with fine grained locking; on other tables
+** they need the table write locked.
+**
+** Each party matches with the match context of its own scheduler, and
+** select results are copied out right away under the stripe lock into
+** heap fragments of the chunk, consed in slot order. The caller links
+** the fragments into its heap, so no object is matched or copied twice.
+**
+** The scan job is freed by whichever thread is done with it last, so it
+** is not allocated as ERTS_ALC_T_DB_TMP (temp_alloc has thread specific
+** instances).
+*/
+#define PSCAN_CHUNK_SLOTS 512
+#define PSCAN_ROUND_SLOTS (64*PSCAN_CHUNK_SLOTS)
+#define PSCAN_MAX_CHUNKS (PSCAN_ROUND_SLOTS/PSCAN_CHUNK_SLOTS + DB_HASH_LOCK_CNT)
+#define PSCAN_FRAG_WORDS 1024
+
+#define PARALLEL_SCAN(tb) (((tb)->common.status & DB_PARALLEL_SCAN)	\
+			   && erts_no_schedulers > 1			\
+			   && NACTIVE(tb) >= 2*PSCAN_CHUNK_SLOTS)
+#define PARALLEL_DELETE(tb) (PARALLEL_SCAN(tb)				\
+			     && ((tb)->common.status & DB_FINE_LOCKED))
+
+typedef struct {
+    int stripe;
+    Uint k0, k1;          /* slots k*DB_HASH_LOCK_CNT+stripe for k0 <= k < k1 */
+    ErlHeapFragment* bp;  /* PSCAN_SELECT: copies of the results ... */
+    Eterm list;           /* ... consed onto each other in slot order */
+    Eterm* tail;          /* the tail of the first cons in list */
+} DbHashScanChunk;
+
+typedef struct {
+    DbTableHash* tb;
+    Eterm self;           /* the calling process, for self() in matches */
+    Binary* mp;
+    DbHashScanOp op;
+    int all_objects;
+    int fixated_by_me;
+    long nchunks;
+    erts_smp_atomic_t next;   /* next chunk to claim */
+    erts_smp_atomic_t refc;
+    erts_smp_atomic_t got;
+    DbWorkers workers;        /* helpers that may be scanning */
+    DbHashScanChunk chunk[1];
+} DbHashScan;
+
+static Eterm* pscan_alloc_heap(DbHashScanChunk* ch, Uint need)
+{
+    ErlHeapFragment* bp = ch->bp;
+    Eterm* hp;
+
+    if (bp == NULL || bp->alloc_size - bp->used_size < need) {
+	bp = new_message_buffer(need > PSCAN_FRAG_WORDS
+				? need : PSCAN_FRAG_WORDS);
+	bp->used_size = 0;
+	bp->next = ch->bp;
+	ch->bp = bp;
+    }
+    hp = bp->mem + bp->used_size;
+    bp->used_size += need;
+    return hp;
+}
+
+static void pscan_chunk(DbHashScan* sc, DbHashScanChunk* ch,
+			ErtsSchedulerData* esdp)
+{
+    DbTableHash* tb = sc->tb;
+    Uint last_pseudo_delete = (Uint)-1;
+    erts_smp_rwmtx_t* lck;
+    Uint32 dummy;
+    long got = 0;
+    Uint k;
+
+    if (sc->op == PSCAN_DELETE) {
+	lck = WLOCK_HASH(tb, ch->stripe);
+    } else {
+	lck = RLOCK_HASH(tb, ch->stripe);
+    }
+    for (k = ch->k0; k < ch->k1; k++) {
+	Uint ix = k*DB_HASH_LOCK_CNT + ch->stripe;
+	HashDbTerm** bp = &BUCKET(tb, ix);
+
+	while (*bp != NULL) {
+	    HashDbTerm* b = *bp;
+	    Eterm res;
+
+	    if (b->hvalue == INVALID_HASH) {
+		bp = &b->next;
+		continue;
+	    }
+	    res = db_prog_match_table(esdp, sc->self, sc->mp,
+				      make_tuple(b->dbterm.tpl), &dummy);
+	    switch (sc->op) {
+	    case PSCAN_SELECT:
+		if (is_value(res)) {
+		    Eterm* hp;
+		    Uint sz;
+
+		    if (sc->all_objects) {
+			sz = b->dbterm.size;
+			hp = pscan_alloc_heap(ch, sz + 2);
+			res = copy_shallow(DBTERM_BUF(&b->dbterm), sz,
+					   &hp, &ch->bp->off_heap);
+		    } else {
+			sz = size_object(res);
+			hp = pscan_alloc_heap(ch, sz + 2);
+			res = copy_struct(res, sz, &hp, &ch->bp->off_heap);
+		    }
+		    if (ch->tail == NULL) {
+			ch->tail = hp + 1;
+		    }
+		    ch->list = CONS(hp, res, ch->list);
+		    ++got;
+		}
+		break;
+	    case PSCAN_COUNT:
+		if (res == am_true) {
+		    ++got;
+		}
+		break;
+	    case PSCAN_DELETE:
+		if (res == am_true) {
+		    erts_smp_atomic_dec(&tb->common.nitems);
+		    ++got;
+		    if (NFIXED(tb) > sc->fixated_by_me) { /* fixated by others? */
+			if (ix != last_pseudo_delete) {
+			    add_fixed_deletion(tb, ix);
+			    last_pseudo_delete = ix;
+			}
+			b->hvalue = INVALID_HASH;
+		    } else {
+			*bp = b->next;
+			free_term(tb, b);
+			continue;
+		    }
+		}
+		break;
+	    }
+	    bp = &b->next;
+	}
+    }
+    if (sc->op == PSCAN_DELETE) {
+	WUNLOCK_HASH(lck);
+    } else {
+	RUNLOCK_HASH(lck);
+    }
+    erts_smp_atomic_add(&sc->got, got);
+}
+
+static void pscan_work(DbHashScan* sc, ErtsSchedulerData* esdp)
+{
+    for (;;) {
+	long c = erts_smp_atomic_inctest(&sc->next) - 1;
+	if (c >= sc->nchunks) {
+	    break;
+	}
+	pscan_chunk(sc, &sc->chunk[c], esdp);
+    }
+}
+
+static void pscan_deref(DbHashScan* sc)
+{
+    if (erts_smp_atomic_dectest(&sc->refc) == 0) {
+	db_workers_destroy(&sc->workers);
+	erts_free(ERTS_ALC_T_DB_SEL_LIST, sc);
+    }
+}
+
+/* Misc op run by an idle scheduler */
+static void pscan_helper(void* arg)
+{
+    DbHashScan* sc = (DbHashScan*) arg;
+    erts_smp_rwmtx_t* rwlock = &sc->tb->common.rwlock;
+
+    db_workers_enter(&sc->workers);
+    /* Chunks left means that the caller still holds the table */
+    if (erts_smp_atomic_read(&sc->next) < sc->nchunks
+	&& erts_smp_rwmtx_tryrlock(rwlock) == 0) {
+	pscan_work(sc, erts_get_scheduler_data());
+	erts_smp_rwmtx_runlock(rwlock);
+    }
+    db_workers_leave(&sc->workers);
+    pscan_deref(sc);
+}
+
+/*
+** Scan one round from slot_ix, in the same stripe major order as
+** next_slot(). The caller holds the table read locked but no stripe
+** lock; the table lock is let go of and taken again if the caller has
+** to wait for helpers. Adds the number of matching (or deleted) objects
+** to *got and, for PSCAN_SELECT, conses the results onto *match_list.
+** Returns the slot to continue from, or 0 when the table is done or
+** was deleted meanwhile.
+*/
+static Uint pscan_round(Process* p, DbTableHash* tb, Binary* mp,
+			DbHashScanOp op, int all_objects, int fixated_by_me,
+			Uint slot_ix, Uint* got, Eterm* match_list)
+{
+    Uint nactive = NACTIVE(tb);
+    int s = slot_ix & DB_HASH_LOCK_MASK;
+    Uint k = slot_ix / DB_HASH_LOCK_CNT;
+    Uint left = PSCAN_ROUND_SLOTS;
+    DbHashScan* sc;
+    long n = 0;
+    int helpers, posted;
+    long i;
+
+    ASSERT(!tb->common.is_thread_safe || op != PSCAN_DELETE);
+    sc = erts_alloc(ERTS_ALC_T_DB_SEL_LIST,
+		    sizeof(DbHashScan)
+		    + (PSCAN_MAX_CHUNKS-1) * sizeof(DbHashScanChunk));
+    for (;;) {
+	Uint len;
+	while (s < DB_HASH_LOCK_CNT && k*DB_HASH_LOCK_CNT + s >= nactive) {
+	    ++s;
+	    k = 0;
+	}
+	if (s == DB_HASH_LOCK_CNT || left == 0) {
+	    break;
+	}
+	len = (nactive - s + DB_HASH_LOCK_CNT - 1) / DB_HASH_LOCK_CNT - k;
+	if (len > left) len = left;
+	if (len > PSCAN_CHUNK_SLOTS) len = PSCAN_CHUNK_SLOTS;
+	ASSERT(n < PSCAN_MAX_CHUNKS);
+	sc->chunk[n].stripe = s;
+	sc->chunk[n].k0 = k;
+	sc->chunk[n].k1 = k + len;
+	sc->chunk[n].bp = NULL;
+	sc->chunk[n].list = NIL;
+	sc->chunk[n].tail = NULL;
+	++n;
+	k += len;
+	left -= len;
+    }
+    slot_ix = (s < DB_HASH_LOCK_CNT) ? k*DB_HASH_LOCK_CNT + s : 0;
+
+    sc->tb = tb;
+    sc->self = p->id;
+    sc->mp = mp;
+    sc->op = op;
+    sc->all_objects = all_objects;
+    sc->fixated_by_me = fixated_by_me;
+    sc->nchunks = n;
+    erts_smp_atomic_init(&sc->next, 0);
+    db_workers_init(&sc->workers);
+    erts_smp_atomic_init(&sc->got, 0);
+
+    helpers = (int) (n - 1);
+    if (helpers > (int) erts_no_schedulers - 1) {
+	helpers = (int) erts_no_schedulers - 1;
+    }
+    erts_smp_atomic_init(&sc->refc, 1 + helpers);
+    posted = (helpers > 0
+	      ? erts_schedule_misc_op_idle(helpers, pscan_helper, (void *) sc)
+	      : 0);
+    if (posted < helpers) {
+	erts_smp_atomic_add(&sc->refc, posted - helpers);
+    }
+
+    pscan_work(sc, ERTS_GET_SCHEDULER_DATA_FROM_PROC(p));
+    /* All chunks are claimed, wait for the helpers still scanning one */
+    if (erts_smp_atomic_read(&sc->workers.busy) != 0) {
+	erts_smp_rwmtx_runlock(&tb->common.rwlock);
+	db_workers_wait(&sc->workers);
+	erts_smp_rwmtx_rlock(&tb->common.rwlock);
+	if (tb->common.status & DB_DELETE) {
+	    slot_ix = 0;
+	}
+    }
+
+    *got += erts_smp_atomic_read(&sc->got);
+    for (i = 0; i < n; i++) {
+	DbHashScanChunk* ch = &sc->chunk[i];
+	ErlHeapFragment* bp = ch->bp;
+
+	if (ch->list != NIL) {
+	    *ch->tail = *match_list;
+	    *match_list = ch->list;
+	}
+	while (bp != NULL) {
+	    ErlHeapFragment* next = bp->next;
+	    erts_link_mbuf_to_proc(p, bp);
+	    bp = next;
+	}
+    }
+    pscan_deref(sc);
+    return slot_ix;
+}
+#else
+#define PARALLEL_SCAN(tb) 0
+#define PARALLEL_DELETE(tb) 0
+#define pscan_round(P,TB,MP,OP,ALL,FIX,IX,GOT,ML) 0
+#endif /* ERTS_SMP */
+
 /*
  * Continue collecting select matches, this may happen either due to a trap
  * or when the user calls ets:select/1
@@ -1228,8 +2146,6 @@ static int db_select_continue_hash(Process *p,
     int num_left = 1000;
     HashDbTerm *current = 0;
     Eterm match_list;
-    Uint32 dummy;
-    unsigned sz;
     Eterm *hp;
     Eterm match_res;
     Sint got;
@@ -1266,6 +2182,20 @@ static int db_select_continue_hash(Process *p,
 	goto done; /* Already got all or enough in the match_list */
     }
 
+    if (!chunk_size && PARALLEL_SCAN(tb)) {
+	if (slot_ix >= NACTIVE(tb)) {
+	    RET_TO_BIF(NIL,DB_ERROR_BADPARAM);
+	}
+	slot_ix = pscan_round(p, tb, mp, PSCAN_SELECT, all_objects, 0,
+			      slot_ix, (Uint*)&got, &match_list);
+	if (slot_ix == 0) {
+	    slot_ix = -1; /* EOT */
+	    num_left = 0;
+	    goto done;
+	}
+	goto trap;
+    }
+
     lck = RLOCK_HASH(tb,slot_ix);
     if (slot_ix >= NACTIVE(tb)) {
 	RUNLOCK_HASH(lck);	
@@ -1282,22 +2212,10 @@ static int db_select_continue_hash(Process *p,
     for(;;) {
 	if (current->hvalue != INVALID_HASH && 
 	    (match_res = 
-	     db_prog_match(p,mp,
-			   make_tuple(current->dbterm.tpl),
-			   NULL,0,&dummy),
+	     db_match_dbterm(&tb->common, p, mp, all_objects,
+			     &current->dbterm),
 	     is_value(match_res))) {
-	    if (all_objects) {
-		hp = HAlloc(p, current->dbterm.size + 2);
-		match_res = copy_shallow(DBTERM_BUF(&current->dbterm),
-					 current->dbterm.size,
-					 &hp,
-					 &MSO(p));
-	    } else {
-		sz = size_object(match_res);
-	    
-		hp = HAlloc(p, sz + 2);
-		match_res = copy_struct(match_res, sz, &hp, &MSO(p));
-	    }
+	    hp = HAlloc(p, 2);
             match_list = CONS(hp, match_res, match_list);
 	    ++got;
 	}
@@ -1391,9 +2309,7 @@ static int db_select_chunk_hash(Process *p, DbTable *tbl,
     HashDbTerm *current = 0;
     unsigned current_list_pos = 0;
     Eterm match_list;
-    Uint32 dummy;
     Eterm match_res;
-    unsigned sz;
     Eterm *hp;
     int num_left = 1000;
     Uint got = 0;
@@ -1428,6 +2344,18 @@ static int db_select_chunk_hash(Process *p, DbTable *tbl,
 	/* can't possibly match anything */
     }
 
+    if (!mpi.key_given && !chunk_size && PARALLEL_SCAN(tb)) {
+	match_list = NIL;
+	slot_ix = pscan_round(p, tb, mpi.mp, PSCAN_SELECT, mpi.all_objects, 0,
+			      0, &got, &match_list);
+	if (slot_ix == 0) {
+	    slot_ix = -1; /* EOT */
+	    num_left = 0;
+	    goto done;
+	}
+	goto trap;
+    }
+
     if (!mpi.key_given) {
     /* Run this code if pattern is variable or GETKEY(pattern)  */
     /* is a variable                                            */
@@ -1460,22 +2388,11 @@ static int db_select_chunk_hash(Process *p, DbTable *tbl,
     for(;;) {
 	if (current != NULL) {
 	    if (current->hvalue != INVALID_HASH) {
-		match_res = db_prog_match(p,mpi.mp,
-					  make_tuple(current->dbterm.tpl),
-					  NULL,0,&dummy);
+		match_res = db_match_dbterm(&tb->common, p, mpi.mp,
+					    mpi.all_objects,
+					    &current->dbterm);
 		if (is_value(match_res)) {
-		    if (mpi.all_objects) {
-			hp = HAlloc(p, current->dbterm.size + 2);
-			match_res = copy_shallow(DBTERM_BUF(&current->dbterm),
-						 current->dbterm.size,
-						 &hp,
-						 &MSO(p));
-		    } else {
-			sz = size_object(match_res);
-			
-			hp = HAlloc(p, sz + 2);
-			match_res = copy_struct(match_res, sz, &hp, &MSO(p));
-		    }
+		    hp = HAlloc(p, 2);
 		    match_list = CONS(hp, match_res, match_list);
 		    ++got;
 		}
@@ -1590,7 +2507,6 @@ static int db_select_count_hash(Process *p,
     Uint slot_ix = 0;
     HashDbTerm* current = NULL;
     unsigned current_list_pos = 0;
-    Uint32 dummy;
     Eterm *hp;
     int num_left = 1000;
     Uint got = 0;
@@ -1622,6 +2538,16 @@ static int db_select_count_hash(Process *p,
 	/* can't possibly match anything */
     }
 
+    if (!mpi.key_given && PARALLEL_SCAN(tb)) {
+	slot_ix = pscan_round(p, tb, mpi.mp, PSCAN_COUNT, 0, 0,
+			      0, &got, NULL);
+	if (slot_ix == 0) {
+	    num_left = 0;
+	    goto done;
+	}
+	goto trap;
+    }
+
     if (!mpi.key_given) {
     /* Run this code if pattern is variable or GETKEY(pattern)  */
     /* is a variable                                            */      
@@ -1640,8 +2566,8 @@ static int db_select_count_hash(Process *p,
     for(;;) {
 	if (current != NULL) {
 	    if (current->hvalue != INVALID_HASH) {
-		if (db_prog_match(p, mpi.mp, make_tuple(current->dbterm.tpl),
-				  NULL,0, &dummy) == am_true) {
+		if (db_test_dbterm(&tb->common, p, mpi.mp,
+				   &current->dbterm)) {
 		    ++got;
 		}
 		--num_left;
@@ -1709,7 +2635,6 @@ static int db_select_delete_hash(Process *p,
     Uint slot_ix = 0;
     HashDbTerm **current = NULL;
     unsigned current_list_pos = 0;
-    Uint32 dummy;
     Eterm *hp;
     int num_left = 1000;
     Uint got = 0;
@@ -1747,6 +2672,19 @@ static int db_select_delete_hash(Process *p,
 	/* can't possibly match anything */
     }
 
+    if (!mpi.key_given && PARALLEL_DELETE(tb)) {
+	slot_ix = pscan_round(p, tb, mpi.mp, PSCAN_DELETE, 0, fixated_by_me,
+			      0, &got, NULL);
+	if (slot_ix == 0) {
+	    if (tb->common.status & DB_DELETE) {
+		RET_TO_BIF(erts_make_integer(got,p),DB_ERROR_NONE);
+	    }
+	    num_left = 0;
+	    goto done;
+	}
+	goto trap;
+    }
+
     if (!mpi.key_given) {
 	/* Run this code if pattern is variable or GETKEY(pattern)  */
 	/* is a variable                                            */
@@ -1790,9 +2728,8 @@ static int db_select_delete_hash(Process *p,
 	} 
 	else {
 	    int did_erase = 0;
-	    if ((db_prog_match(p,mpi.mp,
-			       make_tuple((*current)->dbterm.tpl),
-			       NULL,0,&dummy)) == am_true) {
+	    if (db_test_dbterm(&tb->common, p, mpi.mp,
+			       &(*current)->dbterm)) {
 		if (NFIXED(tb) > fixated_by_me) { /* fixated by others? */
 		    if (slot_ix != last_pseudo_delete) {
 			add_fixed_deletion(tb, slot_ix);
@@ -1855,7 +2792,6 @@ static int db_select_delete_continue_hash(Process *p,
     Uint slot_ix;
     Uint last_pseudo_delete = (Uint)-1;
     HashDbTerm **current = NULL;
-    Uint32 dummy;
     Eterm *hp;
     int num_left = 1000;
     Uint got;
@@ -1879,6 +2815,22 @@ static int db_select_delete_continue_hash(Process *p,
     } else {
 	got = unsigned_val(tptr[4]);
     }
+
+    if (PARALLEL_DELETE(tb)) {
+	if (slot_ix >= NACTIVE(tb)) {
+	    goto done;
+	}
+	slot_ix = pscan_round(p, tb, mp, PSCAN_DELETE, 0, fixated_by_me,
+			      slot_ix, &got, NULL);
+	if (slot_ix == 0) {
+	    if (tb->common.status & DB_DELETE) {
+		RET_TO_BIF(erts_make_integer(got,p),DB_ERROR_NONE);
+	    }
+	    num_left = 0;
+	    goto done;
+	}
+	goto trap;
+    }
     
     lck = WLOCK_HASH(tb,slot_ix);
     if (slot_ix >= NACTIVE(tb)) {
@@ -1903,8 +2855,7 @@ static int db_select_delete_continue_hash(Process *p,
 	} 
 	else {
 	    int did_erase = 0;
-	    if ((db_prog_match(p,mp,make_tuple((*current)->dbterm.tpl),
-			       NULL,0,&dummy)) == am_true) {
+	    if (db_test_dbterm(&tb->common, p, mp, &(*current)->dbterm)) {
 		if (NFIXED(tb) > fixated_by_me) { /* fixated by others? */
 		    if (slot_ix != last_pseudo_delete) {
 			add_fixed_deletion(tb, slot_ix);
@@ -1966,7 +2917,6 @@ static int db_select_count_continue_hash(Process *p,
     DbTableHash *tb = &tbl->hash;
     Uint slot_ix;
     HashDbTerm* current;
-    Uint32 dummy;
     Eterm *hp;
     int num_left = 1000;
     Uint got;
@@ -1989,6 +2939,19 @@ static int db_select_count_continue_hash(Process *p,
     } else {
 	got = unsigned_val(tptr[4]);
     }
+
+    if (PARALLEL_SCAN(tb)) {
+	if (slot_ix >= NACTIVE(tb)) {
+	    goto done;
+	}
+	slot_ix = pscan_round(p, tb, mp, PSCAN_COUNT, 0, 0,
+			      slot_ix, &got, NULL);
+	if (slot_ix == 0) {
+	    num_left = 0;
+	    goto done;
+	}
+	goto trap;
+    }
     
 
     lck = RLOCK_HASH(tb, slot_ix);
@@ -2004,8 +2967,7 @@ static int db_select_count_continue_hash(Process *p,
 		current = current->next;
 		continue;
 	    }
-	    if (db_prog_match(p, mp, make_tuple(current->dbterm.tpl),
-			      NULL,0,&dummy) == am_true) {
+	    if (db_test_dbterm(&tb->common, p, mp, &current->dbterm)) {
 		++got;
 	    }
 	    --num_left;
@@ -2053,6 +3015,20 @@ trap:
 
 void db_initialize_hash(void)
 {
+#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+    int i;
+    no_reader_epochs = (int) erts_no_schedulers;
+    reader_epochs = erts_alloc(ERTS_ALC_T_DB_TABLES,
+			       sizeof(DbHashReaderEpoch)*(no_reader_epochs+1));
+    if ((((UWord) reader_epochs) & ERTS_CACHE_LINE_MASK) != 0)
+	reader_epochs = ((DbHashReaderEpoch *)
+			 ((((UWord) reader_epochs) & ~ERTS_CACHE_LINE_MASK)
+			  + ERTS_CACHE_LINE_SIZE));
+    for (i = 0; i < no_reader_epochs; ++i) {
+	erts_smp_atomic_init(&reader_epochs[i].epoch, 0);
+    }
+    erts_smp_atomic_init(&lockfree_epoch, 0);
+#endif
 }
 
 
@@ -2136,6 +3112,9 @@ static int db_free_table_continue_hash(DbTable *tbl)
 	}
     }
     erts_smp_atomic_set(&tb->fixdel, (long)NULL);
+#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+    free_all_retired(tb);
+#endif
 
     done /= 2;
     while(tb->nslots != 0) {
@@ -2390,7 +3369,7 @@ static int free_seg(DbTableHash *tb, int free_records)
 	    while(p != 0) {		
 		HashDbTerm* nxt = p->next;
 		ASSERT(free_records); /* segment not empty as assumed? */
-		free_term(tb, p);
+		do_free_term(tb, p);
 		p = nxt;
 		++nrecords;
 	    }
@@ -2435,11 +3414,19 @@ static int free_seg(DbTableHash *tb, int free_records)
 	bytes = sizeof(struct segment);
     }
     
+#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+    if (IS_LOCKFREE(tb) && !free_records) {
+	/* A reader with an old nactive may still be in this segment */
+	retire(tb, top, bytes);
+    }
+    else
+#endif
     erts_db_free(ERTS_ALC_T_DB_SEG, (DbTable *)tb,
 		 (void*)top, bytes);
 #ifdef DEBUG
     if (seg_ix > 0) {
-	if (seg_ix < tb->nsegs) SEGTAB(tb)[seg_ix] = NULL;
+	if (seg_ix < tb->nsegs && (free_records || !IS_LOCKFREE(tb)))
+	    SEGTAB(tb)[seg_ix] = NULL;
     } else {
 	erts_smp_atomic_set(&tb->segtab, (long)NULL);
     }
@@ -2453,10 +3440,11 @@ static int free_seg(DbTableHash *tb, int free_records)
 static HashDbTerm* get_term(DbTableHash* tb, HashDbTerm* old, 
 			    Eterm obj, HashValue hval)
 {
-    HashDbTerm* p = db_get_term((DbTableCommon *) tb,
-				(old != NULL) ? &(old->dbterm) : NULL, 
-				((char *) &(old->dbterm)) - ((char *) old),
-				obj);
+    HashDbTerm* p = (IS_COMPRESSED(tb) ? db_get_term_comp : db_get_term)
+	((DbTableCommon *) tb,
+	 (old != NULL) ? &(old->dbterm) : NULL, 
+	 ((char *) &(old->dbterm)) - ((char *) old),
+	 obj);
     p->hvalue = hval;
     /*p->next = NULL;*/ /*No Need */
     return p;
@@ -2468,7 +3456,8 @@ static HashDbTerm* get_term(DbTableHash* tb, HashDbTerm* old,
 ** works for ptr1 == ptr2 == 0  => []
 ** or ptr2 == 0
 */
-static Eterm put_term_list(Process* p, HashDbTerm* ptr1, HashDbTerm* ptr2)
+static Eterm put_term_list(Process* p, DbTableHash* tb,
+			   HashDbTerm* ptr1, HashDbTerm* ptr2)
 {
     int sz = 0;
     HashDbTerm* ptr;
@@ -2480,7 +3469,7 @@ static Eterm put_term_list(Process* p, HashDbTerm* ptr1, HashDbTerm* ptr2)
     while(ptr != ptr2) {
 
 	if (ptr->hvalue != INVALID_HASH)
-	    sz += ptr->dbterm.size + 2;
+	    sz += db_size_dbterm(&tb->common, &ptr->dbterm) + 2;
 
 	ptr = ptr->next;
     }
@@ -2490,7 +3479,7 @@ static Eterm put_term_list(Process* p, HashDbTerm* ptr1, HashDbTerm* ptr2)
     ptr = ptr1;
     while(ptr != ptr2) {
 	if (ptr->hvalue != INVALID_HASH) {
-	    copy = copy_shallow(DBTERM_BUF(&ptr->dbterm), ptr->dbterm.size, &hp, &MSO(p));
+	    copy = db_copy_dbterm(&tb->common, &ptr->dbterm, &hp, &MSO(p));
 	    list = CONS(hp, copy, list);
 	    hp  += 2;
 	}
@@ -2499,7 +3488,21 @@ static Eterm put_term_list(Process* p, HashDbTerm* ptr1, HashDbTerm* ptr2)
     return list;
 }
 
+/* Free an object unlinked from the table.
+** Deferred for lock free tables as readers may still see it.
+*/
 static void free_term(DbTableHash *tb, HashDbTerm* p)
+{
+#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+    if (IS_LOCKFREE(tb)) {
+	retire(tb, p, 0);
+	return;
+    }
+#endif
+    do_free_term(tb, p);
+}
+
+static void do_free_term(DbTableHash *tb, HashDbTerm* p)
 {
     db_free_term_data(&(p->dbterm));
     erts_db_free(ERTS_ALC_T_DB_TERM,
@@ -2508,10 +3511,34 @@ static void free_term(DbTableHash *tb, HashDbTerm* p)
 		 SIZ_DBTERM(p)*sizeof(Eterm));
 }
 
+/* Give a new and empty table room for about size_hint objects up front,
+** so that it does not have to grow while it is being filled.
+*/
+static void presize(DbTableHash* tb, Uint size_hint)
+{
+    Uint want = size_hint / CHAIN_LEN;
+    int nactive;
+    int szm = SEGSZ_MASK;
+
+    if (want > MAX_HINT_SLOTS) {
+	want = MAX_HINT_SLOTS;
+    }
+    while (tb->nslots < want) {
+	if (!alloc_seg(tb)) break;
+    }
+    nactive = tb->nslots;
+    while (szm + 1 < nactive) {
+	szm = (szm << 1) | 1;
+    }
+    erts_smp_atomic_set(&tb->nactive, nactive);
+    erts_smp_atomic_set(&tb->szm, szm);
+    tb->min_nactive = nactive;
+}
+
 /* Grow table with one new bucket.
 ** Allocate new segment if needed.
 */
-static void grow(DbTableHash* tb, int nactive)
+static int grow(DbTableHash* tb, int nactive)
 {
     HashDbTerm** pnext;
     HashDbTerm** to_pnext;
@@ -2521,7 +3548,7 @@ static void grow(DbTableHash* tb, int nactive)
     int szm;
 
     if (erts_smp_atomic_xchg(&tb->is_resizing, 1)) { 
-	return; /* already in progress */
+	return 0; /* already in progress */
     }
     if (NACTIVE(tb) != nactive) {
 	goto abort; /* already done (race) */
@@ -2552,6 +3579,7 @@ static void grow(DbTableHash* tb, int nactive)
 	WUNLOCK_HASH(lck);
 	goto abort;
     }
+    begin_resize_seq(tb, from_ix);
     erts_smp_atomic_inc(&tb->nactive);
     if (from_ix == 0) {
 	erts_smp_atomic_set(&tb->szm, szm);
@@ -2583,22 +3611,28 @@ static void grow(DbTableHash* tb, int nactive)
 	}
     }
     *to_pnext = NULL;
+    end_resize_seq(tb, nactive);
 
     WUNLOCK_HASH(lck);
-    return;
+    return 1;
    
 abort:
     erts_smp_atomic_set(&tb->is_resizing, 0);
+    return 0;
 }
 
 
 /* Shrink table by joining top bucket.
-** Remove top segment if it gets empty.
+** Remove the top segment once the one below it is empty as well, one
+** empty segment is kept to not free and allocate it over and over again
+** when the table size is around a segment boundary.
 */
-static void shrink(DbTableHash* tb, int nactive)
+static int shrink(DbTableHash* tb, int nactive)
 {     
+    int joined = 0;
+
     if (erts_smp_atomic_xchg(&tb->is_resizing, 1)) {
-	return; /* already in progress */
+	return 0; /* already in progress */
     }
     if (NACTIVE(tb) == nactive) {
 	erts_smp_rwmtx_t* lck;
@@ -2615,6 +3649,7 @@ static void shrink(DbTableHash* tb, int nactive)
 	    HashDbTerm** dst_bp = &BUCKET(tb, dst_ix);
 	    HashDbTerm** bp = src_bp;
 
+	    begin_resize_seq(tb, dst_ix);
 	    /* Q: Why join lists by appending "dst" at the end of "src"?
 	       A: Must step through "src" anyway to purge pseudo deleted. */
 	    while(*bp != NULL) {
@@ -2634,11 +3669,13 @@ static void shrink(DbTableHash* tb, int nactive)
 	    if (dst_ix == 0) {
 		erts_smp_atomic_set(&tb->szm, low_szm);
 	    }
+	    end_resize_seq(tb, dst_ix);
 	    WUNLOCK_HASH(lck);
 	    
-	    if (tb->nslots - src_ix >= SEGSZ) {
+	    if (tb->nslots - src_ix >= 2*SEGSZ) {
 		free_seg(tb, 0);
 	    }
+	    joined = 1;
 	}
 	else {
 	    WUNLOCK_HASH(lck);
@@ -2647,6 +3684,7 @@ static void shrink(DbTableHash* tb, int nactive)
     }
     /*else already done */
     erts_smp_atomic_set(&tb->is_resizing, 0);
+    return joined;
 }
 
 
@@ -2713,6 +3751,19 @@ static int db_lookup_dbterm_hash(DbTable *tbl, Eterm key, DbUpdateHandle* handle
 
     while (b != 0) {
 	if (has_live_key(tb,b,key,hval)) {
+	    if (IS_LOCKFREE(tb)) {
+		/* Readers may be looking at b, update a private copy
+		   that db_finalize_dbterm_hash will link in instead.
+		   The object is copied as stored, elements of compressed
+		   tables are already encoded. */
+		HashDbTerm* cp = (HashDbTerm*)
+		    db_get_term(&tb->common, NULL,
+				((char *) &b->dbterm) - ((char *) b),
+				make_tuple(b->dbterm.tpl));
+		cp->hvalue = hval;
+		cp->next = b->next;
+		b = cp;
+	    }
 	    handle->tb = tbl;
 	    handle->bp = (void**) prevp;
 	    handle->dbterm = &b->dbterm;
@@ -2736,9 +3787,11 @@ static void db_finalize_dbterm_hash(DbUpdateHandle* handle)
     DbTable* tbl = handle->tb;
     HashDbTerm* oldp = (HashDbTerm*) *(handle->bp);
     erts_smp_rwmtx_t* lck = (erts_smp_rwmtx_t*) handle->lck;
+    /* Lock free tables are updated in a private copy, not in place */
+    int is_copy = (&oldp->dbterm != handle->dbterm);
 
     ERTS_SMP_LC_ASSERT(IS_HASH_WLOCKED(&tbl->hash,lck));  /* locked by db_lookup_dbterm_hash */
-    ASSERT(&oldp->dbterm == handle->dbterm);
+    ASSERT(!is_copy || IS_LOCKFREE(&tbl->hash));
 
     if (handle->mustResize) {
 	Eterm* top;
@@ -2747,7 +3800,6 @@ static void db_finalize_dbterm_hash(DbUpdateHandle* handle)
 	HashDbTerm* newp = erts_db_alloc(ERTS_ALC_T_DB_TERM, tbl,
 					 sizeof(HashDbTerm)+sizeof(Eterm)*(handle->new_size-1));    
 	sys_memcpy(newp, oldp, sizeof(HashDbTerm)-sizeof(DbTerm));  /* copy only hashtab header */
-	*(handle->bp) = newp;
 	newDbTerm = &newp->dbterm;
     
 	newDbTerm->size = handle->new_size;
@@ -2764,14 +3816,27 @@ static void db_finalize_dbterm_hash(DbUpdateHandle* handle)
 			   handle->new_size,
 			   &top, &newDbTerm->off_heap);
 	DBTERM_SET_TPL(newDbTerm,tuple_val(copy));
+	LOCKFREE_WRITE_BARRIER(&tbl->hash);
+	*(handle->bp) = newp;
 
 	WUNLOCK_HASH(lck);
 		
+	if (is_copy) {
+	    free_term(&tbl->hash, oldp);
+	}
 	db_free_term_data(handle->dbterm);
 	erts_db_free(ERTS_ALC_T_DB_TERM, tbl,
 		     (void *) (((char *) handle->dbterm) - (sizeof(HashDbTerm) - sizeof(DbTerm))),
 		     sizeof(HashDbTerm) + sizeof(Eterm)*(handle->dbterm->size-1));
     }
+    else if (is_copy) {
+	HashDbTerm* newp = (HashDbTerm*) (((char *) handle->dbterm)
+					  - (sizeof(HashDbTerm) - sizeof(DbTerm)));
+	LOCKFREE_WRITE_BARRIER(&tbl->hash);
+	*(handle->bp) = newp;
+	WUNLOCK_HASH(lck);
+	free_term(&tbl->hash, oldp);
+    }
     else {
 	WUNLOCK_HASH(lck);
     }
@@ -2811,6 +3876,57 @@ void db_foreach_offheap_hash(DbTable *tbl,
     }
 }
 
+static void db_foreach_key_hash(DbTable *tbl,
+				Eterm key,
+				void (*func)(DbTable *, Eterm, void *),
+				void *arg)
+{
+    DbTableHash *tb = &tbl->hash;
+    HashValue hval = MAKE_HASH(key);
+    erts_smp_rwmtx_t* lck = RLOCK_HASH(tb, hval);
+    HashDbTerm* b = BUCKET(tb, hash_to_ix(tb, hval));
+
+    for (; b != NULL; b = b->next) {
+	if (has_live_key(tb, b, key, hval)) {
+	    (*func)(tbl, make_tuple(b->dbterm.tpl), arg);
+	}
+    }
+    RUNLOCK_HASH(lck);
+}
+
+/* The cursor is the next slot to go through, in next_slot() order */
+static void db_foreach_dbterm_hash(Process *p, DbTable *tbl,
+				   Eterm *cursor, Sint max,
+				   void (*func)(DbTable *, DbTerm *, void *),
+				   void *arg)
+{
+    DbTableHash *tb = &tbl->hash;
+    Uint ix = (*cursor == NIL) ? 0 : unsigned_val(*cursor);
+    erts_smp_rwmtx_t* lck;
+    HashDbTerm* b;
+
+    if (ix >= NACTIVE(tb)) {
+	*cursor = am_EOT;
+	return;
+    }
+    lck = RLOCK_HASH(tb, ix);
+    do {
+	for (b = BUCKET(tb, ix); b != NULL; b = b->next) {
+	    if (b->hvalue != INVALID_HASH) {
+		(*func)(tbl, &b->dbterm, arg);
+		--max;
+	    }
+	}
+	ix = next_slot(tb, ix, &lck);
+    } while (ix != 0 && max > 0);
+    if (ix == 0) {
+	*cursor = am_EOT;
+    } else {
+	RUNLOCK_HASH(lck);
+	*cursor = make_small(ix);
+    }
+}
+
 void db_calc_stats_hash(DbTableHash* tb, DbHashStats* stats)
 {
     HashDbTerm* b;
@@ -2819,9 +3935,27 @@ void db_calc_stats_hash(DbTableHash* tb, DbHashStats* stats)
     int sq_sum = 0;
     int ix;
     int len;
+    int i;
     
     stats->min_chain_len = INT_MAX;
     stats->max_chain_len = 0;
+    for (i = 0; i < DB_HASH_CHAIN_HIST; i++) {
+	stats->chain_hist[i] = 0;
+    }
+    for (i = 0; i < DB_HASH_LOCK_CNT; i++) {
+	stats->lock_wait_count[i] = 0;
+	stats->lock_wait_time[i] = 0;
+#ifdef ERTS_SMP
+	if (tb->locks != NULL) {
+	    stats->lock_wait_count[i] =
+		erts_smp_atomic_read(&tb->locks->lck_vec[i].s.wait_count);
+	    stats->lock_wait_time[i] =
+		((Uint64) erts_smp_atomic_read(&tb->locks->lck_vec[i].s.wait_sec)
+		 * DB_HASH_USEC_PER_SEC
+		 + erts_smp_atomic_read(&tb->locks->lck_vec[i].s.wait_usec));
+	}
+#endif
+    }
     ix = 0;
     lck = RLOCK_HASH(tb,ix);
     do {
@@ -2829,6 +3963,10 @@ void db_calc_stats_hash(DbTableHash* tb, DbHashStats* stats)
 	for (b = BUCKET(tb,ix); b!=NULL; b=b->next) {
 	    len++;
 	}
+	/* bucket 0 is empty chains, bucket i>0 holds 2^(i-1) .. 2^i-1 */
+	for (i = 0; (len >> i) != 0 && i < DB_HASH_CHAIN_HIST-1; i++)
+	    ;
+	stats->chain_hist[i]++;
 	sum += len;
 	sq_sum += len*len;
 	if (len < stats->min_chain_len) stats->min_chain_len = len;
@@ -33,10 +33,38 @@ typedef struct hash_db_term {
     DbTerm dbterm;         /* The actual term */
 } HashDbTerm;
 
+/* A table object unlinked from a lock free table (DB_LOCKFREE_READ),
+** waiting for all readers that might see it to leave their read epoch.
+*/
+typedef struct db_hash_retired {
+    struct db_hash_retired *next;
+    long epoch;               /* global read epoch when retired */
+    void* ptr;                /* HashDbTerm* or table segment */
+    Uint seg_bytes;           /* size of segment, or 0 if a HashDbTerm */
+} DbHashRetired;
+
+/* Lock free bucket reads need atomic ops that are more than emulated
+** with locks, since they rely on ordering of plain loads and stores.
+*/
+#if defined(ERTS_SMP) && defined(ETHR_HAVE_OPTIMIZED_ATOMIC_OPS)
+#  define DB_HASH_LOCKFREE_READ_SUPPORT
+#endif
+
 #define DB_HASH_LOCK_CNT 16
 typedef struct db_table_hash_fine_locks {
     union {
-	erts_smp_rwmtx_t lck;
+	struct {
+	    erts_smp_rwmtx_t lck;
+	    /* Odd while a bucket of this lock is split or joined.
+	       Lets lock free readers detect a concurrent grow/shrink. */
+	    erts_smp_atomic_t resize_seq;
+	    /* Times the lock was found busy and time waited for it. The
+	       time is split in seconds and microseconds so that it does
+	       not wrap where long is 32 bits. */
+	    erts_smp_atomic_t wait_count;
+	    erts_smp_atomic_t wait_sec;
+	    erts_smp_atomic_t wait_usec;
+	} s;
 	byte _cache_line_alignment[64];
     }lck_vec[DB_HASH_LOCK_CNT];
 } DbTableHashFineLocks;
@@ -55,9 +83,15 @@ typedef struct db_table_hash {
     erts_smp_atomic_t fixdel;  /* (FixedDeletion*) */	
     erts_smp_atomic_t nactive; /* Number of "active" slots */
     erts_smp_atomic_t is_resizing; /* grow/shrink in progress */
+    int min_nactive;  /* Never shrink below this, see size_hint */
 #ifdef ERTS_SMP
     DbTableHashFineLocks* locks;
 #endif
+#ifdef DB_HASH_LOCKFREE_READ_SUPPORT
+    /* Only used by DB_LOCKFREE_READ tables */
+    erts_smp_atomic_t retired;   /* (DbHashRetired*) objects not yet freed */
+    erts_smp_atomic_t nretired;  /* length of retired list (approximate) */
+#endif
 } DbTableHash;
 
 
@@ -90,12 +124,22 @@ int db_erase_bag_exact2(DbTable *tbl, Eterm key, Eterm value);
 /* not yet in method table */
 int db_mark_all_deleted_hash(DbTable *tbl);
 
+/* Insert a list of objects, write locking each stripe once */
+int db_put_many_hash(DbTable *tbl, Eterm *objs, Uint nobjs);
+
+/* Chain length histogram buckets: 0, 1, 2-3, 4-7, ... */
+#define DB_HASH_CHAIN_HIST 8
+
 typedef struct {
     float avg_chain_len;
     float std_dev_chain_len;
     float std_dev_expected;
     int max_chain_len;
     int min_chain_len;
+    Uint chain_hist[DB_HASH_CHAIN_HIST];
+    /* Per stripe lock contention, zero if not fine locked */
+    Uint lock_wait_count[DB_HASH_LOCK_CNT];
+    Uint64 lock_wait_time[DB_HASH_LOCK_CNT]; /* microseconds */
 }DbHashStats;
 
 void db_calc_stats_hash(DbTableHash* tb, DbHashStats*);
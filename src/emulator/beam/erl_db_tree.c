@@ -80,6 +80,30 @@
 
 #define EMPTY_NODE(Dtt) (TOP_NODE(Dtt) == NULL)
 
+/*
+** A fine locked (write_concurrency) table is partitioned into bases,
+** see erl_db_tree.h. Bases are only added or removed while the table
+** is exclusively locked.
+*/
+#define IS_PARTITIONED(tb) ((tb)->bases != NULL)
+#define NBASES(tb) ((tb)->bases->nbases)
+#define BASE(tb,i) ((tb)->bases->base[(i)])
+#define SPLIT_KEY(b) ((b)->split->dbterm.tpl[1])
+
+#ifdef ERTS_SMP
+#  define IS_EXCLUSIVE(tb) ((tb)->common.is_thread_safe)
+#else
+#  define IS_EXCLUSIVE(tb) (1)
+#endif
+
+/*
+** Lock statistics of a base. A base that is often found write locked
+** is split in two, one that seldom is gets joined with a neighbour.
+*/
+#define BASE_CONTENDED 250
+#define BASE_UNCONTENDED 1
+#define BASE_SPLIT_LIMIT 1000
+#define BASE_JOIN_LIMIT (-1000)
 
 
 /* Obtain table static stack if available. NULL if not.
@@ -87,6 +111,10 @@
 */
 static DbTreeStack* get_static_stack(DbTableTree* tb)
 {
+    /* The static stack would be shared between bases locked by others */
+    if (IS_PARTITIONED(tb)) {
+	return NULL;
+    }
     if (!erts_smp_atomic_xchg(&tb->is_stack_busy, 1)) {
 	return &tb->static_stack;
     }
@@ -99,7 +127,7 @@ static DbTreeStack* get_static_stack(DbTableTree* tb)
 static DbTreeStack* get_any_stack(DbTableTree* tb)
 {
     DbTreeStack* stack;
-    if (!erts_smp_atomic_xchg(&tb->is_stack_busy, 1)) {
+    if (!IS_PARTITIONED(tb) && !erts_smp_atomic_xchg(&tb->is_stack_busy, 1)) {
 	return &tb->static_stack;
     }
     stack = erts_db_alloc(ERTS_ALC_T_DB_STK, (DbTable *) tb,
@@ -270,15 +298,29 @@ static void free_term(DbTableTree *tb, TreeDbTerm* p);
 static int balance_left(TreeDbTerm **this); 
 static int balance_right(TreeDbTerm **this); 
 static int delsub(TreeDbTerm **this); 
+static TreeDbTerm *join_trees(TreeDbTerm *a, TreeDbTerm *k, TreeDbTerm *b);
+static TreeDbTerm *linkout_min(TreeDbTerm **root);
+static DbTreeBase *new_base(DbTableTree *tb, int ix);
+static void free_base(DbTableTree *tb, DbTreeBase *b);
+static void split_base(DbTableTree *tb, int ix);
+static void join_bases(DbTableTree *tb, int ix);
 static TreeDbTerm *slot_search(Process *p, DbTableTree *tb, Sint slot);
 static TreeDbTerm *find_node(DbTableTree *tb, Eterm key);
 static TreeDbTerm **find_node2(DbTableTree *tb, Eterm key);
 static TreeDbTerm *find_next(DbTableTree *tb, DbTreeStack*, Eterm key);
 static TreeDbTerm *find_prev(DbTableTree *tb, DbTreeStack*, Eterm key);
+static TreeDbTerm *do_find_next(DbTableTree *tb, TreeDbTerm *root,
+				DbTreeStack*, Eterm key);
+static TreeDbTerm *do_find_prev(DbTableTree *tb, TreeDbTerm *root,
+				DbTreeStack*, Eterm key);
 static TreeDbTerm *find_next_from_pb_key(DbTableTree *tb, DbTreeStack*,
 					 Eterm key);
 static TreeDbTerm *find_prev_from_pb_key(DbTableTree *tb, DbTreeStack*,
 					 Eterm key);
+static TreeDbTerm *do_find_next_from_pb_key(DbTableTree *tb, TreeDbTerm *root,
+					    DbTreeStack*, Eterm key);
+static TreeDbTerm *do_find_prev_from_pb_key(DbTableTree *tb, TreeDbTerm *root,
+					    DbTreeStack*, Eterm key);
 static void traverse_backwards(DbTableTree *tb,
 			       DbTreeStack*,
 			       Eterm lastkey,
@@ -344,6 +386,8 @@ static int db_prev_tree(Process *p, DbTable *tbl,
 static int db_put_tree(DbTable *tbl, Eterm obj, int key_clash_fail);
 static int db_get_tree(Process *p, DbTable *tbl, 
 		       Eterm key,  Eterm *ret);
+static int db_get_many_tree(Process *p, DbTable *tbl,
+			    Eterm *keys, Uint nkeys, Eterm *ret);
 static int db_member_tree(DbTable *tbl, Eterm key, Eterm *ret);
 static int db_get_element_tree(Process *p, DbTable *tbl, 
 			       Eterm key,int ndex,
@@ -377,6 +421,15 @@ static void db_foreach_offheap_tree(DbTable *,
 				    void (*)(ErlOffHeap *, void *),
 				    void *);
 
+static void db_foreach_key_tree(DbTable *tbl, Eterm key,
+				void (*func)(DbTable *, Eterm, void *),
+				void *arg);
+
+static void db_foreach_dbterm_tree(Process *p, DbTable *tbl,
+				   Eterm *cursor, Sint max,
+				   void (*func)(DbTable *, DbTerm *, void *),
+				   void *arg);
+
 static int db_delete_all_objects_tree(Process* p, DbTable* tbl);
 
 #ifdef HARDDEBUG
@@ -385,6 +438,150 @@ static void db_check_table_tree(DbTable *tbl);
 static int db_lookup_dbterm_tree(DbTable *, Eterm key, DbUpdateHandle*);
 static void db_finalize_dbterm_tree(DbUpdateHandle*);
 
+/*
+** Locking of the bases of a partitioned tree. All functions do nothing
+** (and return NULL) if the table is not partitioned or if it is
+** exclusively locked.
+*/
+
+/* Index of the base where key belongs
+*/
+static ERTS_INLINE int base_ix(DbTableTree *tb, Eterm key)
+{
+    int lo = 1;
+    int hi = NBASES(tb) - 1;
+    int ix = 0;
+
+    while (lo <= hi) {
+	int mid = (lo + hi) / 2;
+	if (cmp(key, SPLIT_KEY(BASE(tb,mid))) >= 0) {
+	    ix = mid;
+	    lo = mid + 1;
+	} else {
+	    hi = mid - 1;
+	}
+    }
+    return ix;
+}
+
+/* Root of the tree where key belongs
+*/
+static ERTS_INLINE TreeDbTerm **key_root(DbTableTree *tb, Eterm key)
+{
+    return IS_PARTITIONED(tb) ? &BASE(tb,base_ix(tb,key))->root : &tb->root;
+}
+
+static ERTS_INLINE erts_smp_rwmtx_t* RLOCK_BASE(DbTableTree *tb,
+						DbTreeBase *b)
+{
+    if (IS_EXCLUSIVE(tb)) {
+	return NULL;
+    }
+    erts_smp_rwmtx_rlock(&b->lck);
+    return &b->lck;
+}
+
+static ERTS_INLINE void RUNLOCK_BASE(erts_smp_rwmtx_t* lck)
+{
+    if (lck != NULL) {
+	erts_smp_rwmtx_runlock(lck);
+    }
+}
+
+static ERTS_INLINE erts_smp_rwmtx_t* RLOCK_KEY(DbTableTree *tb, Eterm key)
+{
+    if (!IS_PARTITIONED(tb)) {
+	return NULL;
+    }
+    return RLOCK_BASE(tb, BASE(tb,base_ix(tb,key)));
+}
+
+/* Write lock the base where key belongs and record if we had to wait
+*/
+static ERTS_INLINE void WLOCK_BASE(DbTreeBase *b)
+{
+    if (erts_smp_rwmtx_tryrwlock(&b->lck) != 0) {
+	erts_smp_rwmtx_rwlock(&b->lck);
+	b->lock_stat += BASE_CONTENDED;
+    } else {
+	b->lock_stat -= BASE_UNCONTENDED;
+    }
+}
+
+static ERTS_INLINE DbTreeBase* WLOCK_KEY(DbTableTree *tb, Eterm key)
+{
+    DbTreeBase *b;
+
+    if (!IS_PARTITIONED(tb) || IS_EXCLUSIVE(tb)) {
+	return NULL;
+    }
+    b = BASE(tb,base_ix(tb,key));
+    WLOCK_BASE(b);
+    return b;
+}
+
+static ERTS_INLINE void WUNLOCK_KEY(DbTableTree *tb, DbTreeBase *b)
+{
+    int adapt;
+
+    if (b == NULL) {
+	return;
+    }
+    adapt = 0;
+    if (b->lock_stat > BASE_SPLIT_LIMIT) {
+	if (NBASES(tb) < DB_TREE_MAX_BASES) {
+	    adapt = 1;
+	} else {
+	    b->lock_stat = 0;
+	}
+    } else if (b->lock_stat < BASE_JOIN_LIMIT) {
+	if (NBASES(tb) > 1) {
+	    adapt = 1;
+	} else {
+	    b->lock_stat = 0;
+	}
+    }
+    erts_smp_rwmtx_rwunlock(&b->lck);
+    if (adapt) {
+	/* Done by db_adapt_tree() once the table lock is released */
+	erts_smp_atomic_set(&tb->adapt, 1);
+    }
+}
+
+/* Lock all bases, in order, for operations that traverse the table.
+*/
+static void lock_all_bases(DbTableTree *tb, int write)
+{
+    int i;
+
+    if (!IS_PARTITIONED(tb) || IS_EXCLUSIVE(tb)) {
+	return;
+    }
+    for (i = 0; i < NBASES(tb); ++i) {
+	if (write) {
+	    erts_smp_rwmtx_rwlock(&BASE(tb,i)->lck);
+	} else {
+	    erts_smp_rwmtx_rlock(&BASE(tb,i)->lck);
+	}
+    }
+}
+
+static void unlock_all_bases(DbTableTree *tb, int write)
+{
+    int i;
+
+    if (!IS_PARTITIONED(tb) || IS_EXCLUSIVE(tb)) {
+	return;
+    }
+    for (i = NBASES(tb) - 1; i >= 0; --i) {
+	if (write) {
+	    erts_smp_rwmtx_rwunlock(&BASE(tb,i)->lck);
+	} else {
+	    erts_smp_rwmtx_runlock(&BASE(tb,i)->lck);
+	}
+    }
+}
+
 /*
 ** Static variables
 */
@@ -403,6 +600,7 @@ DbTableMethod db_tree =
     db_prev_tree,
     db_put_tree,
     db_get_tree,
+    db_get_many_tree,
     db_get_element_tree,
     db_member_tree,
     db_erase_tree,
@@ -420,6 +618,8 @@ DbTableMethod db_tree =
     db_free_table_continue_tree,
     db_print_tree,
     db_foreach_offheap_tree,
+    db_foreach_key_tree,
+    db_foreach_dbterm_tree,
 #ifdef HARDDEBUG
     db_check_table_tree,
 #else
@@ -464,6 +664,104 @@ int db_create_tree(Process *p, DbTable *tbl)
     tb->static_stack.slot = 0;
     erts_smp_atomic_init(&tb->is_stack_busy, 0);
     tb->deletion = 0;
+    tb->bases = NULL;
+    erts_smp_atomic_init(&tb->adapt, 0);
+#ifdef ERTS_SMP
+    if (tb->common.type & DB_FINE_LOCKED) {
+	tb->bases = (DbTreeBases *) erts_db_alloc(ERTS_ALC_T_DB_SEG,
+						  (DbTable *) tb,
+						  sizeof(DbTreeBases));
+	tb->bases->nbases = 1;
+	tb->bases->base[0] = new_base(tb, 0);
+    }
+#endif
+    return DB_ERROR_NONE;
+}
+
+/*
+** Restructure the bases according to the lock statistics, when a write
+** asked for it. Called by db_unlock() after it has released the table,
+** the table is locked again, exclusively, just for this, so that the
+** table methods never have to give up the table lock.
+*/
+void db_adapt_tree(DbTable *tbl)
+{
+#ifdef ERTS_SMP
+    DbTableTree *tb = &tbl->tree;
+    int i;
+
+    erts_smp_rwmtx_rwlock(&tb->common.rwlock);
+    /* Someone may have deleted the table or adapted it before us */
+    if (erts_smp_atomic_xchg(&tb->adapt, 0)
+	&& !(tb->common.status & DB_DELETE) && IS_PARTITIONED(tb)) {
+	for (i = 0; i < NBASES(tb); ++i) {
+	    DbTreeBase *b = BASE(tb,i);
+	    if (b->lock_stat > BASE_SPLIT_LIMIT
+		&& NBASES(tb) < DB_TREE_MAX_BASES) {
+		split_base(tb, i);
+		break;
+	    }
+	    if (b->lock_stat < BASE_JOIN_LIMIT && NBASES(tb) > 1) {
+		join_bases(tb, (i + 1 < NBASES(tb)) ? i : i - 1);
+		break;
+	    }
+	}
+    }
+    erts_smp_rwmtx_rwunlock(&tb->common.rwlock);
+#endif
+}
+
+/*
+** first, next, last and prev of a partitioned tree, only one base at a
+** time is locked. With a non-value key we start at the first (forward)
+** or last base.
+*/
+static int step_bases(Process *p, DbTableTree *tb, Eterm key, int forward,
+		      Eterm *ret)
+{
+    DbTreeStack* stack = get_any_stack(tb);
+    TreeDbTerm *this = NULL;
+    erts_smp_rwmtx_t* lck;
+    Eterm e;
+    Eterm *hp;
+    Uint sz;
+    int i;
+
+    if (is_value(key)) {
+	i = base_ix(tb, key);
+    } else {
+	i = forward ? 0 : NBASES(tb) - 1;
+    }
+    *ret = am_EOT;
+    for (; i >= 0 && i < NBASES(tb); i += forward ? 1 : -1) {
+	DbTreeBase *b = BASE(tb,i);
+
+	lck = RLOCK_BASE(tb, b);
+	stack->pos = stack->slot = 0;
+	if (is_value(key)) {
+	    this = forward ? do_find_next(tb, b->root, stack, key)
+		: do_find_prev(tb, b->root, stack, key);
+	    key = THE_NON_VALUE;
+	} else if ((this = b->root) != NULL) {
+	    if (forward) {
+		while (this->left != NULL)
+		    this = this->left;
+	    } else {
+		while (this->right != NULL)
+		    this = this->right;
+	    }
+	}
+	if (this != NULL) {
+	    e = GETKEY(tb, this->dbterm.tpl);
+	    sz = size_object(e);
+	    hp = HAlloc(p, sz);
+	    *ret = copy_struct(e,sz,&hp,&MSO(p));
+	    RUNLOCK_BASE(lck);
+	    break;
+	}
+	RUNLOCK_BASE(lck);
+    }
+    release_stack(tb,stack);
     return DB_ERROR_NONE;
 }
 
@@ -476,6 +774,9 @@ static int db_first_tree(Process *p, DbTable *tbl, Eterm *ret)
     Eterm *hp;
     Uint sz;
 
+    if (IS_PARTITIONED(tb)) {
+	return step_bases(p, tb, THE_NON_VALUE, 1, ret);
+    }
     if (( this = tb->root ) == NULL) {
 	*ret = am_EOT;
 	return DB_ERROR_NONE;
@@ -514,6 +815,9 @@ static int db_next_tree(Process *p, DbTable *tbl, Eterm key, Eterm *ret)
 
     if (is_atom(key) && key == am_EOT)
 	return DB_ERROR_BADKEY;
+    if (IS_PARTITIONED(tb)) {
+	return step_bases(p, tb, key, 1, ret);
+    }
     stack = get_any_stack(tb);
     this = find_next(tb, stack, key);
     release_stack(tb,stack);
@@ -540,6 +844,9 @@ static int db_last_tree(Process *p, DbTable *tbl, Eterm *ret)
     Eterm *hp;
     Uint sz;
 
+    if (IS_PARTITIONED(tb)) {
+	return step_bases(p, tb, THE_NON_VALUE, 0, ret);
+    }
     if (( this = tb->root ) == NULL) {
 	*ret = am_EOT;
 	return DB_ERROR_NONE;
@@ -578,6 +885,9 @@ static int db_prev_tree(Process *p, DbTable *tbl, Eterm key, Eterm *ret)
 
     if (is_atom(key) && key == am_EOT)
 	return DB_ERROR_BADKEY;
+    if (IS_PARTITIONED(tb)) {
+	return step_bases(p, tb, key, 0, ret);
+    }
     stack = get_any_stack(tb);
     this = find_prev(tb, stack, key);
     release_stack(tb,stack);
@@ -595,23 +905,27 @@ static int db_prev_tree(Process *p, DbTable *tbl, Eterm key, Eterm *ret)
     return DB_ERROR_NONE;
 }
 
-static int db_put_tree(DbTable *tbl, Eterm obj, int key_clash_fail)
+/* Insert obj in the tree at root, which the caller has locked
+*/
+static int put_term(DbTableTree *tb, TreeDbTerm **root, Eterm obj,
+		    int key_clash_fail)
 {
-    DbTableTree *tb = &tbl->tree;
     /* Non recursive insertion in AVL tree, building our own stack */
     TreeDbTerm **tstack[STACK_NEED];
     int tpos = 0;
     int dstack[STACK_NEED+1];
     int dpos = 0;
     int state = 0;
-    TreeDbTerm **this = &tb->root;
+    TreeDbTerm **this;
     Sint c;
     Eterm key;
     int dir;
     TreeDbTerm *p1, *p2, *p;
+    int ret = DB_ERROR_NONE;
 
     key = GETKEY(tb, tuple_val(obj));
 
+    this = root;
     reset_static_stack(tb);
 
     dstack[dpos++] = DIR_END;
@@ -620,7 +934,8 @@ static int db_put_tree(DbTable *tbl, Eterm obj, int key_clash_fail)
 	    state = 1;
 	    if (erts_smp_atomic_inctest(&tb->common.nitems) >= TREE_MAX_ELEMENTS) {
 		erts_smp_atomic_dec(&tb->common.nitems);
-		return DB_ERROR_SYSRES;
+		ret = DB_ERROR_SYSRES;
+		goto done;
 	    }
 	    *this = get_term(tb, NULL, obj);
 	    (*this)->balance = 0;
@@ -639,7 +954,8 @@ static int db_put_tree(DbTable *tbl, Eterm obj, int key_clash_fail)
 	    *this = get_term(tb, *this, obj);
 	    break;
 	} else {
-	    return DB_ERROR_BADKEY; /* key already exists */
+	    ret = DB_ERROR_BADKEY; /* key already exists */
+	    goto done;
 	}
 
     while (state && ( dir = dstack[--dpos] ) != DIR_END) {
@@ -707,7 +1023,67 @@ static int db_put_tree(DbTable *tbl, Eterm obj, int key_clash_fail)
 	    }
 	}
     }
-    return DB_ERROR_NONE;
+done:
+    return ret;
+}
+
+static int db_put_tree(DbTable *tbl, Eterm obj, int key_clash_fail)
+{
+    DbTableTree *tb = &tbl->tree;
+    Eterm key = GETKEY(tb, tuple_val(obj));
+    DbTreeBase *b = WLOCK_KEY(tb, key);
+    int ret;
+
+    ret = put_term(tb, (b != NULL) ? &b->root : key_root(tb, key),
+		   obj, key_clash_fail);
+    WUNLOCK_KEY(tb, b);
+    return ret;
+}
+
+/*
+** Insert a list of objects, as ets:insert/2 does. On a partitioned table
+** the base of each object is looked up once, and all bases needed are
+** write locked, in order, before anything is inserted. Readers thereby
+** see either none or all of the objects.
+*/
+int db_put_many_tree(DbTable *tbl, Eterm *objs, Uint nobjs)
+{
+    DbTableTree *tb = &tbl->tree;
+    byte* ixs;
+    byte needed[DB_TREE_MAX_BASES];
+    int ret = DB_ERROR_NONE;
+    Uint i;
+    int j;
+
+    if (!IS_PARTITIONED(tb) || IS_EXCLUSIVE(tb)) {
+	for (i = 0; i < nobjs && ret == DB_ERROR_NONE; ++i) {
+	    ret = put_term(tb, key_root(tb, GETKEY(tb, tuple_val(objs[i]))),
+			   objs[i], 0);
+	}
+	return ret;
+    }
+
+    ixs = erts_alloc(ERTS_ALC_T_DB_TMP, nobjs);
+    sys_memzero(needed, sizeof(needed));
+    for (i = 0; i < nobjs; ++i) {
+	ixs[i] = base_ix(tb, GETKEY(tb, tuple_val(objs[i])));
+	needed[ixs[i]] = 1;
+    }
+    for (j = 0; j < NBASES(tb); ++j) {
+	if (needed[j]) {
+	    WLOCK_BASE(BASE(tb,j));
+	}
+    }
+    for (i = 0; i < nobjs && ret == DB_ERROR_NONE; ++i) {
+	ret = put_term(tb, &BASE(tb,ixs[i])->root, objs[i], 0);
+    }
+    for (j = NBASES(tb) - 1; j >= 0; --j) {
+	if (needed[j]) {
+	    WUNLOCK_KEY(tb, BASE(tb,j));
+	}
+    }
+    erts_free(ERTS_ALC_T_DB_TMP, ixs);
+    return ret;
 }
 
 static int db_get_tree(Process *p, DbTable *tbl, Eterm key, Eterm *ret)
@@ -716,6 +1092,7 @@ static int db_get_tree(Process *p, DbTable *tbl, Eterm key, Eterm *ret)
     Eterm copy;
     Eterm *hp;
     TreeDbTerm *this;
+    erts_smp_rwmtx_t* lck;
 
     /*
      * This is always a set, so we know exactly how large
@@ -723,25 +1100,62 @@ static int db_get_tree(Process *p, DbTable *tbl, Eterm key, Eterm *ret)
      * The list created around it is purely for interface conformance.
      */
     
+    lck = RLOCK_KEY(tb,key);
     this = find_node(tb,key);
     if (this == NULL) {
 	*ret = NIL;
     } else {
-	hp = HAlloc(p, this->dbterm.size + 2);
-	copy = copy_shallow(DBTERM_BUF(&this->dbterm), 
-			    this->dbterm.size, 
-			    &hp, 
-			    &MSO(p));
+	hp = HAlloc(p, db_size_dbterm(&tb->common, &this->dbterm) + 2);
+	copy = db_copy_dbterm(&tb->common, &this->dbterm, &hp, &MSO(p));
 	*ret = CONS(hp, copy, NIL);
     }
+    RUNLOCK_BASE(lck);
+    return DB_ERROR_NONE;
+}
+
+/* Look up a number of keys with all bases locked once, copying what is
+** found into one heap block.
+*/
+static int db_get_many_tree(Process *p, DbTable *tbl,
+			    Eterm *keys, Uint nkeys, Eterm *ret)
+{
+    DbTableTree *tb = &tbl->tree;
+    TreeDbTerm **found;
+    Uint i;
+    Uint sz = 0;
+    Eterm list = NIL;
+    Eterm *hp;
+
+    found = erts_alloc(ERTS_ALC_T_DB_TMP, nkeys * sizeof(TreeDbTerm *));
+    lock_all_bases(tb, 0);
+    for (i = 0; i < nkeys; ++i) {
+	found[i] = find_node(tb, keys[i]);
+	if (found[i] != NULL) {
+	    sz += db_size_dbterm(&tb->common, &found[i]->dbterm) + 2;
+	}
+    }
+    hp = HAlloc(p, sz);
+    for (i = nkeys; i-- > 0; ) {
+	if (found[i] != NULL) {
+	    Eterm copy = db_copy_dbterm(&tb->common, &found[i]->dbterm,
+					&hp, &MSO(p));
+	    list = CONS(hp, copy, list);
+	    hp += 2;
+	}
+    }
+    unlock_all_bases(tb, 0);
+    erts_free(ERTS_ALC_T_DB_TMP, found);
+    *ret = list;
     return DB_ERROR_NONE;
 }
 
 static int db_member_tree(DbTable *tbl, Eterm key, Eterm *ret)
 {
     DbTableTree *tb = &tbl->tree;
+    erts_smp_rwmtx_t* lck = RLOCK_KEY(tb,key);
 
     *ret = (find_node(tb,key) == NULL) ? am_false : am_true;
+    RUNLOCK_BASE(lck);
     return DB_ERROR_NONE;
 }
 
@@ -752,8 +1166,9 @@ static int db_get_element_tree(Process *p, DbTable *tbl,
     /*
      * Look the node up:
      */
-    Eterm *hp;
     TreeDbTerm *this;
+    erts_smp_rwmtx_t* lck;
+    int retval = DB_ERROR_NONE;
 
     /*
      * This is always a set, so we know exactly how large
@@ -762,34 +1177,31 @@ static int db_get_element_tree(Process *p, DbTable *tbl,
      * around the element here either.
      */
     
+    lck = RLOCK_KEY(tb,key);
     this = find_node(tb,key);
     if (this == NULL) {
-	return DB_ERROR_BADKEY;
+	retval = DB_ERROR_BADKEY;
+    } else if (ndex > arityval(this->dbterm.tpl[0])) {
+	retval = DB_ERROR_BADPARAM;
     } else {
-	Eterm element;
-	Uint sz;
-	if (ndex > arityval(this->dbterm.tpl[0])) {
-	    return DB_ERROR_BADPARAM;
-	}
-	element = this->dbterm.tpl[ndex];
-	sz = size_object(element);
-	hp = HAlloc(p, sz);
-	*ret = copy_struct(element, 
-			   sz, 
-			   &hp, 
-			   &MSO(p));
+	*ret = db_copy_element_proc(&tb->common, p, &this->dbterm, ndex);
     }
-    return DB_ERROR_NONE;
+    RUNLOCK_BASE(lck);
+    return retval;
 }
 
 static int db_erase_tree(DbTable *tbl, Eterm key, Eterm *ret)
 {
     DbTableTree *tb = &tbl->tree;
     TreeDbTerm *res;
+    DbTreeBase *b;
 
     *ret = am_true;
 
-    if ((res = linkout_tree(tb, key)) != NULL) {
+    b = WLOCK_KEY(tb, key);
+    res = linkout_tree(tb, key);
+    WUNLOCK_KEY(tb, b);
+    if (res != NULL) {
 	free_term(tb, res);
     }
     return DB_ERROR_NONE;
@@ -799,17 +1211,21 @@ static int db_erase_object_tree(DbTable *tbl, Eterm object, Eterm *ret)
 {
     DbTableTree *tb = &tbl->tree;
     TreeDbTerm *res;
+    DbTreeBase *b;
 
     *ret = am_true;
 
-    if ((res = linkout_object_tree(tb, object)) != NULL) {
+    b = WLOCK_KEY(tb, GETKEY(tb, tuple_val(object)));
+    res = linkout_object_tree(tb, object);
+    WUNLOCK_KEY(tb, b);
+    if (res != NULL) {
 	free_term(tb, res);
     }
     return DB_ERROR_NONE;
 }
 
 
-static int db_slot_tree(Process *p, DbTable *tbl, 
+static int do_slot_tree(Process *p, DbTable *tbl, 
 			Eterm slot_term, Eterm *ret)
 {
     DbTableTree *tb = &tbl->tree;
@@ -846,15 +1262,23 @@ static int db_slot_tree(Process *p, DbTable *tbl,
 	*ret = am_false;
 	return DB_ERROR_UNSPEC;
     }
-    hp = HAlloc(p, st->dbterm.size + 2);
-    copy = copy_shallow(DBTERM_BUF(&st->dbterm), 
-			st->dbterm.size, 
-			&hp, 
-			&MSO(p));
+    hp = HAlloc(p, db_size_dbterm(&tb->common, &st->dbterm) + 2);
+    copy = db_copy_dbterm(&tb->common, &st->dbterm, &hp, &MSO(p));
     *ret = CONS(hp, copy, NIL);
     return DB_ERROR_NONE;
 }
 
+static int db_slot_tree(Process *p, DbTable *tbl, 
+			Eterm slot_term, Eterm *ret)
+{
+    int res;
+
+    lock_all_bases(&tbl->tree, 0);
+    res = do_slot_tree(p, tbl, slot_term, ret);
+    unlock_all_bases(&tbl->tree, 0);
+    return res;
+}
+
 
 
 static BIF_RETTYPE ets_select_reverse(Process *p, Eterm a1, Eterm a2, Eterm a3)
@@ -923,7 +1347,7 @@ static BIF_RETTYPE bif_trap3(Export *bif,
 ** trap to itself again (via the ets:select/1 bif).
 ** Note that this is common for db_select_tree and db_select_chunk_tree.
 */
-static int db_select_continue_tree(Process *p, 
+static int do_select_continue_tree(Process *p, 
 				   DbTable *tbl,
 				   Eterm continuation,
 				   Eterm *ret)
@@ -1077,8 +1501,19 @@ static int db_select_continue_tree(Process *p,
 #undef RET_TO_BIF
 }
 
+static int db_select_continue_tree(Process *p, DbTable *tbl,
+				   Eterm continuation, Eterm *ret)
+{
+    int res;
+
+    lock_all_bases(&tbl->tree, 0);
+    res = do_select_continue_tree(p, tbl, continuation, ret);
+    unlock_all_bases(&tbl->tree, 0);
+    return res;
+}
+
 
-static int db_select_tree(Process *p, DbTable *tbl, 
+static int do_select_tree(Process *p, DbTable *tbl, 
 			  Eterm pattern, int reverse, Eterm *ret)
 {
     DbTableTree *tb = &tbl->tree;
@@ -1190,11 +1625,22 @@ static int db_select_tree(Process *p, DbTable *tbl,
 
 }
 
+static int db_select_tree(Process *p, DbTable *tbl, 
+			  Eterm pattern, int reverse, Eterm *ret)
+{
+    int res;
+
+    lock_all_bases(&tbl->tree, 0);
+    res = do_select_tree(p, tbl, pattern, reverse, ret);
+    unlock_all_bases(&tbl->tree, 0);
+    return res;
+}
+
     
 /*
 ** This is called either when the select_count bif traps.
 */
-static int db_select_count_continue_tree(Process *p, 
+static int do_select_count_continue_tree(Process *p, 
 					 DbTable *tbl,
 					 Eterm continuation,
 					 Eterm *ret)
@@ -1285,8 +1731,19 @@ static int db_select_count_continue_tree(Process *p,
 #undef RET_TO_BIF
 }
 
+static int db_select_count_continue_tree(Process *p, DbTable *tbl,
+					 Eterm continuation, Eterm *ret)
+{
+    int res;
+
+    lock_all_bases(&tbl->tree, 0);
+    res = do_select_count_continue_tree(p, tbl, continuation, ret);
+    unlock_all_bases(&tbl->tree, 0);
+    return res;
+}
+
 
-static int db_select_count_tree(Process *p, DbTable *tbl, 
+static int do_select_count_tree(Process *p, DbTable *tbl, 
 				Eterm pattern, Eterm *ret)
 {
     DbTableTree *tb = &tbl->tree;
@@ -1386,7 +1843,18 @@ static int db_select_count_tree(Process *p, DbTable *tbl,
 
 }
 
-static int db_select_chunk_tree(Process *p, DbTable *tbl, 
+static int db_select_count_tree(Process *p, DbTable *tbl, 
+				Eterm pattern, Eterm *ret)
+{
+    int res;
+
+    lock_all_bases(&tbl->tree, 0);
+    res = do_select_count_tree(p, tbl, pattern, ret);
+    unlock_all_bases(&tbl->tree, 0);
+    return res;
+}
+
+static int do_select_chunk_tree(Process *p, DbTable *tbl, 
 				Eterm pattern, Sint chunk_size,
 				int reverse,
 				Eterm *ret)
@@ -1540,10 +2008,22 @@ static int db_select_chunk_tree(Process *p, DbTable *tbl,
 
 }
 
+static int db_select_chunk_tree(Process *p, DbTable *tbl, 
+				Eterm pattern, Sint chunk_size,
+				int reverse, Eterm *ret)
+{
+    int res;
+
+    lock_all_bases(&tbl->tree, 0);
+    res = do_select_chunk_tree(p, tbl, pattern, chunk_size, reverse, ret);
+    unlock_all_bases(&tbl->tree, 0);
+    return res;
+}
+
 /*
 ** This is called when select_delete traps
 */
-static int db_select_delete_continue_tree(Process *p, 
+static int do_select_delete_continue_tree(Process *p, 
 					  DbTable *tbl,
 					  Eterm continuation,
 					  Eterm *ret)
@@ -1630,7 +2110,18 @@ static int db_select_delete_continue_tree(Process *p,
 #undef RET_TO_BIF
 }
 
-static int db_select_delete_tree(Process *p, DbTable *tbl, 
+static int db_select_delete_continue_tree(Process *p, DbTable *tbl,
+					  Eterm continuation, Eterm *ret)
+{
+    int res;
+
+    lock_all_bases(&tbl->tree, 1);
+    res = do_select_delete_continue_tree(p, tbl, continuation, ret);
+    unlock_all_bases(&tbl->tree, 1);
+    return res;
+}
+
+static int do_select_delete_tree(Process *p, DbTable *tbl, 
 				 Eterm pattern, Eterm *ret)
 {
     DbTableTree *tb = &tbl->tree;
@@ -1733,6 +2224,17 @@ static int db_select_delete_tree(Process *p, DbTable *tbl,
 
 }
 
+static int db_select_delete_tree(Process *p, DbTable *tbl, 
+				 Eterm pattern, Eterm *ret)
+{
+    int res;
+
+    lock_all_bases(&tbl->tree, 1);
+    res = do_select_delete_tree(p, tbl, pattern, ret);
+    unlock_all_bases(&tbl->tree, 1);
+    return res;
+}
+
 /*
 ** Other interface routines (not directly coupled to one bif)
 */
@@ -1743,17 +2245,28 @@ static void db_print_tree(int to, void *to_arg,
 			  DbTable *tbl)
 {
     DbTableTree *tb = &tbl->tree;
+    int i;
 #ifdef TREE_DEBUG
     if (show)
 	erts_print(to, to_arg, "\nTree data dump:\n"
 		   "------------------------------------------------\n");
-    do_dump_tree2(to, to_arg, show, tb->root, 0);
+    if (IS_PARTITIONED(tb)) {
+	for (i = 0; i < NBASES(tb); ++i)
+	    do_dump_tree2(to, to_arg, show, BASE(tb,i)->root, 0);
+    } else {
+	do_dump_tree2(to, to_arg, show, tb->root, 0);
+    }
     if (show)
 	erts_print(to, to_arg, "\n"
 		   "------------------------------------------------\n");
 #else
     erts_print(to, to_arg, "Ordered set (AVL tree), Elements: %d\n", NITEMS(tb));
-    do_dump_tree(to, to_arg, tb->root);
+    if (IS_PARTITIONED(tb)) {
+	for (i = 0; i < NBASES(tb); ++i)
+	    do_dump_tree(to, to_arg, BASE(tb,i)->root);
+    } else {
+	do_dump_tree(to, to_arg, tb->root);
+    }
 #endif
 }
 
@@ -1776,6 +2289,19 @@ static int db_free_table_continue_tree(DbTable *tbl)
 	PUSH_NODE(&tb->static_stack, tb->root);
     }
     result = do_free_tree_cont(tb, DELETE_RECORD_LIMIT);
+    if (result && IS_PARTITIONED(tb)) {
+	if (NBASES(tb) > 0) {	/* Continue with the last base */
+	    DbTreeBase *b = BASE(tb,--NBASES(tb));
+	    PUSH_NODE(&tb->static_stack, b->root);
+	    free_base(tb, b);
+	    return 0;
+	}
+	erts_db_free(ERTS_ALC_T_DB_SEG,
+		     (DbTable *) tb,
+		     (void *) tb->bases,
+		     sizeof(DbTreeBases));
+	tb->bases = NULL;
+    }
     if (result) {		/* Completely done. */
 	erts_db_free(ERTS_ALC_T_DB_STK,
 		     (DbTable *) tb,
@@ -1803,7 +2329,75 @@ static void db_foreach_offheap_tree(DbTable *tbl,
 				    void (*func)(ErlOffHeap *, void *),
 				    void * arg)
 {
-    do_db_tree_foreach_offheap(tbl->tree.root, func, arg);
+    DbTableTree *tb = &tbl->tree;
+    int i;
+
+    if (IS_PARTITIONED(tb)) {
+	for (i = 0; i < NBASES(tb); ++i)
+	    do_db_tree_foreach_offheap(BASE(tb,i)->root, func, arg);
+    } else {
+	do_db_tree_foreach_offheap(tb->root, func, arg);
+    }
+}
+
+static void db_foreach_key_tree(DbTable *tbl, Eterm key,
+				void (*func)(DbTable *, Eterm, void *),
+				void *arg)
+{
+    DbTableTree *tb = &tbl->tree;
+    erts_smp_rwmtx_t* lck = RLOCK_KEY(tb,key);
+    TreeDbTerm *this = find_node(tb,key);
+
+    if (this != NULL) {
+	(*func)(tbl, make_tuple(this->dbterm.tpl), arg);
+    }
+    RUNLOCK_BASE(lck);
+}
+
+/* The cursor is the key of the last object done */
+static void db_foreach_dbterm_tree(Process *p, DbTable *tbl,
+				   Eterm *cursor, Sint max,
+				   void (*func)(DbTable *, DbTerm *, void *),
+				   void *arg)
+{
+    DbTableTree *tb = &tbl->tree;
+    DbTreeStack* stack;
+    TreeDbTerm *this;
+    TreeDbTerm *last = NULL;
+    int i;
+
+    lock_all_bases(tb, 0);
+    stack = get_any_stack(tb);
+    if (*cursor == NIL) {
+	/* Leftmost node of the first base that is not empty */
+	this = NULL;
+	for (i = 0; this == NULL && i < (IS_PARTITIONED(tb) ? NBASES(tb) : 1);
+	     ++i) {
+	    stack->pos = stack->slot = 0;
+	    for (this = IS_PARTITIONED(tb) ? BASE(tb,i)->root : tb->root;
+		 this != NULL; this = this->left) {
+		PUSH_NODE(stack, this);
+	    }
+	    this = TOP_NODE(stack);
+	}
+    } else {
+	this = find_next(tb, stack, *cursor);
+    }
+    while (this != NULL && max-- > 0) {
+	(*func)(tbl, &this->dbterm, arg);
+	last = this;
+	this = find_next(tb, stack, GETKEY(tb, this->dbterm.tpl));
+    }
+    release_stack(tb, stack);
+    if (this == NULL) {
+	*cursor = am_EOT;
+    } else {
+	Eterm key = GETKEY(tb, last->dbterm.tpl);
+	Uint sz = size_object(key);
+	Eterm* hp = HAlloc(p, sz);
+	*cursor = copy_struct(key, sz, &hp, &MSO(p));
+    }
+    unlock_all_bases(tb, 0);
 }
 
 
@@ -1832,7 +2426,7 @@ static TreeDbTerm *linkout_tree(DbTableTree *tb,
     int dstack[STACK_NEED+1];
     int dpos = 0;
     int state = 0;
-    TreeDbTerm **this = &tb->root;
+    TreeDbTerm **this = key_root(tb, key);
     Sint c;
     int dir;
     TreeDbTerm *q = NULL;
@@ -1892,7 +2486,7 @@ static TreeDbTerm *linkout_object_tree(DbTableTree *tb,
     int dstack[STACK_NEED+1];
     int dpos = 0;
     int state = 0;
-    TreeDbTerm **this = &tb->root;
+    TreeDbTerm **this;
     Sint c;
     int dir;
     TreeDbTerm *q = NULL;
@@ -1906,6 +2500,7 @@ static TreeDbTerm *linkout_object_tree(DbTableTree *tb,
 
     
     key = GETKEY(tb, tuple_val(object));
+    this = key_root(tb, key);
 
     reset_static_stack(tb);
     dstack[dpos++] = DIR_END;
@@ -1921,7 +2516,7 @@ static TreeDbTerm *linkout_object_tree(DbTableTree *tb,
 	    tstack[tpos++] = this;
 	    this = &((*this)->right);
 	} else { /* Equal key, found the only possible matching object*/
-	    if (!eq(object,make_tuple((*this)->dbterm.tpl))) {
+	    if (!db_eq_dbterm(&tb->common, object, &(*this)->dbterm)) {
 		return NULL;
 	    }
 	    q = (*this);
@@ -2117,10 +2712,11 @@ static TreeDbTerm* get_term(DbTableTree *tb,
 			    TreeDbTerm* old, 
 			    Eterm obj) 
 {
-    TreeDbTerm* p = db_get_term((DbTableCommon *) tb,
-				(old != NULL) ? &(old->dbterm) : NULL, 
-				((char *) &(old->dbterm)) - ((char *) old),
-				obj);
+    TreeDbTerm* p = (IS_COMPRESSED(tb) ? db_get_term_comp : db_get_term)
+	((DbTableCommon *) tb,
+	 (old != NULL) ? &(old->dbterm) : NULL, 
+	 ((char *) &(old->dbterm)) - ((char *) old),
+	 obj);
     return p;
 }
 
@@ -2249,15 +2845,257 @@ static int delsub(TreeDbTerm **this)
     return h;
 }
 
+/*
+ * Helpers for partitioned trees
+ */
+static int tree_height(TreeDbTerm *t)
+{
+    int h = 0;
+
+    while (t != NULL) {
+	++h;
+	t = (t->balance < 0) ? t->left : t->right;
+    }
+    return h;
+}
+
+/*
+ * Join the trees a and b with the node k, all keys in a are smaller than
+ * the key of k which is smaller than all keys in b.
+ */
+static TreeDbTerm *join_trees(TreeDbTerm *a, TreeDbTerm *k, TreeDbTerm *b)
+{
+    TreeDbTerm **tstack[STACK_NEED];
+    int tpos = 0;
+    TreeDbTerm **this;
+    TreeDbTerm *root;
+    int ha = tree_height(a);
+    int hb = tree_height(b);
+    int h, state;
+
+    if (ha <= hb + 1 && hb <= ha + 1) {
+	k->left = a;
+	k->right = b;
+	k->balance = hb - ha;
+	return k;
+    }
+    if (ha > hb) {
+	/* Walk down the right side of a to a subtree as high as b */
+	root = a;
+	this = &root;
+	h = ha;
+	while (h > hb + 1) {
+	    h -= ((*this)->balance >= 0) ? 1 : 2;
+	    tstack[tpos++] = this;
+	    this = &((*this)->right);
+	}
+	k->left = *this;
+	k->right = b;
+	k->balance = hb - h;
+	*this = k;
+	state = 1;
+	while (state && tpos) {
+	    this = tstack[--tpos];
+	    switch ((*this)->balance) {
+	    case -1:
+		(*this)->balance = 0;
+		state = 0;
+		break;
+	    case 0:
+		(*this)->balance = 1;
+		break;
+	    case 1: /* The right side is now two higher, as if the
+		       left had shrunk */
+		state = !balance_left(this);
+		break;
+	    }
+	}
+    } else {
+	root = b;
+	this = &root;
+	h = hb;
+	while (h > ha + 1) {
+	    h -= ((*this)->balance <= 0) ? 1 : 2;
+	    tstack[tpos++] = this;
+	    this = &((*this)->left);
+	}
+	k->left = a;
+	k->right = *this;
+	k->balance = h - ha;
+	*this = k;
+	state = 1;
+	while (state && tpos) {
+	    this = tstack[--tpos];
+	    switch ((*this)->balance) {
+	    case 1:
+		(*this)->balance = 0;
+		state = 0;
+		break;
+	    case 0:
+		(*this)->balance = -1;
+		break;
+	    case -1:
+		state = !balance_right(this);
+		break;
+	    }
+	}
+    }
+    return root;
+}
+
+/*
+ * Link out the node with the smallest key
+ */
+static TreeDbTerm *linkout_min(TreeDbTerm **root)
+{
+    TreeDbTerm **tstack[STACK_NEED];
+    int tpos = 0;
+    TreeDbTerm **this = root;
+    TreeDbTerm *q;
+    int state = 1;
+
+    if (*this == NULL) {
+	return NULL;
+    }
+    while ((*this)->left != NULL) {
+	tstack[tpos++] = this;
+	this = &((*this)->left);
+    }
+    q = *this;
+    *this = q->right;
+    while (state && tpos) {
+	state = balance_left(tstack[--tpos]);
+    }
+    return q;
+}
+
+static DbTreeBase *new_base(DbTableTree *tb, int ix)
+{
+    DbTreeBase *b = (DbTreeBase *) erts_db_alloc(ERTS_ALC_T_DB_SEG,
+						 (DbTable *) tb,
+						 sizeof(DbTreeBase));
+    erts_smp_rwmtx_init_x(&b->lck, "db_tree_base", make_small(ix));
+    b->root = NULL;
+    b->split = NULL;
+    b->lock_stat = 0;
+    return b;
+}
+
+/* The tree of the base must already be taken care of */
+static void free_base(DbTableTree *tb, DbTreeBase *b)
+{
+    if (b->split != NULL) {
+	free_term(tb, b->split);
+    }
+    erts_smp_rwmtx_destroy(&b->lck);
+    erts_db_free(ERTS_ALC_T_DB_SEG,
+		 (DbTable *) tb,
+		 (void *) b,
+		 sizeof(DbTreeBase));
+}
+
+#ifdef ERTS_ENABLE_LOCK_CHECK
+/* Bases are locked in index order, which is what the lock checker
+   is told when the locks are initialized */
+static void renumber_bases(DbTableTree *tb, int from)
+{
+    for (; from < NBASES(tb); ++from) {
+	erts_smp_rwmtx_destroy(&BASE(tb,from)->lck);
+	erts_smp_rwmtx_init_x(&BASE(tb,from)->lck, "db_tree_base",
+			      make_small(from));
+    }
+}
+#else
+#  define renumber_bases(tb,from)
+#endif
+
+/*
+ * Split base ix at the root of its tree, the root and its right subtree
+ * are moved to a new base following it. Table must be exclusively locked.
+ */
+static void split_base(DbTableTree *tb, int ix)
+{
+    DbTreeBase *b = BASE(tb,ix);
+    DbTreeBase *nb;
+    TreeDbTerm *r = b->root;
+    Eterm tmp[2];
+
+    b->lock_stat = 0;
+    if (r == NULL || r->left == NULL) {
+	return; /* Too small to be worth it */
+    }
+    nb = new_base(tb, ix + 1);
+    tmp[0] = make_arityval(1);
+    tmp[1] = GETKEY(tb, r->dbterm.tpl);
+    nb->split = get_term(tb, NULL, make_tuple(tmp));
+    b->root = r->left;
+    nb->root = join_trees(NULL, r, r->right);
+    sys_memmove(&BASE(tb,ix+2), &BASE(tb,ix+1),
+		(NBASES(tb) - ix - 1) * sizeof(DbTreeBase *));
+    BASE(tb,ix+1) = nb;
+    ++NBASES(tb);
+    renumber_bases(tb, ix + 2);
+}
+
+/*
+ * Join base ix+1 into base ix. Table must be exclusively locked.
+ */
+static void join_bases(DbTableTree *tb, int ix)
+{
+    DbTreeBase *b = BASE(tb,ix);
+    DbTreeBase *nb = BASE(tb,ix+1);
+    TreeDbTerm *m;
+
+    if ((m = linkout_min(&nb->root)) != NULL) {
+	b->root = join_trees(b->root, m, nb->root);
+    }
+    b->lock_stat = 0;
+    --NBASES(tb);
+    sys_memmove(&BASE(tb,ix+1), &BASE(tb,ix+2),
+		(NBASES(tb) - ix - 1) * sizeof(DbTreeBase *));
+    free_base(tb, nb);
+    renumber_bases(tb, ix + 1);
+}
+
 /*
  * Helper for db_slot
  */
 
+static Uint count_nodes(TreeDbTerm *t)
+{
+    Uint n = 0;
+
+    while (t != NULL) {
+	n += 1 + count_nodes(t->left);
+	t = t->right;
+    }
+    return n;
+}
+
 static TreeDbTerm *slot_search(Process *p, DbTableTree *tb, Sint slot)
 {
+    TreeDbTerm *root = tb->root;
     TreeDbTerm *this;
     TreeDbTerm *tmp;
-    DbTreeStack* stack = get_any_stack(tb);
+    DbTreeStack* stack;
+    int i;
+
+    if (IS_PARTITIONED(tb)) {
+	/* No slot positions are kept for the bases, count our way
+	   to the base holding the slot */
+	root = NULL;
+	for (i = 0; i < NBASES(tb); ++i) {
+	    Uint n = count_nodes(BASE(tb,i)->root);
+	    if (slot <= n) {
+		root = BASE(tb,i)->root;
+		break;
+	    }
+	    slot -= n;
+	}
+	if (root == NULL)
+	    return NULL;
+    }
+    stack = get_any_stack(tb);
     ASSERT(stack != NULL);
 
     if (slot == 1) { /* Don't search from where we are if we are 
@@ -2270,7 +3108,7 @@ static TreeDbTerm *slot_search(Process *p, DbTableTree *tb, Sint slot)
 	stack->pos = 0;
     }
     if (EMPTY_NODE(stack)) {
-	this = tb->root;
+	this = root;
 	if (this == NULL)
 	    goto done;
 	while (this->left != NULL){
@@ -2328,6 +3166,49 @@ done:
  */
 
 static TreeDbTerm *find_next(DbTableTree *tb, DbTreeStack* stack, Eterm key)
+{
+    TreeDbTerm *this;
+    int i;
+
+    if (!IS_PARTITIONED(tb)) {
+	return do_find_next(tb, tb->root, stack, key);
+    }
+    i = base_ix(tb, key);
+    this = do_find_next(tb, BASE(tb,i)->root, stack, key);
+    /* Continue with the smallest key of the following bases */
+    while (this == NULL && ++i < NBASES(tb)) {
+	stack->pos = stack->slot = 0;
+	for (this = BASE(tb,i)->root; this != NULL; this = this->left) {
+	    PUSH_NODE(stack, this);
+	}
+	this = TOP_NODE(stack);
+    }
+    return this;
+}
+
+static TreeDbTerm *find_prev(DbTableTree *tb, DbTreeStack* stack, Eterm key)
+{
+    TreeDbTerm *this;
+    int i;
+
+    if (!IS_PARTITIONED(tb)) {
+	return do_find_prev(tb, tb->root, stack, key);
+    }
+    i = base_ix(tb, key);
+    this = do_find_prev(tb, BASE(tb,i)->root, stack, key);
+    /* Continue with the largest key of the preceding bases */
+    while (this == NULL && --i >= 0) {
+	stack->pos = stack->slot = 0;
+	for (this = BASE(tb,i)->root; this != NULL; this = this->right) {
+	    PUSH_NODE(stack, this);
+	}
+	this = TOP_NODE(stack);
+    }
+    return this;
+}
+
+static TreeDbTerm *do_find_next(DbTableTree *tb, TreeDbTerm *root,
+				DbTreeStack* stack, Eterm key)
 {
     TreeDbTerm *this;
     TreeDbTerm *tmp;
@@ -2340,7 +3221,7 @@ static TreeDbTerm *find_next(DbTableTree *tb, DbTreeStack* stack, Eterm key)
 	}
     }
     if (EMPTY_NODE(stack)) { /* Have to rebuild the stack */
-	if (( this = tb->root ) == NULL)
+	if (( this = root ) == NULL)
 	    return NULL;
 	for (;;) {
 	    PUSH_NODE(stack, this);
@@ -2384,7 +3265,8 @@ static TreeDbTerm *find_next(DbTableTree *tb, DbTreeStack* stack, Eterm key)
     return this;
 }
 
-static TreeDbTerm *find_prev(DbTableTree *tb, DbTreeStack* stack, Eterm key)
+static TreeDbTerm *do_find_prev(DbTableTree *tb, TreeDbTerm *root,
+				DbTreeStack* stack, Eterm key)
 {
     TreeDbTerm *this;
     TreeDbTerm *tmp;
@@ -2397,7 +3279,7 @@ static TreeDbTerm *find_prev(DbTableTree *tb, DbTreeStack* stack, Eterm key)
 	}
     }
     if (EMPTY_NODE(stack)) { /* Have to rebuild the stack */
-	if (( this = tb->root ) == NULL)
+	if (( this = root ) == NULL)
 	    return NULL;
 	for (;;) {
 	    PUSH_NODE(stack, this);
@@ -2443,6 +3325,40 @@ static TreeDbTerm *find_prev(DbTableTree *tb, DbTreeStack* stack, Eterm key)
 
 static TreeDbTerm *find_next_from_pb_key(DbTableTree *tb, DbTreeStack* stack,
 					 Eterm key)
+{
+    TreeDbTerm *this;
+    int i;
+
+    if (!IS_PARTITIONED(tb)) {
+	return do_find_next_from_pb_key(tb, tb->root, stack, key);
+    }
+    for (i = 0; i < NBASES(tb); ++i) {
+	this = do_find_next_from_pb_key(tb, BASE(tb,i)->root, stack, key);
+	if (this != NULL)
+	    return this;
+    }
+    return NULL;
+}
+
+static TreeDbTerm *find_prev_from_pb_key(DbTableTree *tb, DbTreeStack* stack,
+					 Eterm key)
+{
+    TreeDbTerm *this;
+    int i;
+
+    if (!IS_PARTITIONED(tb)) {
+	return do_find_prev_from_pb_key(tb, tb->root, stack, key);
+    }
+    for (i = NBASES(tb) - 1; i >= 0; --i) {
+	this = do_find_prev_from_pb_key(tb, BASE(tb,i)->root, stack, key);
+	if (this != NULL)
+	    return this;
+    }
+    return NULL;
+}
+
+static TreeDbTerm *do_find_next_from_pb_key(DbTableTree *tb, TreeDbTerm *root,
+					    DbTreeStack* stack, Eterm key)
 {
     TreeDbTerm *this;
     TreeDbTerm *tmp;
@@ -2450,7 +3366,7 @@ static TreeDbTerm *find_next_from_pb_key(DbTableTree *tb, DbTreeStack* stack,
 
     /* spool the stack, we have to "re-search" */
     stack->pos = stack->slot = 0;
-    if (( this = tb->root ) == NULL)
+    if (( this = root ) == NULL)
 	return NULL;
     for (;;) {
 	PUSH_NODE(stack, this);
@@ -2474,8 +3390,8 @@ static TreeDbTerm *find_next_from_pb_key(DbTableTree *tb, DbTreeStack* stack,
     }
 }
 
-static TreeDbTerm *find_prev_from_pb_key(DbTableTree *tb, DbTreeStack* stack,
-					 Eterm key)
+static TreeDbTerm *do_find_prev_from_pb_key(DbTableTree *tb, TreeDbTerm *root,
+					    DbTreeStack* stack, Eterm key)
 {
     TreeDbTerm *this;
     TreeDbTerm *tmp;
@@ -2483,7 +3399,7 @@ static TreeDbTerm *find_prev_from_pb_key(DbTableTree *tb, DbTreeStack* stack,
 
     /* spool the stack, we have to "re-search" */
     stack->pos = stack->slot = 0;
-    if (( this = tb->root ) == NULL)
+    if (( this = root ) == NULL)
 	return NULL;
     for (;;) {
 	PUSH_NODE(stack, this);
@@ -2520,7 +3436,7 @@ static TreeDbTerm *find_node(DbTableTree *tb, Eterm key)
     if(!stack || EMPTY_NODE(stack) 
        || !CMP_EQ(GETKEY(tb, ( this = TOP_NODE(stack) )->dbterm.tpl), key)) {
 
-	this = tb->root;
+	this = *key_root(tb, key);
 	while (this != NULL && 
 	       ( res = cmp(key, GETKEY(tb, this->dbterm.tpl)) ) != 0) {
 	    if (res < 0)
@@ -2543,7 +3459,7 @@ static TreeDbTerm **find_node2(DbTableTree *tb, Eterm key)
     TreeDbTerm **this;
     Sint res;
 
-    this = &tb->root;
+    this = key_root(tb, key);
     while ((*this) != NULL && 
 	   ( res = cmp(key, GETKEY(tb, (*this)->dbterm.tpl)) ) != 0) {
 	if (res < 0)
@@ -2559,10 +3475,16 @@ static TreeDbTerm **find_node2(DbTableTree *tb, Eterm key)
 static int db_lookup_dbterm_tree(DbTable *tbl, Eterm key, DbUpdateHandle* handle)
 {
     DbTableTree *tb = &tbl->tree;
+    DbTreeBase *b = WLOCK_KEY(tb, key);
     TreeDbTerm **pp = find_node2(tb, key);
 
-    if (pp == NULL) return 0;
+    if (pp == NULL) {
+	WUNLOCK_KEY(tb, b);
+	return 0;
+    }
 
+    /* KEEP the base WLOCKED, db_finalize_dbterm_tree will WUNLOCK */
+    handle->lck = b;
     handle->tb = tbl;
     handle->dbterm = &(*pp)->dbterm;
     handle->bp = (void**) pp;
@@ -2608,12 +3530,40 @@ static void db_finalize_dbterm_tree(DbUpdateHandle* handle)
 		     (void *) (((char *) handle->dbterm) - (sizeof(TreeDbTerm) - sizeof(DbTerm))),
 		     sizeof(TreeDbTerm) + sizeof(Eterm)*(handle->dbterm->size-1));
     }
+    WUNLOCK_KEY(&handle->tb->tree, (DbTreeBase*) handle->lck);
 #ifdef DEBUG
     handle->dbterm = 0;
 #endif
     return;
 }   
 
+/*
+ * Root of the first and last non empty tree, NULL if the table is empty
+ */
+static TreeDbTerm *first_root(DbTableTree *tb)
+{
+    int i;
+
+    if (!IS_PARTITIONED(tb)) {
+	return tb->root;
+    }
+    for (i = 0; i < NBASES(tb) && BASE(tb,i)->root == NULL; ++i)
+	;
+    return (i < NBASES(tb)) ? BASE(tb,i)->root : NULL;
+}
+
+static TreeDbTerm *last_root(DbTableTree *tb)
+{
+    int i;
+
+    if (!IS_PARTITIONED(tb)) {
+	return tb->root;
+    }
+    for (i = NBASES(tb) - 1; i >= 0 && BASE(tb,i)->root == NULL; --i)
+	;
+    return (i >= 0) ? BASE(tb,i)->root : NULL;
+}
+
 /*
  * Traverse the tree with a callback function, used by db_match_xxx
  */
@@ -2630,7 +3580,7 @@ static void traverse_backwards(DbTableTree *tb,
 
     if (lastkey == NIL) {
 	stack->pos = stack->slot = 0;
-	if (( this = tb->root ) == NULL) {
+	if (( this = last_root(tb) ) == NULL) {
 	    return;
 	}
 	while (this != NULL) {
@@ -2668,7 +3618,7 @@ static void traverse_forward(DbTableTree *tb,
 
     if (lastkey == NIL) {
 	stack->pos = stack->slot = 0;
-	if (( this = tb->root ) == NULL) {
+	if (( this = first_root(tb) ) == NULL) {
 	    return;
 	}
 	while (this != NULL) {
@@ -3006,7 +3956,6 @@ static int doit_select(DbTableTree *tb, TreeDbTerm *this, void *ptr,
 {
     struct select_context *sc = (struct select_context *) ptr;
     Eterm ret;
-    Uint32 dummy;
 
     sc->lastobj = this->dbterm.tpl;
     
@@ -3021,24 +3970,10 @@ static int doit_select(DbTableTree *tb, TreeDbTerm *this, void *ptr,
 					   this->dbterm.tpl)) > 0))) {
 	return 0;
     }
-    ret = db_prog_match(sc->p, sc->mp,
-			make_tuple(this->dbterm.tpl), 
-			NULL,0, &dummy);
+    ret = db_match_dbterm(&tb->common, sc->p, sc->mp, sc->all_objects,
+			  &this->dbterm);
     if (is_value(ret)) {
-	Uint sz;
-	Eterm *hp;
-	if (sc->all_objects) {
-	    hp = HAlloc(sc->p, this->dbterm.size + 2);
-	    ret = copy_shallow(DBTERM_BUF(&this->dbterm),
-				     this->dbterm.size,
-				     &hp,
-			             &MSO(sc->p));
-	} else {
-	    sz = size_object(ret);
-	    hp = HAlloc(sc->p, sz + 2);
-	    ret = copy_struct(ret, sz, 
-			      &hp, &MSO(sc->p));
-	}
+	Eterm *hp = HAlloc(sc->p, 2);
 	sc->accum = CONS(hp, ret, sc->accum);
     }
     if (MBUF(sc->p)) {
@@ -3058,8 +3993,6 @@ static int doit_select_count(DbTableTree *tb, TreeDbTerm *this, void *ptr,
 			     int forward)
 {
     struct select_count_context *sc = (struct select_count_context *) ptr;
-    Eterm ret;
-    Uint32 dummy;
 
     sc->lastobj = this->dbterm.tpl;
     
@@ -3070,10 +4003,7 @@ static int doit_select_count(DbTableTree *tb, TreeDbTerm *this, void *ptr,
 					  this->dbterm.tpl)) > 0)) {
 	return 0;
     }
-    ret = db_prog_match(sc->p, sc->mp,
-			make_tuple(this->dbterm.tpl), 
-			NULL,0, &dummy);
-    if (ret == am_true) {
+    if (db_test_dbterm(&tb->common, sc->p, sc->mp, &this->dbterm)) {
 	++(sc->got);
     }
     if (--(sc->max) <= 0) {
@@ -3087,7 +4017,6 @@ static int doit_select_chunk(DbTableTree *tb, TreeDbTerm *this, void *ptr,
 {
     struct select_context *sc = (struct select_context *) ptr;
     Eterm ret;
-    Uint32 dummy;
 
     sc->lastobj = this->dbterm.tpl;
     
@@ -3103,25 +4032,12 @@ static int doit_select_chunk(DbTableTree *tb, TreeDbTerm *this, void *ptr,
 	return 0;
     }
 
-    ret = db_prog_match(sc->p, sc->mp,
-			make_tuple(this->dbterm.tpl), 
-			NULL,0, &dummy);
+    ret = db_match_dbterm(&tb->common, sc->p, sc->mp, sc->all_objects,
+			  &this->dbterm);
     if (is_value(ret)) {
-	Uint sz;
-	Eterm *hp;
+	Eterm *hp = HAlloc(sc->p, 2);
 
 	++(sc->got);
-	if (sc->all_objects) {
-	    hp = HAlloc(sc->p, this->dbterm.size + 2);
-	    ret = copy_shallow(DBTERM_BUF(&this->dbterm),
-				     this->dbterm.size,
-				     &hp,
-			             &MSO(sc->p));
-	} else {
-	    sz = size_object(ret);
-	    hp = HAlloc(sc->p, sz + 2);
-	    ret = copy_struct(ret, sz, &hp, &MSO(sc->p));
-	}
 	sc->accum = CONS(hp, ret, sc->accum);
     }
     if (MBUF(sc->p)) {
@@ -3142,8 +4058,6 @@ static int doit_select_delete(DbTableTree *tb, TreeDbTerm *this, void *ptr,
 			      int forward)
 {
     struct select_delete_context *sc = (struct select_delete_context *) ptr;
-    Eterm ret;
-    Uint32 dummy;
     Eterm key;
 
     if (sc->erase_lastterm)
@@ -3156,10 +4070,7 @@ static int doit_select_delete(DbTableTree *tb, TreeDbTerm *this, void *ptr,
 			 GETKEY_WITH_POS(sc->keypos, 
 					 this->dbterm.tpl)) > 0)
 	return 0;
-    ret = db_prog_match(sc->p, sc->mp,
-			make_tuple(this->dbterm.tpl), 
-			NULL,0, &dummy);
-    if (ret == am_true) {
+    if (db_test_dbterm(&tb->common, sc->p, sc->mp, &this->dbterm)) {
 	key = GETKEY(sc->tb, this->dbterm.tpl);
 	linkout_tree(sc->tb, key);
 	sc->erase_lastterm = 1;
@@ -3194,6 +4105,12 @@ static void do_dump_tree2(int to, void *to_arg, int show, TreeDbTerm *t,
 void db_check_table_tree(DbTable *tbl)
 {
     DbTableTree *tb = &tbl->tree;
+    int i;
+    if (IS_PARTITIONED(tb)) {
+	for (i = 0; i < NBASES(tb); ++i)
+	    check_table_tree(BASE(tb,i)->root);
+	return;
+    }
     check_table_tree(tb->root);
     check_saved_stack(tb);
     check_slot_pos(tb);
@@ -34,6 +34,26 @@ typedef struct {
     TreeDbTerm** array; /* The stack */
 } DbTreeStack;
 
+/*
+** A write_concurrency ordered_set is partitioned into a sorted array of
+** bases, each an AVL tree of its own protected by its own lock. Bases are
+** split and joined depending on how contended their locks are.
+*/
+#define DB_TREE_MAX_BASES 64
+
+typedef struct db_tree_base {
+    erts_smp_rwmtx_t lck;     /* Protects root */
+    TreeDbTerm *root;         /* The tree root of this base */
+    TreeDbTerm *split;        /* {Key} where Key is the lowest key that
+				 belongs to this base, NULL for the first */
+    Sint lock_stat;           /* > 0 if contended, < 0 if not */
+} DbTreeBase;
+
+typedef struct {
+    int nbases;
+    DbTreeBase *base[DB_TREE_MAX_BASES]; /* Sorted on split key */
+} DbTreeBases;
+
 typedef struct db_table_tree {
     DbTableCommon common;
 
@@ -42,6 +62,9 @@ typedef struct db_table_tree {
     Uint deletion;		/* Being deleted */
     erts_smp_atomic_t is_stack_busy;
     DbTreeStack static_stack;
+    DbTreeBases *bases;       /* Partitioned tree, root is not used, 
+				 NULL if not fine locked */
+    erts_smp_atomic_t adapt;  /* A base is to be split or joined */
 } DbTableTree;
 
 /*
@@ -51,5 +74,9 @@ typedef struct db_table_tree {
 void db_initialize_tree(void);
 
 int db_create_tree(Process *p, DbTable *tbl);
+void db_adapt_tree(DbTable *tbl);
+
+/* Insert a list of objects, write locking each base once */
+int db_put_many_tree(DbTable *tbl, Eterm *objs, Uint nobjs);
 
 #endif /* _DB_TREE_H */
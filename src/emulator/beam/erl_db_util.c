@@ -36,6 +36,8 @@
 #include "bif.h"
 #include "big.h"
 #include "erl_binary.h"
+#include "external.h"
+#include "erl_zlib.h"
 
 #include "erl_db_util.h"
 
@@ -261,9 +263,26 @@ typedef enum {
     matchSilent,
     matchSetSeqTokenFake,
     matchTrace2,
-    matchTrace3
+    matchTrace3,
+    matchCmpVC, /* Compare variable and constant, push the result */
+    matchTestVC, /* As above but fail unless true, for guard tests */
+    matchElementV /* Push element of tuple bound to variable */
 } MatchOps;
 
+/*
+** Comparisons done by matchCmpVC and matchTestVC
+*/
+typedef enum {
+    dmcCmpEqExact,
+    dmcCmpNeqExact,
+    dmcCmpEq,
+    dmcCmpNeq,
+    dmcCmpLt,
+    dmcCmpGe,
+    dmcCmpGt,
+    dmcCmpLe
+} DMCCmpOps;
+
 /*
 ** Guard bif's
 */
@@ -409,21 +428,21 @@ create_match_pseudo_process(void)
 }
 
 static ERTS_INLINE ErtsMatchPseudoProcess *
-get_match_pseudo_process(Process *c_p, Uint heap_size)
+get_match_pseudo_process(ErtsSchedulerData *esdp, Uint heap_size)
 {
     ErtsMatchPseudoProcess *mpsp;
 #ifdef ERTS_SMP
-    mpsp = (ErtsMatchPseudoProcess *) c_p->scheduler_data->match_pseudo_process;
+    mpsp = (ErtsMatchPseudoProcess *) esdp->match_pseudo_process;
     if (mpsp)
 	cleanup_match_pseudo_process(mpsp, 0);
     else {
 	ASSERT(erts_smp_tsd_get(match_pseudo_process_key) == NULL);
 	mpsp = create_match_pseudo_process();
-	c_p->scheduler_data->match_pseudo_process = (void *) mpsp;
+	esdp->match_pseudo_process = (void *) mpsp;
 	erts_smp_tsd_set(match_pseudo_process_key, (void *) mpsp);
     }
     ASSERT(mpsp == erts_smp_tsd_get(match_pseudo_process_key));
-    mpsp->process.scheduler_data = c_p->scheduler_data;
+    mpsp->process.scheduler_data = esdp;
 #else
     mpsp = match_pseudo_process;
     cleanup_match_pseudo_process(mpsp, 0);
@@ -466,7 +485,8 @@ match_pseudo_process_init(void)
 void
 erts_match_set_release_result(Process* c_p)
 {
-    (void) get_match_pseudo_process(c_p, 0); /* Clean it up */
+    /* Clean it up */
+    (void) get_match_pseudo_process(ERTS_GET_SCHEDULER_DATA_FROM_PROC(c_p), 0);
 }
 
 /* The trace control word. */
@@ -865,6 +885,10 @@ static DMCRet compile_guard_expr(DMCContext *context,
 				    DMCHeap *heap,
 				    DMC_STACK_TYPE(UWord) *text,
 				    Eterm t);
+static DMCRet dmc_guard_test(DMCContext *context,
+			     DMCHeap *heap,
+			     DMC_STACK_TYPE(UWord) *text,
+			     Eterm t);
 /* match expression subroutine */
 static DMCRet dmc_one_term(DMCContext *context, 
 			   DMCHeap *heap,
@@ -891,6 +915,11 @@ static void add_dmc_err(DMCErrInfo *err_info,
 
 static Eterm dpm_array_to_list(Process *psp, Eterm *arr, int arity);
 
+static Eterm db_prog_match_int(ErtsSchedulerData *esdp, Process *c_p,
+			       Eterm self, Binary *bprog, Eterm term,
+			       Eterm *termp, int arity,
+			       Uint32 *return_flags);
+
 static Eterm match_spec_test(Process *p, Eterm against, Eterm spec, int trace);
 
 static Eterm seq_trace_fake(Process *p, Eterm arg1);
@@ -1263,6 +1292,42 @@ Eterm db_getkey(int keypos, Eterm obj)
 ** Matching compiled (executed by "Pam" :-)
 */
 
+/*
+** A table match spec with a single clause and a tuple head can only
+** match objects of the head's arity with the same immediate constants
+** in the same places. Record that, so that db_prog_match() can reject
+** most objects without starting the program.
+*/
+static void dmc_prefilter(MatchProg *prog, DMCContext *context)
+{
+    Eterm head;
+    Eterm *tp;
+    Uint i;
+
+    prog->prefilter_arity = 0;
+    prog->prefilter_num = 0;
+    if (!(context->cflags & DCOMP_TABLE) || context->num_match != 1) {
+	return;
+    }
+    head = context->matchexpr[0];
+    if (!is_tuple(head)) {
+	return;
+    }
+    tp = tuple_val(head);
+    prog->prefilter_arity = arityval(*tp);
+    for (i = 1; i <= arityval(*tp); ++i) {
+	if (prog->prefilter_num == DMC_MAX_PREFILTER) {
+	    break;
+	}
+	if (is_immed(tp[i]) && db_is_variable(tp[i]) < 0 
+	    && tp[i] != am_Underscore) {
+	    prog->prefilter_pos[prog->prefilter_num] = i;
+	    prog->prefilter_val[prog->prefilter_num] = tp[i];
+	    ++prog->prefilter_num;
+	}
+    }
+}
+
 /*
 ** The actual compiling of the match expression and the guards
 */
@@ -1538,6 +1603,7 @@ restart:
 		      (3 * (FENCE_PATTERN_SIZE * sizeof(Eterm *))));
     ret->eheap_offset = heap.used + FENCE_PATTERN_SIZE;
     ret->stack_offset = ret->eheap_offset + max_eheap_need + FENCE_PATTERN_SIZE;
+    dmc_prefilter(ret, &context);
 #ifdef DMC_DEBUG
     ret->prog_end = ret->text + DMC_STACK_NUM(text);
 #endif
@@ -1595,6 +1661,23 @@ erts_match_prog_foreach_offheap(Binary *bprog,
 	(*func)(&(prog->saved_program_buf->off_heap), arg);
 }
 
+/*
+** The comparison of matchCmpVC and matchTestVC
+*/
+static ERTS_INLINE int dmc_cmp(UWord op, Eterm a, Eterm b)
+{
+    switch (op) {
+    case dmcCmpEqExact:	 return EQ(a, b);
+    case dmcCmpNeqExact: return !EQ(a, b);
+    case dmcCmpEq:	 return CMP_EQ(a, b);
+    case dmcCmpNeq:	 return CMP_NE(a, b);
+    case dmcCmpLt:	 return CMP_LT(a, b);
+    case dmcCmpGe:	 return CMP_GE(a, b);
+    case dmcCmpGt:	 return CMP_LT(b, a);
+    default:		 return CMP_GE(b, a);
+    }
+}
+
 /*
 ** This is not the most efficient way to do it, but it's a rare
 ** and not especially nice case when this is used.
@@ -1619,6 +1702,32 @@ Eterm db_prog_match(Process *c_p, Binary *bprog, Eterm term,
 		    Eterm *termp,
 		    int arity,
 		    Uint32 *return_flags)
+{
+    return db_prog_match_int(ERTS_GET_SCHEDULER_DATA_FROM_PROC(c_p), c_p,
+			     c_p->id, bprog, term, termp, arity, return_flags);
+}
+
+/*
+** Run a table match program (DCOMP_TABLE) without a process, in the
+** match context of the scheduler esdp. self is what self() returns.
+** Used by schedulers helping some process with a table scan.
+*/
+Eterm db_prog_match_table(ErtsSchedulerData *esdp, Eterm self,
+			  Binary *bprog, Eterm term,
+			  Uint32 *return_flags)
+{
+    return db_prog_match_int(esdp, NULL, self, bprog, term, NULL, 0,
+			     return_flags);
+}
+
+/*
+** c_p is only used by trace match programs and is NULL for
+** db_prog_match_table().
+*/
+static Eterm db_prog_match_int(ErtsSchedulerData *esdp, Process *c_p,
+			       Eterm self, Binary *bprog, Eterm term,
+			       Eterm *termp, int arity,
+			       Uint32 *return_flags)
 {
     MatchProg *prog = Binary2MatchProg(bprog);
     Eterm *ep;
@@ -1638,7 +1747,6 @@ Eterm db_prog_match(Process *c_p, Binary *bprog, Eterm term,
     Process *psp;
     Process *tmpp;
     Process *current_scheduled;
-    ErtsSchedulerData *esdp;
     Eterm (*bif)(Process*, ...);
     int fail_label;
     int atomic_trace;
@@ -1649,13 +1757,27 @@ Eterm db_prog_match(Process *c_p, Binary *bprog, Eterm term,
     Uint save_op;
 #endif /* DMC_DEBUG */
 
-    mpsp = get_match_pseudo_process(c_p, prog->heap_size);
+    if (prog->prefilter_arity != 0) {
+	if (!is_tuple(term) || 
+	    arityval(*tuple_val(term)) != prog->prefilter_arity) {
+	    *return_flags = 0U;
+	    return THE_NON_VALUE;
+	}
+	tp = tuple_val(term);
+	for (i = 0; i < prog->prefilter_num; ++i) {
+	    if (tp[prog->prefilter_pos[i]] != prog->prefilter_val[i]) {
+		*return_flags = 0U;
+		return THE_NON_VALUE;
+	    }
+	}
+    }
+
+    mpsp = get_match_pseudo_process(esdp, prog->heap_size);
     psp = &mpsp->process;
 
     /* We need to lure the scheduler into believing in the pseudo process, 
        because of floating point exceptions. Do *after* mpsp is set!!! */
 
-    esdp = ERTS_GET_SCHEDULER_DATA_FROM_PROC(c_p);
     ASSERT(esdp != NULL);
     current_scheduled = esdp->current_process;
     esdp->current_process = psp;
@@ -1912,6 +2034,27 @@ restart:
 	case matchPushV:
 	    *esp++ = hp[*pc++];
 	    break;
+	case matchCmpVC:
+	    *esp++ = dmc_cmp(pc[0], hp[pc[1]], (Eterm) pc[2]) 
+		? am_true : am_false;
+	    pc += 3;
+	    break;
+	case matchTestVC:
+	    if (!dmc_cmp(pc[0], hp[pc[1]], (Eterm) pc[2]))
+		FAIL();
+	    pc += 3;
+	    break;
+	case matchElementV:
+	    n = *pc++;
+	    t = hp[*pc++];
+	    if (is_tuple(t) && n <= arityval(*tuple_val(t))) {
+		*esp++ = tuple_val(t)[n];
+	    } else if (do_catch) {
+		*esp++ = FAIL_TERM;
+	    } else {
+		FAIL();
+	    }
+	    break;
 	case matchPushExpr:
 	    *esp++ = term;
 	    break;
@@ -2005,7 +2148,7 @@ restart:
 	    pc += n;
 	    break;
 	case matchSelf:
-	    *esp++ = c_p->id;
+	    *esp++ = self;
 	    break;
 	case matchWaste:
 	    --esp;
@@ -2515,6 +2658,400 @@ void db_free_term_data(DbTerm* p)
     erts_cleanup_offheap(&p->off_heap);
 }
 
+/*
+** Compressed tables (DB_COMPRESSED)
+**
+** The key and the elements that are immediates or numbers are stored
+** as they are, every other element is stored as a heap binary holding
+**
+**    byte 0:     DB_ELEM_EXT or DB_ELEM_ZLIB
+**    bytes 1-4:  heap size of the decoded element
+**    bytes 5-8:  size of the external format (DB_ELEM_ZLIB only)
+**    bytes 5/9-: the external format, zlib compressed if DB_ELEM_ZLIB
+**
+** and is decoded when it is copied out of the table. Keeping numbers
+** as they are lets update_counter work on the stored term, nothing
+** would be gained by encoding them anyway.
+*/
+#define DB_ELEM_EXT  0
+#define DB_ELEM_ZLIB 1
+#define DB_ELEM_HDR      5
+#define DB_ELEM_ZLIB_HDR 9
+
+#define DB_ELEM_ENCODED(X) (is_not_immed(X) && !is_number(X))
+#define IS_ENCODED(TB,TPL,I) ((I) != (TB)->keypos && DB_ELEM_ENCODED((TPL)[I]))
+
+/*
+** Encode elem the way compressed tables store it. The heap binary is
+** allocated as ERTS_ALC_T_TMP and freed by the caller.
+*/
+static Eterm encode_element(DbTableCommon *tb, Eterm elem)
+{
+    Uint ext_sz = erts_encode_ext_size(elem);
+    Eterm* hp = erts_alloc(ERTS_ALC_T_TMP,
+			   heap_bin_size(DB_ELEM_ZLIB_HDR + ext_sz)
+			   * sizeof(Eterm));
+    ErlHeapBin* hb = (ErlHeapBin *) hp;
+    byte* bytes = (byte *) hb->data;
+    byte* ext = bytes + DB_ELEM_HDR;
+    byte* ep = ext;
+    Uint sz;
+    Sint dsz;
+
+    erts_encode_ext(elem, &ep);
+    ext_sz = ep - ext;
+    dsz = erts_decode_ext_size(ext, ext_sz, 0);
+    ASSERT(dsz >= 0);
+    bytes[0] = DB_ELEM_EXT;
+    put_int32(dsz, bytes+1);
+    sz = DB_ELEM_HDR + ext_sz;
+
+    if ((tb->status & DB_COMPRESSED_ZLIB) && ext_sz > DB_ELEM_ZLIB_HDR) {
+	/* Only keep the compressed form if it is smaller */
+	uLongf dest_len = ext_sz - (DB_ELEM_ZLIB_HDR - DB_ELEM_HDR);
+	byte* zbuf = erts_alloc(ERTS_ALC_T_TMP, dest_len);
+
+	if (erl_zlib_compress2(zbuf, &dest_len, ext, ext_sz,
+			       Z_DEFAULT_COMPRESSION) == Z_OK) {
+	    bytes[0] = DB_ELEM_ZLIB;
+	    put_int32(ext_sz, bytes+5);
+	    sys_memcpy(bytes + DB_ELEM_ZLIB_HDR, zbuf, dest_len);
+	    sz = DB_ELEM_ZLIB_HDR + dest_len;
+	}
+	erts_free(ERTS_ALC_T_TMP, zbuf);
+    }
+    hb->thing_word = header_heap_bin(sz);
+    hb->size = sz;
+    return make_binary(hb);
+}
+
+static ERTS_INLINE Uint decoded_element_size(Eterm elem)
+{
+    ErlHeapBin* hb = (ErlHeapBin *) binary_val(elem);
+    return (Uint) get_int32(((byte *) hb->data) + 1);
+}
+
+static Eterm decode_element(Eterm elem, Eterm** hpp, ErlOffHeap* off_heap)
+{
+    ErlHeapBin* hb = (ErlHeapBin *) binary_val(elem);
+    byte* bytes = (byte *) hb->data;
+    byte* ext;
+    Eterm res;
+
+    ASSERT(thing_subtag(hb->thing_word) == HEAP_BINARY_SUBTAG);
+    if (bytes[0] == DB_ELEM_ZLIB) {
+	uLongf ext_sz = (Uint32) get_int32(bytes+5);
+	byte* buf = erts_alloc(ERTS_ALC_T_TMP, ext_sz);
+
+	if (erl_zlib_uncompress(buf, &ext_sz, bytes + DB_ELEM_ZLIB_HDR,
+				hb->size - DB_ELEM_ZLIB_HDR) != Z_OK) {
+	    erl_exit(1, "%s, line %d: bad compressed ets element\n",
+		     __FILE__, __LINE__);
+	}
+	ext = buf;
+	res = erts_decode_ext(hpp, off_heap, &ext);
+	erts_free(ERTS_ALC_T_TMP, buf);
+    }
+    else {
+	ext = bytes + DB_ELEM_HDR;
+	res = erts_decode_ext(hpp, off_heap, &ext);
+    }
+    if (is_non_value(res)) {
+	erl_exit(1, "%s, line %d: bad compressed ets element\n",
+		 __FILE__, __LINE__);
+    }
+    return res;
+}
+
+/*
+** As db_get_term(), but stores obj as in a compressed table.
+*/
+void* db_get_term_comp(DbTableCommon *tb, DbTerm* old, Uint offset, Eterm obj)
+{
+    Eterm* tpl = tuple_val(obj);
+    Uint arity = arityval(*tpl);
+    Eterm* tmp = erts_alloc(ERTS_ALC_T_TMP, (arity+1)*sizeof(Eterm));
+    void* structp;
+    Uint i;
+
+    tmp[0] = tpl[0];
+    for (i = 1; i <= arity; i++) {
+	tmp[i] = IS_ENCODED(tb,tpl,i) ? encode_element(tb, tpl[i]) : tpl[i];
+    }
+    structp = db_get_term(tb, old, offset, make_tuple(tmp));
+    for (i = 1; i <= arity; i++) {
+	if (IS_ENCODED(tb,tpl,i)) {
+	    erts_free(ERTS_ALC_T_TMP, binary_val(tmp[i]));
+	}
+    }
+    erts_free(ERTS_ALC_T_TMP, tmp);
+    return structp;
+}
+
+/*
+** Heap size needed by db_copy_dbterm().
+*/
+Uint db_size_dbterm(DbTableCommon *tb, DbTerm* obj)
+{
+    Uint arity, i, sz;
+
+    if (!(tb->status & DB_COMPRESSED)) {
+	return obj->size;
+    }
+    arity = arityval(obj->tpl[0]);
+    sz = arity + 1;
+    for (i = 1; i <= arity; i++) {
+	sz += db_size_element(tb, obj, i);
+    }
+    return sz;
+}
+
+/*
+** Copy a stored object to *hpp, decoding it if the table is compressed.
+*/
+Eterm db_copy_dbterm(DbTableCommon *tb, DbTerm* obj,
+		     Eterm** hpp, ErlOffHeap* off_heap)
+{
+    Uint arity, i;
+    Eterm* res;
+
+    if (!(tb->status & DB_COMPRESSED)) {
+	return copy_shallow(DBTERM_BUF(obj), obj->size, hpp, off_heap);
+    }
+    arity = arityval(obj->tpl[0]);
+    res = *hpp;
+    *hpp += arity + 1;
+    res[0] = obj->tpl[0];
+    for (i = 1; i <= arity; i++) {
+	res[i] = db_copy_element(tb, obj, i, hpp, off_heap);
+    }
+    return make_tuple(res);
+}
+
+Uint db_size_element(DbTableCommon *tb, DbTerm* obj, int ndex)
+{
+    Eterm elem = obj->tpl[ndex];
+
+    if (is_immed(elem)) {
+	return 0;
+    }
+    if ((tb->status & DB_COMPRESSED) && IS_ENCODED(tb,obj->tpl,ndex)) {
+	return decoded_element_size(elem);
+    }
+    return size_object(elem);
+}
+
+Eterm db_copy_element(DbTableCommon *tb, DbTerm* obj, int ndex,
+		      Eterm** hpp, ErlOffHeap* off_heap)
+{
+    Eterm elem = obj->tpl[ndex];
+
+    if (is_immed(elem)) {
+	return elem;
+    }
+    if ((tb->status & DB_COMPRESSED) && IS_ENCODED(tb,obj->tpl,ndex)) {
+	return decode_element(elem, hpp, off_heap);
+    }
+    return copy_struct(elem, size_object(elem), hpp, off_heap);
+}
+
+/*
+** As COPY_OBJECT() on an element of a stored object.
+*/
+Eterm db_copy_element_proc(DbTableCommon *tb, Process *p,
+			   DbTerm* obj, int ndex)
+{
+    Eterm* hp;
+
+    if (is_immed(obj->tpl[ndex])) {
+	return obj->tpl[ndex];
+    }
+    hp = HAlloc(p, db_size_element(tb, obj, ndex));
+    return db_copy_element(tb, obj, ndex, &hp, &MSO(p));
+}
+
+/*
+** Decoded copy of an object in a compressed table, for matching and
+** comparing. Allocated as ERTS_ALC_T_TMP, free with free_tmp_dbterm().
+*/
+static DbTerm* alloc_tmp_dbterm(DbTableCommon *tb, DbTerm* obj)
+{
+    Uint sz = db_size_dbterm(tb, obj);
+    DbTerm* p = erts_alloc(ERTS_ALC_T_TMP,
+			   sizeof(DbTerm) + sizeof(Eterm)*(sz-1));
+    Eterm* top = DBTERM_BUF(p);
+    Eterm copy;
+
+    p->off_heap.mso = NULL;
+    p->off_heap.externals = NULL;
+#ifndef HYBRID /* FIND ME! */
+    p->off_heap.funs = NULL;
+#endif
+    p->off_heap.overhead = 0;
+    copy = db_copy_dbterm(tb, obj, &top, &p->off_heap);
+    DBTERM_SET_TPL(p,tuple_val(copy));
+    (void) copy; /* Only checked in debug builds */
+    p->size = top - DBTERM_BUF(p);
+    ASSERT(p->size == sz);
+    return p;
+}
+
+static void free_tmp_dbterm(DbTerm* p)
+{
+    erts_cleanup_offheap(&p->off_heap);
+    erts_free(ERTS_ALC_T_TMP, p);
+}
+
+/*
+** Run the match program mp on a stored object. If it matches, the
+** result (the whole object if all_objects) is copied to the heap of p
+** and returned, otherwise THE_NON_VALUE.
+*/
+Eterm db_match_dbterm(DbTableCommon *tb, Process *p, Binary *mp,
+		      int all_objects, DbTerm* obj)
+{
+    Uint32 dummy;
+    DbTerm* tmp = NULL;
+    Eterm res;
+    Eterm* hp;
+    Uint sz;
+
+    if (tb->status & DB_COMPRESSED) {
+	obj = tmp = alloc_tmp_dbterm(tb, obj);
+    }
+    res = db_prog_match(p, mp, make_tuple(obj->tpl), NULL, 0, &dummy);
+    if (is_value(res)) {
+	if (all_objects) {
+	    hp = HAlloc(p, obj->size);
+	    res = copy_shallow(DBTERM_BUF(obj), obj->size, &hp, &MSO(p));
+	}
+	else if (is_not_immed(res)) {
+	    sz = size_object(res);
+	    hp = HAlloc(p, sz);
+	    res = copy_struct(res, sz, &hp, &MSO(p));
+	}
+    }
+    if (tmp != NULL) {
+	free_tmp_dbterm(tmp);
+    }
+    return res;
+}
+
+/*
+** Whether the match program mp returns true for a stored object,
+** as for select_count and select_delete.
+*/
+int db_test_dbterm(DbTableCommon *tb, Process *p, Binary *mp, DbTerm* obj)
+{
+    Uint32 dummy;
+    DbTerm* tmp = NULL;
+    int res;
+
+    if (tb->status & DB_COMPRESSED) {
+	obj = tmp = alloc_tmp_dbterm(tb, obj);
+    }
+    res = (db_prog_match(p, mp, make_tuple(obj->tpl), NULL, 0, &dummy)
+	   == am_true);
+    if (tmp != NULL) {
+	free_tmp_dbterm(tmp);
+    }
+    return res;
+}
+
+/*
+** Compare obj to a stored object.
+*/
+int db_eq_dbterm(DbTableCommon *tb, Eterm obj, DbTerm* dbterm)
+{
+    DbTerm* tmp;
+    int res;
+
+    if (!(tb->status & DB_COMPRESSED)) {
+	return eq(make_tuple(dbterm->tpl), obj);
+    }
+    tmp = alloc_tmp_dbterm(tb, dbterm);
+    res = eq(make_tuple(tmp->tpl), obj);
+    free_tmp_dbterm(tmp);
+    return res;
+}
+
+/*
+** An element as it should be written into a stored object of tb by
+** db_do_update_element(). Encoded elements are built on the heap of p.
+*/
+Eterm db_encode_element(DbTableCommon *tb, Process *p, Eterm elem)
+{
+    Eterm enc;
+    Eterm* hp;
+    Uint sz;
+
+    if (!(tb->status & DB_COMPRESSED) || !DB_ELEM_ENCODED(elem)) {
+	return elem;
+    }
+    enc = encode_element(tb, elem);
+    sz = heap_bin_size(binary_size(enc));
+    hp = HAlloc(p, sz);
+    sys_memcpy(hp, binary_val(enc), sz*sizeof(Eterm));
+    erts_free(ERTS_ALC_T_TMP, binary_val(enc));
+    return make_binary(hp);
+}
+
+/*
+** Timestamp in microseconds for the table statistics. Only taken around
+** selects and when a stripe lock turned out to be busy.
+*/
+Uint64 db_stats_time(void)
+{
+#ifdef HAVE_GETHRTIME
+    return (Uint64) (sys_gethrtime() / 1000);
+#else
+    SysTimeval tv;
+    sys_gettimeofday(&tv);
+    return ((Uint64) tv.tv_sec) * 1000000 + tv.tv_usec;
+#endif
+}
+
+/*
+** Jobs split between a process and idle schedulers: the process waits
+** for the other threads still working on the job blocked on a condition
+** variable rather than spinning on the busy count.
+*/
+void db_workers_init(DbWorkers* w)
+{
+    erts_smp_atomic_init(&w->busy, 0);
+    erts_smp_mtx_init(&w->mtx, "db_workers");
+    erts_smp_cnd_init(&w->cnd);
+}
+
+void db_workers_destroy(DbWorkers* w)
+{
+    erts_smp_cnd_destroy(&w->cnd);
+    erts_smp_mtx_destroy(&w->mtx);
+}
+
+void db_workers_enter(DbWorkers* w)
+{
+    erts_smp_atomic_inc(&w->busy);
+}
+
+void db_workers_leave(DbWorkers* w)
+{
+    if (erts_smp_atomic_dectest(&w->busy) == 0) {
+	erts_smp_mtx_lock(&w->mtx);
+	erts_smp_cnd_broadcast(&w->cnd);
+	erts_smp_mtx_unlock(&w->mtx);
+    }
+}
+
+void db_workers_wait(DbWorkers* w)
+{
+    erts_smp_mtx_lock(&w->mtx);
+    while (erts_smp_atomic_read(&w->busy) != 0) {
+	erts_smp_cnd_wait(&w->cnd, &w->mtx);
+    }
+    erts_smp_mtx_unlock(&w->mtx);
+}
+
 
 /*
 ** Check if object represents a "match" variable 
@@ -2842,8 +3379,8 @@ static DMCRet dmc_one_term(DMCContext *context,
 ** Match guard compilation
 */
 
-static void do_emit_constant(DMCContext *context, DMC_STACK_TYPE(UWord) *text,
-			     Eterm t) 
+/* A copy of constant t that lives as long as the program */
+static Eterm dmc_private_constant(DMCContext *context, Eterm t)
 {
 	int sz;
 	ErlHeapFragment *emb;
@@ -2860,6 +3397,14 @@ static void do_emit_constant(DMCContext *context, DMC_STACK_TYPE(UWord) *text,
 	    emb->next = context->save;
 	    context->save = emb;
 	}
+	return tmp;
+}
+
+static void do_emit_constant(DMCContext *context, DMC_STACK_TYPE(UWord) *text,
+			     Eterm t) 
+{
+	Eterm tmp = dmc_private_constant(context, t);
+
 	DMC_PUSH(*text,matchPushC);
 	DMC_PUSH(*text,(Uint) tmp);
 	if (++context->stack_used > context->stack_need)
@@ -3814,6 +4359,99 @@ static DMCRet dmc_silent(DMCContext *context,
   
 
 
+/*
+** Is t a constant that needs no code to be evaluated?
+*/
+static int dmc_is_simple_constant(Eterm t)
+{
+    if (is_immed(t)) {
+	return (db_is_variable(t) < 0 && t != am_DollarUnderscore &&
+		t != am_DollarDollar);
+    }
+    return is_boxed(t) && !BOXED_IS_TUPLE(t);
+}
+
+/*
+** Variable number if t is a bound variable, otherwise -1
+*/
+static int dmc_bound_variable(DMCHeap *heap, Eterm t)
+{
+    int n = db_is_variable(t);
+
+    if (n < 0 || n >= heap->used || heap->data[n] == 0U) {
+	return -1;
+    }
+    return n;
+}
+
+/*
+** Emit a superinstruction for the guard call t if it has one of the
+** common shapes, a comparison between a bound variable and a constant
+** or element/2 on a bound variable with a constant index. These save
+** pushing the arguments and the bif call. Returns 0 if nothing emitted.
+*/
+static int dmc_super_call(DMCContext *context,
+			  DMCHeap *heap,
+			  DMC_STACK_TYPE(UWord) *text,
+			  Eterm t)
+{
+    Eterm *p = tuple_val(t);
+    int n;
+    int swap;
+    UWord op;
+
+    if (arityval(*p) != 3) {
+	return 0;
+    }
+    if (p[1] == am_element) {
+	if (!is_small(p[2]) || signed_val(p[2]) < 1 ||
+	    (n = dmc_bound_variable(heap, p[3])) < 0) {
+	    return 0;
+	}
+	DMC_PUSH(*text, matchElementV);
+	DMC_PUSH(*text, (UWord) signed_val(p[2]));
+	DMC_PUSH(*text, n);
+    } else {
+	switch (p[1]) {
+	case am_Eq:   op = dmcCmpEqExact; break;
+	case am_Neq:  op = dmcCmpNeqExact; break;
+	case am_Eqeq: op = dmcCmpEq; break;
+	case am_Neqeq: op = dmcCmpNeq; break;
+	case am_Lt:   op = dmcCmpLt; break;
+	case am_Ge:   op = dmcCmpGe; break;
+	case am_Gt:   op = dmcCmpGt; break;
+	case am_Le:   op = dmcCmpLe; break;
+	default:      return 0;
+	}
+	if ((n = dmc_bound_variable(heap, p[2])) >= 0 
+	    && dmc_is_simple_constant(p[3])) {
+	    swap = 0;
+	} else if ((n = dmc_bound_variable(heap, p[3])) >= 0 
+		   && dmc_is_simple_constant(p[2])) {
+	    swap = 1;
+	} else {
+	    return 0;
+	}
+	if (swap) { /* Constant first, turn it around */
+	    switch (op) {
+	    case dmcCmpLt: op = dmcCmpGt; break;
+	    case dmcCmpGt: op = dmcCmpLt; break;
+	    case dmcCmpGe: op = dmcCmpLe; break;
+	    case dmcCmpLe: op = dmcCmpGe; break;
+	    default: break;
+	    }
+	}
+	DMC_PUSH(*text, matchCmpVC);
+	DMC_PUSH(*text, op);
+	DMC_PUSH(*text, n);
+	DMC_PUSH(*text, (UWord) dmc_private_constant(context, 
+						     p[swap ? 2 : 3]));
+    }
+    if (++context->stack_used > context->stack_need)
+	context->stack_need = context->stack_used;
+    return 1;
+}
+
 static DMCRet dmc_fun(DMCContext *context,
 		       DMCHeap *heap,
 		       DMC_STACK_TYPE(UWord) *text,
@@ -3910,6 +4548,10 @@ static DMCRet dmc_fun(DMCContext *context,
 
     *constant = 0;
 
+    if (dmc_super_call(context, heap, text, t)) {
+	return retOk;
+    }
+
     for (i = a; i > 1; --i) {
 	if ((ret = dmc_expr(context, heap, text, p[i], &c)) != retOk)
 	    return ret;
@@ -4022,6 +4664,12 @@ static DMCRet compile_guard_expr(DMCContext *context,
 	while (is_list(l)) {
 	    constant = 0;
 	    t = CAR(list_val(l));
+	    if (context->is_guard) {
+		if ((ret = dmc_guard_test(context, heap, text, t)) != retOk)
+		    return ret;
+		l = CDR(list_val(l));
+		continue;
+	    }
 	    if ((ret = dmc_expr(context, heap, text, t, &constant)) !=
 		retOk)
 		return ret;
@@ -4052,6 +4700,48 @@ static DMCRet compile_guard_expr(DMCContext *context,
 
 
 
+/*
+** Compile one guard test. An andalso is split into one test per
+** argument, as a guard fails the same way whether an argument is false
+** or not a boolean. A comparison superinstruction is turned into a test
+** that fails directly instead of pushing a boolean for matchTrue.
+*/
+static DMCRet dmc_guard_test(DMCContext *context,
+			     DMCHeap *heap,
+			     DMC_STACK_TYPE(UWord) *text,
+			     Eterm t)
+{
+    DMCRet ret;
+    int constant = 0;
+    Uint start;
+    Uint i;
+
+    if (is_tuple(t) && arityval(*tuple_val(t)) >= 2 &&
+	(tuple_val(t)[1] == am_andalso || tuple_val(t)[1] == am_andthen)) {
+	Eterm *p = tuple_val(t);
+	for (i = 2; i <= arityval(*p); ++i) {
+	    if ((ret = dmc_guard_test(context, heap, text, p[i])) != retOk)
+		return ret;
+	}
+	return retOk;
+    }
+    start = DMC_STACK_NUM(*text);
+    if ((ret = dmc_expr(context, heap, text, t, &constant)) != retOk)
+	return ret;
+    if (constant) {
+	do_emit_constant(context, text, t);
+    }
+    if (DMC_STACK_NUM(*text) == start + 4 && 
+	DMC_PEEK(*text, start) == matchCmpVC) {
+	DMC_POKE(*text, start, matchTestVC);
+    } else {
+	DMC_PUSH(*text, matchTrue);
+    }
+    --context->stack_used;
+    return retOk;
+}
+
+
 /*
 ** Match compilation utility code
 */
@@ -4626,6 +5316,17 @@ static void db_match_dis(Binary *bp)
 	    ++t;
 	    erts_printf("PushV\t%bpu\n", n);
 	    break;
+	case matchCmpVC:
+	case matchTestVC:
+	    erts_printf("%s\t%bpu, %bpu, %T\n",
+			(*t == matchCmpVC) ? "CmpVC" : "TestVC",
+			(Uint) t[1], (Uint) t[2], (Eterm) t[3]);
+	    t += 4;
+	    break;
+	case matchElementV:
+	    erts_printf("ElementV\t%bpu, %bpu\n", (Uint) t[1], (Uint) t[2]);
+	    t += 3;
+	    break;
 	case matchTrue:
 	    ++t;
 	    erts_printf("True\n");
@@ -108,6 +108,11 @@ typedef struct db_table_method
 		  DbTable* tb, /* [in out] */ 
 		  Eterm key, 
 		  Eterm* ret);
+    int (*db_get_many)(Process* p, 
+		       DbTable* tb, /* [in out] */ 
+		       Eterm* keys,
+		       Uint nkeys,
+		       Eterm* ret);
     int (*db_get_element)(Process* p, 
 			  DbTable* tb, /* [in out] */ 
 			  Eterm key, 
@@ -172,6 +177,27 @@ typedef struct db_table_method
     void (*db_foreach_offheap)(DbTable* db,  /* [in out] */ 
 			       void (*func)(ErlOffHeap *, void *),
 			       void *arg);
+    /* Call func on each object with the key. The table lock must be
+    ** held and func must not modify the table.
+    */
+    void (*db_foreach_key)(DbTable* db,
+			   Eterm key,
+			   void (*func)(DbTable *, Eterm, void *),
+			   void *arg);
+    /* Call func on each object in the table, as stored, about max
+    ** objects at a time. *cursor is NIL on the first call and is set to
+    ** where the next call goes on, or to am_EOT when all objects are
+    ** done; a cursor that is not immediate is built on the heap of p.
+    ** As with select continuations, no object is missed or seen twice
+    ** only if the table is fixed (or iteration safe) between the calls.
+    ** The table lock must be held and func must not modify the table.
+    */
+    void (*db_foreach_dbterm)(Process* p,
+			      DbTable* db,
+			      Eterm* cursor, /* [in out] */
+			      Sint max,
+			      void (*func)(DbTable *, DbTerm *, void *),
+			      void *arg);
     void (*db_check_table)(DbTable* tb);
 
     /* Lookup a dbterm for updating. Return false if not found.
@@ -201,6 +227,24 @@ typedef struct db_fixation {
 } DbFixation;
 
 
+/* Operation counters of a table, see ets:info(T,stats). One cache line
+** per scheduler, indexed by scheduler number (0 when not a scheduler),
+** so a hot table does not bounce a shared counter line between them.
+** A slot is only written by its own scheduler and read without locks.
+*/
+typedef struct db_table_stats {
+    union {
+	struct {
+	    Uint lookups;
+	    Uint inserts;
+	    Uint deletes;
+	    Uint selects;
+	    Uint64 select_time; /* microseconds */
+	} c;
+	byte _cache_line_alignment[64];
+    } sched[1];
+} DbTableStats;
+
 typedef struct db_table_common {
     erts_refc_t ref;
     erts_refc_t fixref;       /* fixation counter */
@@ -226,6 +270,9 @@ typedef struct db_table_common {
     Uint32 status;            /* bit masks defined  below */
     int slot;                 /* slot index in meta_main_tab */
     int keypos;               /* defaults to 1 */
+    Uint size_hint;           /* Expected number of objects, 0 if unknown */
+    struct db_table_index* index; /* Secondary indexes (erl_db.c) or NULL */
+    DbTableStats* stats;      /* Operation counters or NULL */
 } DbTableCommon;
 
 /* These are status bit patterns */
@@ -240,8 +287,12 @@ typedef struct db_table_common {
 #define DB_DUPLICATE_BAG (1 << 8)
 #define DB_ORDERED_SET   (1 << 9)
 #define DB_DELETE        (1 << 10) /* table is being deleted */
+#define DB_LOCKFREE_READ (1 << 11) /* hash buckets are read without locks */
+#define DB_PARALLEL_SCAN (1 << 12) /* full scans helped by idle schedulers */
+#define DB_COMPRESSED    (1 << 13) /* non-key elements stored encoded */
+#define DB_COMPRESSED_ZLIB (1 << 14) /* ... and zlib compressed */
 
-#define ERTS_ETS_TABLE_TYPES (DB_BAG|DB_SET|DB_DUPLICATE_BAG|DB_ORDERED_SET|DB_FINE_LOCKED)
+#define ERTS_ETS_TABLE_TYPES (DB_BAG|DB_SET|DB_DUPLICATE_BAG|DB_ORDERED_SET|DB_FINE_LOCKED|DB_LOCKFREE_READ)
 
 #define IS_HASH_TABLE(Status) (!!((Status) & \
 				  (DB_BAG | DB_SET | DB_DUPLICATE_BAG)))
@@ -249,6 +300,7 @@ typedef struct db_table_common {
 				  DB_ORDERED_SET))
 #define NFIXED(T) (erts_refc_read(&(T)->common.fixref,0))
 #define IS_FIXED(T) (NFIXED(T) != 0) 
+#define IS_COMPRESSED(T) ((T)->common.status & DB_COMPRESSED)
 
 Eterm erts_ets_copy_object(Eterm, Process*);
 
@@ -270,6 +322,13 @@ Eterm erts_ets_copy_object(Eterm, Process*);
 #define ONLY_READER(P,T) (((T)->common.status & DB_PRIVATE) && \
 (T)->common.owner == (P)->id)
 
+/* Threads working on a job that the calling process waits for */
+typedef struct {
+    erts_smp_atomic_t busy;
+    erts_smp_mtx_t mtx;
+    erts_smp_cnd_t cnd;
+} DbWorkers;
+
 /* Function prototypes */
 Eterm db_get_trace_control_word_0(Process *p);
 Eterm db_set_trace_control_word_1(Process *p, Eterm val);
@@ -278,6 +337,26 @@ void db_initialize_util(void);
 Eterm db_getkey(int keypos, Eterm obj);
 void db_free_term_data(DbTerm* p);
 void* db_get_term(DbTableCommon *tb, DbTerm* old, Uint offset, Eterm obj);
+void* db_get_term_comp(DbTableCommon *tb, DbTerm* old, Uint offset, Eterm obj);
+Uint db_size_dbterm(DbTableCommon *tb, DbTerm* obj);
+Eterm db_copy_dbterm(DbTableCommon *tb, DbTerm* obj,
+		     Eterm** hpp, ErlOffHeap* off_heap);
+Uint db_size_element(DbTableCommon *tb, DbTerm* obj, int ndex);
+Eterm db_copy_element(DbTableCommon *tb, DbTerm* obj, int ndex,
+		      Eterm** hpp, ErlOffHeap* off_heap);
+Eterm db_copy_element_proc(DbTableCommon *tb, Process *p,
+			   DbTerm* obj, int ndex);
+Eterm db_match_dbterm(DbTableCommon *tb, Process *p, Binary *mp,
+		      int all_objects, DbTerm* obj);
+int db_test_dbterm(DbTableCommon *tb, Process *p, Binary *mp, DbTerm* obj);
+int db_eq_dbterm(DbTableCommon *tb, Eterm obj, DbTerm* dbterm);
+Eterm db_encode_element(DbTableCommon *tb, Process *p, Eterm elem);
+Uint64 db_stats_time(void);
+void db_workers_init(DbWorkers* w);
+void db_workers_destroy(DbWorkers* w);
+void db_workers_enter(DbWorkers* w);
+void db_workers_leave(DbWorkers* w);
+void db_workers_wait(DbWorkers* w);
 int db_has_variable(Eterm obj);
 int db_is_variable(Eterm obj);
 void db_do_update_element(DbUpdateHandle* handle,
@@ -290,6 +369,8 @@ Binary *db_match_set_compile(Process *p, Eterm matchexpr,
 			     Uint flags);
 void erts_db_match_prog_destructor(Binary *);
 
+#define DMC_MAX_PREFILTER 4     /* Constant elements tested before match */
+
 typedef struct match_prog {
     ErlHeapFragment *term_save; /* Only if needed, a list of message 
 				    buffers for off heap copies 
@@ -303,6 +384,12 @@ typedef struct match_prog {
     Uint heap_size;          /* size of: heap + eheap + stack */
     Uint eheap_offset;
     Uint stack_offset;
+    /* Cheap test of the object done before the program is run, filled
+       in for table match specs with one clause and a tuple head. */
+    Uint prefilter_arity;    /* 0 if there is no prefilter */
+    int prefilter_num;       /* Number of constant elements */
+    Uint prefilter_pos[DMC_MAX_PREFILTER];
+    Eterm prefilter_val[DMC_MAX_PREFILTER];
 #ifdef DMC_DEBUG
     UWord* prog_end;		/* End of program */
 #endif
@@ -368,6 +455,8 @@ Binary *db_match_compile(Eterm *matchexpr, Eterm *guards,
 /* Returns newly allocated MatchProg binary with refc == 0*/
 Eterm db_prog_match(Process *p, Binary *prog, Eterm term, Eterm *termp, int arity,
 		    Uint32 *return_flags /* Zeroed on enter */);
+Eterm db_prog_match_table(ErtsSchedulerData *esdp, Eterm self, Binary *prog,
+			  Eterm term, Uint32 *return_flags);
 /* returns DB_ERROR_NONE if matches, 1 if not matches and some db error on 
    error. */
 DMCErrInfo *db_new_dmc_err_info(void);
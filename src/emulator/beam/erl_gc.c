@@ -97,6 +97,7 @@ static Uint setup_rootset(Process*, Eterm*, int, Rootset*);
 static void cleanup_rootset(Rootset *rootset);
 static Uint combined_message_size(Process* p);
 static void remove_message_buffers(Process* p);
+static void release_unused_shared_areas(Process* p, Eterm* objv, int nobj);
 static int major_collection(Process* p, int need, Eterm* objv, int nobj, Uint *recl);
 static int minor_collection(Process* p, int need, Eterm* objv, int nobj, Uint *recl);
 static void do_minor(Process *p, int new_sz, Eterm* objv, int nobj);
@@ -110,6 +111,7 @@ static Uint adjust_after_fullsweep(Process *p, int size_before,
 				   int need, Eterm *objv, int nobj);
 static void shrink_new_heap(Process *p, Uint new_sz, Eterm *objv, int nobj);
 static void grow_new_heap(Process *p, Uint new_sz, Eterm* objv, int nobj);
+static void grow_old_heap(Process *p, Uint new_sz, Eterm* objv, int nobj);
 static void sweep_proc_bins(Process *p, int fullsweep);
 static void sweep_proc_funs(Process *p, int fullsweep);
 static void sweep_proc_externals(Process *p, int fullsweep);
@@ -137,6 +139,171 @@ static int num_heap_sizes;	/* Number of heap sizes. */
 
 Uint erts_test_long_gc_sleep; /* Only used for testing... */
 
+/*
+ * A process with max_gc_pause set avoids fullsweeps that would copy more
+ * than max_gc_pause words: scheduled ones (fullsweep_after) are skipped,
+ * and instead of forced ones the heaps are grown, the old heap at most
+ * ERTS_GC_MAX_OLD_HEAP_GROWTHS times between two fullsweeps so that
+ * garbage in it is eventually reclaimed.
+ */
+#define ERTS_GC_MAX_OLD_HEAP_GROWTHS 2
+
+static ERTS_INLINE int
+fullsweep_too_long(Process *p)
+{
+    Uint sz;
+    if (p->max_gc_pause == 0)
+	return 0;
+    sz = (HEAP_TOP(p) - HEAP_START(p)) + MBUF_SIZE(p);
+    if (OLD_HEAP(p))
+	sz += OLD_HTOP(p) - OLD_HEAP(p);
+    return sz > p->max_gc_pause;
+}
+
+/*
+ * Adaptive heap sizing. The heap size table only provides the steps;
+ * how far up a process goes depends on what it has done so far.
+ *
+ * A process that allocates fast relative to the work it does, and
+ * keeps little of what it allocates, gets room on top of its live data
+ * for about ERTS_GC_ADAPT_REDS reductions worth of allocation. Short
+ * lived workers thereby avoid collecting over and over, and since
+ * shrinking leaves the same room, heaps do not oscillate between two
+ * sizes. Slow allocators get no room and are shrunk towards their live
+ * data as before. A new process has no rate yet and hence no room.
+ */
+#define ERTS_GC_ADAPT_REDS		CONTEXT_REDS
+#define ERTS_GC_ADAPT_MAX_SURVIVAL	500		/* per mille */
+#define ERTS_GC_ADAPT_MAX_ROOM		(16*1024)	/* words */
+#define ERTS_GC_ADAPT_MAX_RATE		(1000*1000)
+#define ERTS_GC_ADAPT_SMOOTH(OLD, NEW)	(((OLD)*3 + (NEW))/4)
+
+static ERTS_INLINE Uint
+gc_alloc_room(Process *p)
+{
+    Uint room;
+    if (p->gc_stats.survival > ERTS_GC_ADAPT_MAX_SURVIVAL)
+	return 0;
+    room = (Uint) (((Uint64) p->gc_stats.alloc_rate * ERTS_GC_ADAPT_REDS)
+		   / 1000);
+    return room > ERTS_GC_ADAPT_MAX_ROOM ? ERTS_GC_ADAPT_MAX_ROOM : room;
+}
+
+static ERTS_INLINE Uint
+gc_current_reds(Process *p)
+{
+    Uint reds = p->reds;
+    if (p->gcstatus == P_RUNNING)
+	reds += erts_current_reductions(p, p);
+    return reds;
+}
+
+static ERTS_INLINE void
+gc_update_alloc_rate(Process *p)
+{
+    ErtsGcStats *gcs = &p->gc_stats;
+    Uint used = (HEAP_TOP(p) - HEAP_START(p)) + MBUF_SIZE(p);
+    Uint reds = gc_current_reds(p);
+    Uint alloced = used > gcs->live ? used - gcs->live : 0;
+    Uint64 rate;
+
+    /*
+     * No reductions since the last GC tells us nothing about the rate;
+     * guessing one would saturate it and hand out maximum room.
+     */
+    if (reds <= gcs->reds)
+	return;
+    reds -= gcs->reds;
+    rate = ((Uint64) alloced * 1000) / reds;
+    if (rate > ERTS_GC_ADAPT_MAX_RATE)
+	rate = ERTS_GC_ADAPT_MAX_RATE;
+    gcs->alloc_rate = ERTS_GC_ADAPT_SMOOTH(gcs->alloc_rate, (Uint) rate);
+}
+
+static ERTS_INLINE void
+gc_update_survival(Process *p, Uint before, Uint after)
+{
+    Uint survival = 0;
+    if (before > 0) {
+	Uint64 s = ((Uint64) after * 1000) / before;
+	survival = s > 1000 ? 1000 : (Uint) s;
+    }
+    p->gc_stats.survival = ERTS_GC_ADAPT_SMOOTH(p->gc_stats.survival,
+						survival);
+}
+
+#ifdef ERTS_SMP
+/*
+ * Fullsweeps of heaps with at least ERTS_GC_PAR_MIN_LIVE words in use
+ * are done in parallel; the GC'ing scheduler is helped by dirty CPU
+ * scheduler threads that happen to be free. See parallel_fullsweep().
+ */
+#define ERTS_GC_PAR_MIN_LIVE		(1024*1024)
+#define ERTS_GC_PAR_MAX_HELPERS		8
+#define ERTS_GC_PAR_CHUNK		(8*1024)
+#define ERTS_GC_PAR_LARGE_OBJ		(ERTS_GC_PAR_CHUNK/8)
+#define ERTS_GC_PAR_GRANULE		1024
+
+/*
+ * Extra to-space needed besides the live data: each retired chunk
+ * wastes less than ERTS_GC_PAR_LARGE_OBJ words, and each worker may
+ * leave its last chunk almost unused.
+ */
+#define ERTS_GC_PAR_SLACK(LIVE, WORKERS)				\
+    ((LIVE)/((ERTS_GC_PAR_CHUNK - ERTS_GC_PAR_LARGE_OBJ)		\
+	     / ERTS_GC_PAR_LARGE_OBJ)					\
+     + (WORKERS)*ERTS_GC_PAR_CHUNK)
+
+/*
+ * Stored in the first word of an object while it is being copied. A
+ * catch never appears on the heap.
+ */
+#define ERTS_GC_PAR_BUSY make_catch(0)
+
+typedef struct {
+    Eterm *start;
+    Eterm *end;
+} ErtsGcParRange;
+
+typedef struct {
+    erts_smp_mtx_t mtx;
+    erts_smp_cnd_t cnd;
+    erts_smp_atomic_t top;	/* Shared to-space allocation pointer */
+    erts_smp_atomic_t waiting;	/* Workers waiting for work */
+    Eterm *end;
+    char *src;
+    Uint src_size;
+    char *oh;
+    Uint oh_size;
+    ErtsGcParRange *ranges;	/* Copied but not yet swept areas */
+    int no_ranges;
+    int max_ranges;
+    int workers;
+    int done;
+} ErtsGcPar;
+
+typedef struct {
+    ErtsGcPar *par;
+    Eterm *c_scan;		/* Swept up to here in current chunk */
+    Eterm *c_top;
+    Eterm *c_end;
+} ErtsGcParWorker;
+
+typedef struct {
+    ErtsDirtyJob job;		/* Has to be first */
+    int queued;
+    ErtsGcPar *par;
+} ErtsGcParHelper;
+
+static erts_smp_mtx_t gc_par_helpers_mtx;
+static ErtsGcParHelper gc_par_helpers[ERTS_GC_PAR_MAX_HELPERS];
+
+static Eterm* parallel_fullsweep(Eterm* n_heap, Eterm* n_htop, Eterm* n_hend,
+				 char* src, Uint src_size,
+				 char* oh, Uint oh_size, int helpers);
+static void gc_par_helper_execute(ErtsDirtyJob *job);
+#endif
+
 /*
  * Initialize GC global data.
  */
@@ -150,6 +317,16 @@ erts_init_gc(void)
     reclaimed = 0;
     erts_test_long_gc_sleep = 0;
 
+#ifdef ERTS_SMP
+    erts_smp_mtx_init(&gc_par_helpers_mtx, "gc_par_helpers");
+    for (i = 0; i < ERTS_GC_PAR_MAX_HELPERS; i++) {
+	gc_par_helpers[i].job.next = NULL;
+	gc_par_helpers[i].job.execute = gc_par_helper_execute;
+	gc_par_helpers[i].queued = 0;
+	gc_par_helpers[i].par = NULL;
+    }
+#endif
+
     /*
      * Heap sizes start growing in a Fibonacci sequence.
      *
@@ -262,6 +439,37 @@ erts_heap_sizes(Process* p)
     return res;
 }
 
+/*
+ * Build the process_info(Pid, gc_stats) result for rp on c_p's heap.
+ */
+Eterm
+erts_gc_stats(Process* c_p, Process* rp)
+{
+    ERTS_DECL_AM(minor_gcs);
+    ERTS_DECL_AM(major_gcs);
+    ERTS_DECL_AM(heap_grows);
+    ERTS_DECL_AM(heap_shrinks);
+    ERTS_DECL_AM(alloc_rate);
+    ERTS_DECL_AM(survival);
+    ERTS_DECL_AM(alloc_room);
+    Eterm tags[7];
+    Uint values[7];
+    Uint hsz = 0;
+    Eterm* hp;
+
+    tags[0] = AM_minor_gcs;	values[0] = rp->gc_stats.minor_gcs;
+    tags[1] = AM_major_gcs;	values[1] = rp->gc_stats.major_gcs;
+    tags[2] = AM_heap_grows;	values[2] = rp->gc_stats.grows;
+    tags[3] = AM_heap_shrinks;	values[3] = rp->gc_stats.shrinks;
+    tags[4] = AM_alloc_rate;	values[4] = rp->gc_stats.alloc_rate;
+    tags[5] = AM_survival;	values[5] = rp->gc_stats.survival;
+    tags[6] = AM_alloc_room;	values[6] = gc_alloc_room(rp);
+
+    (void) erts_bld_atom_uint_2tup_list(NULL, &hsz, 7, tags, values);
+    hp = HAlloc(c_p, hsz);
+    return erts_bld_atom_uint_2tup_list(&hp, NULL, 7, tags, values);
+}
+
 void
 erts_gc_info(ErtsGCInfo *gcip)
 {
@@ -345,6 +553,7 @@ erts_garbage_collect(Process* p, int need, Eterm* objv, int nobj)
 {
     Uint reclaimed_now = 0;
     int done = 0;
+    int fullsweep = 0;
     Uint ms1, s1, us1;
 
     if (IS_TRACED_FL(p, F_TRACE_GC)) {
@@ -364,7 +573,8 @@ erts_garbage_collect(Process* p, int need, Eterm* objv, int nobj)
     ERTS_CHK_OFFHEAP(p);
 
     ErtsGcQuickSanityCheck(p);
-    if (GEN_GCS(p) >= MAX_GEN_GCS(p)) {
+    gc_update_alloc_rate(p);
+    if (GEN_GCS(p) >= MAX_GEN_GCS(p) && !fullsweep_too_long(p)) {
         FLAGS(p) |= F_NEED_FULLSWEEP;
     }
 
@@ -374,6 +584,7 @@ erts_garbage_collect(Process* p, int need, Eterm* objv, int nobj)
     while (!done) {
 	if ((FLAGS(p) & F_NEED_FULLSWEEP) != 0) {
 	    done = major_collection(p, need, objv, nobj, &reclaimed_now);
+	    fullsweep = 1;
 	} else {
 	    done = minor_collection(p, need, objv, nobj, &reclaimed_now);
 	}
@@ -387,6 +598,13 @@ erts_garbage_collect(Process* p, int need, Eterm* objv, int nobj)
 
     ErtsGcQuickSanityCheck(p);
 
+    if (fullsweep && p->shared_areas) {
+	release_unused_shared_areas(p, objv, nobj);
+    }
+
+    p->gc_stats.live = HEAP_TOP(p) - HEAP_START(p);
+    p->gc_stats.reds = gc_current_reds(p);
+
     erts_smp_proc_lock(p, ERTS_PROC_LOCK_STATUS);
     p->status = p->gcstatus;
     erts_smp_proc_unlock(p, ERTS_PROC_LOCK_STATUS);
@@ -446,6 +664,107 @@ erts_garbage_collect(Process* p, int need, Eterm* objv, int nobj)
     return ((int) (HEAP_TOP(p) - HEAP_START(p)) / 10);
 }
 
+/*
+ * Mark the shared term areas referred to from [start, end). Unless
+ * 'ptrs' is set the area is a heap that may contain things, which
+ * are skipped.
+ */
+static void
+mark_shared_area_refs(ErtsSharedAreaRef *refs, Eterm *start, Eterm *end,
+		      int ptrs)
+{
+    Eterm *ptr;
+
+    for (ptr = start; ptr < end; ptr++) {
+	Eterm val = *ptr;
+	switch (primary_tag(val)) {
+	case TAG_PRIMARY_BOXED:
+	case TAG_PRIMARY_LIST:
+	    {
+		ErtsSharedAreaRef *ref = erts_shared_area_ref(refs,
+							      ptr_val(val));
+		if (ref)
+		    ref->hit = 1;
+	    }
+	    break;
+	case TAG_PRIMARY_HEADER:
+	    if (!ptrs && !header_is_transparent(val))
+		ptr += thing_arityval(val);
+	    break;
+	}
+    }
+}
+
+/*
+ * After a fullsweep all live data of the process is on its heap or
+ * in message fragments, so a scan of these and the root set tells
+ * which shared term areas it still refers to. Drop the references to
+ * the others.
+ *
+ * References added while scanning belong to messages not yet seen by
+ * the scan and are kept. Messages are queued before the reference is
+ * added, so all messages belonging to older references are moved into
+ * the private queue before starting. A message queued while scanning
+ * that refers to an area we already have a reference to marks that
+ * reference as hit (add_shared_area_ref() in copy.c), so it is kept as
+ * well; the hits are cleared under the msgq lock for this to work.
+ */
+static void
+release_unused_shared_areas(Process *p, Eterm *objv, int nobj)
+{
+    ErtsSharedAreaRef *scanned;
+    ErtsSharedAreaRef *unused = NULL;
+    ErtsSharedAreaRef *ref;
+    ErtsSharedAreaRef **prevp;
+    ErlMessage *mp;
+    Rootset rootset;
+    Roots *roots;
+    Uint n;
+
+    erts_smp_proc_lock(p, ERTS_PROC_LOCK_MSGQ);
+    ERTS_SMP_MSGQ_MV_INQ2PRIVQ(p);
+    scanned = p->shared_areas;
+    for (ref = scanned; ref; ref = ref->next)
+	ref->hit = 0;
+    erts_smp_proc_unlock(p, ERTS_PROC_LOCK_MSGQ);
+
+    n = setup_rootset(p, objv, nobj, &rootset);
+    for (roots = rootset.roots; n--; roots++)
+	mark_shared_area_refs(scanned, roots->v, roots->v + roots->sz, 1);
+    cleanup_rootset(&rootset);
+
+    mark_shared_area_refs(scanned, HEAP_START(p), HEAP_TOP(p), 0);
+    if (OLD_HEAP(p))
+	mark_shared_area_refs(scanned, OLD_HEAP(p), OLD_HTOP(p), 0);
+    for (mp = p->msg.first; mp; mp = mp->next) {
+	mark_shared_area_refs(scanned, mp->m, mp->m + 2, 1);
+	if (mp->data.attached && is_value(ERL_MESSAGE_TERM(mp))) {
+	    ErlHeapFragment *bp;
+	    for (bp = mp->data.heap_frag; bp; bp = bp->next)
+		mark_shared_area_refs(scanned, bp->mem,
+				      bp->mem + bp->used_size, 0);
+	}
+    }
+
+    erts_smp_proc_lock(p, ERTS_PROC_LOCK_MSGQ);
+    prevp = &p->shared_areas;
+    while (*prevp != scanned)
+	prevp = &(*prevp)->next;
+    while ((ref = *prevp) != NULL) {
+	if (ref->hit) {
+	    ref->hit = 0;
+	    prevp = &ref->next;
+	} else {
+	    *prevp = ref->next;
+	    ref->next = unused;
+	    unused = ref;
+	}
+    }
+    erts_smp_proc_unlock(p, ERTS_PROC_LOCK_MSGQ);
+
+    erts_release_shared_area_refs(unused);
+}
+
 /*
  * Place all living data on a the new heap; deallocate any old heap.
  * Meant to be used by hibernate/3.
@@ -570,6 +889,7 @@ erts_garbage_collect_hibernate(Process* p)
     p->htop = heap + actual_size;
     p->heap = heap;
     p->heap_sz = heap_size;
+    p->gc_stats.live = actual_size;
 
 
 #ifdef CHECK_FOR_HOLES
@@ -745,6 +1065,19 @@ minor_collection(Process* p, int need, Eterm* objv, int nobj, Uint *recl)
 
         OLD_HEND(p) = n_old + new_sz;
         OLD_HEAP(p) = OLD_HTOP(p) = n_old;
+        p->old_heap_growths = 0;
+    }
+
+    /*
+     * Make room for the mature data in the old heap rather than doing
+     * a fullsweep that would take longer than the process allows.
+     */
+    if (OLD_HEAP(p)
+	&& mature > OLD_HEND(p) - OLD_HTOP(p)
+	&& p->old_heap_growths < ERTS_GC_MAX_OLD_HEAP_GROWTHS
+	&& fullsweep_too_long(p)) {
+	Uint new_sz = erts_next_heap_size((OLD_HTOP(p) - OLD_HEAP(p)) + mature, 1);
+	grow_old_heap(p, new_sz, objv, nobj);
     }
 
     /*
@@ -760,17 +1093,22 @@ minor_collection(Process* p, int need, Eterm* objv, int nobj, Uint *recl)
 	Uint fragments = MBUF_SIZE(p) + combined_message_size(p);
 	Uint size_before = fragments + (HEAP_TOP(p) - HEAP_START(p));
 	Uint new_sz = next_heap_size(p, HEAP_SIZE(p) + fragments, 0);
+	Eterm *old_htop = OLD_HTOP(p);
+	Uint room;
 
         do_minor(p, new_sz, objv, nobj);
 
 	/*
-	 * Copy newly received message onto the end of the new heap.
+	 * Copy newly received message onto the end of the new heap
+	 * unless message data is kept off heap.
 	 */
 	ErtsGcQuickSanityCheck(p);
-	for (msgp = p->msg.first; msgp; msgp = msgp->next) {
-	    if (msgp->data.attached) {
-		erts_move_msg_attached_data_to_heap(&p->htop, &p->off_heap, msgp);
-		ErtsGcQuickSanityCheck(p);
+	if (!(p->flags & F_OFF_HEAP_MSGQ)) {
+	    for (msgp = p->msg.first; msgp; msgp = msgp->next) {
+		if (msgp->data.attached) {
+		    erts_move_msg_attached_data_to_heap(&p->htop, &p->off_heap, msgp);
+		    ErtsGcQuickSanityCheck(p);
+		}
 	    }
 	}
 	ErtsGcQuickSanityCheck(p);
@@ -779,6 +1117,10 @@ minor_collection(Process* p, int need, Eterm* objv, int nobj, Uint *recl)
         size_after = HEAP_TOP(p) - HEAP_START(p);
         need_after = size_after + need + stack_size;
         *recl += (size_before - size_after);
+	p->gc_stats.minor_gcs++;
+	gc_update_survival(p, size_before,
+			   size_after + (OLD_HTOP(p) - old_htop));
+	room = gc_alloc_room(p);
 	
         /*
          * Excessively large heaps should be shrunk, but
@@ -792,7 +1134,7 @@ minor_collection(Process* p, int need, Eterm* objv, int nobj, Uint *recl)
         if ((HEAP_SIZE(p) > 3000) && (4 * need_after < HEAP_SIZE(p)) &&
             ((HEAP_SIZE(p) > 8000) ||
              (HEAP_SIZE(p) > (OLD_HEND(p) - OLD_HEAP(p))))) {
-	    Uint wanted = 3 * need_after;
+	    Uint wanted = 3 * need_after + room;
 	    Uint old_heap_sz = OLD_HEND(p) - OLD_HEAP(p);
 
 	    /*
@@ -813,6 +1155,7 @@ minor_collection(Process* p, int need, Eterm* objv, int nobj, Uint *recl)
             }
             if (wanted < HEAP_SIZE(p)) {
                 shrink_new_heap(p, wanted, objv, nobj);
+		p->gc_stats.shrinks++;
             }
             ASSERT(HEAP_SIZE(p) == next_heap_size(p, HEAP_SIZE(p), 0));
 	    return 1;		/* We are done. */
@@ -820,11 +1163,23 @@ minor_collection(Process* p, int need, Eterm* objv, int nobj, Uint *recl)
 
         if (HEAP_SIZE(p) >= need_after) {
 	    /*
-	     * The heap size turned out to be just right. We are done.
+	     * The heap size turned out to be big enough. Grow it anyway
+	     * if it leaves less room than a fast allocator should have.
 	     */
             ASSERT(HEAP_SIZE(p) == next_heap_size(p, HEAP_SIZE(p), 0));
+	    if (HEAP_SIZE(p) - need_after < room) {
+		grow_new_heap(p, next_heap_size(p, need_after + room, 0),
+			      objv, nobj);
+		p->gc_stats.grows++;
+	    }
             return 1;
 	}
+
+	if (fullsweep_too_long(p)) {
+	    /* Grow rather than pausing for a fullsweep */
+	    grow_new_heap(p, next_heap_size(p, need_after, 0), objv, nobj);
+	    return 1;
+	}
     }
 
     /*
@@ -1100,6 +1455,9 @@ major_collection(Process* p, int need, Eterm* objv, int nobj, Uint *recl)
     Uint new_sz;
     Uint fragments = MBUF_SIZE(p) + combined_message_size(p);
     ErlMessage *msgp;
+#ifdef ERTS_SMP
+    int par_helpers = 0;
+#endif
 
     size_before = fragments + (HEAP_TOP(p) - HEAP_START(p));
 
@@ -1117,6 +1475,16 @@ major_collection(Process* p, int need, Eterm* objv, int nobj, Uint *recl)
      * here for no obvious reason. (The stack size is already counted once
      * in HEAP_SIZE(p).)
      */
+#ifdef ERTS_SMP
+    if (erts_no_schedulers > 1
+	&& (src_size + oh_size)/sizeof(Eterm) >= ERTS_GC_PAR_MIN_LIVE) {
+	par_helpers = (int) erts_no_schedulers - 1;
+	if (par_helpers > ERTS_GC_PAR_MAX_HELPERS)
+	    par_helpers = ERTS_GC_PAR_MAX_HELPERS;
+	new_sz += ERTS_GC_PAR_SLACK((src_size + oh_size)/sizeof(Eterm),
+				    par_helpers + 1);
+    }
+#endif
     new_sz = next_heap_size(p, new_sz, 0);
 
     /*
@@ -1199,9 +1567,16 @@ major_collection(Process* p, int need, Eterm* objv, int nobj, Uint *recl)
      * Now all references on the stack point to the new heap. However,
      * most references on the new heap point to the old heap so the next stage
      * is to scan through the new heap evacuating data from the old heap
-     * until all is copied.
+     * until all is copied. Large heaps are scanned by several threads.
      */
 
+#ifdef ERTS_SMP
+    if (par_helpers > 0) {
+	n_htop = parallel_fullsweep(n_heap, n_htop,
+				    n_heap + new_sz - (HEAP_END(p) - p->stop),
+				    src, src_size, oh, oh_size, par_helpers);
+    } else
+#endif
     if (oh_size == 0) {
 	n_htop = sweep_one_area(n_heap, n_htop, src, src_size);
     } else {
@@ -1306,15 +1681,22 @@ major_collection(Process* p, int need, Eterm* objv, int nobj, Uint *recl)
 
     ErtsGcQuickSanityCheck(p);
     /*
-     * Copy newly received message onto the end of the new heap.
+     * Copy newly received message onto the end of the new heap
+     * unless message data is kept off heap.
      */
-    for (msgp = p->msg.first; msgp; msgp = msgp->next) {
-	if (msgp->data.attached) {
-	    erts_move_msg_attached_data_to_heap(&p->htop, &p->off_heap, msgp);
-	    ErtsGcQuickSanityCheck(p);
+    if (!(p->flags & F_OFF_HEAP_MSGQ)) {
+	for (msgp = p->msg.first; msgp; msgp = msgp->next) {
+	    if (msgp->data.attached) {
+		erts_move_msg_attached_data_to_heap(&p->htop, &p->off_heap, msgp);
+		ErtsGcQuickSanityCheck(p);
+	    }
 	}
     }
 
+    p->gc_stats.major_gcs++;
+    gc_update_survival(p, size_before + oh_size/sizeof(Eterm),
+		       HEAP_TOP(p) - HEAP_START(p));
+
     *recl += adjust_after_fullsweep(p, size_before, need, objv, nobj);
 
 #ifdef HARDDEBUG
@@ -1326,11 +1708,453 @@ major_collection(Process* p, int need, Eterm* objv, int nobj, Uint *recl)
     return 1;			/* We are done. */
 }
 
+#ifdef ERTS_SMP
+
+/*
+ * Parallel fullsweep.
+ *
+ * Each worker copies objects into its own chunk of the to-space, which
+ * is carved out of the new heap by an atomic allocation pointer, and
+ * sweeps what it has copied itself. Areas that are copied but not yet
+ * swept are handed over to the shared range stack when a chunk is
+ * retired, when a large object has been copied, and when some worker
+ * is out of work. An object is claimed by replacing its first word with
+ * ERTS_GC_PAR_BUSY; the winner copies it and then stores the forwarding
+ * information, everyone else waits for that.
+ *
+ * Unused tails of chunks are filled with bignum headers so that the
+ * new heap can be walked as usual.
+ */
+
+static ERTS_INLINE void
+gc_par_fill(Eterm *hp, Eterm *end)
+{
+    if (hp < end)
+	*hp = make_pos_bignum_header(end - hp - 1);
+}
+
+static void
+gc_par_push(ErtsGcPar *par, Eterm *start, Eterm *end)
+{
+    erts_smp_mtx_lock(&par->mtx);
+    ASSERT(!par->done);
+    ASSERT(par->no_ranges < par->max_ranges);
+    par->ranges[par->no_ranges].start = start;
+    par->ranges[par->no_ranges].end = end;
+    par->no_ranges++;
+    if (erts_smp_atomic_read(&par->waiting))
+	erts_smp_cnd_signal(&par->cnd);
+    erts_smp_mtx_unlock(&par->mtx);
+}
+
+/*
+ * Get an area to sweep. Returns 0 when all workers are out of work,
+ * i.e. when everything reachable has been copied and swept.
+ */
+static int
+gc_par_get_work(ErtsGcPar *par, Eterm **startp, Eterm **endp)
+{
+    int res = 0;
+    erts_smp_mtx_lock(&par->mtx);
+    while (1) {
+	if (par->no_ranges > 0) {
+	    par->no_ranges--;
+	    *startp = par->ranges[par->no_ranges].start;
+	    *endp = par->ranges[par->no_ranges].end;
+	    res = 1;
+	    break;
+	}
+	if (par->done)
+	    break;
+	if (erts_smp_atomic_read(&par->waiting) + 1 == par->workers) {
+	    par->done = 1;
+	    erts_smp_cnd_broadcast(&par->cnd);
+	    break;
+	}
+	erts_smp_atomic_inc(&par->waiting);
+	erts_smp_cnd_wait(&par->cnd, &par->mtx);
+	erts_smp_atomic_dec(&par->waiting);
+    }
+    erts_smp_mtx_unlock(&par->mtx);
+    return res;
+}
+
+static Eterm *
+gc_par_alloc_block(ErtsGcPar *par, Uint min_sz, Uint *szp)
+{
+    long top = erts_smp_atomic_read(&par->top);
+    while (1) {
+	Uint avail = par->end - (Eterm *) top;
+	Uint sz = *szp;
+	long old;
+	if (avail < min_sz)
+	    erl_exit(ERTS_ABORT_EXIT,
+		     "%s, line %d: parallel fullsweep ran out of heap\n",
+		     __FILE__, __LINE__);
+	if (sz > avail)
+	    sz = avail;
+	old = erts_smp_atomic_cmpxchg(&par->top,
+				      (long) (((Eterm *) top) + sz),
+				      top);
+	if (old == top) {
+	    *szp = sz;
+	    return (Eterm *) top;
+	}
+	top = old;
+    }
+}
+
+static void
+gc_par_retire_chunk(ErtsGcParWorker *w)
+{
+    if (w->c_scan < w->c_top)
+	gc_par_push(w->par, w->c_scan, w->c_top);
+    gc_par_fill(w->c_top, w->c_end);
+    w->c_scan = w->c_top = w->c_end;
+}
+
+/*
+ * Allocate room for a copy. Large objects get a block of their own
+ * which the caller hands over to the range stack once it is filled.
+ */
+static ERTS_INLINE Eterm *
+gc_par_alloc(ErtsGcParWorker *w, Uint sz, int *largep)
+{
+    Eterm *hp;
+    if ((Uint) (w->c_end - w->c_top) < sz) {
+	Uint bsz = sz;
+	if (sz >= ERTS_GC_PAR_LARGE_OBJ) {
+	    *largep = 1;
+	    return gc_par_alloc_block(w->par, sz, &bsz);
+	}
+	gc_par_retire_chunk(w);
+	bsz = ERTS_GC_PAR_CHUNK;
+	w->c_scan = w->c_top = gc_par_alloc_block(w->par, sz, &bsz);
+	w->c_end = w->c_top + bsz;
+    } else if (w->c_top - w->c_scan >= ERTS_GC_PAR_GRANULE
+	       && erts_smp_atomic_read(&w->par->waiting)) {
+	gc_par_push(w->par, w->c_scan, w->c_top);
+	w->c_scan = w->c_top;
+    }
+    hp = w->c_top;
+    w->c_top += sz;
+    return hp;
+}
+
+static Eterm
+gc_par_move_boxed(ErtsGcParWorker *w, Eterm *ptr)
+{
+    erts_smp_atomic_t *hdrp = (erts_smp_atomic_t *) ptr;
+    Eterm hdr;
+    Eterm gval;
+    Eterm* hp;
+    Sint nelts;
+    int large = 0;
+
+    while (1) {
+	hdr = (Eterm) erts_smp_atomic_read(hdrp);
+	if (hdr == ERTS_GC_PAR_BUSY)
+	    continue;
+	if (IS_MOVED_BOXED(hdr)) {
+	    ERTS_THR_MEMORY_BARRIER;
+	    return hdr;
+	}
+	if ((Eterm) erts_smp_atomic_cmpxchg(hdrp,
+					    (long) ERTS_GC_PAR_BUSY,
+					    (long) hdr) == hdr)
+	    break;
+    }
+
+    nelts = header_arity(hdr);
+    switch (hdr & _HEADER_SUBTAG_MASK) {
+    case SUB_BINARY_SUBTAG: nelts++; break;
+    case FUN_SUBTAG: nelts += ((ErlFunThing*)ptr)->num_free+1; break;
+    }
+    hp = gc_par_alloc(w, nelts+1, &large);
+    hp[0] = hdr;
+    sys_memcpy((void *) (hp+1), (void *) (ptr+1), nelts*sizeof(Eterm));
+    gval = make_boxed(hp);
+    ERTS_THR_MEMORY_BARRIER;
+    erts_smp_atomic_set(hdrp, (long) gval);
+    if (large)
+	gc_par_push(w->par, hp, hp+nelts+1);
+    return gval;
+}
+
+static Eterm
+gc_par_move_cons(ErtsGcParWorker *w, Eterm *ptr)
+{
+    erts_smp_atomic_t *carp = (erts_smp_atomic_t *) ptr;
+    Eterm car;
+    Eterm gval;
+    Eterm* hp;
+    int large = 0;
+
+    while (1) {
+	car = (Eterm) erts_smp_atomic_read(carp);
+	if (car == ERTS_GC_PAR_BUSY)
+	    continue;
+	if (IS_MOVED_CONS(car)) {
+	    ERTS_THR_MEMORY_BARRIER;
+	    return ptr[1];
+	}
+	if ((Eterm) erts_smp_atomic_cmpxchg(carp,
+					    (long) ERTS_GC_PAR_BUSY,
+					    (long) car) == car)
+	    break;
+    }
+
+    hp = gc_par_alloc(w, 2, &large);
+    ASSERT(!large);
+    hp[0] = car;
+    hp[1] = ptr[1];
+    gval = make_list(hp);
+    ptr[1] = gval;
+    ERTS_THR_MEMORY_BARRIER;
+    erts_smp_atomic_set(carp, (long) THE_NON_VALUE);
+    return gval;
+}
+
+static ERTS_INLINE void
+gc_par_move(ErtsGcParWorker *w, Eterm *orig)
+{
+    ErtsGcPar *par = w->par;
+    Eterm gval = *orig;
+    Eterm* ptr;
+
+    switch (primary_tag(gval)) {
+    case TAG_PRIMARY_BOXED:
+	ptr = boxed_val(gval);
+	if (in_area(ptr, par->src, par->src_size)
+	    || in_area(ptr, par->oh, par->oh_size)) {
+	    *orig = gc_par_move_boxed(w, ptr);
+	} else if (IS_MOVED_BOXED(*ptr)) {
+	    /* Moved from a heap fragment before the parallel phase */
+	    *orig = *ptr;
+	}
+	break;
+    case TAG_PRIMARY_LIST:
+	ptr = list_val(gval);
+	if (in_area(ptr, par->src, par->src_size)
+	    || in_area(ptr, par->oh, par->oh_size)) {
+	    *orig = gc_par_move_cons(w, ptr);
+	} else if (IS_MOVED_CONS(*ptr)) {
+	    *orig = ptr[1];
+	}
+	break;
+    default:
+	break;
+    }
+}
+
+static void
+gc_par_sweep(ErtsGcParWorker *w, Eterm *n_hp, Eterm *n_end)
+{
+    while (n_hp < n_end) {
+	Eterm gval = *n_hp;
+
+	switch (primary_tag(gval)) {
+	case TAG_PRIMARY_BOXED:
+	case TAG_PRIMARY_LIST:
+	    gc_par_move(w, n_hp++);
+	    break;
+	case TAG_PRIMARY_HEADER: {
+	    if (!header_is_thing(gval))
+		n_hp++;
+	    else {
+		if (header_is_bin_matchstate(gval)) {
+		    ErlBinMatchState *ms = (ErlBinMatchState*) n_hp;
+		    ErlBinMatchBuffer *mb = &(ms->mb);
+		    Eterm orig = mb->orig;
+		    gc_par_move(w, &mb->orig);
+		    if (mb->orig != orig)
+			mb->base = binary_bytes(mb->orig);
+		}
+		n_hp += (thing_arityval(gval)+1);
+	    }
+	    break;
+	}
+	default:
+	    n_hp++;
+	    break;
+	}
+    }
+}
+
+static void
+gc_par_work(ErtsGcParWorker *w)
+{
+    Eterm *start, *end;
+
+    while (1) {
+	if (w->c_scan < w->c_top) {
+	    /* Prefer what we copied ourselves; it is still in the cache */
+	    start = w->c_scan;
+	    end = w->c_top;
+	    w->c_scan = end;
+	} else if (!gc_par_get_work(w->par, &start, &end)) {
+	    break;
+	}
+	gc_par_sweep(w, start, end);
+    }
+
+    /* Nothing left to sweep; just fill the rest of the chunk */
+    ASSERT(w->c_scan == w->c_top);
+    gc_par_fill(w->c_top, w->c_end);
+}
+
+static void
+gc_par_helper_execute(ErtsDirtyJob *job)
+{
+    ErtsGcParHelper *h = (ErtsGcParHelper *) job;
+    ErtsGcParWorker w;
+    ErtsGcPar *par;
+
+    /*
+     * The collection we were scheduled for may be finished already,
+     * in which case it has reset h->par.
+     */
+    erts_smp_mtx_lock(&gc_par_helpers_mtx);
+    h->queued = 0;
+    par = h->par;
+    h->par = NULL;
+    if (par) {
+	erts_smp_mtx_lock(&par->mtx);
+	if (par->done) {
+	    erts_smp_mtx_unlock(&par->mtx);
+	    par = NULL;
+	} else {
+	    par->workers++;
+	    erts_smp_mtx_unlock(&par->mtx);
+	}
+    }
+    erts_smp_mtx_unlock(&gc_par_helpers_mtx);
+
+    if (!par)
+	return;
+
+    w.par = par;
+    w.c_scan = w.c_top = w.c_end = NULL;
+    gc_par_work(&w);
+
+    erts_smp_mtx_lock(&par->mtx);
+    if (--par->workers == 1)
+	erts_smp_cnd_broadcast(&par->cnd);
+    erts_smp_mtx_unlock(&par->mtx);
+}
+
+/*
+ * Split the initially copied area into ranges for the range stack.
+ */
+static void
+gc_par_push_initial(ErtsGcPar *par, Eterm *hp, Eterm *end)
+{
+    Eterm *start = hp;
+
+    while (hp < end) {
+	Eterm val = *hp;
+	if (is_header(val) && header_is_thing(val))
+	    hp += thing_arityval(val)+1;
+	else
+	    hp++;
+	if (hp - start >= ERTS_GC_PAR_GRANULE) {
+	    gc_par_push(par, start, hp);
+	    start = hp;
+	}
+    }
+    if (start < end)
+	gc_par_push(par, start, end);
+}
+
+/*
+ * Sweep the new heap [n_heap, n_htop) and everything copied into it
+ * using the calling thread and up to 'helpers' dirty CPU scheduler
+ * threads. Only what is reachable from src and oh is copied; n_hend
+ * limits the to-space. Returns the new heap top.
+ */
+static Eterm*
+parallel_fullsweep(Eterm* n_heap, Eterm* n_htop, Eterm* n_hend,
+		   char* src, Uint src_size, char* oh, Uint oh_size,
+		   int helpers)
+{
+    ErtsGcPar par;
+    ErtsGcParWorker w;
+    ErtsGcParHelper *scheduled[ERTS_GC_PAR_MAX_HELPERS];
+    Uint to_sz = n_hend - n_heap;
+    int no_scheduled = 0;
+    int i;
+
+    erts_smp_mtx_init(&par.mtx, "gc_par");
+    erts_smp_cnd_init(&par.cnd);
+    erts_smp_atomic_init(&par.top, (long) n_htop);
+    erts_smp_atomic_init(&par.waiting, 0);
+    par.end = n_hend;
+    par.src = src;
+    par.src_size = src_size;
+    par.oh = oh;
+    par.oh_size = oh_size;
+    /* Every pushed range is a granule, a large object, or a chunk tail */
+    par.max_ranges = (to_sz/ERTS_GC_PAR_GRANULE
+		      + to_sz/ERTS_GC_PAR_LARGE_OBJ
+		      + to_sz/(ERTS_GC_PAR_CHUNK - ERTS_GC_PAR_LARGE_OBJ)
+		      + ERTS_GC_PAR_MAX_HELPERS + 2);
+    par.ranges = erts_alloc(ERTS_ALC_T_TMP,
+			    par.max_ranges*sizeof(ErtsGcParRange));
+    par.no_ranges = 0;
+    par.workers = 1;
+    par.done = 0;
+
+    gc_par_push_initial(&par, n_heap, n_htop);
+
+    erts_smp_mtx_lock(&gc_par_helpers_mtx);
+    for (i = 0; i < ERTS_GC_PAR_MAX_HELPERS && no_scheduled < helpers; i++) {
+	if (!gc_par_helpers[i].queued) {
+	    gc_par_helpers[i].queued = 1;
+	    gc_par_helpers[i].par = &par;
+	    scheduled[no_scheduled++] = &gc_par_helpers[i];
+	}
+    }
+    erts_smp_mtx_unlock(&gc_par_helpers_mtx);
+
+    for (i = 0; i < no_scheduled; i++)
+	erts_schedule_dirty_job(&scheduled[i]->job, ERTS_DIRTY_CPU_JOB);
+
+    w.par = &par;
+    w.c_scan = w.c_top = w.c_end = NULL;
+    gc_par_work(&w);
+
+    /*
+     * Make sure helpers that have not started yet stay away, and wait
+     * for the ones that joined to finish filling their chunks.
+     */
+    erts_smp_mtx_lock(&gc_par_helpers_mtx);
+    for (i = 0; i < no_scheduled; i++) {
+	if (scheduled[i]->par == &par)
+	    scheduled[i]->par = NULL;
+    }
+    erts_smp_mtx_unlock(&gc_par_helpers_mtx);
+
+    erts_smp_mtx_lock(&par.mtx);
+    while (par.workers > 1)
+	erts_smp_cnd_wait(&par.cnd, &par.mtx);
+    erts_smp_mtx_unlock(&par.mtx);
+
+    ASSERT(par.no_ranges == 0);
+    erts_free(ERTS_ALC_T_TMP, (void *) par.ranges);
+    erts_smp_cnd_destroy(&par.cnd);
+    erts_smp_mtx_destroy(&par.mtx);
+
+    return (Eterm *) erts_smp_atomic_read(&par.top);
+}
+
+#endif /* ERTS_SMP */
+
 static Uint
 adjust_after_fullsweep(Process *p, int size_before, int need, Eterm *objv, int nobj)
 {
     int wanted, sz, size_after, need_after;
     int stack_size = STACK_SZ_ON_HEAP(p);
+    int room = (int) gc_alloc_room(p);
     Uint reclaimed_now;
 
     size_after = (HEAP_TOP(p) - HEAP_START(p));
@@ -1354,7 +2178,7 @@ adjust_after_fullsweep(Process *p, int size_before, int need, Eterm *objv, int n
            wanted = 4 * need_after;
            I think this is better as fullsweep is used mainly on
            small memory systems, but I could be wrong... */
-        wanted = 2 * need_after;
+        wanted = 2 * need_after + room;
         if (wanted < p->min_heap_size) {
             sz = p->min_heap_size;
         } else {
@@ -1362,15 +2186,23 @@ adjust_after_fullsweep(Process *p, int size_before, int need, Eterm *objv, int n
         }
         if (sz < HEAP_SIZE(p)) {
             shrink_new_heap(p, sz, objv, nobj);
+	    p->gc_stats.shrinks++;
         }
     }
 
+    if (HEAP_SIZE(p) - need_after < room) {
+	/* Leave a fast allocator its room */
+	sz = next_heap_size(p, need_after + room, 0);
+	grow_new_heap(p, sz, objv, nobj);
+	p->gc_stats.grows++;
+    }
+
     return reclaimed_now;
 }
 
 /*
  * Return the size of all message buffers that are NOT linked in the
- * mbuf list.
+ * mbuf list and that will be moved onto the heap by the collection.
  */
 static Uint
 combined_message_size(Process* p)
@@ -1378,6 +2210,9 @@ combined_message_size(Process* p)
     Uint sz = 0;
     ErlMessage *msgp;
 
+    if (p->flags & F_OFF_HEAP_MSGQ)
+	return 0; /* Left in their fragments until received */
+
     for (msgp = p->msg.first; msgp; msgp = msgp->next) {
 	if (msgp->data.attached) {
 	    sz += erts_msg_attached_data_size(msgp);
@@ -1965,6 +2800,43 @@ grow_new_heap(Process *p, Uint new_sz, Eterm* objv, int nobj)
     HEAP_SIZE(p) = new_sz;
 }
 
+/*
+ * Grow the old heap in place of a fullsweep. Everything that may point
+ * into it (young heap, heap fragments, old heap itself and the rootset)
+ * is adjusted if the area moved.
+ */
+static void
+grow_old_heap(Process *p, Uint new_sz, Eterm* objv, int nobj)
+{
+    Eterm* new_old;
+    Uint old_size = OLD_HTOP(p) - OLD_HEAP(p);
+    Sint offs;
+
+    ASSERT(OLD_HEND(p) - OLD_HEAP(p) < new_sz);
+    new_old = (Eterm *) ERTS_HEAP_REALLOC(ERTS_ALC_T_OLD_HEAP,
+					  (void *) OLD_HEAP(p),
+					  sizeof(Eterm)*(OLD_HEND(p) - OLD_HEAP(p)),
+					  sizeof(Eterm)*new_sz);
+
+    if ((offs = new_old - OLD_HEAP(p)) != 0) {
+	char* area = (char *) OLD_HEAP(p);
+	Uint area_size = (char *) OLD_HTOP(p) - area;
+	ErlHeapFragment* bp;
+
+	offset_heap(new_old, old_size, offs, area, area_size);
+	offset_heap(HEAP_START(p), HEAP_TOP(p) - HEAP_START(p),
+		    offs, area, area_size);
+	for (bp = MBUF(p); bp != NULL; bp = bp->next) {
+	    offset_heap(bp->mem, bp->used_size, offs, area, area_size);
+	}
+	offset_rootset(p, offs, area, area_size, objv, nobj);
+    }
+    OLD_HEAP(p) = new_old;
+    OLD_HTOP(p) = new_old + old_size;
+    OLD_HEND(p) = new_old + new_sz;
+    p->old_heap_growths++;
+}
+
 static void
 shrink_new_heap(Process *p, Uint new_sz, Eterm *objv, int nobj)
 {
@@ -2529,8 +3401,10 @@ within2(Eterm *ptr, Process *p, Eterm *real_htop)
 		hfp = erts_dist_ext_trailer(mp->data.dist_ext);
 	    else
 		hfp = NULL;
-	    if (hfp && hfp->mem <= ptr && ptr < hfp->mem + hfp->used_size)
-		return 1;
+	    for (; hfp; hfp = hfp->next) {
+		if (hfp->mem <= ptr && ptr < hfp->mem + hfp->used_size)
+		    return 1;
+	    }
 	}
         mp = mp->next;
     }
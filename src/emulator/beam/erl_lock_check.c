@@ -94,6 +94,7 @@ static erts_lc_lock_order_t erts_lock_order[] = {
     {	"dist_entry",				"address"		},
     {	"dist_entry_links",			"address"		},
     {	"proc_status",				"pid"			},
+    {	"sched_groups",				NULL			},
     {	"proc_tab",				NULL			},
     {   "ports_snapshot",                       NULL                    },
     {	"db_tab",				"address"		},    
@@ -102,6 +103,8 @@ static erts_lc_lock_order_t erts_lock_order[] = {
     {	"meta_main_tab_slot",			"address"		},
     {	"meta_main_tab_main",			NULL 			},
     {	"db_hash_slot",				"address"		},
+    {	"db_tree_base",				"address"		},
+    {	"db_workers",				NULL			},
     {	"node_table",				NULL			},
     {	"dist_table",				NULL			},
     {	"sys_tracers",				NULL			},
@@ -109,6 +112,9 @@ static erts_lc_lock_order_t erts_lock_order[] = {
     {	"export_tab",				NULL			},
     {	"fun_tab",				NULL			},
     {	"environ",				NULL			},
+    {	"gc_par_helpers",			NULL			},
+    {	"gc_par",				NULL			},
+    {	"dirty_job_queue",			"address"		},
 #endif
     {	"asyncq",				"address"		},
 #ifndef ERTS_SMP
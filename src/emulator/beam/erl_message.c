@@ -47,7 +47,7 @@ ERTS_SCHED_PREF_QUICK_ALLOC_IMPL(message,
 
 static ERTS_INLINE int in_heapfrag(const Eterm* ptr, const ErlHeapFragment *bp)
 {
-    return ((unsigned)(ptr - bp->mem) < bp->used_size);
+    return (ptr >= bp->mem && ptr < bp->mem + bp->used_size);
 }
 
 
@@ -406,6 +406,64 @@ erts_queue_dist_message(Process *rcvr,
     }
 }
 
+#ifdef ERTS_SMP
+
+void
+erts_smp_msgq_fetch_lf_inq(Process *p)
+{
+    ErlMessage *mp, *first, **last;
+    int len;
+    long head;
+
+    /* Caller serializes fetchers, normally by holding the msgq lock */
+    if (erts_smp_atomic_read(&p->msg_lf_inq) == ERTS_MSG_LF_INQ_NOTIFY)
+	return;
+    head = erts_smp_atomic_xchg(&p->msg_lf_inq, ERTS_MSG_LF_INQ_NOTIFY);
+    mp = (ErlMessage *) (head & ~ERTS_MSG_LF_INQ_NOTIFY);
+    if (!mp)
+	return;
+
+    /* Pushed newest first; reverse into arrival order */
+    first = NULL;
+    last = &mp->next;
+    len = 0;
+    while (mp) {
+	ErlMessage *next = mp->next;
+	mp->next = first;
+	first = mp;
+	mp = next;
+	len++;
+    }
+    *p->msg_inq.last = first;
+    p->msg_inq.last = last;
+    p->msg_inq.len += len;
+    erts_smp_atomic_add(&p->msg_lf_inq_len, (long) -len);
+}
+
+/*
+ * Push message onto the lock free in queue of 'p'. Returns
+ * non-zero if the caller is responsible for waking up 'p'.
+ */
+static ERTS_INLINE int
+lf_link_message(Process *p, ErlMessage *mp)
+{
+    long head;
+
+    /* Counted before it is visible, so that fetching never goes below 0 */
+    erts_smp_atomic_inc(&p->msg_lf_inq_len);
+    head = erts_smp_atomic_read(&p->msg_lf_inq);
+    while (1) {
+	long prev;
+	mp->next = (ErlMessage *) (head & ~ERTS_MSG_LF_INQ_NOTIFY);
+	prev = erts_smp_atomic_cmpxchg(&p->msg_lf_inq, (long) mp, head);
+	if (prev == head)
+	    return (int) (head & ERTS_MSG_LF_INQ_NOTIFY);
+	head = prev;
+    }
+}
+
+#endif
+
 /* Add a message last in message queue */
 void
 erts_queue_message(Process* receiver,
@@ -426,6 +484,36 @@ erts_queue_message(Process* receiver,
     mp = message_alloc();
 
 #ifdef ERTS_SMP
+    if (!*receiver_locks
+	&& !receiver->is_exiting
+	&& receiver->pending_exit.reason == THE_NON_VALUE
+	&& !IS_TRACED_FL(receiver, F_TRACE_RECEIVE)) {
+	/*
+	 * Nothing locked on the receiver; enqueue without taking
+	 * the msgq lock. Only the first sender after the receiver
+	 * emptied its lock free in queue takes the status lock in
+	 * order to wake it up. Messages to a receiver that exits
+	 * meanwhile are freed when the process structure is freed.
+	 * The exit checks are unlocked hints; a receiver that looks
+	 * like it is about to exit takes the locked path below, which
+	 * drops the message. A message without fragments refers only
+	 * to shared areas (see erts_share_term()), never to the heap
+	 * of the receiver.
+	 */
+	ASSERT(bp || is_immed(message)
+	       || ptr_val(message) < receiver->heap
+	       || ptr_val(message) >= receiver->hend);
+	ERL_MESSAGE_TERM(mp) = message;
+	ERL_MESSAGE_TOKEN(mp) = seq_trace_token;
+	mp->data.heap_frag = bp;
+	if (lf_link_message(receiver, mp)) {
+	    *receiver_locks = ERTS_PROC_LOCK_STATUS;
+	    erts_smp_proc_lock(receiver, ERTS_PROC_LOCK_STATUS);
+	    notify_new_message(receiver);
+	}
+	return;
+    }
+
     need_locks = ~(*receiver_locks) & (ERTS_PROC_LOCK_MSGQ
 				       | ERTS_PROC_LOCK_STATUS);
     if (need_locks) {
@@ -487,6 +575,29 @@ erts_queue_message(Process* receiver,
 #endif
 }
 
+/* Free a list of messages not yet consumed by anyone */
+void
+erts_cleanup_messages(ErlMessage *mp)
+{
+    while (mp != NULL) {
+	ErlMessage* next_mp = mp->next;
+	if (mp->data.attached) {
+	    if (is_value(mp->m[0]))
+		free_message_buffer(mp->data.heap_frag);
+	    else {
+		if (is_not_nil(mp->m[1])) {
+		    ErlHeapFragment *heap_frag;
+		    heap_frag = (ErlHeapFragment *) mp->data.dist_ext->ext_endp;
+		    erts_cleanup_offheap(&heap_frag->off_heap);
+		}
+		erts_free_dist_ext_copy(mp->data.dist_ext);
+	    }
+	}
+	free_message(mp);
+	mp = next_mp;
+    }
+}
+
 void
 erts_link_mbuf_to_proc(struct process *proc, ErlHeapFragment *bp)
 {
@@ -538,7 +649,8 @@ erts_move_msg_mbuf_to_heap(Eterm** hpp, ErlOffHeap* off_heap, ErlMessage *msg)
     term = ERL_MESSAGE_TERM(msg);
     token = ERL_MESSAGE_TOKEN(msg);
     if (!bp) {
-	ASSERT(is_immed(term) && is_immed(token));
+	/* The term may be a shared term (erlang:share_term/1) itself */
+	ASSERT(is_immed(token));
 	return;
     }
 
@@ -564,7 +676,6 @@ erts_move_msg_mbuf_to_heap(Eterm** hpp, ErlOffHeap* off_heap, ErlMessage *msg)
     off_heap->overhead += bp->off_heap.overhead;
     sz = bp->used_size;
 
-    ASSERT(is_immed(term) || in_heapfrag(ptr_val(term),bp));
     ASSERT(is_immed(token) || in_heapfrag(ptr_val(token),bp));
 
     fhp = bp->mem;
@@ -584,8 +695,12 @@ erts_move_msg_mbuf_to_heap(Eterm** hpp, ErlOffHeap* off_heap, ErlMessage *msg)
 	    break;
 	case TAG_PRIMARY_LIST:
 	case TAG_PRIMARY_BOXED:
-	    ASSERT(in_heapfrag(ptr_val(val), bp));
-	    *hp++ = offset_ptr(val, offs);
+	    /* Pointers into shared term areas stay as they are */
+	    if (in_heapfrag(ptr_val(val), bp)) {
+		*hp++ = offset_ptr(val, offs);
+	    } else {
+		*hp++ = val;
+	    }
 	    break;
 	case TAG_PRIMARY_HEADER:
 	    *hp++ = val;
@@ -698,8 +813,7 @@ erts_move_msg_mbuf_to_heap(Eterm** hpp, ErlOffHeap* off_heap, ErlMessage *msg)
 #endif
     }
 
-    if (is_not_immed(term)) {
-	ASSERT(in_heapfrag(ptr_val(term),bp));
+    if (is_not_immed(term) && in_heapfrag(ptr_val(term),bp)) {
 	ERL_MESSAGE_TERM(msg) = offset_ptr(term, offs);
 #ifdef HARD_DEBUG
 	ASSERT(dbg_thp_start <= ptr_val(ERL_MESSAGE_TERM(msg)));
@@ -837,6 +951,61 @@ erts_move_msg_attached_data_to_heap(Eterm **hpp, ErlOffHeap *ohp, ErlMessage *ms
     /* else: bad external detected when calculating size */
 }
 
+#ifdef ERTS_SMP
+
+/*
+ * Copy a message to receiver in a single pass. The copy is placed on
+ * the heap of the receiver if its main lock can be acquired and the
+ * copy fits there, otherwise in heap fragments returned in *bpp. As
+ * erts_alloc_message_heap(), this releases the msgq and status locks
+ * on receiver.
+ */
+static Eterm
+copy_message(Process *sender, Eterm message, ErlHeapFragment **bpp,
+	     Process *receiver, ErtsProcLocks *receiver_locks, int share)
+{
+    ErtsProcLocks ulocks = *receiver_locks & ERTS_PROC_LOCKS_MSG_SEND;
+    int locked_main = 0;
+    int on_heap = 0;
+
+    *bpp = NULL;
+    if (!(receiver->flags & F_OFF_HEAP_MSGQ)) {
+	if (*receiver_locks & ERTS_PROC_LOCK_MAIN)
+	    on_heap = 1;
+	else if (erts_smp_proc_trylock(receiver, ERTS_PROC_LOCK_MAIN) == 0) {
+	    locked_main = 1;
+	    *receiver_locks |= ERTS_PROC_LOCK_MAIN;
+	    on_heap = 1;
+	}
+	if (on_heap && ERTS_PROC_IS_EXITING(receiver))
+	    on_heap = 0;
+    }
+
+    if (ulocks) {
+	erts_smp_proc_unlock(receiver, ulocks);
+	*receiver_locks &= ~ulocks;
+    }
+
+    if (on_heap) {
+	Eterm *hp = HEAP_TOP(receiver);
+	Eterm res = copy_struct_bounded(message, &hp, HEAP_LIMIT(receiver) - 1,
+					&MSO(receiver), share,
+					sender->shared_areas);
+	if (is_value(res)) {
+	    HEAP_TOP(receiver) = hp;
+	    return res;
+	}
+    }
+
+    if (locked_main) {
+	erts_smp_proc_unlock(receiver, ERTS_PROC_LOCK_MAIN);
+	*receiver_locks &= ~ERTS_PROC_LOCK_MAIN;
+    }
+    return copy_struct_frags(message, bpp, share, sender->shared_areas);
+}
+
+#endif /* ERTS_SMP */
+
 /*
  * Send a local message when sender & receiver processes are known.
  */
@@ -974,42 +1143,67 @@ erts_send_message(Process* sender,
         BM_SWAP_TIMER(send,system);
 	return;
     } else {
+	int share = (sender->flags & F_COPY_SHARING) != 0;
 #ifdef ERTS_SMP
-	ErlOffHeap *ohp;
-        Eterm *hp;
-	BM_SWAP_TIMER(send,size);
-	msize = size_object(message);
-	BM_SWAP_TIMER(size,send);
-	hp = erts_alloc_message_heap(msize,&bp,&ohp,receiver,receiver_locks);
 	BM_SWAP_TIMER(send,copy);
-	message = copy_struct(message, msize, &hp, ohp);
-	BM_MESSAGE_COPIED(msz);
+	message = copy_message(sender, message, &bp, receiver, receiver_locks,
+			       share);
 	BM_SWAP_TIMER(copy,send);
 	erts_queue_message(receiver, receiver_locks, bp, message, token);
+	erts_add_shared_area_refs(receiver, receiver_locks,
+				  sender->shared_areas);
         BM_SWAP_TIMER(send,system);
 #else
-	ErlMessage* mp = message_alloc();
+	ErlMessage* mp;
         Eterm *hp;
-        BM_SWAP_TIMER(send,size);
-	msize = size_object(message);
-        BM_SWAP_TIMER(size,send);
-	
-	if (receiver->stop - receiver->htop <= msize) {
-            BM_SWAP_TIMER(send,system);
-	    erts_garbage_collect(receiver, msize, receiver->arg_reg, receiver->arity);
-            BM_SWAP_TIMER(system,send);
+	Eterm copy;
+
+	if (receiver->flags & F_OFF_HEAP_MSGQ) {
+	    BM_SWAP_TIMER(send,copy);
+	    message = copy_struct_frags(message, &bp, share,
+					sender->shared_areas);
+	    BM_SWAP_TIMER(copy,send);
+	    erts_queue_message(receiver, receiver_locks, bp, message, token);
+	    erts_add_shared_area_refs(receiver, receiver_locks,
+				      sender->shared_areas);
+	    BM_SWAP_TIMER(send,system);
+	    return;
 	}
+
+	mp = message_alloc();
 	hp = receiver->htop;
-	receiver->htop = hp + msize;
         BM_SWAP_TIMER(send,copy);
-	message = copy_struct(message, msize, &hp, &receiver->off_heap);
-	BM_MESSAGE_COPIED(msize);
+	copy = copy_struct_bounded(message, &hp, receiver->stop - 1,
+				   &receiver->off_heap, share,
+				   sender->shared_areas);
         BM_SWAP_TIMER(copy,send);
+	if (is_value(copy)) {
+	    receiver->htop = hp;
+	    message = copy;
+	} else {
+	    /* Didn't fit; make room for it */
+	    BM_SWAP_TIMER(send,size);
+	    msize = size_object(message);
+	    BM_SWAP_TIMER(size,send);
+	    if (receiver->stop - receiver->htop <= msize) {
+		BM_SWAP_TIMER(send,system);
+		erts_garbage_collect(receiver, msize, receiver->arg_reg, receiver->arity);
+		BM_SWAP_TIMER(system,send);
+	    }
+	    hp = receiver->htop;
+	    receiver->htop = hp + msize;
+	    BM_SWAP_TIMER(send,copy);
+	    message = copy_struct(message, msize, &hp, &receiver->off_heap);
+	    BM_MESSAGE_COPIED(msize);
+	    BM_SWAP_TIMER(copy,send);
+	}
 	ERL_MESSAGE_TERM(mp) = message;
 	ERL_MESSAGE_TOKEN(mp) = NIL;
 	mp->next = NULL;
 	mp->data.attached = NULL;
 	LINK_MESSAGE(receiver, mp);
+	erts_add_shared_area_refs(receiver, receiver_locks,
+				  sender->shared_areas);
 
 	if (receiver->status == P_WAITING) {
 	    erts_add_to_runq(receiver);
@@ -108,9 +108,22 @@ typedef struct {
 
 #ifdef ERTS_SMP
 
+/*
+ * Lock free part of the in queue (Process field msg_lf_inq). Senders
+ * not holding any locks on the receiver push messages onto it (LIFO);
+ * the receiver moves them into msg_inq under the msgq lock. The
+ * NOTIFY bit is set whenever the receiver has emptied it, and tells
+ * the sender that clears it to wake up the receiver.
+ */
+#define ERTS_MSG_LF_INQ_NOTIFY ((long) 1)
+
+/* Move lock free in queue to end of in queue */
+#define ERTS_SMP_MSGQ_FETCH_LF_INQ(P) erts_smp_msgq_fetch_lf_inq((P))
+
 /* Move in message queue to end of private message queue */
 #define ERTS_SMP_MSGQ_MV_INQ2PRIVQ(P)			\
 do {							\
+    erts_smp_msgq_fetch_lf_inq((P));			\
     if ((P)->msg_inq.first) {				\
 	*(P)->msg.last = (P)->msg_inq.first;		\
 	(P)->msg.last = (P)->msg_inq.last;		\
@@ -123,6 +136,7 @@ do {							\
 
 /* Add message last in message queue */
 #define LINK_MESSAGE(p, mp) do { \
+    erts_smp_msgq_fetch_lf_inq((p)); \
     *(p)->msg_inq.last = (mp); \
     (p)->msg_inq.last = &(mp)->next; \
     (p)->msg_inq.len++; \
@@ -130,6 +144,7 @@ do {							\
 
 #else
 
+#define ERTS_SMP_MSGQ_FETCH_LF_INQ(P)
 #define ERTS_SMP_MSGQ_MV_INQ2PRIVQ(P)
 
 /* Add message last in message queue */
@@ -166,7 +181,10 @@ do {							\
  * afterwards and taken care of appropriately.
  *
  * ErtsMoveMsgAttachmentIntoProc() will shallow copy to heap if
- * possible; otherwise, move to heap via garbage collection.
+ * possible; otherwise, move to heap via garbage collection. A process
+ * with F_OFF_HEAP_MSGQ set keeps message data off heap also during
+ * garbage collection, so the collection makes room for the message
+ * which is then moved explicitly.
  *
  * ErtsMoveMsgAttachmentIntoProc() is used when receiveing messages
  * in process_main() and in hipe_check_get_msg().
@@ -183,9 +201,17 @@ do {									\
 	    (HT) = htop__;						\
 	}								\
 	else {								\
+	    int off_heap__ = ((P)->flags & F_OFF_HEAP_MSGQ) != 0;	\
 	    { SWPO ; }							\
-	    (FC) -= erts_garbage_collect((P), 0, NULL, 0);		\
+	    (FC) -= erts_garbage_collect((P), off_heap__ ? need__ : 0,	\
+					 NULL, 0);			\
 	    { SWPI ; }							\
+	    if (off_heap__ && (M)->data.attached) {			\
+		Uint *htop__ = (HT);					\
+		ASSERT((ST) - (HT) >= need__);				\
+		erts_move_msg_attached_data_to_heap(&htop__, &MSO((P)), (M));\
+		(HT) = htop__;						\
+	    }								\
 	}								\
 	ASSERT(!(M)->data.attached);					\
     }									\
@@ -215,6 +241,10 @@ ErlHeapFragment* erts_resize_message_buffer(ErlHeapFragment *, Uint,
 void free_message_buffer(ErlHeapFragment *);
 void erts_queue_dist_message(Process*, ErtsProcLocks*, ErtsDistExternal *, Eterm);
 void erts_queue_message(Process*, ErtsProcLocks*, ErlHeapFragment*, Eterm, Eterm);
+#ifdef ERTS_SMP
+void erts_smp_msgq_fetch_lf_inq(Process *);
+#endif
+void erts_cleanup_messages(ErlMessage *);
 void erts_deliver_exit_message(Eterm, Process*, ErtsProcLocks *, Eterm, Eterm);
 void erts_send_message(Process*, Process*, ErtsProcLocks*, Eterm, unsigned);
 void erts_link_mbuf_to_proc(Process *proc, ErlHeapFragment *bp);
@@ -46,8 +46,9 @@ struct erl_module_nif {
     void* priv_data;
     void* handle;             /* "dlopen" */
     struct enif_entry_t* entry;
-    erts_refc_t rt_cnt;       /* number of resource types */
-    erts_refc_t rt_dtor_cnt;  /* number of resource types with destructors */
+    erts_refc_t rt_cnt;       /* number of resource types and dirty jobs */
+    erts_refc_t rt_dtor_cnt;  /* number of resource types with destructors
+				 and dirty jobs */
     Module* mod;           /* Can be NULL if orphan with dtor-resources left */ 
 };
 
@@ -342,9 +343,10 @@ int enif_send(ErlNifEnv* env, const ErlNifPid* to_pid,
     }
     erts_queue_message(rp, &rp_locks, frags, msg, am_undefined);
     if (rp_locks) {	
-	ERTS_SMP_LC_ASSERT(rp_locks == (rp_had_locks | (ERTS_PROC_LOCK_MSGQ | 
-							ERTS_PROC_LOCK_STATUS)));
-	erts_smp_proc_unlock(rp, (ERTS_PROC_LOCK_MSGQ | ERTS_PROC_LOCK_STATUS));
+	ERTS_SMP_LC_ASSERT((rp_locks & ~(ERTS_PROC_LOCK_MSGQ
+					 | ERTS_PROC_LOCK_STATUS)) == rp_had_locks);
+	erts_smp_proc_unlock(rp, rp_locks & (ERTS_PROC_LOCK_MSGQ
+					     | ERTS_PROC_LOCK_STATUS));
     }
     erts_smp_proc_dec_refc(rp);
     if (flush_me) {
@@ -1062,11 +1064,12 @@ static void close_lib(struct erl_module_nif* lib)
     lib->handle = NULL;
 }
 
-static void steal_resource_type(ErlNifResourceType* type)
+/* Drop a reference to lib held by a resource type, or by a dirty NIF
+ * call which counts as a resource type with a destructor.
+ */
+static void lib_unref(struct erl_module_nif* lib, int has_dtor)
 {
-    struct erl_module_nif* lib = type->owner;
-
-    if (type->dtor != NULL
+    if (has_dtor
 	&& erts_refc_dectest(&lib->rt_dtor_cnt, 0) == 0
 	&& lib->mod == NULL) {
 	/* last type with destructor gone, close orphan lib */
@@ -1079,6 +1082,11 @@ static void steal_resource_type(ErlNifResourceType* type)
     }
 }
 
+static void steal_resource_type(ErlNifResourceType* type)
+{
+    lib_unref(type->owner, type->dtor != NULL);
+}
+
 ErlNifResourceType*
 enif_open_resource_type(ErlNifEnv* env,
 			const char* module_str, 
@@ -1244,6 +1252,165 @@ size_t enif_sizeof_resource(void* obj)
     return ERTS_MAGIC_BIN_DATA_SIZE(bin) - offsetof(ErlNifResource,data);
 }
 
+/***************************************************************************
+ **                           Dirty schedulers                            **
+ ***************************************************************************/
+
+#ifdef ERTS_SMP
+/* A NIF call handed over to a dirty scheduler. Lives in a magic binary
+ * referred both by the dirty scheduler and by the trap argument of the
+ * waiting process, whichever lets go last frees it.
+ */
+typedef struct {
+    ErtsDirtyJob job;
+    ERL_NIF_TERM (*fp)(ErlNifEnv*, int, const ERL_NIF_TERM[]);
+    struct erl_module_nif* lib; /* kept loaded until the job is freed */
+    Binary* mbin;
+    Eterm pid;
+    ErlNifEnv* env;       /* process independent env holding argv and result */
+    ERL_NIF_TERM result;
+    Uint error;
+    int done;             /* protected by status lock of 'pid' */
+    int suspended;        /* protected by status lock of 'pid' */
+    int argc;
+    ERL_NIF_TERM argv[1];
+} ErtsDirtyNifJob;
+
+static Export dirty_nif_finalize_trap_export;
+
+static void dirty_nif_job_dtor(Binary* mbin)
+{
+    ErtsDirtyNifJob* job = (ErtsDirtyNifJob*) ERTS_MAGIC_BIN_DATA(mbin);
+    enif_free_env(job->env);
+    lib_unref(job->lib, 1);
+}
+
+static void dirty_nif_execute(ErtsDirtyJob* dj)
+{
+    ErtsDirtyNifJob* job = (ErtsDirtyNifJob*) dj;
+    ErlNifEnv* env = job->env;
+    Binary* mbin = job->mbin;
+    Process* rp;
+
+    env->tmp_obj_list = NULL;
+    env->fpe_was_unmasked = erts_block_fpe();
+    job->result = (*job->fp)(env, job->argc, job->argv);
+    erts_unblock_fpe(env->fpe_was_unmasked);
+    free_tmp_objs(env);
+    env->tmp_obj_list = (struct enif_tmp_obj_t*) 1;
+    flush_env(env);
+    if (is_non_value(job->result)) {
+	job->error = env->proc->freason ? env->proc->freason : BADARG;
+    }
+
+    rp = erts_pid2proc(NULL, 0, job->pid, ERTS_PROC_LOCK_STATUS);
+    if (rp) {
+	job->done = 1;
+	if (job->suspended) {
+	    job->suspended = 0;
+	    erts_resume(rp, ERTS_PROC_LOCK_STATUS);
+	}
+	erts_smp_proc_unlock(rp, ERTS_PROC_LOCK_STATUS);
+    }
+    if (erts_refc_dectest(&mbin->refc, 0) == 0) {
+	erts_bin_free(mbin);
+    }
+}
+
+/* Trap target of a process waiting for its dirty NIF to finish. */
+static BIF_RETTYPE dirty_nif_finalize(BIF_ALIST_1)
+{
+    ErtsDirtyNifJob* job;
+    Eterm* hp;
+    Uint sz;
+    Eterm res;
+
+    ASSERT(ERTS_TERM_IS_MAGIC_BINARY(BIF_ARG_1));
+    job = (ErtsDirtyNifJob*) ERTS_MAGIC_BIN_DATA(((ProcBin*) binary_val(BIF_ARG_1))->val);
+
+    erts_smp_proc_lock(BIF_P, ERTS_PROC_LOCK_STATUS);
+    if (!job->done) {
+	job->suspended = 1;
+	erts_suspend(BIF_P, ERTS_PROC_LOCK_MAIN|ERTS_PROC_LOCK_STATUS, NULL);
+	erts_smp_proc_unlock(BIF_P, ERTS_PROC_LOCK_STATUS);
+	ERTS_BIF_YIELD1(&dirty_nif_finalize_trap_export, BIF_P, BIF_ARG_1);
+    }
+    erts_smp_proc_unlock(BIF_P, ERTS_PROC_LOCK_STATUS);
+
+    if (is_non_value(job->result)) {
+	BIF_ERROR(BIF_P, job->error);
+    }
+    sz = size_object(job->result);
+    hp = HAlloc(BIF_P, sz);
+    res = copy_struct(job->result, sz, &hp, &MSO(BIF_P));
+    BIF_RET(res);
+}
+
+/* Installed instead of the real function for NIFs flagged as dirty in
+ * their ErlNifFunc entry. load_nif stores the entry after the operands
+ * of call_nif, and current points to the Module, Function, Arity words
+ * before it.
+ */
+static ERL_NIF_TERM dirty_nif_dispatch(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    ErlNifFunc* f = (ErlNifFunc*) env->proc->current[3+3];
+
+    ASSERT(f->arity == (unsigned) env->proc->current[2]);
+    return enif_schedule_dirty_nif(env, f->flags, f->fptr, argc, argv);
+}
+#endif /* ERTS_SMP */
+
+ERL_NIF_TERM enif_schedule_dirty_nif(ErlNifEnv* env, int flags,
+				     ERL_NIF_TERM (*fp)(ErlNifEnv*, int, const ERL_NIF_TERM[]),
+				     int argc, const ERL_NIF_TERM argv[])
+{
+#ifdef ERTS_SMP
+    Binary* mbin;
+    ErtsDirtyNifJob* job;
+    Eterm* hp;
+    Eterm mb_term;
+    int i;
+
+    if (env->proc->id == ERTS_INVALID_PID) {
+	/* Already on a dirty scheduler */
+	return (*fp)(env, argc, argv);
+    }
+
+    mbin = erts_create_magic_binary(sizeof(ErtsDirtyNifJob)
+				    + (argc > 1 ? argc - 1 : 0) * sizeof(ERL_NIF_TERM),
+				    dirty_nif_job_dtor);
+    job = (ErtsDirtyNifJob*) ERTS_MAGIC_BIN_DATA(mbin);
+    job->job.execute = dirty_nif_execute;
+    job->fp = fp;
+    job->lib = env->mod_nif;
+    erts_refc_inc(&job->lib->rt_dtor_cnt, 1);
+    erts_refc_inc(&job->lib->rt_cnt, 1);
+    job->mbin = mbin;
+    job->pid = env->proc->id;
+    job->env = enif_alloc_env();
+    job->env->mod_nif = env->mod_nif;
+    job->result = THE_NON_VALUE;
+    job->error = 0;
+    job->done = 0;
+    job->suspended = 0;
+    job->argc = argc;
+    for (i = 0; i < argc; i++) {
+	job->argv[i] = enif_make_copy(job->env, argv[i]);
+    }
+
+    hp = alloc_heap(env, PROC_BIN_SIZE);
+    mb_term = erts_mk_magic_binary_term(&hp, &MSO(env->proc), mbin);
+    erts_refc_inc(&mbin->refc, 2); /* reference of the dirty scheduler */
+
+    erts_schedule_dirty_job(&job->job, ((flags & ERL_NIF_DIRTY_JOB_IO_BOUND)
+					? ERTS_DIRTY_IO_JOB
+					: ERTS_DIRTY_CPU_JOB));
+    BIF_TRAP1(&dirty_nif_finalize_trap_export, env->proc, mb_term);
+#else
+    return (*fp)(env, argc, argv);
+#endif
+}
+
 /***************************************************************************
  **                              load_nif/2                               **
  ***************************************************************************/
@@ -1424,7 +1591,8 @@ BIF_RETTYPE load_nif_2(BIF_ALIST_2)
 	ret = load_nif_error(BIF_P, bad_lib, "Library init-call unsuccessful");
     }
     else if (entry->major != ERL_NIF_MAJOR_VERSION
-	     || entry->minor > ERL_NIF_MINOR_VERSION) {
+	     || entry->minor > ERL_NIF_MINOR_VERSION
+	     || entry->minor < 1) { /* 2.0 ErlNifFunc has no flags field */
 	
 	ret = load_nif_error(BIF_P, bad_lib, "Library version (%d.%d) not compatible (with %d.%d).",
 			     entry->major, entry->minor, ERL_NIF_MAJOR_VERSION, ERL_NIF_MINOR_VERSION);
@@ -1444,7 +1612,13 @@ BIF_RETTYPE load_nif_2(BIF_ALIST_2)
 		ret = load_nif_error(BIF_P,bad_lib,"Function not found %T:%s/%u",
 				     mod_atom, f->name, f->arity);
 	    }    
-	    else if (code_pp[1] - code_pp[0] < (5+3)) {
+	    else if (code_pp[1] - code_pp[0] < (5+3)
+#ifdef ERTS_SMP
+		     || ((f->flags & (ERL_NIF_DIRTY_JOB_CPU_BOUND
+				      | ERL_NIF_DIRTY_JOB_IO_BOUND))
+			 && code_pp[1] - code_pp[0] < (5+4))
+#endif
+		     ) {
 		ret = load_nif_error(BIF_P,bad_lib,"No explicit call to load_nif"
 				     " in module (%T:%s/%u to small)",
 				     mod_atom, entry->funcs[i].name, entry->funcs[i].arity);
@@ -1552,7 +1726,15 @@ BIF_RETTYPE load_nif_2(BIF_ALIST_2)
 		BpData*  bp  = (BpData*) bps[bp_sched2ix()];
 	        bp->orig_instr = (BeamInstr) BeamOp(op_call_nif);
 	    }	    
-	    code_ptr[5+1] = (BeamInstr) entry->funcs[i].fptr;
+#ifdef ERTS_SMP
+	    if (entry->funcs[i].flags & (ERL_NIF_DIRTY_JOB_CPU_BOUND
+					 | ERL_NIF_DIRTY_JOB_IO_BOUND)) {
+		code_ptr[5+1] = (BeamInstr) dirty_nif_dispatch;
+		code_ptr[5+3] = (BeamInstr) &entry->funcs[i];
+	    }
+	    else
+#endif
+		code_ptr[5+1] = (BeamInstr) entry->funcs[i].fptr;
 	    code_ptr[5+2] = (BeamInstr) lib;
 	}
     }
@@ -1623,6 +1805,16 @@ void erl_nif_init()
     resource_type_list.owner = NULL;
     resource_type_list.module = THE_NON_VALUE;
     resource_type_list.name = THE_NON_VALUE;
+
+#ifdef ERTS_SMP
+    sys_memset((void *) &dirty_nif_finalize_trap_export, 0, sizeof(Export));
+    dirty_nif_finalize_trap_export.address = &dirty_nif_finalize_trap_export.code[3];
+    dirty_nif_finalize_trap_export.code[0] = am_erlang;
+    dirty_nif_finalize_trap_export.code[1] = am_dirty_nif_finalize;
+    dirty_nif_finalize_trap_export.code[2] = 1;
+    dirty_nif_finalize_trap_export.code[3] = (BeamInstr) em_apply_bif;
+    dirty_nif_finalize_trap_export.code[4] = (BeamInstr) &dirty_nif_finalize;
+#endif
 }
 
 #ifdef READONLY_CHECK
@@ -30,9 +30,10 @@
 ** 0.1: R13B03
 ** 1.0: R13B04
 ** 2.0: R14A
+** 2.1: dirty schedulers
 */
 #define ERL_NIF_MAJOR_VERSION 2
-#define ERL_NIF_MINOR_VERSION 0
+#define ERL_NIF_MINOR_VERSION 1
 
 #include <stdlib.h>
 
@@ -80,8 +81,12 @@ typedef struct
     const char* name;
     unsigned arity;
     ERL_NIF_TERM (*fptr)(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]);
+    unsigned flags; /* ERL_NIF_DIRTY_JOB_* to always run on a dirty scheduler */
 }ErlNifFunc;
 
+#define ERL_NIF_DIRTY_JOB_CPU_BOUND 1
+#define ERL_NIF_DIRTY_JOB_IO_BOUND  2
+
 typedef struct enif_entry_t
 {
     int major;
@@ -122,6 +122,7 @@ ERL_NIF_API_FUNC_DECL(ErlNifPid*,enif_self,(ErlNifEnv* caller_env, ErlNifPid* pi
 ERL_NIF_API_FUNC_DECL(int,enif_get_local_pid,(ErlNifEnv* env, ERL_NIF_TERM, ErlNifPid* pid));
 ERL_NIF_API_FUNC_DECL(void,enif_keep_resource,(void* obj));
 ERL_NIF_API_FUNC_DECL(ERL_NIF_TERM,enif_make_resource_binary,(ErlNifEnv*,void* obj,const void* data, size_t size));
+ERL_NIF_API_FUNC_DECL(ERL_NIF_TERM,enif_schedule_dirty_nif,(ErlNifEnv*,int flags,ERL_NIF_TERM (*fp)(ErlNifEnv*,int,const ERL_NIF_TERM[]),int argc,const ERL_NIF_TERM argv[]));
 
 /*
 ** Add last to keep compatibility on Windows!!!
@@ -230,6 +231,7 @@ ERL_NIF_API_FUNC_DECL(ERL_NIF_TERM,enif_make_resource_binary,(ErlNifEnv*,void* o
 #  define enif_get_local_pid ERL_NIF_API_FUNC_MACRO(enif_get_local_pid)
 #  define enif_keep_resource ERL_NIF_API_FUNC_MACRO(enif_keep_resource)
 #  define enif_make_resource_binary ERL_NIF_API_FUNC_MACRO(enif_make_resource_binary)
+#  define enif_schedule_dirty_nif ERL_NIF_API_FUNC_MACRO(enif_schedule_dirty_nif)
 #endif
 
 #ifndef enif_make_list1
@@ -1336,6 +1336,28 @@ setup_reference_table(void)
 				   HEAP_REF,
 				   process_tab[i]->id);
 	    }
+	    for (msg = ((ErlMessage *)
+			(erts_smp_atomic_read(&process_tab[i]->msg_lf_inq)
+			 & ~ERTS_MSG_LF_INQ_NOTIFY));
+		 msg;
+		 msg = msg->next) {
+		ErlHeapFragment *heap_frag = NULL;
+		if (msg->data.attached) {
+		    if (is_value(ERL_MESSAGE_TERM(msg)))
+			heap_frag = msg->data.heap_frag;
+		    else {
+			if (msg->data.dist_ext->dep)
+			    insert_dist_entry(msg->data.dist_ext->dep,
+					      HEAP_REF, process_tab[i]->id, 0);
+			if (is_not_nil(ERL_MESSAGE_TOKEN(msg)))
+			    heap_frag = erts_dist_ext_trailer(msg->data.dist_ext);
+		    }
+		}
+		if (heap_frag)
+		    insert_offheap(&(heap_frag->off_heap),
+				   HEAP_REF,
+				   process_tab[i]->id);
+	    }
 #endif
 	    /* Insert links */
 	    if(process_tab[i]->nlinks)
@@ -47,6 +47,9 @@
 #define ERTS_PROC_MIN_CONTEXT_SWITCH_REDS_COST (CONTEXT_REDS/10)
 
 #define ERTS_SCHED_SLEEP_SPINCOUNT 10000
+#define ERTS_SCHED_SLEEP_SPINCOUNT_MAX (4*ERTS_SCHED_SLEEP_SPINCOUNT)
+#define ERTS_SCHED_SLEEP_SPINCOUNT_MIN (ERTS_SCHED_SLEEP_SPINCOUNT/100)
+#define ERTS_SCHED_SHORT_SLEEP_US 100
 
 #define ERTS_WAKEUP_OTHER_LIMIT (100*CONTEXT_REDS/2)
 #define ERTS_WAKEUP_OTHER_DEC 10
@@ -54,6 +57,8 @@
 
 #define ERTS_MAX_CPU_TOPOLOGY_ID ((int) 0xffff)
 
+#define ERTS_PROC_POOL_MAX_LEN 32
+
 #if 0 || defined(DEBUG)
 #define ERTS_FAKE_SCHED_BIND_PRINT_SORTED_CPU_DATA
 #endif
@@ -342,6 +347,8 @@ static void exec_misc_ops(ErtsRunQueue *);
 static void print_function_from_pc(int to, void *to_arg, BeamInstr* x);
 static int stack_element_dump(int to, void *to_arg, Process* p, Eterm* sp,
 			      int yreg);
+static void init_sched_groups(void);
+static void proc_pool_trim(ErtsSchedulerData *esdp);
 #ifdef ERTS_SMP
 static void handle_pending_exiters(ErtsProcList *);
 
@@ -350,6 +357,19 @@ static void cpu_bind_order_sort(erts_cpu_topology_t *cpudata,
 				ErtsCpuBindOrder bind_order,
 				int mk_seq);
 static void signal_schedulers_bind_change(erts_cpu_topology_t *cpudata, int size);
+static void update_runq_steal_order(void);
+static void runq_inbox_drain(ErtsRunQueue *rq, long close);
+static int sched_group_stays(Process *p, ErtsRunQueue *from, ErtsRunQueue *to);
+
+#define ERTS_RUNQ_INBOX_CLOSED ((long) 1)
+
+/* The inbox holds a pointer, which may look negative as a long */
+static ERTS_INLINE int
+runq_inbox_non_empty(ErtsRunQueue *rq)
+{
+    long head = erts_smp_atomic_read(&rq->inbox);
+    return head != 0 && head != ERTS_RUNQ_INBOX_CLOSED;
+}
 
 #endif
 
@@ -695,6 +715,81 @@ non_empty_runq(ErtsRunQueue *rq)
     }
 }
 
+/*
+ * Run queue length averaged over the schedule() passes of its scheduler,
+ * scaled by 1 << ERTS_RUNQ_LOAD_SHIFT. Only written by the scheduler of
+ * the run queue, and read without locks when choosing a steal victim.
+ */
+#define ERTS_RUNQ_LOAD_SHIFT 8
+
+static ERTS_INLINE void
+update_runq_load(ErtsRunQueue *rq)
+{
+    long load = erts_smp_atomic_read(&rq->load);
+    load += (((long) rq->len << ERTS_RUNQ_LOAD_SHIFT) - load) / 8;
+    erts_smp_atomic_set(&rq->load, load);
+}
+
+static ERTS_INLINE Uint64
+sched_time_us(void)
+{
+#ifdef HAVE_GETHRTIME
+    return (Uint64) (sys_gethrtime() / 1000);
+#else
+    SysTimeval tv;
+    sys_gettimeofday(&tv);
+    return ((Uint64) tv.tv_sec) * 1000000 + tv.tv_usec;
+#endif
+}
+
+/*
+ * Called with the run queue locked when a scheduler wakes up; records
+ * the time since wake_scheduler() woke it, if it did.
+ */
+static ERTS_INLINE void
+sched_wakeup_latency(ErtsRunQueue *rq)
+{
+    ERTS_SMP_LC_ASSERT(erts_smp_lc_runq_is_locked(rq));
+    if (rq->wake_time) {
+	Uint64 now = sched_time_us();
+	Uint64 dt = now > rq->wake_time ? now - rq->wake_time : 0;
+	int i = 0;
+	while (dt && i < ERTS_SCHED_WAKEUP_LATENCY_SLOTS - 1) {
+	    dt >>= 1;
+	    i++;
+	}
+	rq->wakeup_latency[i]++;
+	rq->wake_time = 0;
+    }
+}
+
+#if ERTS_SCHED_SLEEP_SPINCOUNT != 0
+/*
+ * Adapt the number of spins before going to sleep. spun is the number
+ * of spins done and slept the time in microseconds spent sleeping, or
+ * -1 if woken while spinning. When spinning pays off we aim at twice
+ * the spins that were needed; a short sleep means we should have spun
+ * longer, and a long one that the spinning was wasted.
+ */
+static ERTS_INLINE void
+sched_spin_adapt(ErtsRunQueue *rq, int spun, Sint64 slept)
+{
+    int sc = rq->spincount;
+    ERTS_SMP_LC_ASSERT(erts_smp_lc_runq_is_locked(rq));
+    if (slept < 0)
+	sc += (2*spun - sc) / 4;
+    else if (slept < ERTS_SCHED_SHORT_SLEEP_US)
+	sc *= 2;
+    else
+	sc /= 2;
+    if (sc < ERTS_SCHED_SLEEP_SPINCOUNT_MIN)
+	sc = ERTS_SCHED_SLEEP_SPINCOUNT_MIN;
+    else if (sc > ERTS_SCHED_SLEEP_SPINCOUNT_MAX)
+	sc = ERTS_SCHED_SLEEP_SPINCOUNT_MAX;
+    rq->spincount = sc;
+}
+#endif
+
 static ERTS_INLINE int
 sched_spin_wake(ErtsRunQueue *rq)
 {
@@ -737,7 +832,9 @@ sched_sys_wait(Uint no, ErtsRunQueue *rq)
     long dt;
 #if ERTS_SCHED_SLEEP_SPINCOUNT != 0
     int val;
-    int spincount = ERTS_SCHED_SLEEP_SPINCOUNT;
+    int spins = rq->spincount;
+    int spincount = spins;
+    Uint64 sleep_start;
     ERTS_SMP_LC_ASSERT(erts_smp_lc_runq_is_locked(rq));
 
 #endif
@@ -777,6 +874,7 @@ sched_sys_wait(Uint no, ErtsRunQueue *rq)
 	ASSERT(erts_smp_atomic_read(&rq->spin_wake) >= 0);
 	erts_smp_atomic_dec(&rq->spin_waiter);
 	ASSERT(erts_smp_atomic_read(&rq->spin_waiter) >= 0);
+	sched_spin_adapt(rq, spins - spincount, -1);
     }
     else {
     sleep:
@@ -792,6 +890,9 @@ sched_sys_wait(Uint no, ErtsRunQueue *rq)
 	    erts_sys_schedule_interrupt(0);
 	    erts_smp_runq_unlock(rq);
 
+#if ERTS_SCHED_SLEEP_SPINCOUNT != 0
+	    sleep_start = sched_time_us();
+#endif
 	    erl_sys_schedule(0);
 
 	    dt = do_time_read_and_reset();
@@ -800,10 +901,13 @@ sched_sys_wait(Uint no, ErtsRunQueue *rq)
 	    erts_smp_runq_lock(rq);
 
 #if ERTS_SCHED_SLEEP_SPINCOUNT != 0
+	    sched_spin_adapt(rq, spins,
+			     (Sint64) (sched_time_us() - sleep_start));
 	}
     }
 #endif
 
+    sched_wakeup_latency(rq);
     sched_active_sys(no, rq);
 }
 
@@ -812,7 +916,9 @@ sched_cnd_wait(Uint no, ErtsRunQueue *rq)
 {
 #if ERTS_SCHED_SLEEP_SPINCOUNT != 0
     int val;
-    int spincount = ERTS_SCHED_SLEEP_SPINCOUNT;
+    int spins = rq->spincount;
+    int spincount = spins;
+    Uint64 sleep_start;
     ERTS_SMP_LC_ASSERT(erts_smp_lc_runq_is_locked(rq));
 #endif
 
@@ -850,7 +956,9 @@ sched_cnd_wait(Uint no, ErtsRunQueue *rq)
     sleep:
 	erts_smp_atomic_dec(&rq->spin_waiter);
 	ASSERT(erts_smp_atomic_read(&rq->spin_waiter) >= 0);
+	sleep_start = sched_time_us();
 	erts_smp_cnd_wait(&rq->cnd, &rq->mtx);
+	sched_spin_adapt(rq, spins, (Sint64) (sched_time_us() - sleep_start));
     }
     else {
     woken:
@@ -858,9 +966,12 @@ sched_cnd_wait(Uint no, ErtsRunQueue *rq)
 	ASSERT(erts_smp_atomic_read(&rq->spin_wake) >= 0);
 	erts_smp_atomic_dec(&rq->spin_waiter);
 	ASSERT(erts_smp_atomic_read(&rq->spin_waiter) >= 0);
+	sched_spin_adapt(rq, spins - spincount, -1);
     }
 #endif
 
+    sched_wakeup_latency(rq);
+
     erts_smp_activity_end(ERTS_ACTIVITY_WAIT,
 			  prepare_for_block,
 			  resume_after_block,
@@ -900,6 +1011,7 @@ wake_scheduler(ErtsRunQueue *rq, int incq)
 		erts_smp_cnd_signal(&rq->cnd);
 	}
 	rq->woken = 1;
+	rq->wake_time = sched_time_us();
 	if (incq)
 	    non_empty_runq(rq);
     }
@@ -1117,7 +1229,9 @@ immigrate(ErtsRunQueue *rq)
 				    ? &from_rq->procs.prio[PRIORITY_NORMAL]
 				    : &from_rq->procs.prio[prio]);
 			for (proc = from_rpq->first; proc; proc = proc->next)
-			    if (proc->prio == prio && !proc->bound_runq)
+			    if (proc->prio == prio
+				&& !proc->bound_runq
+				&& !sched_group_stays(proc, from_rq, rq))
 				break;
 			if (proc) {
 			    ErtsProcLocks proc_locks = 0;
@@ -1170,6 +1284,12 @@ evacuate_run_queue(ErtsRunQueue *evac_rq, ErtsRunQueue *rq)
     for (prio = 0; prio < ERTS_NO_PROC_PRIO_LEVELS; prio++)
 	evac_rq->procs.prio_info[prio].migrate.runq = rq;
 
+    /*
+     * Close the inbox; processes already pushed to it will
+     * emigrate when added.
+     */
+    runq_inbox_drain(evac_rq, ERTS_RUNQ_INBOX_CLOSED);
+
     /* Evacuate scheduled misc ops */
 
     if (evac_rq->misc.start) {
@@ -1397,6 +1517,160 @@ try_steal_task_from_victim(ErtsRunQueue *rq, int *rq_lockedp, ErtsRunQueue *vrq)
 }
 
 
+/*
+ * Topology aware stealing and migration. runq_dist holds the distance
+ * between the cpus that the schedulers of two run queues are bound to:
+ * 1 if they share a core (and its caches), then 2 for the same processor
+ * node, 3 for the same processor, 4 for the same node and
+ * ERTS_RUNQ_MAX_DIST otherwise, or if any of them is unbound. Each run
+ * queue has the other run queues in runq_steal_order sorted on distance,
+ * and in round robin order from its own index at the same distance, which
+ * is the plain round robin order when no scheduler is bound.
+ *
+ * Both are rewritten in place when a scheduler is rebound, with the
+ * erts_cpu_bind_rwmtx write locked. A thief reading them at the same time
+ * may only see a less than perfect order.
+ */
+#define ERTS_RUNQ_MAX_DIST 5
+#define ERTS_RUNQ_DIST(A, B) \
+  ((int) runq_dist[(A)*erts_no_run_queues + (B)])
+#define ERTS_RUNQ_STEAL_ORDER(IX) \
+  (&runq_steal_order[(IX)*(erts_no_run_queues-1)])
+
+static byte *runq_dist;
+static int *runq_steal_order;
+
+static int
+cpu_distance(erts_cpu_topology_t *x, erts_cpu_topology_t *y)
+{
+    if (!x || !y || x->node != y->node)
+	return ERTS_RUNQ_MAX_DIST;
+    if (x->processor != y->processor)
+	return 4;
+    if (x->processor_node != y->processor_node)
+	return 3;
+    if (x->core != y->core)
+	return 2;
+    return 1;
+}
+
+static void
+update_runq_steal_order(void)
+{
+    erts_cpu_topology_t *cpudata, **rq_cpu;
+    int cpudata_size, n, ix, vix, i, dist;
+
+    if (!runq_steal_order)
+	return;
+
+    n = (int) erts_no_run_queues;
+    cpudata = user_cpudata ? user_cpudata : system_cpudata;
+    cpudata_size = user_cpudata ? user_cpudata_size : system_cpudata_size;
+
+    rq_cpu = erts_alloc(ERTS_ALC_T_TMP, sizeof(erts_cpu_topology_t *)*n);
+    for (ix = 0; ix < n; ix++) {
+	int cpu = scheduler2cpu_map ? scheduler2cpu_map[ix+1].bound_id : -1;
+	rq_cpu[ix] = NULL;
+	for (i = 0; cpu >= 0 && i < cpudata_size; i++) {
+	    if (cpudata[i].logical == cpu) {
+		rq_cpu[ix] = &cpudata[i];
+		break;
+	    }
+	}
+    }
+
+    for (ix = 0; ix < n; ix++)
+	for (vix = 0; vix < n; vix++)
+	    runq_dist[ix*n + vix] = (byte) (ix == vix
+					    ? 0
+					    : cpu_distance(rq_cpu[ix],
+							   rq_cpu[vix]));
+
+    for (ix = 0; ix < n; ix++) {
+	int *order = ERTS_RUNQ_STEAL_ORDER(ix);
+	i = 0;
+	for (dist = 1; dist <= ERTS_RUNQ_MAX_DIST; dist++) {
+	    for (vix = (ix + 1) % n; vix != ix; vix = (vix + 1) % n) {
+		if (ERTS_RUNQ_DIST(ix, vix) == dist)
+		    order[i++] = vix;
+	    }
+	}
+	ASSERT(i == n - 1);
+    }
+
+    erts_free(ERTS_ALC_T_TMP, rq_cpu);
+}
+
+/*
+ * Scheduler groups, see process_flag(scheduler_group, Tag). Each group
+ * holds the index (+1) of the run queue it lives on; it is claimed by
+ * the first member added to a run queue and moved if that run queue is
+ * suspended or inactivated. Members are redirected there when made
+ * runnable, and are not migrated further away than
+ * ERTS_SCHED_GROUP_MAX_DIST (sibling cores) unless their run queue is
+ * being emptied. Idle schedulers may still steal them; a stolen member
+ * goes back the next time it is made runnable.
+ */
+#define ERTS_SCHED_GROUP_MAX_DIST 2
+
+static int
+sched_group_stays(Process *p, ErtsRunQueue *from, ErtsRunQueue *to)
+{
+    if (!p->sched_group)
+	return 0;
+    if (from->flags & (ERTS_RUNQ_FLG_SUSPENDED|ERTS_RUNQ_FLG_INACTIVE))
+	return 0;
+    return (!runq_dist
+	    || ERTS_RUNQ_DIST(from->ix, to->ix) > ERTS_SCHED_GROUP_MAX_DIST);
+}
+
+/*
+ * Returns the run queue of the group of p, locked, if p should be
+ * moved there from runq; otherwise NULL. Note that runq may have been
+ * unlocked and relocked.
+ */
+static ErtsRunQueue *
+sched_group_runq(ErtsRunQueue *runq, Process *p)
+{
+    erts_smp_atomic_t *home = &p->sched_group->home;
+    long hix = erts_smp_atomic_read(home);
+    ErtsRunQueue *hrq;
+
+    if (erts_common_run_queue)
+	return NULL;
+
+    if (!hix) {
+	(void) erts_smp_atomic_cmpxchg(home, runq->ix + 1, 0);
+	return NULL;
+    }
+
+    hrq = ERTS_RUNQ_IX(hix - 1);
+    if (hrq == runq)
+	return NULL;
+
+    erts_smp_xrunq_lock(runq, hrq);
+
+    if (runq->flags & ERTS_RUNQ_FLG_SUSPENDED) {
+	/* Leave it to evacuation */
+	erts_smp_runq_unlock(hrq);
+	return NULL;
+    }
+
+    if (hrq->flags & (ERTS_RUNQ_FLG_SUSPENDED|ERTS_RUNQ_FLG_INACTIVE)) {
+	erts_smp_runq_unlock(hrq);
+	(void) erts_smp_atomic_cmpxchg(home, runq->ix + 1, hix);
+	return NULL;
+    }
+
+    if (ERTS_CHK_RUNQ_FLG_EMIGRATE(hrq->flags, p->prio)) {
+	/* Group run queue is overloaded; stay where we are */
+	erts_smp_runq_unlock(hrq);
+	return NULL;
+    }
+
+    return hrq;
+}
+
 static ERTS_INLINE int
 check_possible_steal_victim(ErtsRunQueue *rq, int *rq_lockedp, int vix)
 {
@@ -1412,7 +1686,8 @@ check_possible_steal_victim(ErtsRunQueue *rq, int *rq_lockedp, int vix)
 static int
 try_steal_task(ErtsRunQueue *rq)
 {
-    int res, rq_locked, vix, active_rqs, blnc_rqs;
+    int res, rq_locked, vix, oix, active_rqs, blnc_rqs;
+    int *order;
     
     if (erts_common_run_queue)
 	return 0;
@@ -1455,19 +1730,49 @@ try_steal_task(ErtsRunQueue *rq)
 	    }
 	}
 
-	vix = rq->ix;
-
-	/* ... then try to steal a job from another active queue... */
-	while (erts_smp_atomic_read(&no_empty_run_queues) < blnc_rqs) {
-	    vix++;
-	    if (vix >= active_rqs)
-		vix = 0;
-	    if (vix == rq->ix)
-		break;
+	/*
+	 * ... then try to steal a job from another active queue. Queues
+	 * whose schedulers are closer in the cpu topology are tried first,
+	 * and at the same distance the one with the highest load first.
+	 */
+	order = ERTS_RUNQ_STEAL_ORDER(rq->ix);
+	oix = 0;
+	while (oix < erts_no_run_queues - 1
+	       && erts_smp_atomic_read(&no_empty_run_queues) < blnc_rqs) {
+	    int dist = ERTS_RUNQ_DIST(rq->ix, order[oix]);
+	    int end, best = -1;
+	    long best_load = -1;
+
+	    for (end = oix;
+		 (end < erts_no_run_queues - 1
+		  && ERTS_RUNQ_DIST(rq->ix, order[end]) == dist);
+		 end++) {
+		vix = order[end];
+		if (vix < active_rqs && vix != rq->ix) {
+		    long load = erts_smp_atomic_read(&ERTS_RUNQ_IX(vix)->load);
+		    if (load > best_load) {
+			best = end;
+			best_load = load;
+		    }
+		}
+	    }
 
-	    res = check_possible_steal_victim(rq, &rq_locked, vix);
-	    if (res)
-		goto done;
+	    if (best >= 0) {
+		res = check_possible_steal_victim(rq, &rq_locked, order[best]);
+		if (res)
+		    goto done;
+		for (; oix < end; oix++) {
+		    vix = order[oix];
+		    if (oix == best || vix >= active_rqs || vix == rq->ix)
+			continue;
+		    if (erts_smp_atomic_read(&no_empty_run_queues) >= blnc_rqs)
+			goto done;
+		    res = check_possible_steal_victim(rq, &rq_locked, vix);
+		    if (res)
+			goto done;
+		}
+	    }
+	    oix = end;
 	}
 
     }
@@ -1541,6 +1846,34 @@ rqc_len_cmp(const void *x, const void *y)
     return ((ErtsRunQueueCompare *) x)->len - ((ErtsRunQueueCompare *) y)->len;
 }
 
+/*
+ * Of the run queues in run_queue_compare[tix..fix-1] that can take more
+ * work (negative len), move the one whose scheduler is closest to the
+ * scheduler of from_qix to position tix. Migrations then stay within a
+ * core or processor when possible.
+ */
+static void
+closest_runq_compare(int from_qix, int tix, int fix)
+{
+    int cix, best = tix;
+    int best_dist = ERTS_RUNQ_MAX_DIST + 1;
+
+    for (cix = tix; cix < fix && run_queue_compare[cix].len < 0; cix++) {
+	int dist = ERTS_RUNQ_DIST(from_qix, run_queue_compare[cix].qix);
+	if (dist < best_dist) {
+	    best = cix;
+	    best_dist = dist;
+	    if (dist == 1)
+		break;
+	}
+    }
+    if (best != tix) {
+	ErtsRunQueueCompare tmp = run_queue_compare[tix];
+	run_queue_compare[tix] = run_queue_compare[best];
+	run_queue_compare[best] = tmp;
+    }
+}
+
 #define ERTS_PERCENT(X, Y) \
   ((Y) == 0 \
    ? ((X) == 0 ? 100 : INT_MAX) \
@@ -1882,6 +2215,7 @@ if (pix == 2) erts_fprintf(stderr, "\n");
 		    if (eof || eot)
 			break;
 		    from_qix = run_queue_compare[fix].qix;
+		    closest_runq_compare(from_qix, tix, fix);
 		    to_qix = run_queue_compare[tix].qix;
 		    if (run_queue_info[from_qix].prio[pix].avail == 0) {
 			ERTS_SET_RUNQ_FLG_EVACUATE(run_queue_info[from_qix].flags,
@@ -2101,11 +2435,13 @@ erts_init_scheduling(int mrq, int no_schedulers, int no_schedulers_online)
 #endif
 
     for (ix = 0; ix < n; ix++) {
-	int pix, rix;
+	int pix, rix, i;
 	ErtsRunQueue *rq = ERTS_RUNQ_IX(ix);
 
 	rq->ix = ix;
 	erts_smp_atomic_init(&rq->info_flags, ERTS_RUNQ_IFLG_NONEMPTY);
+	erts_smp_atomic_init(&rq->load, 0);
+	erts_smp_atomic_init(&rq->inbox, 0);
 
 	/* make sure that the "extra" id correponds to the schedulers
 	 * id if the esdp->no <-> ix+1 mapping change.
@@ -2119,6 +2455,10 @@ erts_init_scheduling(int mrq, int no_schedulers, int no_schedulers_online)
 
 	rq->waiting = 0;
 	rq->woken = 0;
+	rq->spincount = ERTS_SCHED_SLEEP_SPINCOUNT;
+	rq->wake_time = 0;
+	for (i = 0; i < ERTS_SCHED_WAKEUP_LATENCY_SLOTS; i++)
+	    rq->wakeup_latency[i] = 0;
 	rq->flags = !mrq ? ERTS_RUNQ_FLG_SHARED_RUNQ : 0;
 	rq->check_balance_reds = ERTS_RUNQ_CALL_CHECK_BALANCE_REDS;
 	rq->full_reds_history_sum = 0;
@@ -2177,10 +2517,19 @@ erts_init_scheduling(int mrq, int no_schedulers, int no_schedulers_online)
 	run_queue_compare = erts_alloc(ERTS_ALC_T_RUNQ_BLNS,
 				       (sizeof(ErtsRunQueueCompare)
 					* erts_no_run_queues));
+	runq_dist = erts_alloc(ERTS_ALC_T_RUNQ_BLNS,
+			       erts_no_run_queues * erts_no_run_queues);
+	runq_steal_order = erts_alloc(ERTS_ALC_T_RUNQ_BLNS,
+				      (sizeof(int)
+				       * erts_no_run_queues
+				       * (erts_no_run_queues - 1)));
+	update_runq_steal_order();
     }
 
 #endif
 
+    init_sched_groups();
+
     /* Create and initialize scheduler specific data */
 
     n = (int) no_schedulers;
@@ -2212,6 +2561,8 @@ erts_init_scheduling(int mrq, int no_schedulers, int no_schedulers_online)
 	esdp->no = (Uint) ix+1;
 	esdp->current_process = NULL;
 	esdp->current_port = NULL;
+	esdp->proc_pool = NULL;
+	esdp->proc_pool_len = 0;
 
 	esdp->virtual_reds = 0;
 	esdp->cpu_id = -1;
@@ -2581,6 +2932,8 @@ do {									\
                     | ERTS_RUNQ_FLG_HALFTIME_OUT_OF_WORK);		\
     (RQ)->check_balance_reds = ERTS_RUNQ_CALL_CHECK_BALANCE_REDS;	\
     erts_smp_atomic_band(&(RQ)->info_flags, ~ERTS_RUNQ_IFLG_SUSPENDED);	\
+    (void) erts_smp_atomic_cmpxchg(&(RQ)->inbox, 0,			\
+				   ERTS_RUNQ_INBOX_CLOSED);		\
     for (pix__ = 0; pix__ < ERTS_NO_PROC_PRIO_LEVELS; pix__++) {	\
 	(RQ)->procs.prio_info[pix__].max_len = 0;			\
 	(RQ)->procs.prio_info[pix__].reds = 0;				\
@@ -3032,6 +3385,124 @@ erts_multi_scheduling_blockers(Process *p)
     return res;
 }
 
+/*
+ * Dirty schedulers.
+ *
+ * Plain threads that execute jobs which would otherwise block a normal
+ * scheduler, e.g. long running NIFs. They never touch the run queues;
+ * whoever schedules a job is responsible for suspending and resuming
+ * the process waiting for it. The threads of a job type are started
+ * when the first job of that type is scheduled, a system that never
+ * uses them pays nothing for them.
+ */
+
+typedef struct {
+    erts_smp_mtx_t mtx;
+    erts_smp_cnd_t cnd;
+    ErtsDirtyJob *first;
+    ErtsDirtyJob *last;
+    int no_threads;
+} ErtsDirtyJobQueue;
+
+static ErtsDirtyJobQueue dirty_job_queue[ERTS_NO_DIRTY_JOB_TYPES];
+
+static void start_dirty_threads(ErtsDirtyJobQueue *q, int type);
+
+void
+erts_schedule_dirty_job(ErtsDirtyJob *job, int type)
+{
+    ErtsDirtyJobQueue *q;
+    ASSERT(0 <= type && type < ERTS_NO_DIRTY_JOB_TYPES);
+    q = &dirty_job_queue[type];
+    job->next = NULL;
+    erts_smp_mtx_lock(&q->mtx);
+    if (q->last)
+	q->last->next = job;
+    else
+	q->first = job;
+    q->last = job;
+    if (q->no_threads == 0)
+	start_dirty_threads(q, type);
+    erts_smp_cnd_signal(&q->cnd);
+    erts_smp_mtx_unlock(&q->mtx);
+}
+
+static void *
+dirty_sched_thread_func(void *vq)
+{
+    ErtsDirtyJobQueue *q = (ErtsDirtyJobQueue *) vq;
+#ifdef ERTS_ENABLE_LOCK_CHECK
+    {
+	char buf[31];
+	erts_snprintf(&buf[0], 31, "dirty %s scheduler",
+		      q == &dirty_job_queue[ERTS_DIRTY_IO_JOB] ? "io" : "cpu");
+	erts_lc_set_thread_name(&buf[0]);
+    }
+#endif
+    erts_proc_lock_prepare_proc_lock_waiter();
+    erts_thread_init_float();
+
+    while (1) {
+	ErtsDirtyJob *job;
+	erts_smp_mtx_lock(&q->mtx);
+	while (!q->first)
+	    erts_smp_cnd_wait(&q->cnd, &q->mtx);
+	job = q->first;
+	q->first = job->next;
+	if (!q->first)
+	    q->last = NULL;
+	erts_smp_mtx_unlock(&q->mtx);
+
+	(*job->execute)(job);
+    }
+    return NULL;
+}
+
+/* Called with the queue locked, the first time a job is queued */
+static void
+start_dirty_threads(ErtsDirtyJobQueue *q, int type)
+{
+    int i, wanted, res = 0;
+    ethr_thr_opts opts = ETHR_THR_OPTS_DEFAULT_INITER;
+
+    opts.detached = 1;
+    opts.suggested_stack_size = erts_sched_thread_suggested_stack_size;
+
+    wanted = (type == ERTS_DIRTY_CPU_JOB
+	      ? (int) erts_no_schedulers
+	      : ERTS_DIRTY_IO_SCHEDULERS);
+    if (wanted < 1)
+	wanted = 1;
+    for (i = 0; i < wanted; i++) {
+	ethr_tid tid;
+	res = ethr_thr_create(&tid, dirty_sched_thread_func, (void *) q, &opts);
+	if (res != 0)
+	    break;
+	q->no_threads++;
+    }
+    if (q->no_threads < 1)
+	erl_exit(1,
+		 "Failed to create any dirty %s scheduler-threads: %s (%d)\n",
+		 type == ERTS_DIRTY_IO_JOB ? "io" : "cpu",
+		 erl_errno_id(res),
+		 res);
+}
+
+static void
+init_dirty_schedulers(void)
+{
+    int type;
+
+    for (type = 0; type < ERTS_NO_DIRTY_JOB_TYPES; type++) {
+	ErtsDirtyJobQueue *q = &dirty_job_queue[type];
+
+	erts_smp_mtx_init_x(&q->mtx, "dirty_job_queue", make_small(type));
+	erts_smp_cnd_init(&q->cnd);
+	q->first = q->last = NULL;
+	q->no_threads = 0;
+    }
+}
+
 static void *
 sched_thread_func(void *vesdp)
 {
@@ -3101,6 +3572,8 @@ erts_start_schedulers(void)
     opts.detached = 1;
     opts.suggested_stack_size = erts_sched_thread_suggested_stack_size;
 
+    init_dirty_schedulers();
+
     if (wanted < 1)
 	wanted = 1;
     if (wanted > ERTS_MAX_NO_OF_SCHEDULERS) {
@@ -3459,6 +3932,9 @@ check_cpu_bind(ErtsSchedulerData *esdp)
 	    erts_send_error_to_logger_nogl(dsbufp);
 	}
     }
+#ifdef ERTS_SMP
+    update_runq_steal_order();
+#endif
     erts_smp_runq_lock(esdp->run_queue);
 #ifdef ERTS_SMP
     if (erts_common_run_queue)
@@ -5376,6 +5852,7 @@ internal_add_to_runq(ErtsRunQueue *runq, Process *p)
 	return;
     }
     ASSERT(!p->scheduler_data);
+    ASSERT(!(p->status_flags & ERTS_PROC_SFLG_ININBOX));
 #endif
 
     ERTS_DBG_CHK_PROCS_RUNQ_NOPROC(runq, p);
@@ -5395,11 +5872,22 @@ internal_add_to_runq(ErtsRunQueue *runq, Process *p)
 	}
     }
     else {
-	add_runq = erts_check_emigration_need(runq, p->prio);
-	if (!add_runq)
-	    add_runq = runq;
-	else /* Process emigrated */
+	add_runq = NULL;
+	if (p->sched_group)
+	    add_runq = sched_group_runq(runq, p);
+	if (add_runq) /* Process moved to its scheduler group */
 	    p->run_queue = add_runq;
+	else {
+	    add_runq = erts_check_emigration_need(runq, p->prio);
+	    if (add_runq && sched_group_stays(p, runq, add_runq)) {
+		erts_smp_runq_unlock(add_runq);
+		add_runq = NULL;
+	    }
+	    if (!add_runq)
+		add_runq = runq;
+	    else /* Process emigrated */
+		p->run_queue = add_runq;
+	}
     }
 #endif
 
@@ -5419,10 +5907,131 @@ internal_add_to_runq(ErtsRunQueue *runq, Process *p)
 }
 
 
+#ifdef ERTS_SMP
+
+/*
+ * Run queue inbox.
+ *
+ * A waiting process that is made runnable by another thread is pushed
+ * without taking the run queue lock onto rq->inbox, a lock free stack
+ * linked through p->inbox_next. The scheduler owning the run queue
+ * moves the pushed processes into its run queue on its next pass
+ * through schedule(). The inbox is only used when the owning scheduler
+ * is busy; if it is, or might be about to go, to sleep we take the
+ * ordinary path since it has to be woken anyway. A suspended run queue
+ * has its inbox closed.
+ *
+ * ERTS_PROC_SFLG_ININBOX is set (under the status lock) while the
+ * process is in the inbox. Such a process is neither running nor in a
+ * run queue, so it cannot exit until it has been drained.
+ */
+
+static ERTS_INLINE int
+runq_inbox_push(ErtsRunQueue *rq, Process *p)
+{
+    long head, prev;
+
+    ERTS_SMP_LC_ASSERT(ERTS_PROC_LOCK_STATUS & erts_proc_lc_my_proc_locks(p));
+
+    if (p->status != P_WAITING
+	|| p->bound_runq
+	|| (p->status_flags & (ERTS_PROC_SFLG_RUNNING
+			       | ERTS_PROC_SFLG_PENDADD2SCHEDQ)))
+	return 0;
+
+    if ((erts_smp_atomic_read(&rq->info_flags)
+	 & (ERTS_RUNQ_IFLG_SUSPENDED|ERTS_RUNQ_IFLG_NONEMPTY))
+	!= ERTS_RUNQ_IFLG_NONEMPTY)
+	return 0;
+
+    head = erts_smp_atomic_read(&rq->inbox);
+    while (1) {
+	if (head == ERTS_RUNQ_INBOX_CLOSED)
+	    return 0;
+	p->inbox_next = (Process *) head;
+	prev = erts_smp_atomic_cmpxchg(&rq->inbox, (long) p, head);
+	if (prev == head)
+	    break;
+	head = prev;
+    }
+
+    p->status_flags |= ERTS_PROC_SFLG_ININBOX;
+
+    /*
+     * The scheduler checks the inbox after clearing the non-empty flag
+     * and before going to sleep; if it raced past that check we need
+     * to wake it.
+     */
+    if (!(erts_smp_atomic_read(&rq->info_flags) & ERTS_RUNQ_IFLG_NONEMPTY)) {
+	erts_smp_runq_lock(rq);
+	wake_scheduler(rq, 1);
+	erts_smp_runq_unlock(rq);
+    }
+
+    return 1;
+}
+
+static void
+runq_inbox_drain(ErtsRunQueue *rq, long close)
+{
+    Process *p, *next, *list;
+    long head;
+
+    ERTS_SMP_LC_ASSERT(erts_smp_lc_runq_is_locked(rq));
+
+    head = erts_smp_atomic_xchg(&rq->inbox, close);
+    if (head == ERTS_RUNQ_INBOX_CLOSED)
+	return;
+
+    /* Reverse the stack so that processes are added in push order */
+    list = NULL;
+    for (p = (Process *) head; p; p = next) {
+	next = p->inbox_next;
+	p->inbox_next = list;
+	list = p;
+    }
+
+    for (p = list; p; p = next) {
+	next = p->inbox_next;
+	p->inbox_next = NULL;
+
+	if (erts_smp_proc_trylock(p, ERTS_PROC_LOCK_STATUS) == EBUSY) {
+	    erts_smp_runq_unlock(rq);
+	    erts_smp_proc_lock(p, ERTS_PROC_LOCK_STATUS);
+	    erts_smp_runq_lock(rq);
+	}
+
+	ASSERT(p->status_flags & ERTS_PROC_SFLG_ININBOX);
+	p->status_flags &= ~ERTS_PROC_SFLG_ININBOX;
+
+	if (p->status == P_SUSPENDED && !ERTS_PROC_PENDING_EXIT(p)) {
+	    /* Suspended after the push; wake up as runnable */
+	    p->rstatus = P_RUNABLE;
+	}
+	else if (p->run_queue == rq)
+	    internal_add_to_runq(rq, p);
+	else {
+	    erts_smp_runq_unlock(rq);
+	    erts_add_to_runq(p);
+	    erts_smp_runq_lock(rq);
+	}
+
+	erts_smp_proc_unlock(p, ERTS_PROC_LOCK_STATUS);
+    }
+}
+
+#endif
+
 void
 erts_add_to_runq(Process *p)
 {
     ErtsRunQueue *runq = erts_get_runq_proc(p);
+#ifdef ERTS_SMP
+    if (p->status_flags & (ERTS_PROC_SFLG_INRUNQ|ERTS_PROC_SFLG_ININBOX))
+	return;
+    if (!erts_common_run_queue && runq_inbox_push(runq, p))
+	return;
+#endif
     erts_smp_runq_lock(runq);
     internal_add_to_runq(runq, p);
     erts_smp_runq_unlock(runq);
@@ -5762,6 +6371,112 @@ erts_set_process_priority(Process *p, Eterm new_value)
     return old_value;
 }
 
+/*
+ * The scheduler groups in use, an open addressed hash table on the tag.
+ * Members point to their slot, so slots never move. A slot is freed when
+ * its last member leaves, and is then left with tag NIL so that probing
+ * for the tags after it still finds them.
+ */
+#define ERTS_SCHED_GROUP_SLOTS 1024
+
+static ErtsSchedGroup sched_groups[ERTS_SCHED_GROUP_SLOTS];
+static erts_smp_mtx_t sched_groups_mtx;
+
+static void
+init_sched_groups(void)
+{
+    int ix;
+    erts_smp_mtx_init(&sched_groups_mtx, "sched_groups");
+    for (ix = 0; ix < ERTS_SCHED_GROUP_SLOTS; ix++) {
+	sched_groups[ix].tag = THE_NON_VALUE;
+	sched_groups[ix].refc = 0;
+	erts_smp_atomic_init(&sched_groups[ix].home, 0);
+    }
+}
+
+/* Returns the group of tag with a reference added, or NULL if all
+ * slots are in use. */
+static ErtsSchedGroup *
+sched_group_join(Eterm tag)
+{
+    Uint hix = make_hash(tag) % ERTS_SCHED_GROUP_SLOTS;
+    ErtsSchedGroup *grp = NULL;
+    ErtsSchedGroup *unused = NULL;
+    int i;
+
+    erts_smp_mtx_lock(&sched_groups_mtx);
+    for (i = 0; i < ERTS_SCHED_GROUP_SLOTS; i++) {
+	ErtsSchedGroup *slot = &sched_groups[(hix + i) % ERTS_SCHED_GROUP_SLOTS];
+	if (slot->tag == tag) {
+	    grp = slot;
+	    break;
+	}
+	if (slot->tag == NIL || slot->tag == THE_NON_VALUE) {
+	    if (!unused)
+		unused = slot;
+	    if (slot->tag == THE_NON_VALUE)
+		break; /* tag is not further on */
+	}
+    }
+    if (!grp && unused) {
+	grp = unused;
+	grp->tag = tag;
+	erts_smp_atomic_set(&grp->home, 0);
+    }
+    if (grp)
+	grp->refc++;
+    erts_smp_mtx_unlock(&sched_groups_mtx);
+    return grp;
+}
+
+static void
+sched_group_leave(ErtsSchedGroup *grp)
+{
+    erts_smp_mtx_lock(&sched_groups_mtx);
+    ASSERT(grp->refc > 0);
+    if (--grp->refc == 0)
+	grp->tag = NIL;
+    erts_smp_mtx_unlock(&sched_groups_mtx);
+}
+
+/*
+ * Set the scheduler group of the current process. *yieldp is set if the
+ * group lives on another run queue; the process is moved there when
+ * rescheduled. Fails if the tag is not an atom or a small integer, or
+ * if there are ERTS_SCHED_GROUP_SLOTS groups already.
+ */
+Eterm
+erts_set_process_sched_group(Process *p, Eterm new_value, int *yieldp)
+{
+    ErtsSchedGroup *old_grp = p->sched_group;
+    ErtsSchedGroup *new_grp = NULL;
+    Eterm old_value;
+    ERTS_SMP_LC_ASSERT(ERTS_PROC_LOCK_STATUS & erts_proc_lc_my_proc_locks(p));
+    if (is_not_atom(new_value) && is_not_small(new_value))
+	return THE_NON_VALUE;
+    old_value = old_grp ? old_grp->tag : am_undefined;
+    if (new_value == old_value)
+	new_grp = old_grp;
+    else if (new_value != am_undefined) {
+	new_grp = sched_group_join(new_value);
+	if (!new_grp)
+	    return THE_NON_VALUE;
+    }
+    if (new_grp != old_grp) {
+	p->sched_group = new_grp;
+	if (old_grp)
+	    sched_group_leave(old_grp);
+    }
+    *yieldp = 0;
+#ifdef ERTS_SMP
+    if (new_grp && !p->bound_runq && !erts_common_run_queue) {
+	long hix = erts_smp_atomic_read(&new_grp->home);
+	*yieldp = hix && hix - 1 != p->run_queue->ix;
+    }
+#endif
+    return old_value;
+}
+
 #ifdef ERTS_SMP
 
 static ERTS_INLINE int
@@ -5983,6 +6698,9 @@ Process *schedule(Process *p, int calls)
 	if (rq->flags & ERTS_RUNQ_FLGS_IMMIGRATE_QMASK)
 	    immigrate(rq);
 
+	if (runq_inbox_non_empty(rq))
+	    runq_inbox_drain(rq, 0);
+
  continue_check_activities_to_run:
 
 	if (rq->flags & (ERTS_RUNQ_FLG_SHARED_RUNQ
@@ -6018,6 +6736,10 @@ Process *schedule(Process *p, int calls)
 
 	ASSERT(rq->len == rq->procs.len + rq->ports.info.len);
 
+#ifdef ERTS_SMP
+	update_runq_load(rq);
+#endif
+
 #ifndef ERTS_SMP
 
 	if (rq->len == 0 && !rq->misc.start)
@@ -6052,6 +6774,19 @@ Process *schedule(Process *p, int calls)
 		}
 	    }
 
+	    if (runq_inbox_non_empty(rq)) {
+		non_empty_runq(rq);
+		goto check_activities_to_run;
+	    }
+
+	    if (esdp->proc_pool) {
+		non_empty_runq(rq);
+		erts_smp_runq_unlock(rq);
+		proc_pool_trim(esdp);
+		erts_smp_runq_lock(rq);
+		goto check_activities_to_run;
+	    }
+
 	    if (prepare_for_sys_schedule()) {
 		erts_smp_atomic_set(&function_calls, 0);
 		fcalls = 0;
@@ -6078,8 +6813,10 @@ Process *schedule(Process *p, int calls)
 #else
 	do_sys_schedule:
 	    runnable = rq->len != 0;
-	    if (!runnable)
+	    if (!runnable) {
 		sched_waiting_sys(esdp->no, rq);
+		proc_pool_trim(esdp);
+	    }
 #endif
 
 	    /*
@@ -6414,10 +7151,9 @@ erts_sched_stat_term(Process *p, int total)
  * Scheduling of misc stuff
  */
 
-void
-erts_schedule_misc_op(void (*func)(void *), void *arg)
+static void
+schedule_misc_op(ErtsRunQueue *rq, void (*func)(void *), void *arg)
 {
-    ErtsRunQueue *rq = erts_get_runq_current(NULL);
     ErtsMiscOpList *molp = misc_op_list_alloc();
 
     erts_smp_runq_lock(rq);
@@ -6443,6 +7179,49 @@ erts_schedule_misc_op(void (*func)(void *), void *arg)
     erts_smp_runq_unlock(rq);
 }
 
+void
+erts_schedule_misc_op(void (*func)(void *), void *arg)
+{
+    schedule_misc_op(erts_get_runq_current(NULL), func, arg);
+}
+
+#ifdef ERTS_SMP
+/*
+ * Schedule func(arg) on at most max other schedulers that currently
+ * have nothing to run, so that they can help with work that can be
+ * split up. Returns the number of schedulers it was scheduled on.
+ */
+int
+erts_schedule_misc_op_idle(int max, void (*func)(void *), void *arg)
+{
+    ErtsRunQueue *crq = erts_get_runq_current(NULL);
+    int ix;
+    int n = 0;
+
+    if (erts_common_run_queue) {
+	while (n < max && n + 1 < erts_no_schedulers) {
+	    schedule_misc_op(crq, func, arg);
+	    n++;
+	}
+	return n;
+    }
+    for (ix = 0; ix < erts_no_run_queues && n < max; ix++) {
+	ErtsRunQueue *rq = ERTS_RUNQ_IX(ix);
+	int idle;
+	if (rq == crq)
+	    continue;
+	erts_smp_runq_lock(rq);
+	idle = (rq->len == 0 && !(rq->flags & ERTS_RUNQ_FLG_INACTIVE));
+	erts_smp_runq_unlock(rq);
+	if (idle) {
+	    schedule_misc_op(rq, func, arg);
+	    n++;
+	}
+    }
+    return n;
+}
+#endif
+
 static void
 exec_misc_ops(ErtsRunQueue *rq)
 {
@@ -6488,6 +7267,46 @@ erts_get_total_context_switches(void)
     return res;
 }
 
+/*
+ * statistics(scheduler_wakeup_latency): [{MaxMicroSeconds, Count}] over
+ * all run queues, the last bound being infinity.
+ */
+Eterm
+erts_sched_wakeup_latency_term(Process *c_p)
+{
+    Uint hist[ERTS_SCHED_WAKEUP_LATENCY_SLOTS];
+    Uint sz, *szp;
+    Eterm res, *hp, **hpp;
+    int i;
+
+    for (i = 0; i < ERTS_SCHED_WAKEUP_LATENCY_SLOTS; i++)
+	hist[i] = 0;
+    ERTS_ATOMIC_FOREACH_RUNQ(rq,
+			     for (i = 0; i < ERTS_SCHED_WAKEUP_LATENCY_SLOTS; i++)
+				 hist[i] += rq->wakeup_latency[i]);
+
+    sz = 0;
+    szp = &sz;
+    hpp = NULL;
+    while (1) {
+	res = NIL;
+	for (i = ERTS_SCHED_WAKEUP_LATENCY_SLOTS - 1; i >= 0; i--) {
+	    Eterm bound = (i == ERTS_SCHED_WAKEUP_LATENCY_SLOTS - 1
+			   ? am_infinity
+			   : erts_bld_uint(hpp, szp, ((Uint) 1) << i));
+	    Eterm count = erts_bld_uint(hpp, szp, hist[i]);
+	    res = erts_bld_cons(hpp, szp,
+				erts_bld_tuple(hpp, szp, 2, bound, count),
+				res);
+	}
+	if (hpp)
+	    return res;
+	hp = HAlloc(c_p, sz);
+	szp = NULL;
+	hpp = &hp;
+    }
+}
+
 void
 erts_get_total_reductions(Uint *redsp, Uint *diffp)
 {
@@ -6582,12 +7401,62 @@ Uint erts_process_count(void)
 void
 erts_free_proc(Process *p)
 {
+    ErtsSchedulerData *esdp = erts_get_scheduler_data();
+#ifdef ERTS_SMP
+    /* Messages enqueued lock free after the process exited */
+    erts_cleanup_messages((ErlMessage *)
+			  (erts_smp_atomic_read(&p->msg_lf_inq)
+			   & ~ERTS_MSG_LF_INQ_NOTIFY));
+#endif
+    /* Nothing can refer to the areas through this process anymore */
+    erts_release_shared_area_refs(p->shared_areas);
 #if defined(ERTS_ENABLE_LOCK_COUNT) && defined(ERTS_SMP)
     erts_lcnt_proc_lock_destroy(p);
 #endif
+    if (p->heap && p->heap_sz != (Uint) H_MIN_SIZE) {
+	ERTS_HEAP_FREE(ERTS_ALC_T_HEAP, (void *) p->heap,
+		       p->heap_sz*sizeof(Eterm));
+	p->heap = NULL;
+    }
+
+    /*
+     * Keep the structure, and a heap of the default size left by
+     * delete_process(), for the next spawn on this scheduler. When
+     * freed by other threads (the last reference to the process
+     * dropped outside of a scheduler) it goes back to the allocator,
+     * as does the whole pool once the scheduler goes idle.
+     */
+    if (esdp && esdp->proc_pool_len < ERTS_PROC_POOL_MAX_LEN) {
+	p->next = esdp->proc_pool;
+	esdp->proc_pool = p;
+	esdp->proc_pool_len++;
+	return;
+    }
+    if (p->heap)
+	ERTS_HEAP_FREE(ERTS_ALC_T_HEAP, (void *) p->heap,
+		       p->heap_sz*sizeof(Eterm));
     erts_free(ERTS_ALC_T_PROC, (void *) p);
 }
 
+/*
+ * Give the pooled structures of a scheduler back to the allocators. Done
+ * when the scheduler is about to wait for work, so that a burst of
+ * spawns does not keep memory on schedulers that have gone idle.
+ */
+static void
+proc_pool_trim(ErtsSchedulerData *esdp)
+{
+    while (esdp->proc_pool) {
+	Process *p = esdp->proc_pool;
+	esdp->proc_pool = p->next;
+	if (p->heap)
+	    ERTS_HEAP_FREE(ERTS_ALC_T_HEAP, (void *) p->heap,
+			   p->heap_sz*sizeof(Eterm));
+	erts_free(ERTS_ALC_T_PROC, (void *) p);
+    }
+    esdp->proc_pool_len = 0;
+}
+
 
 /*
 ** Allocate process and find out where to place next process.
@@ -6598,6 +7467,7 @@ alloc_process(void)
 #ifdef ERTS_SMP
     erts_pix_lock_t *pix_lock;
 #endif
+    ErtsSchedulerData *esdp = erts_get_scheduler_data();
     Process* p;
     int p_prev;
 
@@ -6608,9 +7478,23 @@ alloc_process(void)
 	goto error; /* Process table full! */
     }
 
-    p = (Process*) erts_alloc_fnf(ERTS_ALC_T_PROC, sizeof(Process));
-    if (!p)
-	goto error; /* ENOMEM */ 
+    if (esdp && esdp->proc_pool) {
+	/* Reuse a structure freed on this scheduler; may come with a heap */
+	p = esdp->proc_pool;
+	esdp->proc_pool = p->next;
+	esdp->proc_pool_len--;
+    } else {
+	p = (Process*) erts_alloc_fnf(ERTS_ALC_T_PROC, sizeof(Process));
+	if (!p)
+	    goto error; /* ENOMEM */
+	p->heap = NULL;
+    }
+
+#ifdef ERTS_SMP
+    /* Senders may find the process before erl_create_process() is done */
+    erts_smp_atomic_init(&p->msg_lf_inq, ERTS_MSG_LF_INQ_NOTIFY);
+    erts_smp_atomic_init(&p->msg_lf_inq_len, 0);
+#endif
 
     p_last = p_next;
 
@@ -6751,6 +7635,7 @@ erl_create_process(Process* parent, /* Parent of process (default group leader).
 	p->prio           = PRIORITY_NORMAL;
 	p->max_gen_gcs    = (Uint16) erts_smp_atomic_read(&erts_max_gen_gcs);
     }
+    p->max_gc_pause = 0;
     p->skipped = 0;
     ASSERT(p->min_heap_size == erts_next_heap_size(p->min_heap_size, 0));
     
@@ -6784,13 +7669,22 @@ erl_create_process(Process* parent, /* Parent of process (default group leader).
 #endif
 #endif
 
-    p->heap = (Eterm *) ERTS_HEAP_ALLOC(ERTS_ALC_T_HEAP, sizeof(Eterm)*sz);
+    if (p->heap && p->heap_sz != sz) {
+	ERTS_HEAP_FREE(ERTS_ALC_T_HEAP, (void *) p->heap,
+		       p->heap_sz*sizeof(Eterm));
+	p->heap = NULL;
+    }
+    if (!p->heap)
+	p->heap = (Eterm *) ERTS_HEAP_ALLOC(ERTS_ALC_T_HEAP, sizeof(Eterm)*sz);
     p->old_hend = p->old_htop = p->old_heap = NULL;
     p->high_water = p->heap;
 #ifdef INCREMENTAL
     p->scan_top = p->high_water;
 #endif
     p->gen_gcs = 0;
+    p->old_heap_growths = 0;
+    sys_memzero((void *) &p->gc_stats, sizeof(ErtsGcStats));
+    p->shared_areas = NULL;
     p->stop = p->hend = p->heap + sz;
     p->htop = p->heap;
     p->heap_sz = sz;
@@ -6870,6 +7764,7 @@ erl_create_process(Process* parent, /* Parent of process (default group leader).
     p->msg_inq.len = 0;
     p->bound_runq = NULL;
 #endif
+    p->sched_group = NULL;
     p->bif_timers = NULL;
     p->mbuf = NULL;
     p->mbuf_sz = 0;
@@ -6973,6 +7868,7 @@ erl_create_process(Process* parent, /* Parent of process (default group leader).
     p->pending_suspenders = NULL;
     p->pending_exit.reason = THE_NON_VALUE;
     p->pending_exit.bp = NULL;
+    p->inbox_next = NULL;
 #endif
 
 #if !defined(NO_FPE_SIGNALS)
@@ -7028,8 +7924,12 @@ void erts_init_empty_process(Process *p)
     p->heap = NULL;
     p->gen_gcs = 0;
     p->max_gen_gcs = 0;
+    p->old_heap_growths = 0;
+    sys_memzero((void *) &p->gc_stats, sizeof(ErtsGcStats));
+    p->shared_areas = NULL;
     p->min_heap_size = 0;
     p->min_vheap_size = 0;
+    p->max_gc_pause = 0;
     p->status = P_RUNABLE;
     p->gcstatus = P_RUNABLE;
     p->rstatus = P_RUNABLE;
@@ -7055,6 +7955,7 @@ void erts_init_empty_process(Process *p)
 #else
     memset(&(p->u.tm), 0, sizeof(ErlTimer));
 #endif
+    p->sched_group = NULL;
     p->next = NULL;
     p->off_heap.mso = NULL;
 #ifndef HYBRID /* FIND ME! */
@@ -7141,6 +8042,8 @@ void erts_init_empty_process(Process *p)
     p->msg_inq.first = NULL;
     p->msg_inq.last = &p->msg_inq.first;
     p->msg_inq.len = 0;
+    erts_smp_atomic_init(&p->msg_lf_inq, ERTS_MSG_LF_INQ_NOTIFY);
+    erts_smp_atomic_init(&p->msg_lf_inq_len, 0);
     p->suspendee = NIL;
     p->pending_suspenders = NULL;
     p->pending_exit.reason = THE_NON_VALUE;
@@ -7250,8 +8153,6 @@ erts_cleanup_empty_process(Process* p)
 static void
 delete_process(Process* p)
 {
-    ErlMessage* mp;
-
     VERBOSE(DEBUG_PROCESSES, ("Removing process: %T\n",p->id));
 
     /* Cleanup psd */
@@ -7259,6 +8160,11 @@ delete_process(Process* p)
     if (p->psd)
 	erts_free(ERTS_ALC_T_PSD, p->psd);
 
+    if (p->sched_group) {
+	sched_group_leave(p->sched_group);
+	p->sched_group = NULL;
+    }
+
     /* Clean binaries and funs */
     erts_cleanup_offheap(&p->off_heap);
 
@@ -7285,7 +8191,11 @@ delete_process(Process* p)
     hipe_delete_process(&p->hipe);
 #endif
 
-    ERTS_HEAP_FREE(ERTS_ALC_T_HEAP, (void*) p->heap, p->heap_sz*sizeof(Eterm));
+    if (p->heap_sz != (Uint) H_MIN_SIZE) {
+	ERTS_HEAP_FREE(ERTS_ALC_T_HEAP, (void*) p->heap, p->heap_sz*sizeof(Eterm));
+	p->heap = NULL;
+    }
+    /* else: left for reuse by the next spawn, see erts_free_proc() */
     if (p->old_heap != NULL) {
 
 #ifdef DEBUG
@@ -7307,24 +8217,7 @@ delete_process(Process* p)
     erts_erase_dicts(p);
 
     /* free all pending messages */
-    mp = p->msg.first;
-    while(mp != NULL) {
-	ErlMessage* next_mp = mp->next;
-	if (mp->data.attached) {
-	    if (is_value(mp->m[0]))
-		free_message_buffer(mp->data.heap_frag);
-	    else {
-		if (is_not_nil(mp->m[1])) {
-		    ErlHeapFragment *heap_frag;
-		    heap_frag = (ErlHeapFragment *) mp->data.dist_ext->ext_endp;
-		    erts_cleanup_offheap(&heap_frag->off_heap);
-		}
-		erts_free_dist_ext_copy(mp->data.dist_ext);
-	    }
-	}
-	free_message(mp);
-	mp = next_mp;
-    }
+    erts_cleanup_messages(p->msg.first);
 
     ASSERT(!p->monitors);
     ASSERT(!p->nlinks);
@@ -7426,7 +8319,8 @@ handle_pending_exiters(ErtsProcList *pnd_xtrs)
 	if (p) {
 	    if (proclist_same(plp, p)
 		&& !(p->status_flags & ERTS_PROC_SFLG_RUNNING)) {
-		ASSERT(p->status_flags & ERTS_PROC_SFLG_INRUNQ);
+		ASSERT(p->status_flags & (ERTS_PROC_SFLG_INRUNQ
+					  | ERTS_PROC_SFLG_ININBOX));
 		ASSERT(ERTS_PROC_PENDING_EXIT(p));
 		erts_handle_pending_exit(p, ERTS_PROC_LOCKS_ALL);
 	    }
@@ -177,6 +177,32 @@ extern int erts_sched_thread_suggested_stack_size;
 #define ERTS_RUNQ_IFLG_SUSPENDED		(((long) 1) << 0)
 #define ERTS_RUNQ_IFLG_NONEMPTY			(((long) 1) << 1)
 
+/*
+ * Slot i of the wakeup latency histogram counts wakeups that took
+ * less than 2^i microseconds (and at least 2^(i-1)); the last slot
+ * counts the rest.
+ */
+#define ERTS_SCHED_WAKEUP_LATENCY_SLOTS 16
+
+#ifdef ERTS_SMP
+/*
+ * Jobs executed by the dirty scheduler threads, i.e. work that would
+ * hold a normal scheduler for too long. CPU bound jobs run on one
+ * dirty thread per scheduler, I/O bound jobs on a small separate set.
+ */
+#define ERTS_DIRTY_CPU_JOB		0
+#define ERTS_DIRTY_IO_JOB		1
+#define ERTS_NO_DIRTY_JOB_TYPES		2
+
+#define ERTS_DIRTY_IO_SCHEDULERS	4
+
+typedef struct ErtsDirtyJob_ ErtsDirtyJob;
+struct ErtsDirtyJob_ {
+    ErtsDirtyJob *next;
+    void (*execute)(ErtsDirtyJob *);
+};
+#endif
+
 
 #ifdef DEBUG
 #  if defined(ARCH_64) && !HALFWORD_HEAP
@@ -267,6 +293,9 @@ typedef struct {
 struct ErtsRunQueue_ {
     int ix;
     erts_smp_atomic_t info_flags;
+    erts_smp_atomic_t load; /* averaged len, see update_runq_load() */
+    erts_smp_atomic_t inbox; /* Process pushed by other threads, see
+			      * runq_inbox_push() */
 
     erts_smp_mtx_t mtx;
     erts_smp_cnd_t cnd;
@@ -286,6 +315,9 @@ struct ErtsRunQueue_ {
     int len;
     int wakeup_other;
     int wakeup_other_reds;
+    int spincount; /* adapted by sched_spin_adapt() */
+    Uint64 wake_time; /* when wake_scheduler() woke us; 0 if not woken */
+    Uint wakeup_latency[ERTS_SCHED_WAKEUP_LATENCY_SLOTS];
 
     struct {
 	int len;
@@ -372,6 +404,9 @@ struct ErtsSchedulerData_ {
 
     ErtsAtomCacheMap atom_cache_map;
 
+    Process *proc_pool;		/* Freed process structures, see alloc_process() */
+    Uint proc_pool_len;
+
 #ifdef ERTS_SMP
     /* NOTE: These fields are modified under held mutexes by other threads */
 #ifdef ERTS_SMP_SCHEDULERS_NEED_TO_CHECK_CHILDREN
@@ -497,6 +532,31 @@ struct ErtsPendingSuspend_ {
 #  define BIN_OLD_VHEAP_SZ(p) (p)->bin_old_vheap_sz
 #  define BIN_OLD_VHEAP(p)    (p)->bin_old_vheap
 
+/*
+ * What the adaptive heap sizing in erl_gc.c has learnt about a process;
+ * see process_info(Pid, gc_stats).
+ */
+typedef struct {
+    Uint minor_gcs;
+    Uint major_gcs;
+    Uint grows;			/* Heap grown beyond what was needed */
+    Uint shrinks;
+    Uint live;			/* Heap words in use after last GC */
+    Uint reds;			/* Reductions at last GC */
+    Uint alloc_rate;		/* Words allocated per 1000 reductions */
+    Uint survival;		/* Per mille of collected data surviving */
+} ErtsGcStats;
+
+/* Reference to a shared term area (copy.c) */
+typedef struct erts_shared_area_ref ErtsSharedAreaRef;
+
+/* A scheduler group, see process_flag(scheduler_group, Tag) */
+typedef struct {
+    Eterm tag;			/* THE_NON_VALUE if never used, NIL if freed */
+    Uint refc;			/* Members; protected by the group table lock */
+    erts_smp_atomic_t home;	/* Index (+1) of the group run queue, or 0 */
+} ErtsSchedGroup;
+
 struct process {
     /* All fields in the PCB that differs between different heap
      * architectures, have been moved to the end of this struct to
@@ -512,6 +572,7 @@ struct process {
     Uint heap_sz;		/* Size of heap in words */
     Uint min_heap_size;         /* Minimum size of heap (in words). */
     Uint min_vheap_size;        /* Minimum size of virtual heap (in words). */
+    Uint max_gc_pause;          /* Max words a fullsweep should copy; 0 = no limit */
 
 #if !defined(NO_FPE_SIGNALS)
     volatile unsigned long fp_exception;
@@ -606,6 +667,9 @@ struct process {
     Eterm *old_heap;
     Uint16 gen_gcs;		/* Number of (minor) generational GCs. */
     Uint16 max_gen_gcs;		/* Max minor gen GCs before fullsweep. */
+    Uint16 old_heap_growths;	/* Times old heap grown instead of fullsweep. */
+    ErtsGcStats gc_stats;	/* Input to heap sizing */
+    ErtsSharedAreaRef *shared_areas; /* Shared term areas referred to */
     ErlOffHeap off_heap;	/* Off-heap data updated by copy_struct(). */
     ErlHeapFragment* mbuf;	/* Pointer to message buffer list */
     Uint mbuf_sz;		/* Size of all message buffers */
@@ -625,6 +689,7 @@ struct process {
     } u;
 
     ErtsRunQueue *bound_runq;
+    ErtsSchedGroup *sched_group; /* NULL if in no scheduler group */
 
 #ifdef ERTS_SMP
     erts_proc_lock_t lock;
@@ -633,10 +698,13 @@ struct process {
     Uint32 runq_flags;
     Uint32 status_flags;
     ErlMessageInQueue msg_inq;
+    erts_smp_atomic_t msg_lf_inq;	/* Lock free part of msg_inq */
+    erts_smp_atomic_t msg_lf_inq_len;	/* Messages in msg_lf_inq */
     Eterm suspendee;
     ErtsPendingSuspend *pending_suspenders;
     ErtsPendExit pending_exit;
     ErtsRunQueue *run_queue;
+    Process *inbox_next;	/* Next process in run queue inbox */
 #ifdef HIPE
     struct hipe_process_state_smp hipe_smp;
 #endif
@@ -838,6 +906,8 @@ extern struct erts_system_profile_flags_t erts_system_profile_flags;
 #define F_HAVE_BLCKD_MSCHED  (1 <<  8) /* Process has blocked multi-scheduling */
 #define F_P2PNR_RESCHED      (1 <<  9) /* Process has been rescheduled via erts_pid2proc_not_running() */
 #define F_FORCE_GC           (1 << 10) /* Force gc at process in-scheduling */
+#define F_OFF_HEAP_MSGQ      (1 << 11) /* Keep message data off heap until received */
+#define F_COPY_SHARING       (1 << 12) /* Preserve sharing in messages sent */
 
 /* process trace_flags */
 #define F_SENSITIVE          (1 << 0)
@@ -909,6 +979,9 @@ extern struct erts_system_profile_flags_t erts_system_profile_flags;
 								   exit */
 #define ERTS_PROC_SFLG_RUNNING		(((Uint32) 1) << 3)	/* Process is
 								   running */
+#define ERTS_PROC_SFLG_ININBOX		(((Uint32) 1) << 4)	/* Process is
+								   in run q
+								   inbox */
 /* Scheduler flags in process struct... */
 #define ERTS_PROC_RUNQ_FLG_RUNNING	(((Uint32) 1) << 0)	/* Process is
 								   running */
@@ -1011,6 +1084,7 @@ erts_block_multi_scheduling(Process *, ErtsProcLocks, int, int);
 int erts_is_multi_scheduling_blocked(void);
 Eterm erts_multi_scheduling_blockers(Process *);
 void erts_start_schedulers(void);
+void erts_schedule_dirty_job(ErtsDirtyJob *, int);
 void erts_smp_notify_check_children_needed(void);
 #endif
 Uint erts_active_schedulers(void);
@@ -1034,6 +1108,9 @@ ErtsMigrateResult erts_proc_migrate(Process *,
 #endif
 Process *schedule(Process*, int);
 void erts_schedule_misc_op(void (*)(void *), void *);
+#ifdef ERTS_SMP
+int erts_schedule_misc_op_idle(int, void (*)(void *), void *);
+#endif
 Eterm erl_create_process(Process*, Eterm, Eterm, Eterm, ErlSpawnOpts*);
 void erts_do_exit_process(Process*, Eterm);
 void erts_continue_exit_process(Process *);
@@ -1053,8 +1130,10 @@ void erts_program_counter_info(int to, void *to_arg, Process *);
 
 Eterm erts_get_process_priority(Process *p);
 Eterm erts_set_process_priority(Process *p, Eterm prio);
+Eterm erts_set_process_sched_group(Process *p, Eterm group, int *yieldp);
 
 Uint erts_get_total_context_switches(void);
+Eterm erts_sched_wakeup_latency_term(Process *c_p);
 void erts_get_total_reductions(Uint *, Uint *);
 void erts_get_exact_total_reductions(Process *, Uint *, Uint *);
 
@@ -42,23 +42,48 @@
 ** Utility macros
 */
 
-/* Flags to pd_get_hash */
-#define PD_GET_OTHER_PROCESS 1UL
+/*
+ * The dictionary is an open addressing hash table with linear probing.
+ * Each slot is two words in data; the hash value of the key as a small
+ * (NIL for a free slot) followed by the {Key,Value} tuple. Probing only
+ * compares the hash words, and all words are valid terms so that the
+ * garbage collector can scan data as an ordinary root array.
+ *
+ * When the table is resized the new table is placed first in data and
+ * the old table after it. Each put/erase then moves a few slots from the
+ * old table to the new one; lookups try both tables until the old one
+ * is empty. Slots vacated in the old table are marked PD_DELETED so that
+ * probing there still works. Erasing from the current table shifts
+ * following entries back instead, so it never holds deleted slots.
+ */
 
 /* Hash constant macros */
-#define MAX_HASH            1342177280UL
-#define INITIAL_SIZE        10
+#define INITIAL_SIZE        8	/* Slots; must be a power of 2 */
+#define PD_REHASH_STEPS     8	/* Old slots moved per put/erase */
+#define PD_KEYS_INDEX_MIN   16	/* Elements needed to index values */
 
-/* Hash utility macros  */
-#define HASH_RANGE(PDict) ((PDict)->homeSize + (PDict)->splitPosition)
+/* Grow above 3/4 full, shrink below 1/8 full */
+#define PD_GROW_LIMIT(Sz)   (((Sz) / 4) * 3)
+#define PD_SHRINK_LIMIT(Sz) ((Sz) / 8)
+
+#define PD_DELETED          am_undefined
 
+/* Hash utility macros  */
 #define MAKE_HASH(Term) 				\
 ((is_small(Term)) ? unsigned_val(Term) :		\
  ((is_atom(Term)) ? 					\
-  (atom_tab(atom_val(term))->slot.bucket.hvalue) :	\
+  (atom_tab(atom_val(Term))->slot.bucket.hvalue) :	\
   make_hash2(Term)))
 
+#define PD_HASH(Term) make_small(MAKE_HASH(Term) & MAX_SMALL)
+
+#define PD_HVAL(PDict, Slot) ((PDict)->data[2*(Slot)])
+#define PD_TUPLE(PDict, Slot) ((PDict)->data[2*(Slot)+1])
+
 #define PD_SZ2BYTES(Sz) (sizeof(ProcDict) + ((Sz) - 1)*sizeof(Eterm))
+#define PD_KEYS_INDEX_BYTES(PDict) 					\
+    (((PDict)->keysHeads + (PDict)->tableSize + (PDict)->oldSize)	\
+     * sizeof(unsigned int))
 
 /* Memory allocation macros */
 #define PD_ALLOC(Sz)				\
@@ -68,14 +93,6 @@
 #define PD_REALLOC(P, OSz, NSz) 		\
      erts_realloc(ERTS_ALC_T_PROC_DICT, (P), (NSz))
 
-
-#define TCAR(Term) CAR(list_val(Term))
-#define TCDR(Term) CDR(list_val(Term))
-
-/* Array access macro */ 
-#define ARRAY_GET(PDict, Index) (((PDict)->size > (Index)) ? \
-				 (PDict)->data[Index] : NIL)
-
 /*
  * Forward decalarations
  */
@@ -85,14 +102,16 @@ static Eterm pd_hash_get_keys(Process *p, Eterm value);
 static Eterm pd_hash_get_all(Process *p, ProcDict *pd);
 static Eterm pd_hash_put(Process *p, Eterm id, Eterm value);
 
-static void shrink(Process *p, Eterm* ret); 
-static void grow(Process *p);
+static ProcDict *pd_alloc(unsigned int nslots, unsigned int oslots);
+static void pd_resize(ProcDict **ppd, unsigned int nslots);
+static void pd_rehash(ProcDict **ppd, unsigned int steps);
+static void pd_drop_keys_index(ProcDict *pd);
+static void pd_build_keys_index(ProcDict *pd);
 
-static void array_shrink(ProcDict **ppd, unsigned int need);
-static Eterm array_put(ProcDict **ppdict, unsigned int ndx, Eterm term);
-
-static unsigned int pd_hash_value(ProcDict *pdict, Eterm term);
-static unsigned int next_array_size(unsigned int need);
+static ERTS_INLINE unsigned int pd_home_slot(Eterm hval, unsigned int nslots);
+static int pd_lookup(ProcDict *pd, Eterm hval, Eterm id);
+static void pd_insert(ProcDict *pd, Eterm hval, Eterm tpl);
+static void pd_remove(ProcDict *pd, unsigned int ix);
 
 /*
 ** Debugging prototypes and macros
@@ -116,7 +135,7 @@ static int hdebugf_line;
 
 #endif /* HARDDEBUG (else) */
 
-#ifdef DEBUG 
+#ifdef DEBUG
 
 static void pd_check(ProcDict *pd);
 
@@ -144,29 +163,25 @@ erts_dictionary_dump(int to, void *to_arg, ProcDict *pd)
     /*PD_CHECK(pd);*/
     if (pd == NULL)
 	return;
-    erts_print(to, to_arg, "(size = %d, used = %d, homeSize = %d, "
-	       "splitPosition = %d, numElements = %d)\n",
-	       pd->size, pd->used, pd->homeSize, 
-	       pd->splitPosition, (unsigned int) pd->numElements);
-    for (i = 0; i < HASH_RANGE(pd); ++i) {
-	erts_print(to, to_arg, "%d: %T\n", i, ARRAY_GET(pd, i));
+    erts_print(to, to_arg, "(size = %d, used = %d, tableSize = %d, "
+	       "oldSize = %d, rehashPos = %d, numElements = %d)\n",
+	       pd->size, pd->used, pd->tableSize, pd->oldSize,
+	       pd->rehashPos, (unsigned int) pd->numElements);
+    for (i = 0; i < pd->tableSize + pd->oldSize; ++i) {
+	erts_print(to, to_arg, "%d: %T %T\n", i,
+		   PD_HVAL(pd, i), PD_TUPLE(pd, i));
     }
 
 #else /* !DEBUG */
 
     int written = 0;
-    Eterm t;
 
     erts_print(to, to_arg, "[");
     if (pd != NULL) {
-	for (i = 0; i < HASH_RANGE(pd); ++i) {
-	    t = ARRAY_GET(pd, i);
-	    if (is_list(t)) {
-		for (; t != NIL; t = TCDR(t)) {
-		    erts_print(to, to_arg, written++ ? ",%T" : "%T", TCAR(t));
-		}
-	    } else if (is_tuple(t)) {
-		erts_print(to, to_arg, written++ ? ",%T" : "%T", t);
+	for (i = 0; i < pd->tableSize + pd->oldSize; ++i) {
+	    if (is_small(PD_HVAL(pd, i))) {
+		erts_print(to, to_arg, written++ ? ",%T" : "%T",
+			   PD_TUPLE(pd, i));
 	    }
 	}
     }
@@ -180,17 +195,11 @@ erts_deep_dictionary_dump(int to, void *to_arg,
 			  ProcDict* pd, void (*cb)(int, void *, Eterm))
 {
     unsigned int i;
-    Eterm t;
 
     if (pd != NULL) {
-	for (i = 0; i < HASH_RANGE(pd); ++i) {
-	    t = ARRAY_GET(pd, i);
-	    if (is_list(t)) {
-		for (; t != NIL; t = TCDR(t)) {
-		    (*cb)(to, to_arg, TCAR(t));
-		}
-	    } else if (is_tuple(t)) {
-		(*cb)(to, to_arg, t);
+	for (i = 0; i < pd->tableSize + pd->oldSize; ++i) {
+	    if (is_small(PD_HVAL(pd, i))) {
+		(*cb)(to, to_arg, PD_TUPLE(pd, i));
 	    }
 	}
     }
@@ -200,8 +209,11 @@ Uint
 erts_dicts_mem_size(Process *p)
 {
     Uint size = 0;
-    if (p->dictionary)
+    if (p->dictionary) {
 	size += PD_SZ2BYTES(p->dictionary->size);
+	if (p->dictionary->keysIndex)
+	    size += PD_KEYS_INDEX_BYTES(p->dictionary);
+    }
     return size;
 }
 
@@ -214,15 +226,14 @@ erts_erase_dicts(Process *p)
     }
 }
 
-/* 
+/*
  * Called from process_info/1,2.
  */
-Eterm erts_dictionary_copy(Process *p, ProcDict *pd) 
+Eterm erts_dictionary_copy(Process *p, ProcDict *pd)
 {
     Eterm* hp;
     Eterm* heap_start;
     Eterm res = NIL;
-    Eterm tmp, tmp2;
     unsigned int i, num;
 
     if (pd == NULL) {
@@ -230,22 +241,14 @@ Eterm erts_dictionary_copy(Process *p, ProcDict *pd)
     }
 
     PD_CHECK(pd);
-    num = HASH_RANGE(pd);
+    num = pd->tableSize + pd->oldSize;
     heap_start = hp = (Eterm *) erts_alloc(ERTS_ALC_T_TMP,
 					   sizeof(Eterm) * pd->numElements * 2);
     for (i = 0; i < num; ++i) {
-	tmp = ARRAY_GET(pd, i);
-	if (is_boxed(tmp)) {
-	    ASSERT(is_tuple(tmp));
-	    res = CONS(hp, tmp, res);
+	if (is_small(PD_HVAL(pd, i))) {
+	    ASSERT(is_tuple(PD_TUPLE(pd, i)));
+	    res = CONS(hp, PD_TUPLE(pd, i), res);
 	    hp += 2;
-	} else if (is_list(tmp)) {
-	    while (tmp != NIL) {
-		tmp2 = TCAR(tmp);
-		res = CONS(hp, tmp2, res);
-		hp += 2;
-		tmp = TCDR(tmp);
-	    }
 	}
     }
     res = copy_object(res, p);
@@ -319,308 +322,194 @@ BIF_RETTYPE erase_1(BIF_ALIST_1)
  */
 static void pd_hash_erase(Process *p, Eterm id, Eterm *ret)
 {
-    unsigned int hval;
-    Eterm old;
-    Eterm tmp;
-    unsigned int range;
+    ProcDict *pd;
+    Eterm hval;
+    int ix;
 
     *ret = am_undefined;
     if (p->dictionary == NULL) {
 	return;
     }
-    hval = pd_hash_value(p->dictionary, id);
-    old = ARRAY_GET(p->dictionary, hval);
-    if (is_boxed(old)) {	/* Tuple */
-	ASSERT(is_tuple(old));
-	if (EQ(tuple_val(old)[1], id)) {
-	    array_put(&(p->dictionary), hval, NIL);
-	    --(p->dictionary->numElements);
-	    *ret = tuple_val(old)[2];
-	}
-    } else if (is_list(old)) {
-	/* Find cons cell for identical value */
-	Eterm* prev = &p->dictionary->data[hval];
-
-	for (tmp = *prev; tmp != NIL; prev = &TCDR(tmp), tmp = *prev) {
-	    if (EQ(tuple_val(TCAR(tmp))[1], id)) {
-		*prev = TCDR(tmp);
-		*ret = tuple_val(TCAR(tmp))[2];
-		--(p->dictionary->numElements);
-	    }
-	}
+    hval = PD_HASH(id);
+    pd_drop_keys_index(p->dictionary);
+    pd_rehash(&(p->dictionary), PD_REHASH_STEPS);
+    pd = p->dictionary;
 
-	/* If there is only one element left in the list we must remove the list. */
-	old = ARRAY_GET(p->dictionary, hval);
-	ASSERT(is_list(old));
-	if (is_nil(TCDR(old))) {
-	    array_put(&p->dictionary, hval, TCAR(old));
-	}
-    } else if (is_not_nil(old)) {
-#ifdef DEBUG
-	erts_fprintf(stderr,
-		     "Process dictionary for process %T is broken, trying to "
-		     "display term found in line %d:\n"
-		     "%T\n", p->id, __LINE__, old);
-#endif
-	erl_exit(1, "Damaged process dictionary found during erase/1.");
+    ix = pd_lookup(pd, hval, id);
+    if (ix < 0) {
+	return;
     }
-    if ((range = HASH_RANGE(p->dictionary)) > INITIAL_SIZE && 
-	range / 2  > (p->dictionary->numElements)) {
-	shrink(p, ret);
+    *ret = tuple_val(PD_TUPLE(pd, ix))[2];
+    if ((unsigned int) ix < pd->tableSize) {
+	pd_remove(pd, ix);
+    } else {
+	PD_HVAL(pd, ix) = PD_DELETED;
+	PD_TUPLE(pd, ix) = NIL;
+    }
+    --(pd->numElements);
+
+    if (pd->tableSize > INITIAL_SIZE &&
+	pd->numElements < PD_SHRINK_LIMIT(pd->tableSize)) {
+	pd_resize(&(p->dictionary), pd->tableSize / 2);
     }
 }
 
 static void pd_hash_erase_all(Process *p)
 {
     if (p->dictionary != NULL) {
+	pd_drop_keys_index(p->dictionary);
 	PD_FREE(p->dictionary, PD_SZ2BYTES(p->dictionary->size));
 	p->dictionary = NULL;
     }
 }
 
-Eterm erts_pd_hash_get(Process *p, Eterm id) 
+Eterm erts_pd_hash_get(Process *p, Eterm id)
 {
-    unsigned int hval;
-    Eterm tmp;
     ProcDict *pd = p->dictionary;
+    int ix;
 
     if (pd == NULL)
 	return am_undefined;
-    hval = pd_hash_value(pd, id);
-    tmp = ARRAY_GET(pd, hval);
-    if (is_boxed(tmp)) {	/* Tuple */
-	ASSERT(is_tuple(tmp));
-	if (EQ(tuple_val(tmp)[1], id)) {
-	    return tuple_val(tmp)[2];
-	}
-    } else if (is_list(tmp)) {
-	for (; tmp != NIL && !EQ(tuple_val(TCAR(tmp))[1], id); tmp = TCDR(tmp)) {
-	    ;
-	}
-	if (tmp != NIL) {
-	    return tuple_val(TCAR(tmp))[2];
-	}
-    } else if (is_not_nil(tmp)) {
-#ifdef DEBUG
-	erts_fprintf(stderr,
-		     "Process dictionary for process %T is broken, trying to "
-		     "display term found in line %d:\n"
-		     "%T\n", p->id, __LINE__, tmp);
-#endif
-	erl_exit(1, "Damaged process dictionary found during get/1.");
-    }
-    return am_undefined;
+    ix = pd_lookup(pd, PD_HASH(id), id);
+    if (ix < 0)
+	return am_undefined;
+    return tuple_val(PD_TUPLE(pd, ix))[2];
 }
 
-static Eterm pd_hash_get_keys(Process *p, Eterm value) 
+/*
+ * The first get_keys/1 after an update scans the whole table. If
+ * get_keys/1 is called again before the next update, an index from
+ * value hash to slots is built and used until the dictionary changes.
+ * The index holds slot numbers rather than terms, so the garbage
+ * collector need not know about it.
+ */
+static Eterm pd_hash_get_keys(Process *p, Eterm value)
 {
     Eterm *hp;
     Eterm res = NIL;
     ProcDict *pd = p->dictionary;
     unsigned int i, num;
-    Eterm tmp, tmp2;
+    Eterm tmp;
 
     if (pd == NULL) {
 	return res;
     }
 
-    num = HASH_RANGE(pd);
+    if (pd->keysIndex == NULL
+	&& pd->keysScanned
+	&& pd->numElements >= PD_KEYS_INDEX_MIN) {
+	pd_build_keys_index(pd);
+    }
+
+    if (pd->keysIndex != NULL) {
+	unsigned int *heads = pd->keysIndex;
+	unsigned int *next = pd->keysIndex + pd->keysHeads;
+	unsigned int h = pd_home_slot(PD_HASH(value), pd->keysHeads);
+
+	for (i = heads[h]; i != 0; i = next[i - 1]) {
+	    tmp = PD_TUPLE(pd, i - 1);
+	    if (EQ(tuple_val(tmp)[2], value)) {
+		hp = HAlloc(p, 2);
+		res = CONS(hp, tuple_val(tmp)[1], res);
+	    }
+	}
+	return res;
+    }
+
+    num = pd->tableSize + pd->oldSize;
     for (i = 0; i < num; ++i) {
-	tmp = ARRAY_GET(pd, i);
-	if (is_boxed(tmp)) {
+	if (is_small(PD_HVAL(pd, i))) {
+	    tmp = PD_TUPLE(pd, i);
 	    ASSERT(is_tuple(tmp));
 	    if (EQ(tuple_val(tmp)[2], value)) {
 		hp = HAlloc(p, 2);
 		res = CONS(hp, tuple_val(tmp)[1], res);
 	    }
-	} else if (is_list(tmp)) {
-	    while (tmp != NIL) {
-		tmp2 = TCAR(tmp);
-		if (EQ(tuple_val(tmp2)[2], value)) {
-		    hp = HAlloc(p, 2);
-		    res = CONS(hp, tuple_val(tmp2)[1], res);
-		}
-		tmp = TCDR(tmp);
-	    }
 	}
     }
+    pd->keysScanned = 1;
     return res;
 }
-	
+
 
 static Eterm
 pd_hash_get_all(Process *p, ProcDict *pd)
 {
     Eterm* hp;
     Eterm res = NIL;
-    Eterm tmp, tmp2;
     unsigned int i;
     unsigned int num;
 
     if (pd == NULL) {
 	return res;
     }
-    num = HASH_RANGE(pd);
+    num = pd->tableSize + pd->oldSize;
     hp = HAlloc(p, pd->numElements * 2);
-    
+
     for (i = 0; i < num; ++i) {
-	tmp = ARRAY_GET(pd, i);
-	if (is_boxed(tmp)) {
-	    ASSERT(is_tuple(tmp));
-	    res = CONS(hp, tmp, res);
+	if (is_small(PD_HVAL(pd, i))) {
+	    ASSERT(is_tuple(PD_TUPLE(pd, i)));
+	    res = CONS(hp, PD_TUPLE(pd, i), res);
 	    hp += 2;
-	} else if (is_list(tmp)) {
-	    while (tmp != NIL) {
-		tmp2 = TCAR(tmp);
-		res = CONS(hp, tmp2, res);
-		hp += 2;
-		tmp = TCDR(tmp);
-	    }
 	}
     }
     return res;
 }
 
 static Eterm pd_hash_put(Process *p, Eterm id, Eterm value)
-{ 
-    unsigned int hval;
+{
+    ProcDict *pd;
+    Eterm hval;
     Eterm *hp;
     Eterm tpl;
     Eterm old;
-    Eterm tmp;
-    int needed;
-    int i = 0;
-#ifdef DEBUG
-    Eterm *hp_limit;
-#endif
+    int ix;
 
     if (p->dictionary == NULL) {
 	/* Create it */
-	array_put(&(p->dictionary), INITIAL_SIZE - 1, NIL);
-	p->dictionary->homeSize = INITIAL_SIZE;
-    }	
-    hval = pd_hash_value(p->dictionary, id);
-    old = ARRAY_GET(p->dictionary, hval);
+	p->dictionary = pd_alloc(INITIAL_SIZE, 0);
+    }
+    hval = PD_HASH(id);
 
     /*
-     * Calculate the number of heap words needed and garbage
-     * collect if necessary. (Might be a slight overestimation.)
+     * The {Key,Value} tuple is all we need on the heap; the
+     * dictionary itself is a root array.
      */
-    needed = 3;			/* {Key,Value} tuple */
-    if (is_boxed(old)) {
-	/*
-	 * We don't want to compare keys twice, so we'll always
-	 * reserve the space for two CONS cells.
-	 */
-	needed += 2+2;
-    } else if (is_list(old)) {
-	i = 0;
-	for (tmp = old; tmp != NIL && !EQ(tuple_val(TCAR(tmp))[1], id); tmp = TCDR(tmp)) {
-	    ++i;
-	}
-	if (is_nil(tmp)) {
-	    i = -1;
-	    needed += 2;
-	} else {
-	    needed += 2*(i+1);
-	}
-    }
-    if (HeapWordsLeft(p) < needed) {
-	Eterm root[3];
+    if (HeapWordsLeft(p) < 3) {
+	Eterm root[2];
 	root[0] = id;
 	root[1] = value;
-	root[2] = old;
-	BUMP_REDS(p, erts_garbage_collect(p, needed, root, 3));
+	BUMP_REDS(p, erts_garbage_collect(p, 3, root, 2));
 	id = root[0];
 	value = root[1];
-	old = root[2];
     }
-#ifdef DEBUG
-    hp_limit = p->htop + needed;
-#endif
-
-    /*
-     * Create the {Key,Value} tuple.
-     */
     hp = HeapOnlyAlloc(p, 3);
     tpl = TUPLE2(hp, id, value);
 
     /*
      * Update the dictionary.
      */
-    if (is_nil(old)) {
-	array_put(&(p->dictionary), hval, tpl);
-	++(p->dictionary->numElements);
-    } else if (is_boxed(old)) {
-	ASSERT(is_tuple(old));
-	if (EQ(tuple_val(old)[1],id)) {
-	    array_put(&(p->dictionary), hval, tpl);
-	    return tuple_val(old)[2];
-	} else {
-	    hp = HeapOnlyAlloc(p, 4);
-	    tmp = CONS(hp, old, NIL);
-	    hp += 2;
-	    ++(p->dictionary->numElements);
-	    array_put(&(p->dictionary), hval, CONS(hp, tpl, tmp));
-	    hp += 2;
-	    ASSERT(hp <= hp_limit);
-	}
-    } else if (is_list(old)) {
-	if (i == -1) {
-	    /*
-	     * New key. Simply prepend the tuple to the beginning of the list.
-	     */
-	    hp = HeapOnlyAlloc(p, 2);
-	    array_put(&(p->dictionary), hval, CONS(hp, tpl, old));
-	    hp += 2;
-	    ASSERT(hp <= hp_limit);
-	    ++(p->dictionary->numElements);
-	} else {
-	    /*
-	     * i = Number of CDRs to skip to reach the changed element in the list.
-	     *
-	     * Replace old value in list. To avoid pointers from the old generation
-	     * to the new, we must rebuild the list from the beginning up to and
-	     * including the changed element.
-	     */
-	    Eterm nlist;
-	    int j;
-
-	    hp = HeapOnlyAlloc(p, (i+1)*2);
-	    
-	    /* Find the list element to change. */
-	    for (j = 0, nlist = old; j < i; j++, nlist = TCDR(nlist)) {
-		;
-	    }
-	    ASSERT(EQ(tuple_val(TCAR(nlist))[1], id));
-	    nlist = TCDR(nlist); /* Unchanged part of list. */
-
-	    /* Rebuild list before the updated element. */
-	    for (tmp = old; i-- > 0; tmp = TCDR(tmp)) {
-		nlist = CONS(hp, TCAR(tmp), nlist);
-		hp += 2;
-	    }
-	    ASSERT(EQ(tuple_val(TCAR(tmp))[1], id));
+    pd_drop_keys_index(p->dictionary);
+    pd_rehash(&(p->dictionary), PD_REHASH_STEPS);
+    pd = p->dictionary;
 
-	    /* Put the updated element first in the new list. */
-	    nlist = CONS(hp, tpl, nlist);
-	    hp += 2;
-	    ASSERT(hp <= hp_limit);
-	    array_put(&(p->dictionary), hval, nlist);
-	    return tuple_val(TCAR(tmp))[2];
+    ix = pd_lookup(pd, hval, id);
+    if (ix >= 0) {
+	old = PD_TUPLE(pd, ix);
+	if ((unsigned int) ix < pd->tableSize) {
+	    PD_TUPLE(pd, ix) = tpl;
+	} else {
+	    PD_HVAL(pd, ix) = PD_DELETED;
+	    PD_TUPLE(pd, ix) = NIL;
+	    pd_insert(pd, hval, tpl);
 	}
-    } else {
-#ifdef DEBUG
-	erts_fprintf(stderr,
-		     "Process dictionary for process %T is broken, trying to "
-		     "display term found in line %d:\n"
-		     "%T\n", p->id, __LINE__, old);
-#endif
-
-	erl_exit(1, "Damaged process dictionary found during put/2.");
+	return tuple_val(old)[2];
     }
-    if (HASH_RANGE(p->dictionary) <= p->dictionary->numElements) {
-	grow(p);
+
+    pd_insert(pd, hval, tpl);
+    ++(pd->numElements);
+    if (pd->numElements > PD_GROW_LIMIT(pd->tableSize)) {
+	pd_resize(&(p->dictionary), pd->tableSize * 2);
     }
     return am_undefined;
 }
@@ -629,355 +518,243 @@ static Eterm pd_hash_put(Process *p, Eterm id, Eterm value)
  * Hash table utilities, rehashing
  */
 
-static void shrink(Process *p, Eterm* ret) 
+static ERTS_INLINE unsigned int pd_home_slot(Eterm hval, unsigned int nslots)
 {
-    unsigned int range = HASH_RANGE(p->dictionary);
-    unsigned int steps = (range*3) / 10;
-    Eterm hi, lo, tmp;
-    unsigned int i;
-    Eterm *hp;
-#ifdef DEBUG
-    Eterm *hp_limit;
-#endif
+    UWord v = unsigned_val(hval);
+    Uint32 h = (Uint32) (v ^ ((v >> 16) >> 16));
 
-    if (range - steps < INITIAL_SIZE) {
-	steps = range - INITIAL_SIZE; 
-    }
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h & (nslots - 1);
+}
 
-    for (i = 0; i < steps; ++i) {
-	ProcDict *pd = p->dictionary;
-	if (pd->splitPosition == 0) {
-	    pd->homeSize /= 2;
-	    pd->splitPosition = pd->homeSize;
-	}
-	--(pd->splitPosition);
-	hi = ARRAY_GET(pd, (pd->splitPosition + pd->homeSize));
-	lo = ARRAY_GET(pd, pd->splitPosition);
-	if (hi != NIL) {
-	    if (lo == NIL) {
-		array_put(&(p->dictionary), pd->splitPosition, hi);
-	    } else {
-		int needed = 4;
-		if (is_list(hi) && is_list(lo)) {
-		    needed = 2*list_length(hi);
-		}
-		if (HeapWordsLeft(p) < needed) {
-		    BUMP_REDS(p, erts_garbage_collect(p, needed, ret, 1));
-		    hi = pd->data[(pd->splitPosition + pd->homeSize)];
-		    lo = pd->data[pd->splitPosition];
-		}
-#ifdef DEBUG
-		hp_limit = p->htop + needed;
-#endif
-		if (is_tuple(lo)) {
-		    if (is_tuple(hi)) {
-			hp = HeapOnlyAlloc(p, 4);
-			tmp = CONS(hp, hi, NIL);
-			hp += 2;
-			array_put(&(p->dictionary), pd->splitPosition, 
-				  CONS(hp,lo,tmp));
-			hp += 2;
-			ASSERT(hp <= hp_limit);
-		    } else { /* hi is a list */
-			hp = HeapOnlyAlloc(p, 2);
-			array_put(&(p->dictionary), pd->splitPosition, 
-				  CONS(hp, lo, hi));
-			hp += 2;
-			ASSERT(hp <= hp_limit);
-		    }
-		} else { /* lo is a list */
-		    if (is_tuple(hi)) {
-			hp = HeapOnlyAlloc(p, 2);
-			array_put(&(p->dictionary), pd->splitPosition, 
-				  CONS(hp, hi, lo));
-			hp += 2;
-			ASSERT(hp <= hp_limit);
-
-		    } else { /* Two lists */
-			hp = HeapOnlyAlloc(p, needed);
-			for (tmp = hi; tmp != NIL; tmp = TCDR(tmp)) {
-			    lo = CONS(hp, TCAR(tmp), lo);
-			    hp += 2;
-			}
-			ASSERT(hp <= hp_limit);
-			array_put(&(p->dictionary), pd->splitPosition, lo);
-		    }
-		}
-	    }
+/*
+ * Look for id among the nslots slots starting at first.
+ * Returns the slot number, or -1 if not found.
+ */
+static ERTS_INLINE int pd_find(ProcDict *pd, unsigned int first,
+			       unsigned int nslots, Eterm hval, Eterm id)
+{
+    unsigned int mask = nslots - 1;
+    unsigned int i = pd_home_slot(hval, nslots);
+    Eterm h;
+
+    while (is_not_nil(h = PD_HVAL(pd, first + i))) {
+	if (h == hval && EQ(tuple_val(PD_TUPLE(pd, first + i))[1], id)) {
+	    return (int) (first + i);
 	}
-	array_put(&(p->dictionary), (pd->splitPosition + pd->homeSize), NIL);
-    }
-    if (HASH_RANGE(p->dictionary) <= (p->dictionary->size / 4)) {
-	array_shrink(&(p->dictionary), (HASH_RANGE(p->dictionary) * 3) / 2);
+	i = (i + 1) & mask;
     }
+    return -1;
 }
 
-static void grow(Process *p)
+static int pd_lookup(ProcDict *pd, Eterm hval, Eterm id)
 {
-    unsigned int i,j;
-    unsigned int steps = p->dictionary->homeSize / 5;
-    Eterm l1,l2;
-    Eterm l;
-    Eterm *hp;
-    unsigned int pos;
-    unsigned int homeSize;
-    int needed = 0;
-    ProcDict *pd;
-#ifdef DEBUG
-    Eterm *hp_limit;
-#endif
+    int ix = pd_find(pd, 0, pd->tableSize, hval, id);
 
-    HDEBUGF(("grow: steps = %d", steps));
-    if (steps == 0)
-	steps = 1;
-    /* Dont grow over MAX_HASH */
-    if ((MAX_HASH - steps) <= HASH_RANGE(p->dictionary)) {
-	return;
+    if (ix < 0 && pd->oldSize != 0) {
+	ix = pd_find(pd, pd->tableSize, pd->oldSize, hval, id);
     }
+    return ix;
+}
 
-    /*
-     * Calculate total number of heap words needed, and garbage collect
-     * if necessary.
-     */
+/*
+ * Put a tuple with a key not present in the current table.
+ */
+static void pd_insert(ProcDict *pd, Eterm hval, Eterm tpl)
+{
+    unsigned int mask = pd->tableSize - 1;
+    unsigned int i = pd_home_slot(hval, pd->tableSize);
 
-    pd = p->dictionary;
-    pos = pd->splitPosition;
-    homeSize = pd->homeSize;
-    for (i = 0; i < steps; ++i) {
-	if (pos == homeSize) {
-	    homeSize *= 2;
-	    pos = 0;
-	}
-	l = ARRAY_GET(pd, pos);
-	pos++;
-	if (is_not_tuple(l)) {
-	    while (l != NIL) {
-		needed += 2;
-		l = TCDR(l);
-	    }
-	}
-    }
-    if (HeapWordsLeft(p) < needed) {
-	BUMP_REDS(p, erts_garbage_collect(p, needed, 0, 0));
+    while (is_not_nil(PD_HVAL(pd, i))) {
+	i = (i + 1) & mask;
     }
-#ifdef DEBUG
-    hp_limit = p->htop + needed;
-#endif
-
-    /*
-     * Now grow.
-     */
+    PD_HVAL(pd, i) = hval;
+    PD_TUPLE(pd, i) = tpl;
+}
 
-    for (i = 0; i < steps; ++i) {
-	ProcDict *pd = p->dictionary;
-	if (pd->splitPosition == pd->homeSize) {
-	    pd->homeSize *= 2;
-	    pd->splitPosition = 0;
+/*
+ * Remove slot ix from the current table, moving back the following
+ * entries whose probe sequence passes the hole.
+ */
+static void pd_remove(ProcDict *pd, unsigned int ix)
+{
+    unsigned int mask = pd->tableSize - 1;
+    unsigned int j = ix;
+    unsigned int k;
+
+    for (;;) {
+	j = (j + 1) & mask;
+	if (is_nil(PD_HVAL(pd, j))) {
+	    break;
 	}
-	pos = pd->splitPosition;
-	++pd->splitPosition; /* For the hashes */
-	l = ARRAY_GET(pd, pos);
-	if (is_tuple(l)) {
-	    if (pd_hash_value(pd, tuple_val(l)[1]) != pos) {
-		array_put(&(p->dictionary), pos + 
-			  p->dictionary->homeSize, l);
-		array_put(&(p->dictionary), pos, NIL);
-	    }
-	} else {
-	    l2 = NIL;
-	    l1 = l;
-	    for (j = 0; l1 != NIL; l1 = TCDR(l1))
-		j += 2;
-	    hp = HeapOnlyAlloc(p, j);
-	
-	    while (l != NIL) {
-		if (pd_hash_value(pd, tuple_val(TCAR(l))[1]) == pos) 
-		    l1 = CONS(hp, TCAR(l), l1);
-		else
-		    l2 = CONS(hp, TCAR(l), l2);
-		hp += 2;
-		l = TCDR(l);
-	    }
-	    if (l1 != NIL && TCDR(l1) == NIL)
-		l1 = TCAR(l1);
-	    if (l2 != NIL && TCDR(l2) == NIL)
-		l2 = TCAR(l2);
-	    ASSERT(hp <= hp_limit);
-	    /* After array_put pd is no longer valid */
-	    array_put(&(p->dictionary), pos, l1);
-	    array_put(&(p->dictionary), pos + 
-		      p->dictionary->homeSize, l2);
+	k = pd_home_slot(PD_HVAL(pd, j), pd->tableSize);
+	if (((j - k) & mask) >= ((j - ix) & mask)) {
+	    PD_HVAL(pd, ix) = PD_HVAL(pd, j);
+	    PD_TUPLE(pd, ix) = PD_TUPLE(pd, j);
+	    ix = j;
 	}
     }
+    PD_HVAL(pd, ix) = NIL;
+    PD_TUPLE(pd, ix) = NIL;
+}
 
-#ifdef HARDDEBUG
-    dictionary_dump(p->dictionary,CERR);
-#endif
+static ProcDict *pd_alloc(unsigned int nslots, unsigned int oslots)
+{
+    unsigned int i;
+    unsigned int siz = 2 * (nslots + oslots);
+    ProcDict *pd = PD_ALLOC(PD_SZ2BYTES(siz));
+
+    for (i = 0; i < siz; ++i)
+	pd->data[i] = NIL;
+    pd->size = pd->used = siz;
+    pd->tableSize = nslots;
+    pd->oldSize = oslots;
+    pd->rehashPos = 0;
+    pd->keysHeads = 0;
+    pd->keysScanned = 0;
+    pd->numElements = 0;
+    pd->keysIndex = NULL;
+    return pd;
 }
 
 /*
-** Array oriented operations
-*/
-
-static void array_shrink(ProcDict **ppd, unsigned int need) 
+ * Start moving the entries to a new table with nslots slots. Any
+ * rehash already in progress is completed first.
+ */
+static void pd_resize(ProcDict **ppd, unsigned int nslots)
 {
-    unsigned int siz = next_array_size(need);
-
-    HDEBUGF(("array_shrink: size = %d, used = %d, need = %d",
-	     (*ppd)->size, (*ppd)->used, need));
+    ProcDict *opd;
+    ProcDict *pd;
 
-    if (siz > (*ppd)->size)
-	return; /* Only shrink */
+    HDEBUGF(("pd_resize: tableSize = %d, nslots = %d",
+	     (*ppd)->tableSize, nslots));
 
-    *ppd = PD_REALLOC(((void *) *ppd),
-		      PD_SZ2BYTES((*ppd)->size),
-		      PD_SZ2BYTES(siz));
+    pd_rehash(ppd, (*ppd)->oldSize);
+    opd = *ppd;
+    ASSERT(opd->oldSize == 0 && opd->keysIndex == NULL);
 
-    (*ppd)->size = siz;
-    if ((*ppd)->size < (*ppd)->used)
-	(*ppd)->used = (*ppd)->size;
-}
-    
-			
-static Eterm array_put(ProcDict **ppdict, unsigned int ndx, Eterm term)
-{
-    unsigned int i;
-    Eterm ret;
-    if (*ppdict == NULL) {
-	Uint siz = next_array_size(ndx+1);
-	ProcDict *p;
-
-        p = PD_ALLOC(PD_SZ2BYTES(siz));
-	for (i = 0; i < siz; ++i) 
-	    p->data[i] = NIL;
-	p->size = siz;
-	p->homeSize = p->splitPosition = p->numElements = p->used = 0;
-	*ppdict = p;
-    } else if (ndx >= (*ppdict)->size) {
-	Uint osize = (*ppdict)->size;
-	Uint nsize = next_array_size(ndx+1);
-	*ppdict = PD_REALLOC(((void *) *ppdict),
-			     PD_SZ2BYTES(osize),
-			     PD_SZ2BYTES(nsize));
-	for (i = osize; i < nsize; ++i)
-	    (*ppdict)->data[i] = NIL;
-	(*ppdict)->size = nsize;
-    }
-    ret = (*ppdict)->data[ndx];
-    (*ppdict)->data[ndx] = term;
-    if ((ndx + 1) > (*ppdict)->used)
-	(*ppdict)->used = ndx + 1;
-#ifdef HARDDEBUG
-    HDEBUGF(("array_put: (*ppdict)->size = %d, (*ppdict)->used = %d, ndx = %d",
-	     (*ppdict)->size, (*ppdict)->used, ndx));
-    erts_fprintf(stderr, "%T", term);
-#endif /* HARDDEBUG */
-    return ret;
+    pd = pd_alloc(nslots, opd->tableSize);
+    sys_memcpy((void *) &PD_HVAL(pd, nslots), (void *) opd->data,
+	       2 * opd->tableSize * sizeof(Eterm));
+    pd->numElements = opd->numElements;
+    PD_FREE(opd, PD_SZ2BYTES(opd->size));
+    *ppd = pd;
 }
 
 /*
-** Basic utilities
-*/
+ * Move up to steps slots from the old table to the current one, and
+ * release the old table once it is empty.
+ */
+static void pd_rehash(ProcDict **ppd, unsigned int steps)
+{
+    ProcDict *pd = *ppd;
+    unsigned int ix;
 
-static unsigned int pd_hash_value(ProcDict *pdict, Eterm term) 
-{ 
-    Uint hash, high;
+    if (pd->oldSize == 0) {
+	return;
+    }
+    while (steps-- > 0 && pd->rehashPos < pd->oldSize) {
+	ix = pd->tableSize + pd->rehashPos++;
+	if (is_small(PD_HVAL(pd, ix))) {
+	    pd_insert(pd, PD_HVAL(pd, ix), PD_TUPLE(pd, ix));
+	    PD_HVAL(pd, ix) = PD_DELETED;
+	    PD_TUPLE(pd, ix) = NIL;
+	}
+    }
+    if (pd->rehashPos == pd->oldSize) {
+	pd->oldSize = pd->rehashPos = 0;
+	pd->used = 2 * pd->tableSize;
+	*ppd = PD_REALLOC(((void *) pd),
+			  PD_SZ2BYTES(pd->size),
+			  PD_SZ2BYTES(pd->used));
+	(*ppd)->size = (*ppd)->used;
+    }
+}
 
-    hash = MAKE_HASH(term);
-    high = hash % (pdict->homeSize*2);
-    if (high >= HASH_RANGE(pdict))
-	return hash % pdict->homeSize;
-    return high;
+/*
+ * Called before every update of the dictionary.
+ */
+static void pd_drop_keys_index(ProcDict *pd)
+{
+    if (pd->keysIndex != NULL) {
+	PD_FREE(pd->keysIndex, PD_KEYS_INDEX_BYTES(pd));
+	pd->keysIndex = NULL;
+	pd->keysHeads = 0;
+    }
+    pd->keysScanned = 0;
 }
 
-static unsigned int next_array_size(unsigned int need)
+/*
+ * The index is keysHeads bucket heads followed by one link per slot;
+ * both hold slot number + 1, with 0 ending the chain.
+ */
+static void pd_build_keys_index(ProcDict *pd)
 {
-    static unsigned int tab[] =
-    {
-	10UL,
-	20UL,
-	40UL,
-	80UL,
-	160UL,
-	320UL,
-	640UL,
-	1280UL,
-	2560UL,
-	5120UL,
-	10240UL,
-	20480UL,
-	40960UL,
-	81920UL,
-	163840UL,
-	327680UL,
-	655360UL,
-	1310720UL,
-	2621440UL,
-	5242880UL,
-	10485760UL,
-	20971520UL,
-	41943040UL,
-	83886080UL,
-	167772160UL,
-	335544320UL,
-	671088640UL,
-	1342177280UL,
-	2684354560UL
-    };
-    int hi = sizeof(tab) / sizeof(Uint) - 1;
-    int lo = 1;
-    int cur = 4;
-
-    while (hi >= lo) {
-	if (tab[cur] >= need && tab[cur - 1] < need)
-	    return tab[cur];
-	if (tab[cur] > need)
-	    hi = cur - 1;
-	else
-	    lo = cur + 1;
-	cur = (hi + lo) / 2;
-    }
-    return need;
+    unsigned int num = pd->tableSize + pd->oldSize;
+    unsigned int heads = INITIAL_SIZE;
+    unsigned int *next;
+    unsigned int i, h;
+
+    ASSERT(pd->keysIndex == NULL);
+    while (heads < pd->numElements) {
+	heads *= 2;
+    }
+    pd->keysHeads = heads;
+    pd->keysIndex = PD_ALLOC(PD_KEYS_INDEX_BYTES(pd));
+    next = pd->keysIndex + heads;
+    for (i = 0; i < heads; ++i) {
+	pd->keysIndex[i] = 0;
+    }
+    for (i = num; i-- > 0; ) {
+	if (is_small(PD_HVAL(pd, i))) {
+	    h = pd_home_slot(PD_HASH(tuple_val(PD_TUPLE(pd, i))[2]), heads);
+	    next[i] = pd->keysIndex[h];
+	    pd->keysIndex[h] = i + 1;
+	}
+    }
 }
 
 
 /*
-** Debug functions 
-*/	    
+** Debug functions
+*/
 #ifdef DEBUG
 
-static void pd_check(ProcDict *pd) 
+static void pd_check(ProcDict *pd)
 {
     unsigned int i;
     Uint num;
     if (pd == NULL)
 	return;
     ASSERT(pd->size >= pd->used);
-    ASSERT(HASH_RANGE(pd) <= MAX_HASH);
-    for (i = 0, num = 0; i < pd->used; ++i) {
-	Eterm t = pd->data[i];
-	if (is_nil(t)) {
+    ASSERT(pd->used == 2 * (pd->tableSize + pd->oldSize));
+    ASSERT((pd->tableSize & (pd->tableSize - 1)) == 0);
+    ASSERT((pd->oldSize & (pd->oldSize - 1)) == 0);
+    ASSERT(pd->oldSize == 0 || pd->rehashPos < pd->oldSize);
+    for (i = 0, num = 0; i < pd->tableSize + pd->oldSize; ++i) {
+	Eterm h = PD_HVAL(pd, i);
+	Eterm t = PD_TUPLE(pd, i);
+	if (is_nil(h) || h == PD_DELETED) {
+	    ASSERT(is_nil(t));
+	    ASSERT(is_nil(h) || i >= pd->tableSize);
 	    continue;
-	} else if (is_tuple(t)) {
+	} else if (is_small(h) && is_tuple(t)) {
 	    ++num;
 	    ASSERT(arityval(*tuple_val(t)) == 2);
-	    continue;
-	} else if (is_list(t)) {
-	    while (t != NIL) {
-		++num;
-		ASSERT(is_tuple(TCAR(t)));
-		ASSERT(arityval(*(tuple_val(TCAR(t)))) == 2);
-		t = TCDR(t);
-	    }
+	    ASSERT(h == PD_HASH(tuple_val(t)[1]));
+	    ASSERT(i < pd->tableSize || i - pd->tableSize >= pd->rehashPos);
+	    ASSERT(pd_lookup(pd, h, tuple_val(t)[1]) == (int) i);
 	    continue;
 	} else {
-	    erl_exit(1, 
+	    erl_exit(1,
 		     "Found tag 0x%08x in process dictionary at position %d",
-		     (unsigned long) t, (int) i);
+		     (unsigned long) h, (int) i);
 	}
     }
     ASSERT(num == pd->numElements);
-    ASSERT(pd->splitPosition <= pd->homeSize);
+    ASSERT(num < pd->tableSize);
 }
 
 #endif /* DEBUG */
@@ -995,7 +772,6 @@ static int hdebugf(char *format, ...)
     va_end(ap);
     erts_fprintf(stderr, "\n");
     return 0;
-} 
+}
 
 #endif /* HARDDEBUG */
-
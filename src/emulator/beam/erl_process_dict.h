@@ -24,9 +24,13 @@
 typedef struct proc_dict {
     unsigned int size;
     unsigned int used;
-    unsigned int homeSize;
-    unsigned int splitPosition;
+    unsigned int tableSize;	/* Slots in the table, a power of 2 */
+    unsigned int oldSize;	/* Slots in the table being rehashed */
+    unsigned int rehashPos;	/* Next slot to move from the old table */
+    unsigned int keysHeads;	/* Buckets in keysIndex */
+    int keysScanned;		/* get_keys/1 scanned since last update */
     Uint numElements;
+    unsigned int *keysIndex;	/* Value to slot index for get_keys/1 */
     Eterm data[1]; /* The beginning of an array of erlang terms */
 } ProcDict;
 
@@ -880,6 +880,32 @@ void init_copy(void);
 Eterm copy_object(Eterm, Process*);
 Uint size_object(Eterm);
 Eterm copy_struct(Eterm, Uint, Eterm**, ErlOffHeap*);
+Eterm copy_struct_bounded(Eterm, Eterm**, Eterm*, ErlOffHeap*, int,
+			  ErtsSharedAreaRef*);
+Eterm copy_struct_frags(Eterm, ErlHeapFragment**, int, ErtsSharedAreaRef*);
+
+/*
+ * Immutable term area outside of all heaps, created by
+ * erlang:share_term/1. Each process that may refer to terms in the
+ * area holds a reference to it in its shared_areas list.
+ */
+typedef struct {
+    erts_refc_t refc;
+    ErlOffHeap off_heap;	/* Binaries, funs and externals in mem */
+    Uint size;			/* Size of mem in words */
+    Eterm mem[1];
+} ErtsSharedArea;
+
+struct erts_shared_area_ref {
+    ErtsSharedAreaRef *next;
+    ErtsSharedArea *area;
+    int hit;			/* Referred to by the term just scanned */
+};
+
+Eterm erts_share_term(Process*, Eterm);
+ErtsSharedAreaRef *erts_shared_area_ref(ErtsSharedAreaRef*, Eterm*);
+void erts_add_shared_area_refs(Process*, ErtsProcLocks*, ErtsSharedAreaRef*);
+void erts_release_shared_area_refs(ErtsSharedAreaRef*);
 Eterm copy_shallow(Eterm*, Uint, Eterm**, ErlOffHeap*);
 void move_multi_frags(Eterm** hpp, ErlOffHeap*, ErlHeapFragment* first,
 		      Eterm* refs, unsigned nrefs);
@@ -1076,6 +1102,7 @@ Eterm erts_gc_after_bif_call(Process* p, Eterm result, Eterm* regs, Uint arity);
 void erts_garbage_collect_literals(Process* p, Eterm* literals, Uint lit_size);
 Uint erts_next_heap_size(Uint, Uint);
 Eterm erts_heap_sizes(Process* p);
+Eterm erts_gc_stats(Process* c_p, Process* rp);
 
 void erts_offset_off_heap(ErlOffHeap *, Sint, Eterm*, Eterm*);
 void erts_offset_heap_ptr(Eterm*, Uint, Sint, Eterm*, Eterm*);
@@ -1845,6 +1872,9 @@ erts_alloc_message_heap(Uint size,
     if (size > (Uint) INT_MAX)
 	erl_exit(ERTS_ABORT_EXIT, "HUGE size (%bpu)\n", size);
 
+    if (receiver->flags & F_OFF_HEAP_MSGQ)
+	goto allocate_in_mbuf;
+
     if (
 #if defined(ERTS_SMP)
 	*receiver_locks & ERTS_PROC_LOCK_MAIN
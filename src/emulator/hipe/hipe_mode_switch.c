@@ -444,6 +444,7 @@ Process *hipe_mode_switch(Process *p, unsigned cmd, Eterm reg[])
 #endif
 	  p->i = hipe_beam_pc_resume;
 	  p->arity = 0;
+	  ERTS_SMP_MSGQ_FETCH_LF_INQ(p);
 	  p->status = P_WAITING;
 	  erts_smp_proc_unlock(p, ERTS_PROC_LOCKS_MSG_RECEIVE);
       do_schedule:
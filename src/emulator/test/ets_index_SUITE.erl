@@ -0,0 +1,105 @@
+%%
+%% %CopyrightBegin%
+%%
+%% Copyright Ericsson AB 2011. All Rights Reserved.
+%%
+%% The contents of this file are subject to the Erlang Public License,
+%% Version 1.1, (the "License"); you may not use this file except in
+%% compliance with the License. You should have received a copy of the
+%% Erlang Public License along with this software. If not, it can be
+%% retrieved online at http://www.erlang.org/.
+%%
+%% Software distributed under the License is distributed on an "AS IS"
+%% basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+%% the License for the specific language governing rights and limitations
+%% under the License.
+%%
+%% %CopyrightEnd%
+%%
+
+-module(ets_index_SUITE).
+
+%% Tests of ets tables created with {index,Pos}.
+
+-include("test_server.hrl").
+
+-export([all/1, init_per_testcase/2, fin_per_testcase/2,
+	 select_delete/1, match_delete/1, delete_all_objects/1]).
+
+-define(N, 10000).
+
+all(doc) -> ["Tests of secondary indexes in ets tables."];
+all(suite) -> [select_delete, match_delete, delete_all_objects].
+
+init_per_testcase(_Case, Config) when is_list(Config) ->
+    Dog = ?t:timetrap(?t:minutes(2)),
+    [{watchdog, Dog}|Config].
+
+fin_per_testcase(_Case, Config) when is_list(Config) ->
+    Dog = ?config(watchdog, Config),
+    ?t:timetrap_cancel(Dog),
+    ok.
+
+select_delete(doc) ->
+    ["The index must not keep entries for objects deleted by "
+     "select_delete/2, also when it traps."];
+select_delete(suite) -> [];
+select_delete(Config) when is_list(Config) ->
+    ?line check_index_size(fun(T) ->
+				   ?N = ets:select_delete(T, [{{'_','_'},
+							       [], [true]}])
+			   end),
+    %% Only the odd keys, the even ones must keep their entries
+    ?line T = filled([set]),
+    ?line ?N div 2 = ets:select_delete(T, [{{'$1','_'},
+					    [{'==',{'rem','$1',2},1}],
+					    [true]}]),
+    ?line [{2,v2}] = ets:index_lookup(T, 2, v2),
+    ?line [] = ets:index_lookup(T, 2, v1),
+    ?line ets:delete(T),
+    ok.
+
+match_delete(doc) ->
+    ["The index must not keep entries for objects deleted by "
+     "match_delete/2."];
+match_delete(suite) -> [];
+match_delete(Config) when is_list(Config) ->
+    ?line check_index_size(fun(T) -> true = ets:match_delete(T, {'_','_'}) end),
+    ok.
+
+delete_all_objects(doc) ->
+    ["delete_all_objects/1 must clear the index."];
+delete_all_objects(suite) -> [];
+delete_all_objects(Config) when is_list(Config) ->
+    ?line check_index_size(fun(T) -> true = ets:delete_all_objects(T) end),
+    ok.
+
+%% The index size is the memory of a table with an index less the
+%% memory of the same table without one.
+check_index_size(Delete) ->
+    lists:foreach(fun(Type) -> check_index_size(Type, Delete) end,
+		  [set, bag, ordered_set]).
+
+check_index_size(Type, Delete) ->
+    Indexed = filled([Type,{index,2}]),
+    Plain = filled([Type]),
+    Full = index_size(Indexed, Plain),
+    Delete(Indexed),
+    Delete(Plain),
+    0 = ets:info(Indexed, size),
+    Empty = index_size(Indexed, Plain),
+    case Empty < Full div 10 of
+	true -> ok;
+	false -> ?t:fail({index_not_emptied, Type, Full, Empty})
+    end,
+    ets:delete(Indexed),
+    ets:delete(Plain).
+
+filled(Opts) ->
+    T = ets:new(?MODULE, [public|Opts]),
+    ets:insert(T, [{K, list_to_atom("v" ++ integer_to_list(K))}
+		   || K <- lists:seq(1, ?N)]),
+    T.
+
+index_size(Indexed, Plain) ->
+    ets:info(Indexed, memory) - ets:info(Plain, memory).
@@ -0,0 +1,104 @@
+%%
+%% %CopyrightBegin%
+%%
+%% Copyright Ericsson AB 2011. All Rights Reserved.
+%%
+%% The contents of this file are subject to the Erlang Public License,
+%% Version 1.1, (the "License"); you may not use this file except in
+%% compliance with the License. You should have received a copy of the
+%% Erlang Public License along with this software. If not, it can be
+%% retrieved online at http://www.erlang.org/.
+%%
+%% Software distributed under the License is distributed on an "AS IS"
+%% basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+%% the License for the specific language governing rights and limitations
+%% under the License.
+%%
+%% %CopyrightEnd%
+%%
+
+-module(shared_term_SUITE).
+
+%% Tests of terms shared with erlang:share_term/1.
+
+-include("test_server.hrl").
+
+-export([all/1, init_per_testcase/2, fin_per_testcase/2,
+	 send_during_gc/1]).
+
+all(doc) -> ["Tests of erlang:share_term/1."];
+all(suite) -> [send_during_gc].
+
+init_per_testcase(_Case, Config) when is_list(Config) ->
+    Dog = ?t:timetrap(?t:minutes(2)),
+    [{watchdog, Dog}|Config].
+
+fin_per_testcase(_Case, Config) when is_list(Config) ->
+    Dog = ?config(watchdog, Config),
+    ?t:timetrap_cancel(Dog),
+    ok.
+
+send_during_gc(doc) ->
+    ["Send a shared term to a process that already refers to its area "
+     "while the process garbage collects. The area must stay alive "
+     "after the sender is gone."];
+send_during_gc(suite) -> [];
+send_during_gc(Config) when is_list(Config) ->
+    ?line Expected = shared_term(),
+    ?line Receiver = spawn_link(fun receiver/0),
+    %% The window is small, go a few rounds
+    ?line lists:foreach(fun(_) -> ok = send_round(Receiver, Expected) end,
+			lists:seq(1, 50)),
+    ?line unlink(Receiver),
+    ?line exit(Receiver, kill),
+    ok.
+
+send_round(Receiver, Expected) ->
+    Sender = spawn(fun() ->
+			   T = erlang:share_term(Expected),
+			   Receiver ! {first, T},
+			   receive go -> ok end,
+			   lists:foreach(fun(_) -> Receiver ! {cfg, T} end,
+					 lists:seq(1, 1000))
+		   end),
+    Mon = erlang:monitor(process, Sender),
+    Receiver ! {start, Sender},
+    receive {'DOWN', Mon, process, Sender, normal} -> ok end,
+    Receiver ! {check, self(), Expected},
+    receive {Receiver, Res} -> Res end.
+
+receiver() ->
+    receive
+	{start, Sender} ->
+	    receive {first, _} -> ok end,
+	    Sender ! go,
+	    gc(200),
+	    receive
+		{check, From, Expected} ->
+		    %% The sender has dropped its reference, make sure
+		    %% ours is the one left
+		    gc(5),
+		    From ! {self(), check(Expected, 0)},
+		    receiver()
+	    end
+    end.
+
+check(Expected, N) ->
+    receive
+	{cfg, T} when T =:= Expected -> check(Expected, N+1);
+	{cfg, T} -> {bad_term, N, T}
+    after 0 ->
+	    case N of
+		1000 -> ok;
+		_ -> {missing, N}
+	    end
+    end.
+
+gc(0) -> ok;
+gc(N) ->
+    erlang:garbage_collect(),
+    gc(N-1).
+
+shared_term() ->
+    {config, lists:seq(1, 100), "a string", <<"a binary">>,
+     [{K, atom_to_list(K)} || K <- [a, b, c, d, e]]}.
@@ -0,0 +1,91 @@
+%%
+%% %CopyrightBegin%
+%%
+%% Copyright Ericsson AB 2011. All Rights Reserved.
+%%
+%% The contents of this file are subject to the Erlang Public License,
+%% Version 1.1, (the "License"); you may not use this file except in
+%% compliance with the License. You should have received a copy of the
+%% Erlang Public License along with this software. If not, it can be
+%% retrieved online at http://www.erlang.org/.
+%%
+%% Software distributed under the License is distributed on an "AS IS"
+%% basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+%% the License for the specific language governing rights and limitations
+%% under the License.
+%%
+%% %CopyrightEnd%
+%%
+
+-module(spawn_SUITE).
+
+%% Spawn and exit throughput, with process structures recycled per
+%% scheduler.
+
+-include("test_server.hrl").
+
+-export([all/1, init_per_testcase/2, fin_per_testcase/2,
+	 spawn_exit_throughput/1, idle_release/1]).
+
+-define(SPAWNS, 200000).
+
+all(doc) -> ["Spawn and exit throughput."];
+all(suite) -> [spawn_exit_throughput, idle_release].
+
+init_per_testcase(_Case, Config) when is_list(Config) ->
+    Dog = ?t:timetrap(?t:minutes(5)),
+    [{watchdog, Dog}|Config].
+
+fin_per_testcase(_Case, Config) when is_list(Config) ->
+    Dog = ?config(watchdog, Config),
+    ?t:timetrap_cancel(Dog),
+    ok.
+
+spawn_exit_throughput(doc) ->
+    ["Benchmark spawning processes that exit at once, from one process "
+     "and from one process per scheduler."];
+spawn_exit_throughput(suite) -> [];
+spawn_exit_throughput(Config) when is_list(Config) ->
+    ?line One = rate(1),
+    ?line Schedulers = erlang:system_info(schedulers_online),
+    ?line All = rate(Schedulers),
+    Comment = lists:flatten(io_lib:format("~p spawns/s from one process, "
+					  "~p spawns/s from ~p processes",
+					  [One, All, Schedulers])),
+    ?t:format("~s~n", [Comment]),
+    {comment, Comment}.
+
+idle_release(doc) ->
+    ["Recycled process structures must be released once the schedulers "
+     "go idle."];
+idle_release(suite) -> [];
+idle_release(Config) when is_list(Config) ->
+    ?line Before = erlang:memory(processes),
+    ?line rate(erlang:system_info(schedulers_online)),
+    ?line receive after 1000 -> ok end,
+    ?line After = erlang:memory(processes),
+    %% Up to 32 structures with a heap each per scheduler would stay
+    ?line Pooled = 32 * (erlang:system_info(wordsize) * 233 + 1000),
+    case After - Before < Pooled of
+	true -> ok;
+	false -> ?t:fail({not_released, Before, After})
+    end.
+
+%% Spawns per second from Spawners processes
+rate(Spawners) ->
+    N = ?SPAWNS div Spawners,
+    Self = self(),
+    T0 = now(),
+    Pids = [spawn_link(fun() -> spawn_loop(N), Self ! {self(), done} end)
+	    || _ <- lists:seq(1, Spawners)],
+    [receive {Pid, done} -> ok end || Pid <- Pids],
+    Us = timer:now_diff(now(), T0),
+    (N * Spawners * 1000000) div erlang:max(Us, 1).
+
+spawn_loop(0) ->
+    ok;
+spawn_loop(N) ->
+    Pid = spawn(fun() -> ok end),
+    Mon = erlang:monitor(process, Pid),
+    receive {'DOWN', Mon, process, Pid, _} -> ok end,
+    spawn_loop(N-1).
@@ -856,5 +856,23 @@ char* erl_atom_names[] = {
   "encode_unsigned",
   "decode_unsigned",
   "nif_error",
+  "read_concurrency",
+  "lockfree",
+  "size_hint",
+  "lookup_many",
+  "parallel_scan",
+  "index_lookup",
+  "zlib",
+  "snapshot",
+  "restore",
+  "scheduler_group",
+  "dirty_nif_finalize",
+  "message_queue_data",
+  "on_heap",
+  "off_heap",
+  "max_gc_pause",
+  "gc_stats",
+  "preserve_sharing",
+  "share_term",
   0
 };
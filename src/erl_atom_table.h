@@ -859,4 +859,22 @@ extern char* erl_atom_names[];
 #define am_encode_unsigned make_atom(849)
 #define am_decode_unsigned make_atom(850)
 #define am_nif_error make_atom(851)
+#define am_read_concurrency make_atom(852)
+#define am_lockfree make_atom(853)
+#define am_size_hint make_atom(854)
+#define am_lookup_many make_atom(855)
+#define am_parallel_scan make_atom(856)
+#define am_index_lookup make_atom(857)
+#define am_zlib make_atom(858)
+#define am_snapshot make_atom(859)
+#define am_restore make_atom(860)
+#define am_scheduler_group make_atom(861)
+#define am_dirty_nif_finalize make_atom(862)
+#define am_message_queue_data make_atom(863)
+#define am_on_heap make_atom(864)
+#define am_off_heap make_atom(865)
+#define am_max_gc_pause make_atom(866)
+#define am_gc_stats make_atom(867)
+#define am_preserve_sharing make_atom(868)
+#define am_share_term make_atom(869)
 #endif
@@ -637,3 +637,8 @@ BIF_LIST(am_binary,am_decode_unsigned,2,binary_decode_unsigned_2,630)
 BIF_LIST(am_erlang,am_nif_error,1,nif_error_1,631)
 BIF_LIST(am_erlang,am_nif_error,2,nif_error_2,632)
 BIF_LIST(am_erlang,am_hash,2,hash_2,633)
+BIF_LIST(am_ets,am_lookup_many,2,ets_lookup_many_2,634)
+BIF_LIST(am_ets,am_index_lookup,3,ets_index_lookup_3,635)
+BIF_LIST(am_ets,am_snapshot,2,ets_snapshot_2,636)
+BIF_LIST(am_ets,am_restore,2,ets_restore_2,637)
+BIF_LIST(am_erlang,am_share_term,1,share_term_1,638)
@@ -653,5 +653,10 @@ BifEntry bif_table[] = {
   {am_erlang, am_nif_error, 1, nif_error_1, wrap_nif_error_1},
   {am_erlang, am_nif_error, 2, nif_error_2, wrap_nif_error_2},
   {am_erlang, am_hash, 2, hash_2, wrap_hash_2},
+  {am_ets, am_lookup_many, 2, ets_lookup_many_2, wrap_ets_lookup_many_2},
+  {am_ets, am_index_lookup, 3, ets_index_lookup_3, wrap_ets_index_lookup_3},
+  {am_ets, am_snapshot, 2, ets_snapshot_2, wrap_ets_snapshot_2},
+  {am_ets, am_restore, 2, ets_restore_2, wrap_ets_restore_2},
+  {am_erlang, am_share_term, 1, share_term_1, wrap_share_term_1},
 };
 
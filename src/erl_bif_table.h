@@ -19,7 +19,7 @@ extern BifEntry bif_table[];
 extern Export* bif_export[];
 extern unsigned char erts_bif_trace_flags[];
 
-#define BIF_SIZE 634
+#define BIF_SIZE 639
 
 #define BIF_abs_1 0
 #define BIF_ebif_abs_1 1
@@ -655,6 +655,11 @@ extern unsigned char erts_bif_trace_flags[];
 #define BIF_nif_error_1 631
 #define BIF_nif_error_2 632
 #define BIF_hash_2 633
+#define BIF_ets_lookup_many_2 634
+#define BIF_ets_index_lookup_3 635
+#define BIF_ets_snapshot_2 636
+#define BIF_ets_restore_2 637
+#define BIF_share_term_1 638
 
 Eterm abs_1(Process*, Eterm);
 Eterm wrap_abs_1(Process*, Eterm, UWord *I);
@@ -1924,4 +1929,14 @@ Eterm nif_error_2(Process*, Eterm, Eterm);
 Eterm wrap_nif_error_2(Process*, Eterm, Eterm, UWord *I);
 Eterm hash_2(Process*, Eterm, Eterm);
 Eterm wrap_hash_2(Process*, Eterm, Eterm, UWord *I);
+Eterm ets_lookup_many_2(Process*, Eterm, Eterm);
+Eterm wrap_ets_lookup_many_2(Process*, Eterm, Eterm, UWord *I);
+Eterm ets_index_lookup_3(Process*, Eterm, Eterm, Eterm);
+Eterm wrap_ets_index_lookup_3(Process*, Eterm, Eterm, Eterm, UWord *I);
+Eterm ets_snapshot_2(Process*, Eterm, Eterm);
+Eterm wrap_ets_snapshot_2(Process*, Eterm, Eterm, UWord *I);
+Eterm ets_restore_2(Process*, Eterm, Eterm);
+Eterm wrap_ets_restore_2(Process*, Eterm, Eterm, UWord *I);
+Eterm share_term_1(Process*, Eterm);
+Eterm wrap_share_term_1(Process*, Eterm, UWord *I);
 #endif
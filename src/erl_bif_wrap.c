@@ -3153,3 +3153,33 @@ wrap_hash_2(Process* p, Eterm arg1, Eterm arg2, UWord *I)
     return erts_bif_trace(633, p, arg1, arg2, 0, I);
 }
 
+Eterm
+wrap_ets_lookup_many_2(Process* p, Eterm arg1, Eterm arg2, UWord *I)
+{
+    return erts_bif_trace(634, p, arg1, arg2, 0, I);
+}
+
+Eterm
+wrap_ets_index_lookup_3(Process* p, Eterm arg1, Eterm arg2, Eterm arg3, UWord *I)
+{
+    return erts_bif_trace(635, p, arg1, arg2, arg3, I);
+}
+
+Eterm
+wrap_ets_snapshot_2(Process* p, Eterm arg1, Eterm arg2, UWord *I)
+{
+    return erts_bif_trace(636, p, arg1, arg2, 0, I);
+}
+
+Eterm
+wrap_ets_restore_2(Process* p, Eterm arg1, Eterm arg2, UWord *I)
+{
+    return erts_bif_trace(637, p, arg1, arg2, 0, I);
+}
+
+Eterm
+wrap_share_term_1(Process* p, Eterm arg1, UWord *I)
+{
+    return erts_bif_trace(638, p, arg1, 0, 0, I);
+}
+